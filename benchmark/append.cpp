@@ -0,0 +1,118 @@
+//==============================================================
+// Continuous ingestion into an AppendableFST versus rebuilding one
+// FST with load().
+//
+// usage: append [num_keys] [key_type] [batch]
+//   num_keys: default 10000000
+//   key_type: randint, email, url (default), uuid, composite; the keys
+//             are sorted and appended in order, like time-ordered keys
+//   batch:    keys appended between publishes (default 10000)
+//
+// Output lines:
+//   load <sec> lookup <Mops/sec> mem <bytes>
+//   append <keys/sec> publish <avg ms> runs <n> lookup <Mops/sec> mem <bytes>
+//==============================================================
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <random>
+
+#include "appendable-fst.h"
+#include "workloadgen.h"
+
+#define NUM_QUERIES 2000000
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t numKeys = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    std::string keyTypeName = (argc > 2) ? argv[2] : "url";
+    uint64_t batch = (argc > 3) ? strtoull(argv[3], NULL, 10) : 10000;
+
+    int keyType = WorkloadGenerator::parseKeyType(keyTypeName);
+    if (keyType < 0) {
+	std::cout << "Incorrect key type: " << keyTypeName << "\n";
+	return 1;
+    }
+
+    WorkloadSpec spec;
+    spec.set("recordcount=" + std::to_string(numKeys));
+    WorkloadGenerator gen(spec, keyType);
+
+    std::vector<std::string> keys;
+    gen.loadKeys(keys);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<uint64_t> values;
+    int longestKeyLen = 0;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	values.push_back(i);
+	if ((int)keys[i].length() > longestKeyLen)
+	    longestKeyLen = keys[i].length();
+    }
+    std::cout << "keys " << keys.size() << " batch " << batch << "\n";
+
+    std::mt19937_64 rng(1);
+    std::vector<uint64_t> queries(NUM_QUERIES);
+    for (uint64_t i = 0; i < NUM_QUERIES; i++)
+	queries[i] = rng() % keys.size();
+
+    FST* index = new FST();
+    double start = get_now();
+    index->load(keys, values, longestKeyLen);
+    double end = get_now();
+    double loadTime = end - start;
+
+    uint64_t found = 0;
+    uint64_t value;
+    start = get_now();
+    for (uint64_t i = 0; i < NUM_QUERIES; i++) {
+	const std::string &q = keys[queries[i]];
+	found += index->lookup((const uint8_t*)q.data(), q.length(), value);
+    }
+    end = get_now();
+    std::cout << "load " << loadTime << " lookup " << NUM_QUERIES / (end - start) / 1000000
+	      << " mem " << index->mem() << "\n";
+    delete index;
+
+    AppendableFST* appendable = new AppendableFST();
+    uint64_t publishes = 0;
+    double publishTime = 0;
+    start = get_now();
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	appendable->append(keys[i], values[i]);
+	if (appendable->pending() == batch || i + 1 == keys.size()) {
+	    double publishStart = get_now();
+	    appendable->publish();
+	    publishTime += get_now() - publishStart;
+	    publishes++;
+	}
+    }
+    end = get_now();
+    double appendTime = end - start;
+
+    shared_ptr<const FSTSnapshot> snapshot = appendable->snapshot();
+    start = get_now();
+    for (uint64_t i = 0; i < NUM_QUERIES; i++) {
+	const std::string &q = keys[queries[i]];
+	found += snapshot->lookup((const uint8_t*)q.data(), q.length(), value);
+    }
+    end = get_now();
+    if (found != 2 * NUM_QUERIES)
+	std::cout << "LOOKUP FAIL " << (2 * NUM_QUERIES - found) << "\n";
+
+    std::cout << "append " << keys.size() / appendTime
+	      << " publish " << publishTime / publishes * 1000
+	      << " runs " << snapshot->numRuns()
+	      << " lookup " << NUM_QUERIES / (end - start) / 1000000
+	      << " mem " << appendable->mem() << "\n";
+
+    delete appendable;
+    return 0;
+}
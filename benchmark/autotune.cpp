@@ -0,0 +1,304 @@
+//==============================================================
+// Measures the label search crossover points and the dense/sparse
+// cutoff ratio on this host, against a trie built from real keys,
+// and writes them as a config header (see fst/include/fst-config.h).
+//
+// usage: autotune <key_file | key_type> [output_header] [num_keys]
+//   key_file: one key per line (e.g. fst/test/bulkload_sort)
+//   key_type: randint, email, url, uuid, composite (generated)
+//   output_header: default fst-tuned.h
+//   num_keys: for generated keys, default 10000000
+//
+// Then configure with cmake -DFST_TUNED_CONFIG=<output_header>.
+//==============================================================
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <algorithm>
+
+#include "FST.hpp"
+#include "label-search.h"
+#include "workloadgen.h"
+
+#define NUM_QUERIES 200000
+#define NUM_REPEATS 3
+#define SAMPLES_PER_SIZE 4096
+#define NUM_LOOKUPS 1000000
+#define MEM_SLACK 1.1
+
+static volatile uint64_t sink = 0;
+
+struct NodeQuery {
+    uint64_t pos;
+    int size;
+    uint8_t target;
+};
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+inline uint64_t xorshift(uint64_t &x) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+template<typename F>
+double nsPerOp(const std::vector<NodeQuery> &queries, F f) {
+    double best = 0;
+    for (int r = 0; r < NUM_REPEATS; r++) {
+	uint64_t sum = 0;
+	double start = get_now();
+	for (size_t i = 0; i < queries.size(); i++) {
+	    uint64_t pos = queries[i].pos;
+	    f(pos, queries[i].size, queries[i].target);
+	    sum += pos;
+	}
+	double t = (get_now() - start) * 1000000000.0 / queries.size();
+	sink += sum;
+	if (r == 0 || t < best)
+	    best = t;
+    }
+    return best;
+}
+
+bool loadKeys(const std::string &source, uint64_t numKeys, std::vector<std::string> &keys) {
+    int keyType = WorkloadGenerator::parseKeyType(source);
+    if (keyType >= 0) {
+	WorkloadSpec spec;
+	spec.set("recordcount=" + std::to_string(numKeys));
+	WorkloadGenerator gen(spec, keyType);
+	gen.loadKeys(keys);
+    }
+    else {
+	std::ifstream infile(source);
+	if (!infile.good())
+	    return false;
+	std::string key;
+	while (infile >> key)
+	    keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return !keys.empty();
+}
+
+//==============================================================
+// LABEL SEARCH
+// Times the three kernels per node size on nodes of the trie and
+// picks the two thresholds that minimize the total time over the
+// trie's node size distribution.
+//==============================================================
+struct Thresholds {
+    int linearBelow;
+    int binaryBelow;
+};
+
+Thresholds pickThresholds(const std::vector<uint64_t> &count, const std::vector<double> t[3]) {
+    Thresholds best = {1, 1};
+    double bestCost = -1;
+    for (int a = 1; a <= 257; a++) {
+	for (int b = a; b <= 257; b++) {
+	    double cost = 0;
+	    for (int s = 1; s <= 256; s++) {
+		if (count[s] == 0)
+		    continue;
+		int k = (s < a) ? 0 : ((s < b) ? 1 : 2);
+		cost += count[s] * t[k][s];
+	    }
+	    if (bestCost < 0 || cost < bestCost) {
+		bestCost = cost;
+		best.linearBelow = a;
+		best.binaryBelow = b;
+	    }
+	}
+    }
+    return best;
+}
+
+void tuneSearch(const FST &index, Thresholds &search, Thresholds &lowerBound) {
+    // the labels by position, bitmap nodes spelled out
+    uint64_t numLabels = index.numSparseLabels();
+    std::vector<uint8_t> labelBytes(numLabels + 16); // SIMD search reads past a node
+    for (uint64_t p = 0; p < numLabels; p++)
+	labelBytes[p] = index.sparseLabel(p);
+    const uint8_t* labels = labelBytes.data();
+    std::vector<uint64_t> count(257, 0);
+    std::vector<std::vector<uint64_t> > samples(257);
+
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    uint64_t pos = 0;
+    while (pos < numLabels) {
+	int size = index.sparseNodeSize(pos);
+	if (size <= 0 || size > 256)
+	    break;
+	count[size]++;
+	// reservoir sample of the nodes of each size
+	if (samples[size].size() < SAMPLES_PER_SIZE)
+	    samples[size].push_back(pos);
+	else if (xorshift(x) % count[size] < SAMPLES_PER_SIZE)
+	    samples[size][xorshift(x) % SAMPLES_PER_SIZE] = pos;
+	pos += size;
+    }
+
+    std::vector<double> tSearch[3];
+    std::vector<double> tLowerBound[3];
+    for (int k = 0; k < 3; k++) {
+	tSearch[k].assign(257, 0);
+	tLowerBound[k].assign(257, 0);
+    }
+
+    std::cout << "size nodes linear binary simd linear_lb binary_lb simd_lb (ns/op)\n";
+    std::vector<NodeQuery> hits(NUM_QUERIES);
+    std::vector<NodeQuery> bounds(NUM_QUERIES);
+    for (int s = 1; s <= 256; s++) {
+	if (count[s] == 0)
+	    continue;
+	for (int i = 0; i < NUM_QUERIES; i++) {
+	    uint64_t node = samples[s][xorshift(x) % samples[s].size()];
+	    hits[i].pos = node;
+	    hits[i].size = s;
+	    hits[i].target = labels[node + xorshift(x) % s];
+	    bounds[i].pos = node;
+	    bounds[i].size = s;
+	    bounds[i].target = xorshift(x) & 0xFF;
+	}
+
+	tSearch[0][s] = nsPerOp(hits, [&](uint64_t &p, int n, uint8_t c) { linearSearch(labels, p, n, c); });
+	tSearch[1][s] = nsPerOp(hits, [&](uint64_t &p, int n, uint8_t c) { binarySearch(labels, p, n, c); });
+	tSearch[2][s] = nsPerOp(hits, [&](uint64_t &p, int n, uint8_t c) { simdSearch(labels, p, n, c); });
+	tLowerBound[0][s] = nsPerOp(bounds, [&](uint64_t &p, int n, uint8_t c) { linearSearch_lowerBound(labels, p, n, c); });
+	tLowerBound[1][s] = nsPerOp(bounds, [&](uint64_t &p, int n, uint8_t c) { binarySearch_lowerBound(labels, p, n, c); });
+	tLowerBound[2][s] = nsPerOp(bounds, [&](uint64_t &p, int n, uint8_t c) { simdSearch_lowerBound(labels, p, n, c); });
+
+	std::cout << s << " " << count[s];
+	for (int k = 0; k < 3; k++)
+	    std::cout << " " << tSearch[k][s];
+	for (int k = 0; k < 3; k++)
+	    std::cout << " " << tLowerBound[k][s];
+	std::cout << "\n";
+    }
+
+    search = pickThresholds(count, tSearch);
+    lowerBound = pickThresholds(count, tLowerBound);
+}
+
+//==============================================================
+// CUTOFF RATIO
+// Picks the fastest ratio among those whose trie is within
+// MEM_SLACK of the smallest.
+//==============================================================
+int tuneCutoffRatio(std::vector<std::string> &keys, std::vector<uint64_t> &values, int longestKeyLen) {
+    int ratios[] = {8, 16, 32, 64, 128, 256, 512};
+    const int numRatios = sizeof(ratios) / sizeof(ratios[0]);
+    double ns[numRatios];
+    uint64_t mem[numRatios];
+
+    std::vector<uint64_t> queries(NUM_LOOKUPS);
+    uint64_t x = 0x2545F4914F6CDD1DULL;
+    for (int i = 0; i < NUM_LOOKUPS; i++)
+	queries[i] = xorshift(x) % keys.size();
+
+    std::cout << "ratio cutoff mem lookup(ns/op)\n";
+    uint64_t minMem = 0;
+    for (int r = 0; r < numRatios; r++) {
+	FST index;
+	index.setCutoffRatio(ratios[r]);
+	index.load(keys, values, longestKeyLen);
+	mem[r] = index.mem();
+	if (r == 0 || mem[r] < minMem)
+	    minMem = mem[r];
+
+	ns[r] = 0;
+	for (int rep = 0; rep < NUM_REPEATS; rep++) {
+	    uint64_t value;
+	    uint64_t sum = 0;
+	    double start = get_now();
+	    for (int i = 0; i < NUM_LOOKUPS; i++) {
+		const std::string &key = keys[queries[i]];
+		index.lookup((const uint8_t*)key.data(), key.length(), value);
+		sum += value;
+	    }
+	    double t = (get_now() - start) * 1000000000.0 / NUM_LOOKUPS;
+	    sink += sum;
+	    if (rep == 0 || t < ns[r])
+		ns[r] = t;
+	}
+	std::cout << ratios[r] << " " << index.stats().cutoffLevel << " " << mem[r] << " " << ns[r] << "\n";
+    }
+
+    int best = -1;
+    for (int r = 0; r < numRatios; r++) {
+	if (mem[r] > minMem * MEM_SLACK)
+	    continue;
+	if (best < 0 || ns[r] < ns[best])
+	    best = r;
+    }
+    return ratios[best];
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+	std::cout << "Usage:\n";
+	std::cout << "1. key file (one key per line) or key type: randint, email, url, uuid, composite\n";
+	std::cout << "2. (optional) output header, default fst-tuned.h\n";
+	std::cout << "3. (optional) number of generated keys, default 10000000\n";
+	return 1;
+    }
+
+    std::string source = argv[1];
+    std::string output = (argc > 2) ? argv[2] : "fst-tuned.h";
+    uint64_t numKeys = (argc > 3) ? strtoull(argv[3], NULL, 10) : 10000000;
+
+    std::vector<std::string> keys;
+    if (!loadKeys(source, numKeys, keys)) {
+	std::cout << "Cannot read keys from " << source << "\n";
+	return 1;
+    }
+
+    std::vector<uint64_t> values;
+    int longestKeyLen = 0;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	values.push_back(i);
+	if ((int)keys[i].length() > longestKeyLen)
+	    longestKeyLen = keys[i].length();
+    }
+    std::cout << "keys " << keys.size() << "\n";
+
+    FST* index = new FST();
+    index->load(keys, values, longestKeyLen);
+    Thresholds search;
+    Thresholds lowerBound;
+    tuneSearch(*index, search, lowerBound);
+    delete index;
+
+    int cutoffRatio = tuneCutoffRatio(keys, values, longestKeyLen);
+
+    char host[256] = "unknown";
+    gethostname(host, sizeof(host) - 1);
+
+    std::ofstream out(output);
+    if (!out.good()) {
+	std::cout << "Cannot write " << output << "\n";
+	return 1;
+    }
+    out << "// Generated by benchmark/autotune on " << host << " from " << source
+	<< " (" << keys.size() << " keys)\n";
+    out << "#define FST_SEARCH_LINEAR_BELOW " << search.linearBelow << "\n";
+    out << "#define FST_SEARCH_BINARY_BELOW " << search.binaryBelow << "\n";
+    out << "#define FST_LOWERBOUND_LINEAR_BELOW " << lowerBound.linearBelow << "\n";
+    out << "#define FST_LOWERBOUND_BINARY_BELOW " << lowerBound.binaryBelow << "\n";
+    out << "#define FST_CUTOFF_RATIO " << cutoffRatio << "\n";
+
+    std::cout << "search: linear < " << search.linearBelow << ", binary < " << search.binaryBelow << ", simd\n";
+    std::cout << "lowerBound: linear < " << lowerBound.linearBelow << ", binary < " << lowerBound.binaryBelow << ", simd\n";
+    std::cout << "cutoff ratio: " << cutoffRatio << "\n";
+    std::cout << "wrote " << output << "\n";
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <string.h>
+
+#include "workloadgen.h"
+
+//==============================================================
+// Writes workloads/load_<keytype>_<workload> and
+// workloads/txn_<keytype>_<workload> from workload_spec/<workload>,
+// the files gen_workload.py produces through YCSB.
+// Run from the benchmark directory.
+//==============================================================
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+	std::cout << "Usage:\n";
+	std::cout << "1. workload type: workloada .. workloadf (or a path to a spec file)\n";
+	std::cout << "2. key type: randint, email, url, uuid, composite\n";
+	std::cout << "3. (optional) property overrides: name=value ...\n";
+	std::cout << "   e.g. recordcount=1000000 requestdistribution=hotspot seed=7\n";
+	std::cout << "   requestdistribution: uniform, zipfian, latest, hotspot\n";
+	std::cout << "   composite keys: compositewidths=4,8 compositeprefixcardinality=1000\n";
+	return 1;
+    }
+
+    std::string workload = argv[1];
+    std::string keyTypeName = argv[2];
+
+    int keyType = WorkloadGenerator::parseKeyType(keyTypeName);
+    if (keyType < 0) {
+	std::cout << "Incorrect key type: " << keyTypeName << "\n";
+	return 1;
+    }
+
+    WorkloadSpec spec;
+    if (!spec.load("workload_spec/" + workload) && !spec.load(workload)) {
+	std::cout << "Cannot read workload spec: " << workload << "\n";
+	return 1;
+    }
+    for (int i = 3; i < argc; i++) {
+	if (!spec.set(argv[i])) {
+	    std::cout << "Bad property override: " << argv[i] << "\n";
+	    return 1;
+	}
+    }
+
+    size_t slash = workload.find_last_of('/');
+    if (slash != std::string::npos)
+	workload = workload.substr(slash + 1);
+
+    std::string loadFile = "workloads/load_" + keyTypeName + "_" + workload;
+    std::string txnFile = "workloads/txn_" + keyTypeName + "_" + workload;
+
+    WorkloadGenerator gen(spec, keyType, spec.getInt("seed", 0));
+
+    std::ofstream loadOut(loadFile);
+    std::ofstream txnOut(txnFile);
+    if (!loadOut.good() || !txnOut.good()) {
+	std::cout << "Cannot write " << loadFile << " / " << txnFile << "\n";
+	return 1;
+    }
+
+    std::cout << "workload type = " << workload << "\n";
+    std::cout << "key type = " << keyTypeName << "\n";
+    std::cout << "request distribution = " << spec.getString("requestdistribution", "uniform") << "\n";
+
+    gen.writeLoad(loadOut);
+    gen.writeTxn(txnOut);
+
+    std::cout << loadFile << ": " << gen.recordCount() << " records\n";
+    std::cout << txnFile << ": " << gen.operationCount() << " operations\n";
+    return 0;
+}
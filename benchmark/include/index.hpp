@@ -21,6 +21,9 @@ class Index
     virtual uint64_t scan(KeyType key, int range) = 0;
 
     virtual int64_t getMemory() const = 0;
+
+    // index-specific build statistics, one line per entry
+    virtual void printStats(std::ostream &os) const { }
 };
 
 //***********************************************************
@@ -345,7 +348,6 @@ class FSTIndex : public Index<KeyType, KeyComparator>
 	std::sort(keys.begin(), keys.end());
 	std::sort(values.begin(), values.end());
 	idx->load(keys, values);
-	iter = FSTIter(idx);
 	return true;
     }
 
@@ -361,6 +363,7 @@ class FSTIndex : public Index<KeyType, KeyComparator>
 
     uint64_t scan(KeyType key, int range) {
 	uint64_t sum = 0;
+	FSTIter iter(idx);
 	idx->lowerBound(key, iter);
 	sum += iter.value();
 	for (int i = 0; i < range - 1; i++) {
@@ -389,13 +392,16 @@ class FSTIndex : public Index<KeyType, KeyComparator>
 	return idx->mem();
     }
 
+    void printStats(std::ostream &os) const {
+	os << "stats " << idx->statsJSON() << "\n";
+    }
+
     FSTIndex() {
 	idx = new FST();
     }
 
  private:
     FST *idx;
-    FSTIter iter;
 };
 
 
@@ -415,7 +421,6 @@ class FSTIndex_Email : public Index<KeyType, KeyComparator>
 	std::sort(keys.begin(), keys.end());
 	std::sort(values.begin(), values.end());
 	idx->load(keys, values, 80);
-	iter = FSTIter(idx);
 	return true;
     }
 
@@ -431,6 +436,7 @@ class FSTIndex_Email : public Index<KeyType, KeyComparator>
 
     uint64_t scan(KeyType key, int range) {
 	uint64_t sum = 0;
+	FSTIter iter(idx);
 	idx->lowerBound((const uint8_t*)key.c_str(), key.length(), iter);
 	for (int i = 0; i < range - 1; i++) {
 	    if (!iter++) break;
@@ -458,13 +464,16 @@ class FSTIndex_Email : public Index<KeyType, KeyComparator>
 	return idx->mem();
     }
 
+    void printStats(std::ostream &os) const {
+	os << "stats " << idx->statsJSON() << "\n";
+    }
+
     FSTIndex_Email() {
 	idx = new FST();
     }
 
  private:
     FST *idx;
-    FSTIter iter;
 };
 
 
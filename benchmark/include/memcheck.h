@@ -0,0 +1,92 @@
+#ifndef _MEMCHECK_H_
+#define _MEMCHECK_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include <iostream>
+#include <new>
+
+//==============================================================
+// Cross-check of an index's own memory figure (getMemory) against
+// the allocator and the OS.
+//
+// Once a MemCheck exists, the global operator new and delete below
+// keep the malloc_usable_size of the live blocks, allocator rounding
+// included; MemCheck also reads the resident set size. Both are
+// sampled around the build, so the deltas are what the index kept.
+// Blocks that do not come from operator new (the FST's rank/select
+// tables and CART's static nodes use posix_memalign/malloc) only show
+// in the RSS, which also holds freed memory the allocator keeps.
+//
+// Include from one translation unit per binary.
+//==============================================================
+namespace memcheck {
+static bool on = false;
+static int64_t usableBytes = 0; // live operator new blocks while on
+}
+
+void* operator new(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (p == NULL)
+	throw std::bad_alloc();
+    if (memcheck::on)
+	memcheck::usableBytes += malloc_usable_size(p);
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    if (p == NULL)
+	return;
+    if (memcheck::on)
+	memcheck::usableBytes -= malloc_usable_size(p);
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+class MemCheck {
+public:
+    MemCheck() : usable_(0), rss_(0) {
+	memcheck::on = true;
+    }
+
+    void start() {
+	usable_ = memcheck::usableBytes;
+	rss_ = rss();
+    }
+
+    // memcheck <reported> usable <bytes> rss <bytes>
+    void print(std::ostream &os, int64_t reported) const {
+	os << "memcheck " << reported
+	   << " usable " << (memcheck::usableBytes - usable_)
+	   << " rss " << (rss() - rss_) << "\n";
+    }
+
+    static int64_t rss() {
+	long pages = 0;
+	long resident = 0;
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (f == NULL)
+	    return 0;
+	if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+	    resident = 0;
+	fclose(f);
+	return (int64_t)resident * sysconf(_SC_PAGESIZE);
+    }
+
+private:
+    int64_t usable_;
+    int64_t rss_;
+};
+
+#endif /* _MEMCHECK_H_ */
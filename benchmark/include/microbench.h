@@ -11,6 +11,8 @@
 //#include "allocatortracker.h"
 
 #include "index.hpp"
+#include "memcheck.h"
+#include "perfcounters.h"
 
 #define LIMIT 10000000
 #define RANGE_PLUS 0
@@ -0,0 +1,119 @@
+#ifndef _PERFCOUNTERS_H_
+#define _PERFCOUNTERS_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <iostream>
+
+//==============================================================
+// Hardware performance counters around a benchmark phase, read
+// through perf_event_open so no external perf tool is needed.
+//
+// Every event is opened on its own (not as a group) so that the
+// kernel can multiplex them when there are fewer hardware counters
+// than events; counts are scaled by time_enabled / time_running.
+// Events the cpu or the sandbox does not support are reported as n/a.
+//==============================================================
+class PerfCounters {
+public:
+    enum {
+	kCycles = 0,
+	kInstructions,
+	kL1DMisses,
+	kLLCMisses,
+	kDTLBMisses,
+	kBranchMisses,
+	kNumEvents
+    };
+
+    PerfCounters() {
+	for (int i = 0; i < kNumEvents; i++) {
+	    fds_[i] = -1;
+	    counts_[i] = 0;
+	}
+
+	openEvent(kCycles, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	openEvent(kInstructions, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	openEvent(kL1DMisses, PERF_TYPE_HW_CACHE, cacheConfig(PERF_COUNT_HW_CACHE_L1D));
+	openEvent(kLLCMisses, PERF_TYPE_HW_CACHE, cacheConfig(PERF_COUNT_HW_CACHE_LL));
+	openEvent(kDTLBMisses, PERF_TYPE_HW_CACHE, cacheConfig(PERF_COUNT_HW_CACHE_DTLB));
+	openEvent(kBranchMisses, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    }
+
+    ~PerfCounters() {
+	for (int i = 0; i < kNumEvents; i++) {
+	    if (fds_[i] >= 0)
+		close(fds_[i]);
+	}
+    }
+
+    void start() {
+	for (int i = 0; i < kNumEvents; i++) {
+	    if (fds_[i] < 0)
+		continue;
+	    ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+	    ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+    }
+
+    void stop() {
+	for (int i = 0; i < kNumEvents; i++) {
+	    if (fds_[i] < 0)
+		continue;
+	    ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+
+	    uint64_t buf[3]; // value, time_enabled, time_running
+	    counts_[i] = 0;
+	    if (read(fds_[i], buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0)
+		continue;
+	    counts_[i] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+	}
+    }
+
+    // Prints one line: "<phase>-perf <event> <count per op> ...".
+    void print(std::ostream &os, const char* phase, uint64_t numOps) {
+	static const char* names[kNumEvents] = {
+	    "cycles", "instructions", "L1D-misses",
+	    "LLC-misses", "dTLB-misses", "branch-misses"
+	};
+
+	os << phase << "-perf";
+	for (int i = 0; i < kNumEvents; i++) {
+	    os << " " << names[i] << " ";
+	    if (fds_[i] < 0 || numOps == 0)
+		os << "n/a";
+	    else
+		os << (double)counts_[i] / numOps;
+	}
+	os << "\n";
+    }
+
+private:
+    static uint64_t cacheConfig(uint64_t cache) {
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    void openEvent(int id, uint32_t type, uint64_t config) {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	fds_[id] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    int fds_[kNumEvents];
+    uint64_t counts_[kNumEvents];
+};
+
+#endif /* _PERFCOUNTERS_H_ */
@@ -0,0 +1,550 @@
+#ifndef _WORKLOADGEN_H_
+#define _WORKLOADGEN_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <fstream>
+#include <iostream>
+
+//==============================================================
+// Native replacement for YCSB's CoreWorkload, so workloads can be
+// generated offline and without Java.
+//
+// Reads the properties of a workload_spec file (recordcount,
+// operationcount, the read/update/insert/scan/readmodifywrite
+// proportions, requestdistribution, maxscanlength, ...) and produces
+// the load and transaction streams either in memory or in the text
+// format the benchmarks read ("INSERT key", "READ key", "SCAN key n").
+//
+// Key numbers are chosen like YCSB: zipfian is the scrambled zipfian
+// over the whole key space, latest is skewed towards the most recent
+// insert, hotspot sends hotopnfraction of the requests to the first
+// hotspotdatafraction of the keys. With insertorder=hashed a key
+// number is spread by the 64-bit FNV hash before being formatted as
+// one of the key types below.
+//==============================================================
+
+enum WorkloadKeyType {
+    kKeyRandint = 0,	// 64-bit integer
+    kKeyEmail,		// reversed host email, as gen_workload.py writes them
+    kKeyURL,
+    kKeyUUID,
+    kKeyComposite,	// fixed-width hex fields, see compositewidths
+    kNumKeyTypes
+};
+
+enum WorkloadOpType {
+    kOpInsert = 0,
+    kOpRead,
+    kOpUpdate,
+    kOpScan,
+    kOpReadModifyWrite
+};
+
+struct WorkloadOp {
+    int type;
+    uint64_t keynum;
+    int scanLength;
+};
+
+inline uint64_t fnvhash64(uint64_t val) {
+    int64_t hashval = 0xCBF29CE484222325LL;
+    for (int i = 0; i < 8; i++) {
+	uint64_t octet = val & 0xff;
+	val = val >> 8;
+	hashval = hashval ^ octet;
+	hashval = (int64_t)((uint64_t)hashval * 1099511628211ULL);
+    }
+    return (hashval < 0) ? (uint64_t)(-hashval) : (uint64_t)hashval;
+}
+
+// splitmix64 finalizer, used to derive independent fields from one hash
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+//==============================================================
+// WORKLOAD SPEC
+//==============================================================
+class WorkloadSpec {
+public:
+    // Parses "name=value" lines, '#' starts a comment.
+    bool load(const std::string &fileName) {
+	std::ifstream in(fileName);
+	if (!in.good())
+	    return false;
+	std::string line;
+	while (std::getline(in, line)) {
+	    size_t hash = line.find('#');
+	    if (hash != std::string::npos)
+		line = line.substr(0, hash);
+	    set(line);
+	}
+	return true;
+    }
+
+    // Accepts "name=value"; returns false if there is no '='.
+    bool set(const std::string &assignment) {
+	size_t eq = assignment.find('=');
+	if (eq == std::string::npos)
+	    return false;
+	props_[trim(assignment.substr(0, eq))] = trim(assignment.substr(eq + 1));
+	return true;
+    }
+
+    std::string getString(const std::string &name, const std::string &def) const {
+	std::map<std::string, std::string>::const_iterator it = props_.find(name);
+	return (it == props_.end()) ? def : it->second;
+    }
+
+    uint64_t getInt(const std::string &name, uint64_t def) const {
+	std::string v = getString(name, "");
+	return v.empty() ? def : strtoull(v.c_str(), NULL, 10);
+    }
+
+    double getDouble(const std::string &name, double def) const {
+	std::string v = getString(name, "");
+	return v.empty() ? def : strtod(v.c_str(), NULL);
+    }
+
+private:
+    static std::string trim(const std::string &s) {
+	size_t b = s.find_first_not_of(" \t\r\n");
+	if (b == std::string::npos)
+	    return "";
+	size_t e = s.find_last_not_of(" \t\r\n");
+	return s.substr(b, e - b + 1);
+    }
+
+    std::map<std::string, std::string> props_;
+};
+
+//==============================================================
+// DISTRIBUTIONS
+//==============================================================
+typedef std::mt19937_64 WorkloadRNG;
+
+inline double nextDouble(WorkloadRNG &rng) {
+    return (rng() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Gray et al., "Quickly Generating Billion-Record Synthetic
+// Databases"; zeta is extended incrementally when the item count grows.
+class ZipfianGenerator {
+public:
+    static constexpr double kZipfianConstant = 0.99;
+
+    ZipfianGenerator(uint64_t min, uint64_t max, double theta = kZipfianConstant, double zetan = 0)
+	: base_(min), items_(max - min + 1), theta_(theta) {
+	zeta2theta_ = zeta(0, 2, 0);
+	alpha_ = 1.0 / (1.0 - theta_);
+	countForZeta_ = items_;
+	zetan_ = (zetan > 0) ? zetan : zeta(0, items_, 0);
+	eta_ = computeEta();
+    }
+
+    // A value in [base, base + itemCount)
+    uint64_t next(WorkloadRNG &rng, uint64_t itemCount) {
+	if (itemCount > countForZeta_) {
+	    zetan_ = zeta(countForZeta_, itemCount, zetan_);
+	    countForZeta_ = itemCount;
+	    items_ = itemCount;
+	    eta_ = computeEta();
+	}
+	double u = nextDouble(rng);
+	double uz = u * zetan_;
+	if (uz < 1.0)
+	    return base_;
+	if (uz < 1.0 + pow(0.5, theta_))
+	    return base_ + 1;
+	uint64_t ret = (uint64_t)(itemCount * pow(eta_ * u - eta_ + 1, alpha_));
+	if (ret >= itemCount)
+	    ret = itemCount - 1;
+	return base_ + ret;
+    }
+
+    uint64_t next(WorkloadRNG &rng) {
+	return next(rng, items_);
+    }
+
+private:
+    double zeta(uint64_t st, uint64_t n, double initialSum) const {
+	double sum = initialSum;
+	for (uint64_t i = st; i < n; i++)
+	    sum += 1 / pow(i + 1, theta_);
+	return sum;
+    }
+
+    double computeEta() const {
+	return (1 - pow(2.0 / items_, 1 - theta_)) / (1 - zeta2theta_ / zetan_);
+    }
+
+    uint64_t base_;
+    uint64_t items_;
+    uint64_t countForZeta_;
+    double theta_;
+    double zeta2theta_;
+    double alpha_;
+    double zetan_;
+    double eta_;
+};
+
+// Zipfian popularity with the popular items scattered over the key
+// space instead of clustered at its start.
+class ScrambledZipfianGenerator {
+public:
+    // zeta over kItemCount items for theta 0.99, precomputed by YCSB
+    static constexpr uint64_t kItemCount = 10000000000ULL;
+    static constexpr double kZetan = 26.46902820178302;
+
+    ScrambledZipfianGenerator(uint64_t min, uint64_t max)
+	: min_(min), itemCount_(max - min + 1),
+	  gen_(0, kItemCount, ZipfianGenerator::kZipfianConstant, kZetan) {}
+
+    uint64_t next(WorkloadRNG &rng) {
+	return min_ + fnvhash64(gen_.next(rng)) % itemCount_;
+    }
+
+private:
+    uint64_t min_;
+    uint64_t itemCount_;
+    ZipfianGenerator gen_;
+};
+
+//==============================================================
+// WORKLOAD GENERATOR
+//==============================================================
+class WorkloadGenerator {
+public:
+    enum {
+	kDistUniform = 0,
+	kDistZipfian,
+	kDistLatest,
+	kDistHotspot
+    };
+
+    WorkloadGenerator(const WorkloadSpec &spec, int keyType, uint64_t seed = 0)
+	: keyType_(keyType), rng_(seed), opsDone_(0), zipfian_(NULL), latest_(NULL), scanZipfian_(NULL) {
+	recordCount_ = spec.getInt("recordcount", 1000);
+	opCount_ = spec.getInt("operationcount", 1000);
+	hashed_ = (spec.getString("insertorder", "hashed") != "ordered");
+
+	double read = spec.getDouble("readproportion", 0.95);
+	double update = spec.getDouble("updateproportion", 0.05);
+	double insert = spec.getDouble("insertproportion", 0);
+	double scan = spec.getDouble("scanproportion", 0);
+	double rmw = spec.getDouble("readmodifywriteproportion", 0);
+	double total = read + update + insert + scan + rmw;
+	if (total <= 0) {
+	    read = 1;
+	    total = 1;
+	}
+	opCDF_[0] = read / total;
+	opCDF_[1] = opCDF_[0] + update / total;
+	opCDF_[2] = opCDF_[1] + insert / total;
+	opCDF_[3] = opCDF_[2] + scan / total;
+
+	insertSequence_ = recordCount_;
+
+	std::string dist = spec.getString("requestdistribution", "uniform");
+	if (dist == "zipfian") {
+	    dist_ = kDistZipfian;
+	    uint64_t expectedNewKeys = (uint64_t)(opCount_ * insert / total * 2.0);
+	    zipfian_ = new ScrambledZipfianGenerator(0, recordCount_ + expectedNewKeys);
+	}
+	else if (dist == "latest") {
+	    dist_ = kDistLatest;
+	    latest_ = new ZipfianGenerator(0, recordCount_ - 1);
+	}
+	else if (dist == "hotspot") {
+	    dist_ = kDistHotspot;
+	    hotSetFraction_ = spec.getDouble("hotspotdatafraction", 0.2);
+	    hotOpnFraction_ = spec.getDouble("hotspotopnfraction", 0.8);
+	}
+	else {
+	    dist_ = kDistUniform;
+	}
+
+	maxScanLength_ = spec.getInt("maxscanlength", 1000);
+	if (spec.getString("scanlengthdistribution", "uniform") == "zipfian")
+	    scanZipfian_ = new ZipfianGenerator(1, maxScanLength_);
+
+	prefixCardinality_ = spec.getInt("compositeprefixcardinality", 1000);
+	std::string widths = spec.getString("compositewidths", "4,8");
+	for (size_t pos = 0; pos < widths.size(); ) {
+	    size_t comma = widths.find(',', pos);
+	    if (comma == std::string::npos)
+		comma = widths.size();
+	    int w = atoi(widths.substr(pos, comma - pos).c_str());
+	    if (w > 0 && w <= 8)
+		compositeWidths_.push_back(w);
+	    pos = comma + 1;
+	}
+	if (compositeWidths_.empty())
+	    compositeWidths_.push_back(8);
+    }
+
+    ~WorkloadGenerator() {
+	delete zipfian_;
+	delete latest_;
+	delete scanZipfian_;
+    }
+
+    uint64_t recordCount() const { return recordCount_; }
+    uint64_t operationCount() const { return opCount_; }
+
+    // Key numbers of the load phase are 0 .. recordCount - 1, in order.
+    // Transaction ops are produced one at a time; returns false after
+    // operationcount ops.
+    bool nextOp(WorkloadOp &op) {
+	if (opsDone_ >= opCount_)
+	    return false;
+	opsDone_++;
+
+	double r = nextDouble(rng_);
+	op.scanLength = 0;
+	if (r < opCDF_[0]) {
+	    op.type = kOpRead;
+	}
+	else if (r < opCDF_[1]) {
+	    op.type = kOpUpdate;
+	}
+	else if (r < opCDF_[2]) {
+	    op.type = kOpInsert;
+	    op.keynum = insertSequence_++;
+	    return true;
+	}
+	else if (r < opCDF_[3]) {
+	    op.type = kOpScan;
+	    op.scanLength = scanZipfian_ ? (int)scanZipfian_->next(rng_) : (int)(1 + rng_() % maxScanLength_);
+	}
+	else {
+	    op.type = kOpReadModifyWrite;
+	}
+	op.keynum = nextKeynum();
+	return true;
+    }
+
+    void loadKeys(std::vector<std::string> &keys) const {
+	keys.reserve(keys.size() + recordCount_);
+	for (uint64_t i = 0; i < recordCount_; i++)
+	    keys.push_back(key(i));
+    }
+
+    void txnOps(std::vector<WorkloadOp> &ops) {
+	WorkloadOp op;
+	ops.reserve(ops.size() + opCount_);
+	while (nextOp(op))
+	    ops.push_back(op);
+    }
+
+    // The 64-bit integer key of a key number (the randint key).
+    uint64_t intKey(uint64_t keynum) const {
+	return hashed_ ? fnvhash64(keynum) : keynum;
+    }
+
+    std::string key(uint64_t keynum) const {
+	uint64_t h = intKey(keynum);
+	switch (keyType_) {
+	case kKeyEmail:
+	    return emailKey(h);
+	case kKeyURL:
+	    return urlKey(h);
+	case kKeyUUID:
+	    return uuidKey(h);
+	case kKeyComposite:
+	    return compositeKey(h);
+	default:
+	    return std::to_string(h);
+	}
+    }
+
+    void writeLoad(std::ostream &os) const {
+	for (uint64_t i = 0; i < recordCount_; i++)
+	    os << "INSERT " << key(i) << "\n";
+    }
+
+    // Read-modify-write is written as a READ followed by an UPDATE, as
+    // YCSB's basic client traces it.
+    void writeTxn(std::ostream &os) {
+	WorkloadOp op;
+	while (nextOp(op)) {
+	    std::string k = key(op.keynum);
+	    switch (op.type) {
+	    case kOpInsert:
+		os << "INSERT " << k << "\n";
+		break;
+	    case kOpRead:
+		os << "READ " << k << "\n";
+		break;
+	    case kOpUpdate:
+		os << "UPDATE " << k << "\n";
+		break;
+	    case kOpScan:
+		os << "SCAN " << k << " " << op.scanLength << "\n";
+		break;
+	    default:
+		os << "READ " << k << "\n";
+		os << "UPDATE " << k << "\n";
+	    }
+	}
+    }
+
+    static int parseKeyType(const std::string &name) {
+	static const char* names[kNumKeyTypes] = {"randint", "email", "url", "uuid", "composite"};
+	for (int i = 0; i < kNumKeyTypes; i++) {
+	    if (name == names[i])
+		return i;
+	}
+	return -1;
+    }
+
+private:
+    // Draws until the key number has been inserted, like YCSB.
+    uint64_t nextKeynum() {
+	uint64_t last = insertSequence_ - 1;
+	uint64_t keynum;
+	do {
+	    if (dist_ == kDistZipfian) {
+		keynum = zipfian_->next(rng_);
+	    }
+	    else if (dist_ == kDistLatest) {
+		keynum = last - latest_->next(rng_, last + 1);
+	    }
+	    else if (dist_ == kDistHotspot) {
+		uint64_t hotInterval = (uint64_t)(recordCount_ * hotSetFraction_);
+		uint64_t coldInterval = recordCount_ - hotInterval;
+		if (nextDouble(rng_) < hotOpnFraction_ || coldInterval == 0)
+		    keynum = hotInterval ? rng_() % hotInterval : 0;
+		else
+		    keynum = hotInterval + rng_() % coldInterval;
+	    }
+	    else {
+		keynum = rng_() % recordCount_;
+	    }
+	} while (keynum > last);
+	return keynum;
+    }
+
+    // Keys embed the whole hash so distinct key numbers stay distinct.
+    static std::string base36(uint64_t x) {
+	static const char digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+	std::string s;
+	do {
+	    s.push_back(digits[x % 36]);
+	    x /= 36;
+	} while (x > 0);
+	return s;
+    }
+
+    static const char* pick(const char* const* words, int n, uint64_t x) {
+	return words[x % n];
+    }
+
+    static std::string emailKey(uint64_t h) {
+	static const char* const names[] = {
+	    "john", "mary", "wei", "anna", "li", "james", "maria", "alex",
+	    "chen", "sara", "david", "emma", "raj", "yuki", "omar", "nina"
+	};
+	static const char* const hosts[] = {
+	    "com.gmail.", "com.yahoo.", "com.hotmail.", "com.aol.",
+	    "net.comcast.", "edu.cmu.cs.", "org.apache.", "co.uk.bbc."
+	};
+	uint64_t r = mix64(h);
+	std::string name = pick(names, 16, r);
+	if ((r >> 8) & 1)
+	    name += ".";
+	name += base36(h);
+	return std::string(pick(hosts, 8, r >> 16)) + "@" + name;
+    }
+
+    static std::string urlKey(uint64_t h) {
+	static const char* const hosts[] = {
+	    "www.wikipedia.org", "www.example.com", "news.bbc.co.uk", "github.com",
+	    "www.amazon.com", "en.wikipedia.org", "www.cmu.edu", "stackoverflow.com"
+	};
+	static const char* const dirs[] = {
+	    "wiki", "news", "articles", "questions", "products", "users",
+	    "2016", "2017", "tags", "blog", "docs", "search"
+	};
+	uint64_t r = mix64(h);
+	std::string url = "http://";
+	url += pick(hosts, 8, r);
+	int depth = 1 + (r >> 8) % 3;
+	for (int i = 0; i < depth; i++) {
+	    url += "/";
+	    url += pick(dirs, 12, r >> (16 + 4 * i));
+	}
+	url += "/";
+	url += base36(h);
+	return url;
+    }
+
+    static std::string uuidKey(uint64_t h) {
+	uint64_t hi = h;
+	uint64_t lo = mix64(h);
+	hi = (hi & ~0xF000ULL) | 0x4000ULL;				// version 4
+	lo = (lo & 0x3FFFFFFFFFFFFFFFULL) | 0x8000000000000000ULL;	// variant 1
+	char buf[40];
+	snprintf(buf, sizeof(buf), "%08x-%04x-%04x-%04x-%012llx",
+		 (unsigned)(hi >> 32), (unsigned)((hi >> 16) & 0xFFFF), (unsigned)(hi & 0xFFFF),
+		 (unsigned)(lo >> 48), (unsigned long long)(lo & 0xFFFFFFFFFFFFULL));
+	return std::string(buf);
+    }
+
+    // The leading field has compositeprefixcardinality values so that
+    // keys share prefixes, the last field carries the hash.
+    std::string compositeKey(uint64_t h) const {
+	std::string key;
+	int n = (int)compositeWidths_.size();
+	for (int i = 0; i < n; i++) {
+	    int w = compositeWidths_[i];
+	    uint64_t v;
+	    if (i == n - 1)
+		v = h;
+	    else if (i == 0)
+		v = mix64(h) % (prefixCardinality_ ? prefixCardinality_ : 1);
+	    else
+		v = mix64(h + i);
+	    if (w < 8)
+		v &= ((uint64_t)1 << (w * 8)) - 1;
+	    char buf[24];
+	    snprintf(buf, sizeof(buf), "%0*llx", w * 2, (unsigned long long)v);
+	    key += buf;
+	}
+	return key;
+    }
+
+    int keyType_;
+    WorkloadRNG rng_;
+    uint64_t recordCount_;
+    uint64_t opCount_;
+    uint64_t opsDone_;
+    bool hashed_;
+    double opCDF_[4];
+    uint64_t insertSequence_;
+
+    int dist_;
+    ScrambledZipfianGenerator* zipfian_;
+    ZipfianGenerator* latest_;
+    double hotSetFraction_;
+    double hotOpnFraction_;
+
+    uint64_t maxScanLength_;
+    ZipfianGenerator* scanZipfian_;
+
+    uint64_t prefixCardinality_;
+    std::vector<int> compositeWidths_;
+};
+
+#endif /* _WORKLOADGEN_H_ */
@@ -0,0 +1,111 @@
+//==============================================================
+// Compares an FST over the keys as is with one over keys compressed
+// by the order-preserving dictionary (FST::setKeyCompression).
+//
+// usage: keycompress [num_keys] [key_type] [num_symbols]
+//   num_keys:    default 10000000
+//   key_type:    randint, email (default), url, uuid, composite
+//   num_symbols: dictionary size, default KeyEncoder::DEFAULT_SYMBOLS
+//
+// Output lines:
+//   <mode> stats <json>
+//   <mode> mem <bytes> height <levels> build <sec>
+//   <mode> lookup <Mops/sec>
+//   <mode> scan <Mscans/sec> (lowerBound + 10 values)
+//==============================================================
+#include <time.h>
+
+#include <algorithm>
+
+#include "FST.hpp"
+#include "workloadgen.h"
+
+#define NUM_QUERIES 2000000
+#define SCAN_LEN 10
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t numKeys = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    std::string keyTypeName = (argc > 2) ? argv[2] : "email";
+    int numSymbols = (argc > 3) ? atoi(argv[3]) : KeyEncoder::DEFAULT_SYMBOLS;
+
+    int keyType = WorkloadGenerator::parseKeyType(keyTypeName);
+    if (keyType < 0) {
+	std::cout << "Incorrect key type: " << keyTypeName << "\n";
+	return 1;
+    }
+
+    WorkloadSpec spec;
+    spec.set("recordcount=" + std::to_string(numKeys));
+    WorkloadGenerator gen(spec, keyType);
+
+    std::vector<std::string> keys;
+    gen.loadKeys(keys);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<uint64_t> values;
+    int longestKeyLen = 0;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	values.push_back(i);
+	if ((int)keys[i].length() > longestKeyLen)
+	    longestKeyLen = keys[i].length();
+    }
+    std::cout << "keys " << keys.size() << "\n";
+
+    std::vector<uint64_t> queries(NUM_QUERIES);
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (int i = 0; i < NUM_QUERIES; i++) {
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	queries[i] = x % keys.size();
+    }
+
+    const char* modes[] = {"plain", "compressed"};
+    for (int m = 0; m < 2; m++) {
+	FST* index = new FST();
+	if (m == 1)
+	    index->setKeyCompression(numSymbols);
+	double start = get_now();
+	index->load(keys, values, longestKeyLen);
+	double end = get_now();
+	std::cout << modes[m] << " stats " << index->statsJSON() << "\n";
+	std::cout << modes[m] << " mem " << index->mem() << " height " << index->stats().treeHeight
+		  << " build " << (end - start) << "\n";
+
+	uint64_t found = 0;
+	uint64_t value;
+	start = get_now();
+	for (int i = 0; i < NUM_QUERIES; i++) {
+	    const std::string &q = keys[queries[i]];
+	    found += index->lookup((const uint8_t*)q.data(), q.length(), value);
+	}
+	end = get_now();
+	if (found != NUM_QUERIES)
+	    std::cout << "LOOKUP FAIL " << (NUM_QUERIES - found) << "\n";
+	std::cout << modes[m] << " lookup " << NUM_QUERIES / (end - start) / 1000000 << "\n";
+
+	uint64_t sum = 0;
+	FSTIter iter(index);
+	start = get_now();
+	for (int i = 0; i < NUM_QUERIES; i++) {
+	    const std::string &q = keys[queries[i]];
+	    if (!index->lowerBound((const uint8_t*)q.data(), q.length(), iter))
+		continue;
+	    sum += iter.value();
+	    for (int j = 1; j < SCAN_LEN && iter++; j++)
+		sum += iter.value();
+	}
+	end = get_now();
+	std::cout << modes[m] << " scan " << NUM_QUERIES / (end - start) / 1000000 << " (" << sum << ")\n";
+
+	delete index;
+    }
+    return 0;
+}
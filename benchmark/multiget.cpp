@@ -0,0 +1,94 @@
+//==============================================================
+// Sorted multi-get: FST::lookup per key vs FST::lookupSorted on
+// sorted batches of keys drawn uniformly from the loaded set.
+//
+// usage: multiget [num_keys] [key_type] [batch_size]
+//   num_keys:   default 10000000
+//   key_type:   randint, email (default), url, uuid, composite
+//   batch_size: default 1000
+//
+// Output lines: <method> <batch_size> <Mops/sec>
+//==============================================================
+#include <time.h>
+
+#include <algorithm>
+#include <random>
+
+#include "FST.hpp"
+#include "workloadgen.h"
+
+#define NUM_QUERIES 10000000
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t numKeys = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    std::string keyTypeName = (argc > 2) ? argv[2] : "email";
+    int batchSize = (argc > 3) ? atoi(argv[3]) : 1000;
+
+    int keyType = WorkloadGenerator::parseKeyType(keyTypeName);
+    if (keyType < 0 || batchSize <= 0) {
+	std::cout << "Incorrect key type or batch size\n";
+	return 1;
+    }
+
+    WorkloadSpec spec;
+    spec.set("recordcount=" + std::to_string(numKeys));
+    WorkloadGenerator gen(spec, keyType);
+
+    std::vector<std::string> keys;
+    gen.loadKeys(keys);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<uint64_t> values;
+    int longestKeyLen = 0;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	values.push_back(i);
+	if ((int)keys[i].length() > longestKeyLen)
+	    longestKeyLen = keys[i].length();
+    }
+
+    FST* index = new FST();
+    index->load(keys, values, longestKeyLen);
+
+    // sorted batches
+    std::vector<std::string> queries;
+    std::mt19937_64 rng(1);
+    for (uint64_t i = 0; i < NUM_QUERIES; i++)
+	queries.push_back(keys[rng() % keys.size()]);
+    for (uint64_t i = 0; i < NUM_QUERIES; i += batchSize)
+	std::sort(queries.begin() + i, queries.begin() + std::min((uint64_t)NUM_QUERIES, i + batchSize));
+
+    std::vector<uint64_t> fetchedValues(batchSize);
+    bool* found = new bool[batchSize];
+
+    uint64_t numFound = 0;
+    double start = get_now();
+    for (uint64_t i = 0; i < NUM_QUERIES; i++) {
+	const std::string &q = queries[i];
+	numFound += index->lookup((const uint8_t*)q.data(), q.length(), fetchedValues[0]);
+    }
+    double end = get_now();
+    std::cout << "lookup " << batchSize << " " << NUM_QUERIES / (end - start) / 1000000 << "\n";
+
+    uint64_t numFoundSorted = 0;
+    start = get_now();
+    for (uint64_t i = 0; i < NUM_QUERIES; i += batchSize) {
+	int n = std::min((uint64_t)batchSize, NUM_QUERIES - i);
+	numFoundSorted += index->lookupSorted(&queries[i], n, fetchedValues.data(), found);
+    }
+    end = get_now();
+    std::cout << "lookupSorted " << batchSize << " " << NUM_QUERIES / (end - start) / 1000000 << "\n";
+
+    if (numFound != NUM_QUERIES || numFoundSorted != NUM_QUERIES)
+	std::cout << "LOOKUP FAIL " << numFound << " " << numFoundSorted << "\n";
+
+    delete[] found;
+    delete index;
+    return 0;
+}
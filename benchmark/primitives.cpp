@@ -0,0 +1,253 @@
+//==============================================================
+// Microbenchmarks for the succinct primitives
+//
+// usage: primitives [max_bitmap_bytes] [num_queries]
+//
+// For bitmaps from 1KB up to max_bitmap_bytes (default 64MB, x4 per
+// step) measures ns/op of
+//   - BitmapRankPoppy::rank, BitmapRankFPoppy::rank,
+//     BitmapSelectPoppy::select (fst)
+//   - rankLUT512 (trank), selectLUT64 (sselect) (fst-serialized)
+//   - the popcount.h word kernels
+// with random and sequential access. Then measures the label search
+// kernels across node sizes, including the bitmap search of large
+// LOUDS-Sparse nodes.
+//
+// Output lines: <primitive> <bitmap bytes | node size> <pattern> <ns/op>
+//==============================================================
+#include <stdlib.h>
+#include <time.h>
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "bitmap-rank.h"
+#include "bitmap-rankF.h"
+#include "bitmap-select.h"
+#include "label-search.h"
+#include "rankselect.h"
+
+// The Poppy structures address bits with uint32; this is the largest
+// size of the 1KB * 4^k series that fits.
+const uint64_t kMaxBitmapBytes = (uint64_t)256 << 20;
+
+static volatile uint64_t sink = 0;
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+inline uint64_t xorshift(uint64_t &x) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return x;
+}
+
+template<typename F>
+double nsPerOp(const std::vector<uint32_t> &queries, F f) {
+    uint64_t sum = 0;
+    double start = get_now();
+    for (size_t i = 0; i < queries.size(); i++)
+	sum += f(queries[i]);
+    double end = get_now();
+    sink += sum;
+    return (end - start) * 1000000000.0 / queries.size();
+}
+
+// random or increasing queries in [lo, hi)
+void makeQueries(std::vector<uint32_t> &queries, uint64_t n, uint64_t lo, uint64_t hi, bool sequential, uint64_t seed) {
+    queries.resize(n);
+    uint64_t range = hi - lo;
+    uint64_t step = (range / n > 0) ? (range / n) : 1;
+    uint64_t x = seed;
+    for (uint64_t i = 0; i < n; i++) {
+	if (sequential)
+	    queries[i] = lo + (i * step) % range;
+	else
+	    queries[i] = lo + xorshift(x) % range;
+    }
+}
+
+inline void report(const char* name, uint64_t size, const char* pattern, double ns) {
+    std::cout << name << " " << size << " " << pattern << " " << ns << "\n";
+}
+
+//==============================================================
+// fst-serialized lookup tables, built like FST::tinit / FST::sinit
+//==============================================================
+void buildRankLUT512(const uint64_t* bits, uint64_t nbits, std::vector<uint32_t> &lut) {
+    uint64_t blocks = nbits / 512;
+    lut.resize(blocks + 1);
+    uint32_t rankCum = 0;
+    for (uint64_t i = 0; i < blocks; i++) {
+	lut[i] = rankCum;
+	for (int w = 0; w < 8; w++)
+	    rankCum += popcount(bits[i * 8 + w]);
+    }
+    lut[blocks] = rankCum;
+}
+
+void buildSelectLUT64(const uint64_t* bits, uint64_t nbits, std::vector<uint32_t> &lut) {
+    lut.clear();
+    lut.push_back(0);
+    uint32_t rankCum = 0;
+    for (uint64_t i = 0; i < nbits / 64; i++) {
+	uint32_t pop = popcount(bits[i]);
+	while ((lut.size() * 64) <= rankCum + pop) {
+	    int rankR = lut.size() * 64 - rankCum;
+	    lut.push_back(i * 64 + select64_popcount_search(bits[i], rankR) + 1);
+	}
+	rankCum += pop;
+    }
+    lut.push_back(nbits);
+}
+
+//==============================================================
+// BITMAPS
+//==============================================================
+void benchBitmap(uint64_t bytes, uint64_t numQueries) {
+    uint64_t nwords = bytes / 8;
+    uint64_t nbits = nwords * 64;
+    uint64_t* bits = new uint64_t[nwords];
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (uint64_t i = 0; i < nwords; i++)
+	bits[i] = xorshift(x);
+
+    BitmapRankPoppy rank(bits, nbits);
+    BitmapRankFPoppy rankF(bits, nbits);
+    BitmapSelectPoppy select(bits, nbits);
+
+    std::vector<uint32_t> rankLUT;
+    std::vector<uint32_t> selectLUT;
+    buildRankLUT512(bits, nbits, rankLUT);
+    buildSelectLUT64(bits, nbits, selectLUT);
+
+    // the last rank block holds the total count, stay clear of it
+    uint64_t rankLimit = (nbits > 512) ? (nbits - 512) : nbits;
+    uint64_t ones = rank.pCount();
+
+    std::vector<uint32_t> queries;
+    const char* patterns[] = {"random", "sequential"};
+    for (int p = 0; p < 2; p++) {
+	bool sequential = (p == 1);
+
+	makeQueries(queries, numQueries, 0, rankLimit, sequential, x);
+	report("BitmapRankPoppy::rank", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return rank.rank(q); }));
+	report("BitmapRankFPoppy::rank", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return rankF.rank(q); }));
+	report("rankLUT512", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return rankLUT512(rankLUT.data(), bits, q); }));
+
+	makeQueries(queries, numQueries, 1, ones, sequential, x);
+	report("BitmapSelectPoppy::select", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return select.select(q); }));
+	report("selectLUT64", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return selectLUT64(selectLUT.data(), bits, q); }));
+
+	// word kernels, queries are word (or 512-bit block) indexes
+	makeQueries(queries, numQueries, 0, nwords, sequential, x);
+	report("popcount", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return popcount(bits[q]); }));
+	report("suxpopcount", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return suxpopcount(bits[q]); }));
+	report("select64_naive", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return select64_naive(bits[q], (q & 15) + 1); }));
+	report("select64_popcount_search", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return select64_popcount_search(bits[q], (q & 15) + 1); }));
+	report("select64_broadword", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return select64_broadword(bits[q], (q & 15) + 1); }));
+
+	makeQueries(queries, numQueries, 0, nwords / 8, sequential, x);
+	report("popcountLinear", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return popcountLinear(bits, (uint64)q * 8, (q & 511) + 1); }));
+	report("select512", bytes, patterns[p],
+	       nsPerOp(queries, [&](uint32_t q) { return select512(bits, q * 8, (q & 127) + 1); }));
+    }
+
+    delete[] bits;
+}
+
+//==============================================================
+// LABEL SEARCH
+//==============================================================
+void benchNodeSearch(uint64_t numQueries) {
+    const uint64_t kLabelBytes = 16 << 20;
+    int sizes[] = {1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 64, 128, 256};
+    const int numSizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    std::vector<uint8_t> labels(kLabelBytes + 16);
+    std::vector<uint8_t> alphabet(256);
+    for (int i = 0; i < 256; i++)
+	alphabet[i] = i;
+
+    uint64_t x = 0x2545F4914F6CDD1DULL;
+    for (int k = 0; k < numSizes; k++) {
+	int n = sizes[k];
+	uint64_t numNodes = kLabelBytes / n;
+
+	// each node holds n distinct sorted labels
+	for (uint64_t node = 0; node < numNodes; node++) {
+	    for (int i = 0; i < n; i++)
+		std::swap(alphabet[i], alphabet[i + xorshift(x) % (256 - i)]);
+	    std::sort(alphabet.begin(), alphabet.begin() + n);
+	    std::copy(alphabet.begin(), alphabet.begin() + n, labels.begin() + node * n);
+	}
+
+	// queries encode node number and the index of an existing label
+	std::vector<uint32_t> queries(numQueries);
+	for (uint64_t i = 0; i < numQueries; i++)
+	    queries[i] = (xorshift(x) % numNodes) * n + xorshift(x) % n;
+
+	const uint8_t* data = labels.data();
+	report("simdSearch", n, "random",
+	       nsPerOp(queries, [&](uint32_t q) {
+		       uint64_t pos = q - q % n;
+		       simdSearch(data, pos, n, data[q]);
+		       return pos; }));
+	report("binarySearch", n, "random",
+	       nsPerOp(queries, [&](uint32_t q) {
+		       uint64_t pos = q - q % n;
+		       binarySearch(data, pos, n, data[q]);
+		       return pos; }));
+	report("linearSearch", n, "random",
+	       nsPerOp(queries, [&](uint32_t q) {
+		       uint64_t pos = q - q % n;
+		       linearSearch(data, pos, n, data[q]);
+		       return pos; }));
+
+	// the same nodes as 256-bit bitmaps (FST_NODE_BITMAP_MIN), only
+	// sizes where the bitmaps do not dwarf the labels
+	if (n < 32)
+	    continue;
+	std::vector<uint64_t> nodeBits(numNodes * 4, 0);
+	for (uint64_t i = 0; i < numNodes * n; i++)
+	    setBit(nodeBits[(i / n) * 4 + (data[i] >> 6)], data[i] & 63);
+	const uint64_t* bitsData = nodeBits.data();
+	report("bitmapSearch", n, "random",
+	       nsPerOp(queries, [&](uint32_t q) {
+		       uint64_t pos = q - q % n;
+		       bitmapSearch(bitsData + (q / n) * 4, pos, data[q]);
+		       return pos; }));
+    }
+}
+
+int main(int argc, char** argv) {
+    uint64_t maxBytes = (argc > 1) ? strtoull(argv[1], NULL, 10) : ((uint64_t)64 << 20);
+    uint64_t numQueries = (argc > 2) ? strtoull(argv[2], NULL, 10) : 10000000;
+
+    if (maxBytes > kMaxBitmapBytes) {
+	std::cout << "max bitmap size capped at " << kMaxBitmapBytes << " bytes (uint32 bit positions)\n";
+	maxBytes = kMaxBitmapBytes;
+    }
+
+    for (uint64_t bytes = 1024; bytes <= maxBytes; bytes *= 4)
+	benchBitmap(bytes, numQueries);
+
+    benchNodeSearch(numQueries);
+    return 0;
+}
@@ -0,0 +1,140 @@
+//==============================================================
+// Workload E style scans: lowerBound + iter++ per range vs
+// FST::scanBatch on batches of ranges, with and without keys. Start
+// keys are drawn uniformly from the loaded set, lengths uniformly from
+// [1, max_scan_length]. Then a sum of all values with iter++ vs
+// FST::forEach.
+//
+// usage: scanbatch [num_keys] [key_type] [batch_size] [max_scan_length]
+//   num_keys:        default 10000000
+//   key_type:        randint, email (default), url, uuid, composite
+//   batch_size:      default 1000
+//   max_scan_length: default 100
+//
+// Output lines: <method> <batch_size> <Mscans/sec>
+//               <method> full <Mkeys/sec>
+//==============================================================
+#include <time.h>
+
+#include <algorithm>
+#include <random>
+
+#include "FST.hpp"
+#include "workloadgen.h"
+
+#define NUM_SCANS 1000000
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t numKeys = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    std::string keyTypeName = (argc > 2) ? argv[2] : "email";
+    int batchSize = (argc > 3) ? atoi(argv[3]) : 1000;
+    int maxScanLength = (argc > 4) ? atoi(argv[4]) : 100;
+
+    int keyType = WorkloadGenerator::parseKeyType(keyTypeName);
+    if (keyType < 0 || batchSize <= 0 || maxScanLength <= 0) {
+	std::cout << "Incorrect key type, batch size or scan length\n";
+	return 1;
+    }
+
+    WorkloadSpec spec;
+    spec.set("recordcount=" + std::to_string(numKeys));
+    WorkloadGenerator gen(spec, keyType);
+
+    std::vector<std::string> keys;
+    gen.loadKeys(keys);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<uint64_t> values;
+    int longestKeyLen = 0;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	values.push_back(i);
+	if ((int)keys[i].length() > longestKeyLen)
+	    longestKeyLen = keys[i].length();
+    }
+
+    FST* index = new FST();
+    index->load(keys, values, longestKeyLen);
+
+    std::vector<FSTRange> ranges(NUM_SCANS);
+    std::mt19937_64 rng(1);
+    uint64_t maxValues = 0;
+    for (uint64_t i = 0; i < NUM_SCANS; i++) {
+	const std::string &key = keys[rng() % keys.size()];
+	ranges[i].key = (const uint8_t*)key.data();
+	ranges[i].keylen = key.length();
+	ranges[i].count = 1 + rng() % maxScanLength;
+	maxValues += ranges[i].count;
+    }
+
+    uint64_t sum = 0;
+    FSTIter iter(index);
+    double start = get_now();
+    for (uint64_t i = 0; i < NUM_SCANS; i++) {
+	if (!index->lowerBound(ranges[i].key, ranges[i].keylen, iter))
+	    continue;
+	sum += iter.value();
+	for (uint32_t j = 1; j < ranges[i].count; j++) {
+	    if (!iter++) break;
+	    sum += iter.value();
+	}
+    }
+    double end = get_now();
+    std::cout << "lowerBound+iter " << batchSize << " " << NUM_SCANS / (end - start) / 1000000 << "\n";
+
+    std::vector<uint64_t> scanned(maxValues);
+    std::vector<uint32_t> counts(batchSize);
+    uint64_t sumBatch = 0;
+    start = get_now();
+    for (uint64_t i = 0; i < NUM_SCANS; i += batchSize) {
+	int n = std::min((uint64_t)batchSize, NUM_SCANS - i);
+	uint64_t total = index->scanBatch(&ranges[i], n, scanned.data(), counts.data());
+	for (uint64_t j = 0; j < total; j++)
+	    sumBatch += scanned[j];
+    }
+    end = get_now();
+    std::cout << "scanBatch " << batchSize << " " << NUM_SCANS / (end - start) / 1000000 << "\n";
+
+    if (sum != sumBatch)
+	std::cout << "SCAN MISMATCH " << sum << " " << sumBatch << "\n";
+
+    std::vector<uint8_t> scannedKeys;
+    std::vector<uint32_t> keyEnd(maxValues);
+    uint64_t keyBytes = 0;
+    start = get_now();
+    for (uint64_t i = 0; i < NUM_SCANS; i += batchSize) {
+	int n = std::min((uint64_t)batchSize, NUM_SCANS - i);
+	index->scanBatch(&ranges[i], n, scanned.data(), counts.data(), scannedKeys, keyEnd.data());
+	keyBytes += scannedKeys.size();
+    }
+    end = get_now();
+    std::cout << "scanBatch+keys " << batchSize << " " << NUM_SCANS / (end - start) / 1000000
+	      << " (" << keyBytes << " key bytes)\n";
+
+    uint64_t sumIter = 0;
+    start = get_now();
+    index->lowerBound((const uint8_t*)"", 0, iter);
+    do {
+	sumIter += iter.value();
+    } while (iter++);
+    end = get_now();
+    std::cout << "iter full " << keys.size() / (end - start) / 1000000 << "\n";
+
+    uint64_t sumForEach = 0;
+    start = get_now();
+    index->forEach((const uint8_t*)"", 0, NULL, 0, [&](uint64_t value) { sumForEach += value; });
+    end = get_now();
+    std::cout << "forEach full " << keys.size() / (end - start) / 1000000 << "\n";
+
+    if (sumIter != sumForEach)
+	std::cout << "FULL SCAN MISMATCH " << sumIter << " " << sumForEach << "\n";
+
+    delete index;
+    return 0;
+}
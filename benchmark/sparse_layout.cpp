@@ -0,0 +1,176 @@
+//==============================================================
+// Compares the LOUDS-Sparse layouts (level order vs blocked) and a
+// DFUDS trie (DFUDSTrie) on point lookups and short range scans of
+// long keys.
+//
+// usage: sparse_layout [num_keys] [key_type] [perf]
+//   num_keys: default 10000000
+//   key_type: randint, email, url (default), uuid, composite
+//   perf:     also print hardware counters per lookup
+//
+// Output lines:
+//   <layout> stats <json>
+//   <layout> <distribution> lookup <Mops/sec>
+//   <layout> <distribution> scan<len> <Mops/sec>
+//   dfuds mem <bytes> nodes <n>
+//==============================================================
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "FST.hpp"
+#include "dfuds.h"
+#include "perfcounters.h"
+#include "workloadgen.h"
+
+#define NUM_QUERIES 2000000
+#define NUM_SCANS 200000
+#define SCAN_LEN 100
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void makeQueries(uint64_t numKeys, int keyType, const char* dist, std::vector<std::string> &queries) {
+    WorkloadSpec spec;
+    spec.set("recordcount=" + std::to_string(numKeys));
+    spec.set("operationcount=" + std::to_string(NUM_QUERIES));
+    spec.set("readproportion=1");
+    spec.set("updateproportion=0");
+    spec.set(std::string("requestdistribution=") + dist);
+
+    WorkloadGenerator gen(spec, keyType, 1);
+    WorkloadOp op;
+    while (gen.nextOp(op))
+	queries.push_back(gen.key(op.keynum));
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t numKeys = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    std::string keyTypeName = (argc > 2) ? argv[2] : "url";
+    bool usePerf = (argc > 3 && strcmp(argv[3], "perf") == 0);
+
+    int keyType = WorkloadGenerator::parseKeyType(keyTypeName);
+    if (keyType < 0) {
+	std::cout << "Incorrect key type: " << keyTypeName << "\n";
+	return 1;
+    }
+
+    WorkloadSpec spec;
+    spec.set("recordcount=" + std::to_string(numKeys));
+    WorkloadGenerator gen(spec, keyType);
+
+    std::vector<std::string> keys;
+    gen.loadKeys(keys);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    std::vector<uint64_t> values;
+    int longestKeyLen = 0;
+    uint64_t totalLen = 0;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	values.push_back(i);
+	totalLen += keys[i].length();
+	if ((int)keys[i].length() > longestKeyLen)
+	    longestKeyLen = keys[i].length();
+    }
+    std::cout << "keys " << keys.size() << " avg-len " << (double)totalLen / keys.size() << "\n";
+
+    const char* dists[] = {"uniform", "zipfian"};
+    std::vector<std::string> queries[2];
+    for (int d = 0; d < 2; d++)
+	makeQueries(numKeys, keyType, dists[d], queries[d]);
+
+    PerfCounters* perf = usePerf ? new PerfCounters() : NULL;
+
+    int layouts[] = {FST::SPARSE_LEVEL_ORDER, FST::SPARSE_BLOCKED};
+    const char* layoutNames[] = {"level", "blocked"};
+    for (int l = 0; l < 2; l++) {
+	FST* index = new FST();
+	index->load(keys, values, longestKeyLen, layouts[l]);
+	std::cout << layoutNames[l] << " stats " << index->statsJSON() << "\n";
+
+	for (int d = 0; d < 2; d++) {
+	    uint64_t found = 0;
+	    uint64_t value;
+	    if (perf) perf->start();
+	    double start = get_now();
+	    for (uint64_t i = 0; i < queries[d].size(); i++) {
+		const std::string &q = queries[d][i];
+		found += index->lookup((const uint8_t*)q.data(), q.length(), value);
+	    }
+	    double end = get_now();
+	    if (perf) perf->stop();
+
+	    if (found != queries[d].size())
+		std::cout << "LOOKUP FAIL " << (queries[d].size() - found) << "\n";
+
+	    std::cout << layoutNames[l] << " " << dists[d] << " lookup "
+		      << queries[d].size() / (end - start) / 1000000 << "\n";
+	    if (perf)
+		perf->print(std::cout, (std::string(layoutNames[l]) + "-" + dists[d]).c_str(), queries[d].size());
+
+	    uint64_t sum = 0;
+	    FSTIter iter(index);
+	    start = get_now();
+	    for (uint64_t i = 0; i < NUM_SCANS; i++) {
+		const std::string &q = queries[d][i];
+		if (!index->lowerBound((const uint8_t*)q.data(), q.length(), iter))
+		    continue;
+		for (int k = 0; k < SCAN_LEN; k++) {
+		    sum += iter.value();
+		    if (!iter++)
+			break;
+		}
+	    }
+	    end = get_now();
+	    std::cout << layoutNames[l] << " " << dists[d] << " scan" << SCAN_LEN << " "
+		      << NUM_SCANS / (end - start) / 1000000 << " (" << sum << ")\n";
+	}
+	delete index;
+    }
+
+    DFUDSTrie* dfuds = new DFUDSTrie();
+    dfuds->load(keys, values);
+    std::cout << "dfuds mem " << dfuds->mem() << " nodes " << dfuds->numNodes() << "\n";
+    for (int d = 0; d < 2; d++) {
+	uint64_t found = 0;
+	uint64_t value;
+	if (perf) perf->start();
+	double start = get_now();
+	for (uint64_t i = 0; i < queries[d].size(); i++) {
+	    const std::string &q = queries[d][i];
+	    found += dfuds->lookup((const uint8_t*)q.data(), q.length(), value);
+	}
+	double end = get_now();
+	if (perf) perf->stop();
+
+	if (found != queries[d].size())
+	    std::cout << "LOOKUP FAIL " << (queries[d].size() - found) << "\n";
+
+	std::cout << "dfuds " << dists[d] << " lookup "
+		  << queries[d].size() / (end - start) / 1000000 << "\n";
+	if (perf)
+	    perf->print(std::cout, (std::string("dfuds-") + dists[d]).c_str(), queries[d].size());
+
+	uint64_t sum = 0;
+	uint64_t scanned[SCAN_LEN];
+	start = get_now();
+	for (uint64_t i = 0; i < NUM_SCANS; i++) {
+	    const std::string &q = queries[d][i];
+	    uint64_t n = dfuds->scan((const uint8_t*)q.data(), q.length(), SCAN_LEN, scanned);
+	    for (uint64_t k = 0; k < n; k++)
+		sum += scanned[k];
+	}
+	end = get_now();
+	std::cout << "dfuds " << dists[d] << " scan" << SCAN_LEN << " "
+		  << NUM_SCANS / (end - start) / 1000000 << " (" << sum << ")\n";
+    }
+    delete dfuds;
+
+    delete perf;
+    return 0;
+}
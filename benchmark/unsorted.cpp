@@ -0,0 +1,112 @@
+//==============================================================
+// End-to-end build from unsorted keys: std::sort + FST::load vs
+// FST::loadUnsorted (radix sort feeding the builder).
+//
+// usage: unsorted [num_keys] [key_type] [threads]
+//   num_keys: default 10000000
+//   key_type: randint, email (default), url, uuid, composite;
+//             randint is built from 64-bit keys
+//   threads:  loadUnsorted threads, default 0 (all)
+//
+// Output lines:
+//   <method> sort <sec> build <sec> total <sec>
+//==============================================================
+#include <time.h>
+
+#include <algorithm>
+
+#include "FST.hpp"
+#include "workloadgen.h"
+
+inline double get_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t numKeys = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    std::string keyTypeName = (argc > 2) ? argv[2] : "email";
+    int threads = (argc > 3) ? atoi(argv[3]) : 0;
+
+    int keyType = WorkloadGenerator::parseKeyType(keyTypeName);
+    if (keyType < 0) {
+	std::cout << "Incorrect key type: " << keyTypeName << "\n";
+	return 1;
+    }
+
+    WorkloadSpec spec;
+    spec.set("recordcount=" + std::to_string(numKeys));
+    WorkloadGenerator gen(spec, keyType);
+
+    std::vector<uint64_t> values(numKeys);
+    for (uint64_t i = 0; i < numKeys; i++)
+	values[i] = i;
+
+    if (keyTypeName == "randint") {
+	std::vector<uint64_t> keys(numKeys);
+	for (uint64_t i = 0; i < numKeys; i++)
+	    keys[i] = gen.intKey(i);
+
+	double start = get_now();
+	std::vector<std::pair<uint64_t, uint64_t> > pairs(numKeys);
+	for (uint64_t i = 0; i < numKeys; i++)
+	    pairs[i] = std::make_pair(keys[i], values[i]);
+	std::stable_sort(pairs.begin(), pairs.end(),
+			 [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) { return a.first < b.first; });
+	std::vector<uint64_t> sortedKeys(numKeys);
+	std::vector<uint64_t> sortedValues(numKeys);
+	for (uint64_t i = 0; i < numKeys; i++) {
+	    sortedKeys[i] = pairs[i].first;
+	    sortedValues[i] = pairs[i].second;
+	}
+	double sorted = get_now();
+	FST* index = new FST();
+	index->load(sortedKeys, sortedValues);
+	double end = get_now();
+	std::cout << "std::sort sort " << (sorted - start) << " build " << (end - sorted)
+		  << " total " << (end - start) << "\n";
+	delete index;
+
+	index = new FST();
+	index->loadUnsorted(keys, values, FST::SPARSE_LEVEL_ORDER, threads);
+	std::cout << "loadUnsorted sort " << index->stats().times.sort
+		  << " build " << (index->stats().times.total - index->stats().times.sort)
+		  << " total " << index->stats().times.total << "\n";
+	delete index;
+	return 0;
+    }
+
+    std::vector<std::string> keys;
+    gen.loadKeys(keys);
+
+    double start = get_now();
+    std::vector<uint64_t> order(numKeys);
+    for (uint64_t i = 0; i < numKeys; i++)
+	order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+		     [&](uint64_t a, uint64_t b) { return keys[a] < keys[b]; });
+    std::vector<std::string> sortedKeys(numKeys);
+    std::vector<uint64_t> sortedValues(numKeys);
+    int longestKeyLen = 0;
+    for (uint64_t i = 0; i < numKeys; i++) {
+	sortedKeys[i] = keys[order[i]];
+	sortedValues[i] = values[order[i]];
+	longestKeyLen = std::max(longestKeyLen, (int)sortedKeys[i].length());
+    }
+    double sorted = get_now();
+    FST* index = new FST();
+    index->load(sortedKeys, sortedValues, longestKeyLen);
+    double end = get_now();
+    std::cout << "std::sort sort " << (sorted - start) << " build " << (end - sorted)
+	      << " total " << (end - start) << "\n";
+    delete index;
+
+    index = new FST();
+    index->loadUnsorted(keys, values, FST::SPARSE_LEVEL_ORDER, threads);
+    std::cout << "loadUnsorted sort " << index->stats().times.sort
+	      << " build " << (index->stats().times.total - index->stats().times.sort)
+	      << " total " << index->stats().times.total << "\n";
+    delete index;
+    return 0;
+}
@@ -120,23 +120,30 @@ inline void load(int wl, std::vector<keytype> &init_keys, std::vector<keytype> &
 //==============================================================
 // EXEC
 //==============================================================
-inline void exec_load(int index_type, std::vector<keytype> &init_keys, std::vector<uint64_t> &values) {
+inline void exec_load(int index_type, std::vector<keytype> &init_keys, std::vector<uint64_t> &values, PerfCounters *perf, MemCheck *memcheck) {
     idx = getInstance<keytype, keycomp>(index_type);
 
     //WRITE ONLY TEST-----------------
     int count = (int)init_keys.size();
+    if (memcheck) memcheck->start();
+    if (perf) perf->start();
     double start_time = get_now();
     if (!idx->load(init_keys, values))
 	return;
     double end_time = get_now();
+    if (perf) perf->stop();
     double tput = count / (end_time - start_time) / 1000000; //Mops/sec
 
     std::cout << "insert " << tput << "\n";
+    if (perf) perf->print(std::cout, "insert", count);
     std::cout << "memory " << (idx->getMemory() / 1000000) << "\n";
+    if (memcheck) memcheck->print(std::cout, idx->getMemory());
+    idx->printStats(std::cout);
 }
 
-inline void exec_txn(int wl, std::vector<keytype> &keys, std::vector<uint64_t> &values, std::vector<int> &ranges, std::vector<int> &ops) {
+inline void exec_txn(int wl, std::vector<keytype> &keys, std::vector<uint64_t> &values, std::vector<int> &ranges, std::vector<int> &ops, PerfCounters *perf) {
     //READ/SCAN TEST----------------
+    if (perf) perf->start();
     double start_time = get_now();
     int txn_num = 0;
     uint64_t s = 0;
@@ -156,24 +163,31 @@ inline void exec_txn(int wl, std::vector<keytype> &keys, std::vector<uint64_t> &
     }
 
     double end_time = get_now();
+    if (perf) perf->stop();
     double tput = txn_num / (end_time - start_time) / 1000000; //Mops/sec
 
-    if (wl == 0)
-	std::cout << "read " << tput << "\n";
-    else if (wl == 1)
-	std::cout << "scan " << tput << "\n";
-    else
-	std::cout << "read " << tput << "\n";
+    const char* phase = (wl == 1) ? "scan" : "read";
+    std::cout << phase << " " << tput << "\n";
+    if (perf) perf->print(std::cout, phase, txn_num);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
 	std::cout << "Usage:\n";
 	std::cout << "1. workload type: c, e\n";
 	std::cout << "2. index type: btree, art, cart, hrt\n";
+	std::cout << "3. (optional) perf: hardware counters per operation\n";
+	std::cout << "   or memcheck: reported memory vs usable heap bytes and RSS\n";
 	return 1;
     }
 
+    PerfCounters *perf = NULL;
+    if (argc == 4 && strcmp(argv[3], "perf") == 0)
+	perf = new PerfCounters();
+    MemCheck *memcheck = NULL;
+    if (argc == 4 && strcmp(argv[3], "memcheck") == 0)
+	memcheck = new MemCheck();
+
     int wl = 0;
     if (strcmp(argv[1], "c") == 0)
 	wl = 0;
@@ -198,8 +212,11 @@ int main(int argc, char *argv[]) {
 
     load(wl, init_keys, keys, values, ranges, ops);
 
-    exec_load(index_type, init_keys, values);
-    exec_txn(wl, keys, values, ranges, ops);
+    exec_load(index_type, init_keys, values, perf, memcheck);
+    exec_txn(wl, keys, values, ranges, ops, perf);
+
+    delete perf;
+    delete memcheck;
 
     return 0;
 }
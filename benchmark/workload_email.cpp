@@ -111,19 +111,26 @@ inline void load(int wl, int index_type, std::vector<keytype> &init_keys, std::v
 //==============================================================
 // EXEC
 //==============================================================
-inline void exec(int wl, int index_type, std::vector<keytype> &init_keys, std::vector<keytype> &keys, std::vector<uint64_t> &values, std::vector<int> &ranges, std::vector<int> &ops) {
+inline void exec(int wl, int index_type, std::vector<keytype> &init_keys, std::vector<keytype> &keys, std::vector<uint64_t> &values, std::vector<int> &ranges, std::vector<int> &ops, PerfCounters *perf, MemCheck *memcheck) {
     Index<keytype, keycomp> *idx = getInstance<keytype, keycomp>(index_type);
 
     //WRITE ONLY TEST-----------------
+    if (memcheck) memcheck->start();
+    if (perf) perf->start();
     double start_time = get_now();
     idx->load(init_keys, values);
     double end_time = get_now();
+    if (perf) perf->stop();
     double tput = init_keys.size() / (end_time - start_time) / 1000000; //Mops/sec
 
     std::cout << "insert " << tput << "\n";
+    if (perf) perf->print(std::cout, "insert", init_keys.size());
     std::cout << "memory " << (idx->getMemory() / 1000000) << "\n";
+    if (memcheck) memcheck->print(std::cout, idx->getMemory());
+    idx->printStats(std::cout);
 
     //READ/SCAN TEST----------------
+    if (perf) perf->start();
     start_time = get_now();
     int txn_num = 0;
 
@@ -142,24 +149,31 @@ inline void exec(int wl, int index_type, std::vector<keytype> &init_keys, std::v
     }
 
     end_time = get_now();
+    if (perf) perf->stop();
     tput = txn_num / (end_time - start_time) / 1000000; //Mops/sec
 
-    if (wl == 0)
-	std::cout << "read " << tput << "\n";
-    else if (wl == 1)
-	std::cout << "scan " << tput << "\n";
-    else
-	std::cout << "read " << tput << "\n";
+    const char* phase = (wl == 1) ? "scan" : "read";
+    std::cout << phase << " " << tput << "\n";
+    if (perf) perf->print(std::cout, phase, txn_num);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
 	std::cout << "Usage:\n";
 	std::cout << "1. workload type: c, e\n";
 	std::cout << "2. index type: art, cart, hrt\n";
+	std::cout << "3. (optional) perf: hardware counters per operation\n";
+	std::cout << "   or memcheck: reported memory vs usable heap bytes and RSS\n";
 	return 1;
     }
 
+    PerfCounters *perf = NULL;
+    if (argc == 4 && strcmp(argv[3], "perf") == 0)
+	perf = new PerfCounters();
+    MemCheck *memcheck = NULL;
+    if (argc == 4 && strcmp(argv[3], "memcheck") == 0)
+	memcheck = new MemCheck();
+
     int wl = 0;
     if (strcmp(argv[1], "c") == 0)
 	wl = 0;
@@ -181,7 +195,10 @@ int main(int argc, char *argv[]) {
     std::vector<int> ops;
 
     load(wl, index_type, init_keys, keys, values, ranges, ops);
-    exec(wl, index_type, init_keys, keys, values, ranges, ops);
+    exec(wl, index_type, init_keys, keys, values, ranges, ops, perf, memcheck);
+
+    delete perf;
+    delete memcheck;
 
     return 0;
 }
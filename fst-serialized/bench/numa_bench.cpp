@@ -0,0 +1,91 @@
+//************************************************
+// NUMA placement benchmark
+//
+// usage: numa_bench [num_keys] [num_threads] [lookups_per_thread]
+//
+// Builds an FST over random 64-bit keys and measures point lookup
+// throughput with the image placed on a single node, interleaved
+// across nodes, and replicated on every node. Threads are spread
+// round-robin over all cpus.
+//************************************************
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "FSTReplicas.hpp"
+
+using namespace std;
+
+inline double get_now() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+double run(FSTReplicas &replicas, vector<uint64_t> &keys, int numThreads, uint64_t numLookups) {
+    vector<int> cpus;
+    for (int n = 0; n < replicas.numNodes(); n++)
+	for (int i = 0; i < (int)replicas.cpusOfNode(n).size(); i++)
+	    cpus.push_back(replicas.cpusOfNode(n)[i]);
+
+    vector<uint64_t> sums(numThreads, 0); // keeps the lookups live
+    vector<thread> threads;
+    double start = get_now();
+    for (int t = 0; t < numThreads; t++) {
+	threads.push_back(thread([&, t]() {
+		    replicas.pinToCpu(cpus[t % cpus.size()]);
+		    uint64_t x = 0x9E3779B97F4A7C15ULL * (t + 1);
+		    uint64_t sum = 0;
+		    uint64_t value;
+		    for (uint64_t i = 0; i < numLookups; i++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+			replicas.lookup(keys[x % keys.size()], value);
+			sum += value;
+		    }
+		    sums[t] = sum;
+		}));
+    }
+    for (int t = 0; t < numThreads; t++)
+	threads[t].join();
+    double end = get_now();
+
+    return (numThreads * numLookups) / (end - start) / 1000000;
+}
+
+int main(int argc, char** argv) {
+    uint64_t numKeys = (argc > 1) ? strtoull(argv[1], NULL, 10) : 10000000;
+    int numThreads = (argc > 2) ? atoi(argv[2]) : thread::hardware_concurrency();
+    uint64_t numLookups = (argc > 3) ? strtoull(argv[3], NULL, 10) : 10000000;
+    if (numThreads < 1)
+	numThreads = 1;
+
+    vector<uint64_t> keys;
+    srand(0);
+    for (uint64_t i = 0; i < numKeys; i++)
+	keys.push_back(((uint64_t)rand() << 32) | rand());
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+    FST* index = load(keys, keys);
+    FSTReplicas replicas;
+    cout << "nodes = " << replicas.numNodes() << "\n";
+    cout << "threads = " << numThreads << "\n";
+    cout << "image = " << index->imageSize() << " bytes\n";
+
+    const char* names[] = {"single-node", "interleaved", "replicated"};
+    FSTPlacement placements[] = {kPlaceSingleNode, kPlaceInterleaved, kPlaceReplicated};
+    for (int i = 0; i < 3; i++) {
+	if (!replicas.build(index, placements[i])) {
+	    cout << names[i] << " failed\n";
+	    continue;
+	}
+	cout << names[i] << " " << run(replicas, keys, numThreads, numLookups) << " Mops/s\n";
+    }
+
+    destroy(index);
+    return 0;
+}
@@ -1,6 +1,14 @@
+#ifndef _FST_H_
+#define _FST_H_
+
 #include <emmintrin.h>
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <vector>
 #include <iostream>
@@ -8,6 +16,7 @@
 
 #include <common.h>
 #include "popcount.h"
+#include "rankselect.h"
 
 using namespace std;
 
@@ -43,6 +52,84 @@ const int skip = 64;
 const int kSkipBits = 6;
 const uint32_t kSkipMask = ((uint32_t)1 << kSkipBits) - 1;
 
+//******************************************************
+// On-disk format
+//******************************************************
+// An FST is one contiguous, position-independent image:
+//
+//   +--------------------------------------------------+ offset 0
+//   | FSTHeader: magic, version, flags, byte-order     |
+//   |   mark, image size, checksum, header size        |
+//   | FST metadata (cutoff level, node counts, ...)    |
+//   | section directory: kNumSections x FSTSection     |
+//   | section pointer cache (runtime only, zero on     |
+//   |   disk, rebuilt by bindSections() at open)       |
+//   +--------------------------------------------------+ aligned to kSectionAlign
+//   | section 0 (cUbits)                               |
+//   +--------------------------------------------------+ aligned to kSectionAlign
+//   | ...                                              |
+//   +--------------------------------------------------+ aligned to kSectionAlign
+//   | section kNumSections-1 (values)                  |
+//   +--------------------------------------------------+ imageSize
+//
+// Offsets in the directory are relative to the start of the image.
+// Integers are stored in the byte order of the builder; byteOrder holds
+// kFSTByteOrderMark as written by the builder, so an image built on a
+// host with different endianness is rejected at open. headerSize is
+// sizeof(FST) of the builder and guards against ABI mismatches. If
+// kFSTFlagChecksum is set, checksum covers the metadata, the directory
+// and every section (see FST::computeChecksum).
+//******************************************************
+const uint32_t kFSTMagic = 0x31545346; // "FST1"
+const uint16_t kFSTFormatVersion = 1;
+const uint64_t kFSTByteOrderMark = 0x0102030405060708ULL;
+const uint16_t kFSTFlagChecksum = 0x1;
+const uint64_t kSectionAlign = 64;
+
+enum FSTSectionId {
+    kSecCUbits = 0,     // D-Labels
+    kSecCUrankLUT,
+    kSecTUbits,         // D-HasChild
+    kSecTUrankLUT,
+    kSecOUbits,         // D-IsPrefixKey
+    kSecOUrankLUT,
+    kSecCbytes,         // S-Labels
+    kSecTbits,          // S-HasChild
+    kSecTrankLUT,
+    kSecSbits,          // S-LOUDS
+    kSecSselectLUT,
+    kSecValuesU,        // D-values
+    kSecValues,         // S-values
+    kNumSections
+};
+
+enum FSTSectionEncoding {
+    kEncBitvector = 1,  // uint64_t words, MSB-first bit order
+    kEncRankLUT64,      // uint32_t cumulative rank per 64-bit block
+    kEncRankLUT512,     // uint32_t cumulative rank per 512-bit block
+    kEncSelectLUT64,    // uint32_t position of every 64th set bit
+    kEncBytes,          // uint8_t labels
+    kEncUint64          // uint64_t values
+};
+
+struct FSTHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t byteOrder;
+    uint64_t imageSize;
+    uint64_t checksum;
+    uint32_t headerSize;
+    uint32_t sectionCount;
+};
+
+struct FSTSection {
+    uint64_t offset;
+    uint64_t length;
+    uint32_t encoding;
+    uint32_t align;
+};
+
 
 //******************************************************
 // Initilization functions for FST
@@ -50,6 +137,29 @@ const uint32_t kSkipMask = ((uint32_t)1 << kSkipBits) - 1;
 FST* load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen);
 FST* load(vector<uint64_t> &keys, vector<uint64_t> &values);
 
+//******************************************************
+// Serialization
+//******************************************************
+// Reads an image written by FST::save into a newly allocated buffer.
+// Returns NULL if the file can not be read or the image is invalid.
+FST* open(const char* fileName);
+// Opens an image in place; image must be kSectionAlign aligned and
+// stay valid for the lifetime of the returned FST.
+FST* open(void* image, uint64_t size);
+// Maps an image written by FST::save for serving tries larger than
+// memory. The header, the LOUDS-Dense sections, the rank/select
+// directories and the top residentSparseLevels levels of LOUDS-Sparse
+// are prefaulted (and mlock'ed if lockResident); the rest of the
+// sparse sections is demand paged with MADV_RANDOM.
+// Only the header and the section directory are checked, so that the
+// sparse sections are not read at open; verifyChecksum also checks
+// the checksum, which reads the whole image.
+// Returns NULL if the file can not be mapped or locked, or the image
+// is invalid.
+FST* mmapOpen(const char* fileName, int residentSparseLevels = 0, bool lockResident = false, bool verifyChecksum = false);
+// Releases an FST returned by load, open or mmapOpen.
+void destroy(FST* fst);
+
 //helpers
 inline bool insertChar_cond(const uint8_t ch, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
 inline bool insertChar(const uint8_t ch, bool isTerm, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
@@ -65,13 +175,36 @@ public:
 	uint32_t cUnb, uint32_t cUmem, uint32_t tUnb, uint32_t tUmem,
 	uint32_t oUnb, uint32_t oUmem, uint32_t vUm, uint32_t cmem,
 	uint32_t tnb, uint32_t tmem, uint32_t smem, uint32_t sbbc, uint32_t vm);
-    virtual ~FST();
+    ~FST();
 
     friend inline bool insertChar_cond(const uint8_t ch, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
     friend inline bool insertChar(const uint8_t ch, bool isTerm, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
 
     friend FST* load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen);
     friend FST* load(vector<uint64_t> &keys, vector<uint64_t> &values);
+    friend FST* open(void* image, uint64_t size);
+    friend FST* mmapOpen(const char* fileName, int residentSparseLevels, bool lockResident, bool verifyChecksum);
+    friend void destroy(FST* fst);
+
+    //serialization
+    bool save(const char* fileName, bool withChecksum = true);
+    uint64_t imageSize();
+    const FSTHeader* header();
+    const FSTSection* section(int id);
+    // Copies the image to dst (imageSize() bytes, kSectionAlign
+    // aligned) and returns the FST living there. The caller owns dst;
+    // do not destroy() the returned FST.
+    FST* copyTo(void* dst);
+
+    //demand paging stats, images opened with mmapOpen only
+    //-------------------------------------------------
+    // Samples page residency with mincore(). A page found resident
+    // that was not resident at the previous sample counts as a fault
+    // of every section it overlaps; pages evicted and faulted back in
+    // between two samples are missed, so the counters are lower bounds.
+    void samplePages();
+    uint64_t residentPages(int id);
+    uint64_t pageFaults(int id);
 
     //point query
     bool lookup(const uint8_t* key, const int keylen, uint64_t &value);
@@ -108,6 +241,21 @@ public:
     void print();
 
 private:
+    //image layout
+    //-------------------------------------------------
+    static uint64_t layout(FSTSection* sections, const uint64_t* lengths);
+    static uint64_t dataOffset();
+    void initHeader();
+    void bindSections();
+    // header, section directory and metadata, and the checksum if
+    // withChecksum
+    bool validate(uint64_t size, bool withChecksum = true);
+    bool metadataMatches();
+    bool checksumMatches();
+    uint64_t computeChecksum();
+    uint64_t sparseLevelEnd(int levels);
+    bool mapResident(int residentSparseLevels, bool lockResident);
+
     //bit/byte vector accessors
     //-------------------------------------------------
     inline uint64_t* cUbits_();
@@ -182,6 +330,8 @@ private:
 
     //members
     //-------------------------------------------------
+    FSTHeader header_;
+
     int16_t cutoff_level_;
     uint16_t tree_height_;
     int8_t first_value_pos_; // negative means in valuesU_
@@ -224,8 +374,16 @@ private:
     //S-values
     uint64_t valmem_;
 
-    //data
-    char data_[0];
+    //section directory
+    FSTSection sections_[kNumSections];
+
+    //section pointer cache, not persisted
+    char* sec_[kNumSections];
+
+    //mapping state, not persisted
+    uint64_t mapLength_; // 0 if the image is not mmap'ed
+    uint8_t* residency_; // last mincore() sample, one byte per page
+    uint64_t pageFaults_[kNumSections];
 
     friend class FSTIter;
 };
@@ -276,3 +434,4 @@ private:
     friend class FST;
 };
 
+#endif /* _FST_H_ */
@@ -0,0 +1,67 @@
+#ifndef _FST_REPLICAS_H_
+#define _FST_REPLICAS_H_
+
+#include <vector>
+
+#include "FST.hpp"
+
+using namespace std;
+
+//******************************************************
+// NUMA placement of serialized FST images
+//******************************************************
+// Dependent rank/select hops pay the full remote-memory latency when
+// the image sits on another socket. FSTReplicas places copies of one
+// image according to an FSTPlacement and routes every lookup to the
+// copy closest to the calling thread.
+//
+// Topology is read from /sys/devices/system/node and memory policy is
+// set with the mbind system call, so there is no libnuma dependency.
+// On machines without NUMA support everything falls back to a single
+// node and plain first-touch copies.
+//******************************************************
+enum FSTPlacement {
+    kPlaceSingleNode = 0, // one copy bound to one node
+    kPlaceInterleaved,    // one copy, pages interleaved across all nodes
+    kPlaceReplicated      // one copy per node
+};
+
+class FSTReplicas {
+public:
+    FSTReplicas();
+    ~FSTReplicas();
+
+    // Copies src according to placement; node is only used by
+    // kPlaceSingleNode. src may be destroyed afterwards.
+    // Returns false if a copy can not be allocated.
+    bool build(FST* src, FSTPlacement placement, int node = 0);
+    void clear();
+
+    // Returns the copy closest to the calling thread. Use it to create
+    // FSTIter's for range queries.
+    FST* local();
+    FST* replica(int node);
+
+    bool lookup(const uint8_t* key, const int keylen, uint64_t &value);
+    bool lookup(const uint64_t key, uint64_t &value);
+
+    //topology
+    int numNodes();
+    int nodeOfCpu(int cpu);
+    const vector<int>& cpusOfNode(int node);
+    bool pinToNode(int node);
+    bool pinToCpu(int cpu);
+
+private:
+    void readTopology();
+    void* allocOnNode(uint64_t size, int node, bool interleave);
+
+    vector<vector<int> > nodeCpus_;
+    vector<int> cpuNode_;
+
+    vector<FST*> replicas_; // indexed by node; entries may share a copy
+    vector<void*> images_;
+    uint64_t imageSize_;
+};
+
+#endif /* _FST_REPLICAS_H_ */
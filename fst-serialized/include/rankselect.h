@@ -0,0 +1,56 @@
+#ifndef _RANKSELECT_H_
+#define _RANKSELECT_H_
+
+#include <stdint.h>
+
+#include "popcount.h"
+
+//******************************************************
+// Rank and select over the serialized bit vectors.
+// The lookup tables are stored as sections of the image (see
+// FSTSectionEncoding); these are the only routines that read them.
+// Bit 0 of a word is its most significant bit.
+//******************************************************
+
+// kEncRankLUT64: one cumulative count per 64-bit word.
+// Returns the number of set bits in [0, pos).
+inline uint32_t rankLUT64(const uint32_t* lut, const uint64_t* bits, uint32_t pos) {
+    uint32_t blockId = pos >> 6;
+    uint32_t offset = pos & (uint32_t)63;
+    if (offset)
+	return lut[blockId] + popcount(bits[blockId] >> (64 - offset));
+    else
+	return lut[blockId];
+}
+
+// kEncRankLUT512: one cumulative count per 512-bit block.
+// Returns the number of set bits in [0, pos).
+inline uint32_t rankLUT512(const uint32_t* lut, const uint64_t* bits, uint32_t pos) {
+    uint32_t blockId = pos >> 9;
+    return lut[blockId] + popcountLinear(const_cast<uint64_t*>(bits), (blockId << 3), (pos & 511));
+}
+
+// kEncSelectLUT64: position + 1 of every 64th set bit.
+// Returns the position of the rank-th set bit (rank >= 1).
+inline uint32_t selectLUT64(const uint32_t* lut, const uint64_t* bits, uint32_t rank) {
+    uint32_t s = lut[rank >> 6];
+    uint32_t rankR = rank & 63;
+
+    if (rankR == 0)
+	return s - 1;
+
+    int idx = s >> 6;
+    int startWordBit = s & 63;
+    uint64_t word = bits[idx] << startWordBit >> startWordBit;
+
+    int pop = 0;
+    while ((pop = popcount(word)) < (int)rankR) {
+	idx++;
+	word = bits[idx];
+	rankR -= pop;
+    }
+
+    return (idx << 6) + select64_popcount_search(word, rankR);
+}
+
+#endif /* _RANKSELECT_H_ */
@@ -279,15 +279,38 @@ FST* load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen) {
     uint32_t sselectLUTCount = spCount / skip + 1;
 
     //-------------------------------------------------
-    uint32_t totalMem = cUmem + (cUnbits / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem + (tUnbits / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem + (oUnbits / kBasicBlockSizeU) * sizeof(uint32_t) + cmem + tmem + (tnbits / kBasicBlockSize) * sizeof(uint32_t) + smem + (sselectLUTCount + 1) * sizeof(uint32_t) + valUmem + valmem;
-
-    void* ptr = malloc(sizeof(FST) + totalMem);
-    memset(ptr, 0, sizeof(FST) + totalMem);
+    uint64_t lengths[kNumSections];
+    lengths[kSecCUbits] = cUmem;
+    lengths[kSecCUrankLUT] = (cUnbits / kBasicBlockSizeU) * sizeof(uint32_t);
+    lengths[kSecTUbits] = tUmem;
+    lengths[kSecTUrankLUT] = (tUnbits / kBasicBlockSizeU) * sizeof(uint32_t);
+    lengths[kSecOUbits] = oUmem;
+    lengths[kSecOUrankLUT] = (oUnbits / kBasicBlockSizeU) * sizeof(uint32_t);
+    lengths[kSecCbytes] = cmem;
+    lengths[kSecTbits] = tmem;
+    lengths[kSecTrankLUT] = (tnbits / kBasicBlockSize) * sizeof(uint32_t);
+    lengths[kSecSbits] = smem;
+    lengths[kSecSselectLUT] = (sselectLUTCount + 1) * sizeof(uint32_t);
+    lengths[kSecValuesU] = valUmem;
+    lengths[kSecValues] = valmem;
+
+    FSTSection sections[kNumSections];
+    uint64_t imageSize = FST::layout(sections, lengths);
+
+    void* ptr = NULL;
+    if (posix_memalign(&ptr, kSectionAlign, imageSize) != 0) {
+	delete[] sbits_tmp;
+	return NULL;
+    }
+    memset(ptr, 0, imageSize);
     FST* fst = new(ptr) FST(cutoff_level, tree_height, first_value_pos, last_value_pos, 
 			    nodeCountU, childCountU, 
 			    cUnbits, cUmem, tUnbits, tUmem, oUnbits, oUmem,
 			    valUmem, cmem, tnbits, tmem, 
 			    smem, sselectLUTCount, valmem);
+    memcpy(fst->sections_, sections, sizeof(sections));
+    fst->header_.imageSize = imageSize;
+    fst->bindSections();
 
     //-------------------------------------------------
     uint64_t* cUbits = fst->cUbits_();
@@ -398,6 +421,7 @@ FST* load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen) {
 	}
     }
 
+    delete[] sbits_tmp;
     return fst;
 }
 
@@ -423,7 +447,14 @@ FST::FST()
       cmem_(0),
       tnbits_(0), tpCount_(0), tmem_(0),
       snbits_(0), spCount_(0), smem_(0), sselectLUTCount_(0),
-      valmem_(0) {}
+      valmem_(0) {
+    initHeader();
+    memset(sections_, 0, sizeof(sections_));
+    memset(sec_, 0, sizeof(sec_));
+    mapLength_ = 0;
+    residency_ = NULL;
+    memset(pageFaults_, 0, sizeof(pageFaults_));
+}
 
 FST::FST(int16_t cl, uint16_t th, int8_t fvp, int32_t lvp, uint32_t ncu, uint32_t ccu,
 	 uint32_t cUnb, uint32_t cUmem, uint32_t tUnb, uint32_t tUmem,
@@ -438,28 +469,451 @@ FST::FST(int16_t cl, uint16_t th, int8_t fvp, int32_t lvp, uint32_t ncu, uint32_
     cmem_(cmem),
     tnbits_(tnb), tpCount_(0), tmem_(tmem),
     snbits_(0), spCount_(0), smem_(smem), sselectLUTCount_(sbbc),
-    valmem_(vm) {}
+    valmem_(vm) {
+    initHeader();
+    memset(sections_, 0, sizeof(sections_));
+    memset(sec_, 0, sizeof(sec_));
+    mapLength_ = 0;
+    residency_ = NULL;
+    memset(pageFaults_, 0, sizeof(pageFaults_));
+}
 
 FST::~FST() {}
 
 //stat
 uint32_t FST::cMemU() { return cUmem_; }
-uint32_t FST::cRankMemU() { return (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t); }
+uint32_t FST::cRankMemU() { return sections_[kSecCUrankLUT].length; }
 uint32_t FST::tMemU() { return tUmem_; }
-uint32_t FST::tRankMemU() { return (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t); }
+uint32_t FST::tRankMemU() { return sections_[kSecTUrankLUT].length; }
 uint32_t FST::oMemU() { return oUmem_;}
-uint32_t FST::oRankMemU() { return (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t); }
+uint32_t FST::oRankMemU() { return sections_[kSecOUrankLUT].length; }
 uint32_t FST::valueMemU() { return valUmem_; }
 
 uint64_t FST::cMem() { return cmem_; }
 uint32_t FST::tMem() { return tmem_; }
-uint32_t FST::tRankMem() { return (tnbits_ / kBasicBlockSize) * sizeof(uint32_t); }
+uint32_t FST::tRankMem() { return sections_[kSecTrankLUT].length; }
 uint32_t FST::sMem() { return smem_;}
-uint32_t FST::sSelectMem() { return (sselectLUTCount_ + 1) * sizeof(uint32_t); }
+uint32_t FST::sSelectMem() { return sections_[kSecSselectLUT].length; }
 uint64_t FST::valueMem() { return valmem_; }
 
 uint64_t FST::mem() {
-    return sizeof(FST) + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + cmem_ + tmem_ + (tnbits_ / kBasicBlockSize) * sizeof(uint32_t) + smem_ + (sselectLUTCount_ + 1) * sizeof(uint32_t) + valUmem_ + valmem_;
+    return header_.imageSize;
+}
+
+//******************************************************
+// image layout
+//******************************************************
+inline uint64_t alignSection(uint64_t len) {
+    return (len + kSectionAlign - 1) / kSectionAlign * kSectionAlign;
+}
+
+uint64_t FST::dataOffset() {
+    return alignSection(sizeof(FST));
+}
+
+// Assigns every section an aligned offset; returns the total image size.
+uint64_t FST::layout(FSTSection* sections, const uint64_t* lengths) {
+    static const uint32_t encodings[kNumSections] = {
+	kEncBitvector, kEncRankLUT64,
+	kEncBitvector, kEncRankLUT64,
+	kEncBitvector, kEncRankLUT64,
+	kEncBytes,
+	kEncBitvector, kEncRankLUT512,
+	kEncBitvector, kEncSelectLUT64,
+	kEncUint64,
+	kEncUint64
+    };
+
+    uint64_t offset = dataOffset();
+    for (int i = 0; i < kNumSections; i++) {
+	sections[i].offset = offset;
+	sections[i].length = lengths[i];
+	sections[i].encoding = encodings[i];
+	sections[i].align = kSectionAlign;
+	offset += alignSection(lengths[i]);
+    }
+    return offset;
+}
+
+void FST::initHeader() {
+    memset(&header_, 0, sizeof(header_));
+    header_.magic = kFSTMagic;
+    header_.version = kFSTFormatVersion;
+    header_.byteOrder = kFSTByteOrderMark;
+    header_.headerSize = sizeof(FST);
+    header_.sectionCount = kNumSections;
+}
+
+void FST::bindSections() {
+    for (int i = 0; i < kNumSections; i++)
+	sec_[i] = (char*)this + sections_[i].offset;
+}
+
+inline uint64_t checksum64(const char* data, uint64_t len, uint64_t h) {
+    const uint64_t kMul = 0x9E3779B97F4A7C15ULL;
+    uint64_t nwords = len / 8;
+    for (uint64_t i = 0; i < nwords; i++) {
+	uint64_t w;
+	memcpy(&w, data + i * 8, 8);
+	h = (h ^ w) * kMul;
+	h ^= h >> 32;
+    }
+    for (uint64_t i = nwords * 8; i < len; i++) {
+	h = (h ^ (uint8_t)data[i]) * kMul;
+	h ^= h >> 32;
+    }
+    return h;
+}
+
+// Covers the metadata, the section directory and all sections; skips
+// the header (which holds the checksum) and the pointer cache.
+uint64_t FST::computeChecksum() {
+    const char* base = (const char*)this;
+    uint64_t metaLen = (const char*)sec_ - base - sizeof(FSTHeader);
+    uint64_t h = checksum64(base + sizeof(FSTHeader), metaLen, header_.imageSize);
+    return checksum64(base + dataOffset(), header_.imageSize - dataOffset(), h);
+}
+
+bool FST::checksumMatches() {
+    return !(header_.flags & kFSTFlagChecksum) || header_.checksum == computeChecksum();
+}
+
+// The section lengths that load() gives the level and node counts in
+// the metadata, and the bit counts that rank and select assume. Without
+// a checksum this is what keeps lookups inside the sections.
+bool FST::metadataMatches() {
+    if (cutoff_level_ < 0 || cutoff_level_ > tree_height_)
+	return false;
+    if ((cutoff_level_ == 0) != (nodeCountU_ == 0))
+	return false;
+
+    uint64_t cUmem = ((uint64_t)nodeCountU_ * 4 / 32 + 1) * 32 * 8;
+    uint64_t oUmem = ((uint64_t)nodeCountU_ / 64 / 32 + 1) * 32 * 8;
+    uint64_t smem = (((uint64_t)cmem_ + 63) / 64 / 32 + 1) * 32 * 8;
+    if (cUmem_ != cUmem || tUmem_ != cUmem || oUmem_ != oUmem)
+	return false;
+    if (tmem_ != smem || smem_ != smem)
+	return false;
+    if (cUnbits_ != cUmem * 8 || tUnbits_ != cUmem * 8 || oUnbits_ != oUmem * 8)
+	return false;
+    if (tnbits_ != smem * 8 || snbits_ != smem * 8)
+	return false;
+
+    if (cUpCount_ > cUnbits_ || tUpCount_ != childCountU_ || tUpCount_ > cUpCount_
+	|| oUpCount_ > nodeCountU_ || tpCount_ > cmem_ || spCount_ > cmem_)
+	return false;
+    if (sselectLUTCount_ != spCount_ / skip + 1)
+	return false;
+    if (valUmem_ != ((uint64_t)cUpCount_ - tUpCount_ + oUpCount_) * 8
+	|| valmem_ != ((uint64_t)cmem_ - tpCount_) * 8)
+	return false;
+
+    uint64_t lengths[kNumSections];
+    lengths[kSecCUbits] = cUmem;
+    lengths[kSecCUrankLUT] = (cUmem * 8 / kBasicBlockSizeU) * sizeof(uint32_t);
+    lengths[kSecTUbits] = cUmem;
+    lengths[kSecTUrankLUT] = (cUmem * 8 / kBasicBlockSizeU) * sizeof(uint32_t);
+    lengths[kSecOUbits] = oUmem;
+    lengths[kSecOUrankLUT] = (oUmem * 8 / kBasicBlockSizeU) * sizeof(uint32_t);
+    lengths[kSecCbytes] = cmem_;
+    lengths[kSecTbits] = smem;
+    lengths[kSecTrankLUT] = (smem * 8 / kBasicBlockSize) * sizeof(uint32_t);
+    lengths[kSecSbits] = smem;
+    lengths[kSecSselectLUT] = ((uint64_t)sselectLUTCount_ + 1) * sizeof(uint32_t);
+    lengths[kSecValuesU] = valUmem_;
+    lengths[kSecValues] = valmem_;
+    for (int i = 0; i < kNumSections; i++)
+	if (sections_[i].length != lengths[i])
+	    return false;
+    return true;
+}
+
+bool FST::validate(uint64_t size, bool withChecksum) {
+    if (header_.magic != kFSTMagic || header_.byteOrder != kFSTByteOrderMark)
+	return false;
+    if (header_.version != kFSTFormatVersion)
+	return false;
+    if (header_.headerSize != sizeof(FST) || header_.sectionCount != kNumSections)
+	return false;
+    if (header_.imageSize != size || size < dataOffset())
+	return false;
+
+    for (int i = 0; i < kNumSections; i++) {
+	const FSTSection &sec = sections_[i];
+	if (sec.offset % kSectionAlign != 0 || sec.offset < dataOffset())
+	    return false;
+	if (sec.offset > size || sec.length > size - sec.offset)
+	    return false;
+    }
+    if (!metadataMatches())
+	return false;
+
+    if (withChecksum && !checksumMatches())
+	return false;
+    return true;
+}
+
+//******************************************************
+// serialization
+//******************************************************
+uint64_t FST::imageSize() { return header_.imageSize; }
+
+const FSTHeader* FST::header() { return &header_; }
+
+FST* FST::copyTo(void* dst) {
+    if (dst == NULL || ((uintptr_t)dst % kSectionAlign) != 0)
+	return NULL;
+    memcpy(dst, this, header_.imageSize);
+
+    FST* fst = (FST*)dst;
+    fst->mapLength_ = 0;
+    fst->residency_ = NULL;
+    memset(fst->pageFaults_, 0, sizeof(fst->pageFaults_));
+    fst->bindSections();
+    return fst;
+}
+
+const FSTSection* FST::section(int id) {
+    if (id < 0 || id >= kNumSections)
+	return NULL;
+    return &sections_[id];
+}
+
+bool FST::save(const char* fileName, bool withChecksum) {
+    FILE* f = fopen(fileName, "wb");
+    if (f == NULL)
+	return false;
+
+    // write a copy of the header block with the runtime state cleared
+    uint64_t headLen = dataOffset();
+    uint64_t runtimeOffset = (char*)sec_ - (char*)this;
+    char* head = new char[headLen];
+    memcpy(head, this, headLen);
+    memset(head + runtimeOffset, 0, headLen - runtimeOffset);
+
+    FSTHeader* h = (FSTHeader*)head;
+    if (withChecksum) {
+	h->flags |= kFSTFlagChecksum;
+	h->checksum = computeChecksum();
+    }
+    else {
+	h->flags &= ~kFSTFlagChecksum;
+	h->checksum = 0;
+    }
+
+    uint64_t bodyLen = header_.imageSize - headLen;
+    bool ok = (fwrite(head, 1, headLen, f) == headLen);
+    ok = ok && (fwrite((char*)this + headLen, 1, bodyLen, f) == bodyLen);
+    ok = (fclose(f) == 0) && ok;
+
+    delete[] head;
+    return ok;
+}
+
+FST* open(void* image, uint64_t size) {
+    if (image == NULL || size < sizeof(FSTHeader) || ((uintptr_t)image % kSectionAlign) != 0)
+	return NULL;
+
+    FST* fst = (FST*)image;
+    if (!fst->validate(size))
+	return NULL;
+
+    fst->bindSections();
+    return fst;
+}
+
+FST* open(const char* fileName) {
+    FILE* f = fopen(fileName, "rb");
+    if (f == NULL)
+	return NULL;
+
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || st.st_size <= 0) {
+	fclose(f);
+	return NULL;
+    }
+    uint64_t size = st.st_size;
+
+    void* image = NULL;
+    if (posix_memalign(&image, kSectionAlign, size) != 0) {
+	fclose(f);
+	return NULL;
+    }
+
+    bool ok = (fread(image, 1, size, f) == size);
+    fclose(f);
+
+    FST* fst = ok ? open(image, size) : NULL;
+    if (fst == NULL)
+	free(image);
+    return fst;
+}
+
+FST* mmapOpen(const char* fileName, int residentSparseLevels, bool lockResident, bool verifyChecksum) {
+    int fd = ::open(fileName, O_RDONLY);
+    if (fd < 0)
+	return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FSTHeader)) {
+	::close(fd);
+	return NULL;
+    }
+    uint64_t size = st.st_size;
+
+    // private mapping: the pointer cache and paging stats are written
+    // into the first page, copy-on-write
+    void* image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (image == MAP_FAILED)
+	return NULL;
+
+    // A plain fault would also read the pages around it, sparse ones
+    // included: the whole mapping is MADV_RANDOM, and the header (like
+    // the resident ranges in mapResident) is read exactly with
+    // MADV_WILLNEED before it is touched. The checksum reads every
+    // page, so it is checked (if at all) last.
+    madvise(image, size, MADV_RANDOM);
+    madvise(image, (size < FST::dataOffset()) ? size : FST::dataOffset(), MADV_WILLNEED);
+
+    FST* fst = (FST*)image;
+    if (!fst->validate(size, false)) {
+	munmap(image, size);
+	return NULL;
+    }
+    fst->bindSections();
+    fst->mapLength_ = size;
+
+    if (!fst->mapResident(residentSparseLevels, lockResident)
+	|| (verifyChecksum && !fst->checksumMatches())) {
+	munmap(image, size);
+	return NULL;
+    }
+    fst->samplePages();
+    memset(fst->pageFaults_, 0, sizeof(fst->pageFaults_));
+    return fst;
+}
+
+void destroy(FST* fst) {
+    if (fst == NULL)
+	return;
+    free(fst->residency_);
+    if (fst->mapLength_ > 0)
+	munmap(fst, fst->mapLength_);
+    else
+	free(fst);
+}
+
+//******************************************************
+// demand paging
+//******************************************************
+inline uint64_t pageSize() {
+    return (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+// Prefaults [ptr, ptr + len) and optionally pins it in memory.
+inline bool makeResident(char* ptr, uint64_t len, bool lock) {
+    if (len == 0)
+	return true;
+    uint64_t ps = pageSize();
+    char* begin = (char*)((uintptr_t)ptr / ps * ps);
+    uint64_t span = (ptr + len) - begin;
+
+    madvise(begin, span, MADV_WILLNEED);
+    volatile char sink = 0;
+    for (uint64_t i = 0; i < span; i += ps)
+	sink ^= begin[i];
+    (void)sink;
+
+    if (lock && mlock(begin, span) != 0)
+	return false;
+    return true;
+}
+
+// Returns the end position of the top levels of LOUDS-Sparse,
+// walking level boundaries with rank and select.
+uint64_t FST::sparseLevelEnd(int levels) {
+    if (levels <= 0 || spCount_ == 0)
+	return 0;
+
+    uint64_t end = 0;
+    uint64_t nodeEnd = childCountU_ + 1; // first node of the next level
+    for (int l = 0; l < levels; l++) {
+	if (nodeEnd - nodeCountU_ + 1 > spCount_)
+	    return cmem_;
+	end = childpos(nodeEnd);
+	nodeEnd = trank(end) + childCountU_ + 1;
+    }
+    return end;
+}
+
+bool FST::mapResident(int residentSparseLevels, bool lockResident) {
+    uint64_t sparseEnd = sparseLevelEnd(residentSparseLevels);
+
+    uint64_t residentLen[kNumSections];
+    for (int i = 0; i < kNumSections; i++)
+	residentLen[i] = sections_[i].length;
+    residentLen[kSecCbytes] = sparseEnd;
+    residentLen[kSecTbits] = (sparseEnd + kWordSize - 1) / kWordSize * sizeof(uint64_t);
+    residentLen[kSecSbits] = residentLen[kSecTbits];
+    residentLen[kSecValues] = (sparseEnd == 0) ? 0 : (sparseEnd - trank(sparseEnd)) * sizeof(uint64_t);
+
+    char* base = (char*)this;
+
+    if (!makeResident(base, dataOffset(), lockResident))
+	return false;
+    for (int i = 0; i < kNumSections; i++) {
+	if (!makeResident(sec_[i], residentLen[i], lockResident))
+	    return false;
+    }
+    return true;
+}
+
+void FST::samplePages() {
+    if (mapLength_ == 0)
+	return;
+
+    uint64_t ps = pageSize();
+    uint64_t npages = (mapLength_ + ps - 1) / ps;
+    uint8_t* vec = (uint8_t*)malloc(npages);
+    if (vec == NULL)
+	return;
+    if (mincore(this, mapLength_, vec) != 0) {
+	free(vec);
+	return;
+    }
+
+    if (residency_ != NULL) {
+	for (int i = 0; i < kNumSections; i++) {
+	    uint64_t first = sections_[i].offset / ps;
+	    uint64_t last = (sections_[i].offset + sections_[i].length + ps - 1) / ps;
+	    for (uint64_t p = first; p < last; p++) {
+		if ((vec[p] & 1) && !(residency_[p] & 1))
+		    pageFaults_[i]++;
+	    }
+	}
+	free(residency_);
+    }
+    residency_ = vec;
+}
+
+uint64_t FST::residentPages(int id) {
+    if (residency_ == NULL || id < 0 || id >= kNumSections)
+	return 0;
+
+    uint64_t ps = pageSize();
+    uint64_t first = sections_[id].offset / ps;
+    uint64_t last = (sections_[id].offset + sections_[id].length + ps - 1) / ps;
+    uint64_t count = 0;
+    for (uint64_t p = first; p < last; p++)
+	count += (residency_[p] & 1);
+    return count;
+}
+
+uint64_t FST::pageFaults(int id) {
+    if (id < 0 || id >= kNumSections)
+	return 0;
+    return pageFaults_[id];
 }
 
 //******************************************************
@@ -484,15 +938,7 @@ inline void FST::cUinit(uint64_t* bits, uint32_t nbits) {
 
 inline uint32_t FST::cUrank(uint32_t pos) {
     assert(pos <= cUnbits_);
-    uint32_t blockId = pos >> kBasicBlockBitsU;
-    uint32_t offset = pos & (uint32_t)63;
-
-    uint32_t* cUrankLUT = cUrankLUT_();
-    uint64_t* cUbits = cUbits_();
-    if (offset)
-	return cUrankLUT[blockId] + popcount(cUbits[blockId] >> (64 - offset));
-    else
-	return cUrankLUT[blockId];
+    return rankLUT64(cUrankLUT_(), cUbits_(), pos);
 }
 
 //*******************************************************************
@@ -514,15 +960,7 @@ inline void FST::tUinit(uint64_t* bits, uint32_t nbits) {
 
 inline uint32_t FST::tUrank(uint32_t pos) {
     assert(pos <= tUnbits_);
-    uint32_t blockId = pos >> kBasicBlockBitsU;
-    uint32_t offset = pos & (uint32_t)63;
-
-    uint32_t* tUrankLUT = tUrankLUT_();
-    uint64_t* tUbits = tUbits_();
-    if (offset)
-	return tUrankLUT[blockId] + popcount(tUbits[blockId] >> (64 - offset));
-    else
-	return tUrankLUT[blockId];
+    return rankLUT64(tUrankLUT_(), tUbits_(), pos);
 }
 
 //*******************************************************************
@@ -537,22 +975,14 @@ inline void FST::oUinit(uint64_t* bits, uint32_t nbits) {
 				  i * kWordCountPerBasicBlockU, 
 				  kBasicBlockSizeU);
     }
-    oUrankLUT[(tUnbits_ / kBasicBlockSizeU)-1] = rankCum;
+    oUrankLUT[(oUnbits_ / kBasicBlockSizeU)-1] = rankCum;
 
     oUpCount_ = rankCum;
 }
 
 inline uint32_t FST::oUrank(uint32_t pos) {
     assert(pos <= oUnbits_);
-    uint32_t blockId = pos >> kBasicBlockBitsU;
-    uint32_t offset = pos & (uint32_t)63;
-
-    uint32_t* oUrankLUT = oUrankLUT_();
-    uint64_t* oUbits = oUbits_();
-    if (offset)
-	return oUrankLUT[blockId] + popcount(oUbits[blockId] >> (64 - offset));
-    else
-	return oUrankLUT[blockId];
+    return rankLUT64(oUrankLUT_(), oUbits_(), pos);
 }
 
 //*******************************************************************
@@ -574,10 +1004,7 @@ inline void FST::tinit(uint64_t* bits, uint32_t nbits) {
 
 inline uint32_t FST::trank(uint32_t pos) {
     assert(pos <= tnbits_);
-    uint32_t blockId = pos >> kBasicBlockBits;
-    uint32_t* trankLUT = trankLUT_();
-    uint64_t* tbits = tbits_();
-    return trankLUT[blockId] + popcountLinear(tbits, (blockId << 3), (pos & 511));
+    return rankLUT512(trankLUT_(), tbits_(), pos);
 }
 
 //*******************************************************************
@@ -618,59 +1045,38 @@ inline void FST::sinit(uint64_t* bits, uint32_t nbits) {
  
 inline uint32_t FST::sselect(uint32_t rank) {
     assert(rank <= spCount_);
-
-    uint32_t* sselectLUT = sselectLUT_();
-    uint64_t* sbits = sbits_();
-
-    uint32_t s = sselectLUT[rank >> kSkipBits];
-    uint32_t rankR = rank & kSkipMask;
-
-    if (rankR == 0)
-	return s - 1;
-
-    int idx = s >> kWordBits;
-    int startWordBit = s & kWordMask;
-    uint64_t word = sbits[idx] << startWordBit >> startWordBit;
-
-    int pop = 0;
-    while ((pop = popcount(word)) < rankR) {
-	idx++;
-	word = sbits[idx];
-	rankR -= pop;
-    }
-
-    return (idx << kWordBits) + select64_popcount_search(word, rankR);
+    return selectLUT64(sselectLUT_(), sbits_(), rank);
 }
 
 //******************************************************
 // bit/byte vector accessors
 //******************************************************
 //*******************************************************************
-inline uint64_t* FST::cUbits_() {return (uint64_t*)data_;}
+inline uint64_t* FST::cUbits_() {return (uint64_t*)sec_[kSecCUbits];}
 
-inline uint32_t* FST::cUrankLUT_() {return (uint32_t*)(data_ + cUmem_);}
+inline uint32_t* FST::cUrankLUT_() {return (uint32_t*)sec_[kSecCUrankLUT];}
 
-inline uint64_t* FST::tUbits_() {return (uint64_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t));}
+inline uint64_t* FST::tUbits_() {return (uint64_t*)sec_[kSecTUbits];}
 
-inline uint32_t* FST::tUrankLUT_() {return (uint32_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_);}
+inline uint32_t* FST::tUrankLUT_() {return (uint32_t*)sec_[kSecTUrankLUT];}
 
-inline uint64_t* FST::oUbits_() {return (uint64_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t));}
+inline uint64_t* FST::oUbits_() {return (uint64_t*)sec_[kSecOUbits];}
 
-inline uint32_t* FST::oUrankLUT_() {return (uint32_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_);}
+inline uint32_t* FST::oUrankLUT_() {return (uint32_t*)sec_[kSecOUrankLUT];}
 
-inline uint8_t* FST::cbytes_() {return (uint8_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t));}
+inline uint8_t* FST::cbytes_() {return (uint8_t*)sec_[kSecCbytes];}
 
-inline uint64_t* FST::tbits_() {return (uint64_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + cmem_);}
+inline uint64_t* FST::tbits_() {return (uint64_t*)sec_[kSecTbits];}
 
-inline uint32_t* FST::trankLUT_() {return (uint32_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + cmem_ + tmem_);}
+inline uint32_t* FST::trankLUT_() {return (uint32_t*)sec_[kSecTrankLUT];}
 
-inline uint64_t* FST::sbits_() {return (uint64_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + cmem_ + tmem_ + (tnbits_ / kBasicBlockSize) * sizeof(uint32_t));}
+inline uint64_t* FST::sbits_() {return (uint64_t*)sec_[kSecSbits];}
 
-inline uint32_t* FST::sselectLUT_() {return (uint32_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + cmem_ + tmem_ + (tnbits_ / kBasicBlockSize) * sizeof(uint32_t) + smem_);}
+inline uint32_t* FST::sselectLUT_() {return (uint32_t*)sec_[kSecSselectLUT];}
 
-inline uint64_t* FST::valuesU_() {return (uint64_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + cmem_ + tmem_ + (tnbits_ / kBasicBlockSize) * sizeof(uint32_t) + smem_ + (sselectLUTCount_ + 1) * sizeof(uint32_t));}
+inline uint64_t* FST::valuesU_() {return (uint64_t*)sec_[kSecValuesU];}
 
-inline uint64_t* FST::values_() {return (uint64_t*)(data_ + cUmem_ + (cUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + tUmem_ + (tUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + oUmem_ + (oUnbits_ / kBasicBlockSizeU) * sizeof(uint32_t) + cmem_ + tmem_ + (tnbits_ / kBasicBlockSize) * sizeof(uint32_t) + smem_ + (sselectLUTCount_ + 1) * sizeof(uint32_t) + valUmem_);}
+inline uint64_t* FST::values_() {return (uint64_t*)sec_[kSecValues];}
 
 //******************************************************
 // IS O BIT SET U?
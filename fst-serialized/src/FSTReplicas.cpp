@@ -0,0 +1,227 @@
+#include <FSTReplicas.hpp>
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+const int kMaxNodes = 1024;
+const int kNodeMaskWords = kMaxNodes / (8 * sizeof(unsigned long));
+
+// Parses a sysfs cpu/node list such as "0-3,8,10-11".
+inline void parseList(const string &list, vector<int> &ids) {
+    stringstream ss(list);
+    string range;
+    while (getline(ss, range, ',')) {
+	if (range.empty() || range[0] == '\n')
+	    continue;
+	size_t dash = range.find('-');
+	int first = atoi(range.c_str());
+	int last = (dash == string::npos) ? first : atoi(range.c_str() + dash + 1);
+	for (int i = first; i <= last; i++)
+	    ids.push_back(i);
+    }
+}
+
+inline bool readLine(const string &path, string &line) {
+    ifstream infile(path.c_str());
+    if (!infile.good())
+	return false;
+    getline(infile, line);
+    return true;
+}
+
+//******************************************************
+// topology
+//******************************************************
+FSTReplicas::FSTReplicas() : imageSize_(0) {
+    readTopology();
+}
+
+FSTReplicas::~FSTReplicas() {
+    clear();
+}
+
+void FSTReplicas::readTopology() {
+    nodeCpus_.clear();
+    cpuNode_.clear();
+
+    int ncpus = sysconf(_SC_NPROCESSORS_CONF);
+    if (ncpus < 1)
+	ncpus = 1;
+    cpuNode_.resize(ncpus, 0);
+
+    string line;
+    vector<int> nodes;
+    if (readLine("/sys/devices/system/node/online", line))
+	parseList(line, nodes);
+
+    for (int i = 0; i < (int)nodes.size(); i++) {
+	if (nodes[i] >= kMaxNodes)
+	    continue;
+	vector<int> cpus;
+	stringstream path;
+	path << "/sys/devices/system/node/node" << nodes[i] << "/cpulist";
+	if (readLine(path.str(), line))
+	    parseList(line, cpus);
+
+	if ((int)nodeCpus_.size() <= nodes[i])
+	    nodeCpus_.resize(nodes[i] + 1);
+	for (int j = 0; j < (int)cpus.size(); j++) {
+	    if (cpus[j] >= (int)cpuNode_.size())
+		cpuNode_.resize(cpus[j] + 1, 0);
+	    cpuNode_[cpus[j]] = nodes[i];
+	    nodeCpus_[nodes[i]].push_back(cpus[j]);
+	}
+    }
+
+    // no sysfs node information: treat the machine as a single node
+    if (nodeCpus_.empty()) {
+	nodeCpus_.resize(1);
+	for (int i = 0; i < ncpus; i++)
+	    nodeCpus_[0].push_back(i);
+    }
+}
+
+int FSTReplicas::numNodes() {
+    return nodeCpus_.size();
+}
+
+int FSTReplicas::nodeOfCpu(int cpu) {
+    if (cpu < 0 || cpu >= (int)cpuNode_.size())
+	return 0;
+    return cpuNode_[cpu];
+}
+
+const vector<int>& FSTReplicas::cpusOfNode(int node) {
+    return nodeCpus_[node];
+}
+
+bool FSTReplicas::pinToNode(int node) {
+    if (node < 0 || node >= numNodes() || nodeCpus_[node].empty())
+	return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int i = 0; i < (int)nodeCpus_[node].size(); i++)
+	CPU_SET(nodeCpus_[node][i], &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool FSTReplicas::pinToCpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+//******************************************************
+// placement
+//******************************************************
+// Maps size bytes and sets their memory policy: bound to node, or
+// interleaved across all nodes. mbind failing (no NUMA support) is not
+// an error; pages are then placed by first touch.
+void* FSTReplicas::allocOnNode(uint64_t size, int node, bool interleave) {
+    void* ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+	return NULL;
+
+    unsigned long mask[kNodeMaskWords];
+    memset(mask, 0, sizeof(mask));
+    int bitsPerWord = 8 * sizeof(unsigned long);
+    if (interleave) {
+	for (int i = 0; i < numNodes(); i++) {
+	    if (!nodeCpus_[i].empty())
+		mask[i / bitsPerWord] |= 1UL << (i % bitsPerWord);
+	}
+    }
+    else {
+	mask[node / bitsPerWord] |= 1UL << (node % bitsPerWord);
+    }
+
+    int mode = interleave ? MPOL_INTERLEAVE : MPOL_BIND;
+    syscall(SYS_mbind, ptr, size, mode, mask, kMaxNodes + 1, 0);
+    return ptr;
+}
+
+bool FSTReplicas::build(FST* src, FSTPlacement placement, int node) {
+    clear();
+    if (src == NULL || node < 0 || node >= numNodes())
+	return false;
+    imageSize_ = src->imageSize();
+    replicas_.resize(numNodes(), NULL);
+
+    vector<int> targets;
+    if (placement == kPlaceReplicated) {
+	for (int i = 0; i < numNodes(); i++) {
+	    if (!nodeCpus_[i].empty())
+		targets.push_back(i);
+	}
+    }
+    else {
+	targets.push_back(node);
+    }
+
+    // copy from a thread running on the target node so that first
+    // touch agrees with the policy even where mbind is unavailable
+    for (int i = 0; i < (int)targets.size(); i++) {
+	void* image = allocOnNode(imageSize_, targets[i], placement == kPlaceInterleaved);
+	if (image == NULL) {
+	    clear();
+	    return false;
+	}
+	images_.push_back(image);
+
+	FST* copy = NULL;
+	int target = targets[i];
+	thread copier([&]() {
+		if (placement != kPlaceInterleaved)
+		    pinToNode(target);
+		copy = src->copyTo(image);
+	    });
+	copier.join();
+	replicas_[target] = copy;
+    }
+
+    // nodes without a copy (or without cpus) use the first one
+    for (int i = 0; i < numNodes(); i++) {
+	if (replicas_[i] == NULL)
+	    replicas_[i] = replicas_[targets[0]];
+    }
+    return true;
+}
+
+void FSTReplicas::clear() {
+    for (int i = 0; i < (int)images_.size(); i++)
+	munmap(images_[i], imageSize_);
+    images_.clear();
+    replicas_.clear();
+    imageSize_ = 0;
+}
+
+//******************************************************
+// routing
+//******************************************************
+FST* FSTReplicas::replica(int node) {
+    if (node < 0 || node >= (int)replicas_.size())
+	return NULL;
+    return replicas_[node];
+}
+
+FST* FSTReplicas::local() {
+    if (replicas_.empty())
+	return NULL;
+    return replicas_[nodeOfCpu(sched_getcpu())];
+}
+
+bool FSTReplicas::lookup(const uint8_t* key, const int keylen, uint64_t &value) {
+    return local()->lookup(key, keylen, value);
+}
+
+bool FSTReplicas::lookup(const uint64_t key, uint64_t &value) {
+    return local()->lookup(key, value);
+}
@@ -3,10 +3,13 @@
 //************************************************
 #include "gtest/gtest.h"
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <fstream>
 #include <algorithm>
 
 #include "FST.hpp"
+#include "FSTReplicas.hpp"
 
 #define TEST_SIZE 234369
 #define TEST_SIZE_INT 1000000
@@ -124,6 +127,221 @@ TEST_F(UnitTest, LookupTest) {
 }
 
 
+TEST_F(UnitTest, SerializeTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = load(keys, values, longestKeyLen);
+    const char* imagePath = "fst_serialize_test.img";
+    ASSERT_TRUE(index->save(imagePath));
+
+    FST *loaded = open(imagePath);
+    ASSERT_TRUE(loaded != NULL);
+    ASSERT_EQ(index->imageSize(), loaded->imageSize());
+    ASSERT_EQ(kFSTFormatVersion, loaded->header()->version);
+    for (int i = 0; i < kNumSections; i++)
+	ASSERT_EQ(0, loaded->section(i)->offset % kSectionAlign);
+
+    uint64_t fetchedValue;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	if (i > 0 && keys[i].compare(keys[i-1]) == 0)
+	    continue;
+	ASSERT_TRUE(loaded->lookup((uint8_t*)keys[i].c_str(), keys[i].length(), fetchedValue));
+	ASSERT_EQ(values[i], fetchedValue);
+    }
+
+    //corrupt one byte in the values section
+    FILE* f = fopen(imagePath, "r+b");
+    ASSERT_TRUE(f != NULL);
+    fseek(f, loaded->section(kSecValues)->offset, SEEK_SET);
+    fputc(0xFF ^ *((uint8_t*)loaded + loaded->section(kSecValues)->offset), f);
+    fclose(f);
+    ASSERT_TRUE(open(imagePath) == NULL);
+
+    remove(imagePath);
+    destroy(loaded);
+    destroy(index);
+}
+
+// Without a checksum, a section length that disagrees with the
+// metadata must still be rejected: lookups size their reads from the
+// metadata, not from the section directory.
+TEST_F(UnitTest, SerializeMetadataTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = load(keys, values, longestKeyLen);
+    const char* imagePath = "fst_metadata_test.img";
+    uint64_t size = index->imageSize();
+    const char* image = (const char*)index;
+    uint64_t dirEnd = index->section(0)->offset;
+
+    //the S-Labels directory entry, and cmem_ before the directory
+    FSTSection cbytes = *index->section(kSecCbytes);
+    uint64_t dirPos = 0;
+    for (uint64_t i = sizeof(FSTHeader); i + sizeof(FSTSection) <= dirEnd; i += 8)
+	if (memcmp(image + i, &cbytes, sizeof(FSTSection)) == 0)
+	    dirPos = i;
+    ASSERT_GT(dirPos, 0);
+    uint32_t cmem = index->cMem();
+    uint64_t cmemPos = 0;
+    int found = 0;
+    for (uint64_t i = sizeof(FSTHeader); i < dirPos; i += 4)
+	if (memcmp(image + i, &cmem, sizeof(cmem)) == 0) {
+	    cmemPos = i;
+	    found++;
+	}
+    ASSERT_EQ(1, found);
+
+    for (int t = 0; t < 3; t++) {
+	ASSERT_TRUE(index->save(imagePath, false));
+	FILE* f = fopen(imagePath, "r+b");
+	ASSERT_TRUE(f != NULL);
+	if (t == 1) {
+	    //a shorter section, still inside the image
+	    FSTSection sec = cbytes;
+	    sec.length -= 64;
+	    fseek(f, dirPos, SEEK_SET);
+	    fwrite(&sec, sizeof(sec), 1, f);
+	}
+	else if (t == 2) {
+	    //more S-Labels than the section holds
+	    uint32_t more = cmem + 4096;
+	    fseek(f, cmemPos, SEEK_SET);
+	    fwrite(&more, sizeof(more), 1, f);
+	}
+	fclose(f);
+
+	FST *loaded = open(imagePath);
+	FST *mapped = mmapOpen(imagePath);
+	ASSERT_EQ(t == 0, loaded != NULL);
+	ASSERT_EQ(t == 0, mapped != NULL);
+	if (t == 0) {
+	    ASSERT_EQ(size, loaded->imageSize());
+	    uint64_t fetchedValue;
+	    ASSERT_TRUE(mapped->lookup((uint8_t*)keys[0].c_str(), keys[0].length(), fetchedValue));
+	    ASSERT_EQ(values[0], fetchedValue);
+	    destroy(loaded);
+	    destroy(mapped);
+	}
+    }
+
+    remove(imagePath);
+    destroy(index);
+}
+
+TEST_F(UnitTest, MmapOpenTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = load(keys, values, longestKeyLen);
+    const char* imagePath = "fst_mmap_test.img";
+    ASSERT_TRUE(index->save(imagePath));
+
+    FST *mapped = mmapOpen(imagePath, 2);
+    ASSERT_TRUE(mapped != NULL);
+
+    uint64_t fetchedValue;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	if (i > 0 && keys[i].compare(keys[i-1]) == 0)
+	    continue;
+	ASSERT_TRUE(mapped->lookup((uint8_t*)keys[i].c_str(), keys[i].length(), fetchedValue));
+	ASSERT_EQ(values[i], fetchedValue);
+    }
+
+    //dense sections and directories stay resident
+    mapped->samplePages();
+    uint64_t ps = sysconf(_SC_PAGESIZE);
+    int residentIds[] = {kSecCUbits, kSecTUbits, kSecOUbits, kSecTrankLUT, kSecSselectLUT, kSecValuesU};
+    for (int i = 0; i < 6; i++) {
+	const FSTSection* sec = mapped->section(residentIds[i]);
+	uint64_t pages = (sec->offset + sec->length + ps - 1) / ps - sec->offset / ps;
+	ASSERT_EQ(pages, mapped->residentPages(residentIds[i]));
+    }
+
+    remove(imagePath);
+    destroy(mapped);
+    destroy(index);
+}
+
+// Opening a mapped image must not read the demand-paged sparse sections:
+// with the image out of the page cache, they are not resident after
+// mmapOpen, and lookups then fault their pages in.
+TEST_F(UnitTest, MmapOpenLazyTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = load(keys, values, longestKeyLen);
+    const char* imagePath = "fst_mmap_lazy_test.img";
+    ASSERT_TRUE(index->save(imagePath));
+
+    int fd = ::open(imagePath, O_RDONLY);
+    ASSERT_TRUE(fd >= 0);
+    fsync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+
+    FST *mapped = mmapOpen(imagePath);
+    ASSERT_TRUE(mapped != NULL);
+
+    //at most the pages shared with the resident sections next to them
+    int sparseIds[] = {kSecCbytes, kSecTbits, kSecSbits, kSecValues};
+    for (int i = 0; i < 4; i++)
+	ASSERT_LE(mapped->residentPages(sparseIds[i]), 2);
+    uint64_t valuesOffset = mapped->section(kSecValues)->offset;
+
+    uint64_t fetchedValue;
+    for (int i = 0; i < TEST_SIZE; i += 1000) {
+	ASSERT_TRUE(mapped->lookup((uint8_t*)keys[i].c_str(), keys[i].length(), fetchedValue));
+    }
+    mapped->samplePages();
+    ASSERT_GT(mapped->pageFaults(kSecValues), 0);
+    destroy(mapped);
+
+    //the checksum is only read on request
+    FILE* f = fopen(imagePath, "r+b");
+    ASSERT_TRUE(f != NULL);
+    fseek(f, valuesOffset, SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, valuesOffset, SEEK_SET);
+    fputc(0xFF ^ c, f);
+    fclose(f);
+    mapped = mmapOpen(imagePath);
+    ASSERT_TRUE(mapped != NULL);
+    destroy(mapped);
+    ASSERT_TRUE(mmapOpen(imagePath, 0, false, true) == NULL);
+
+    remove(imagePath);
+    destroy(index);
+}
+
+TEST_F(UnitTest, ReplicaTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = load(keys, values, longestKeyLen);
+    FSTReplicas replicas;
+    ASSERT_TRUE(replicas.build(index, kPlaceReplicated));
+    destroy(index);
+
+    for (int n = 0; n < replicas.numNodes(); n++)
+	ASSERT_TRUE(replicas.replica(n) != NULL);
+    ASSERT_TRUE(replicas.local() != NULL);
+
+    uint64_t fetchedValue;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	if (i > 0 && keys[i].compare(keys[i-1]) == 0)
+	    continue;
+	ASSERT_TRUE(replicas.lookup((uint8_t*)keys[i].c_str(), keys[i].length(), fetchedValue));
+	ASSERT_EQ(values[i], fetchedValue);
+    }
+}
+
 TEST_F(UnitTest, LookupMonoIntTest) {
     vector<uint64_t> keys;
     int longestKeyLen = loadMonoInt(keys);
@@ -215,7 +433,7 @@ TEST_F(UnitTest, UpperBoundTest) {
     string keyString;
     FSTIter iter(index);
     for (int i = 0; i < TEST_SIZE_INT - 1; i++) {
- 	ASSERT_TRUE(index->upperBound(keys[i] + 1, iter));
+	ASSERT_TRUE(index->upperBound(keys[i] + 1, iter));
 	curkey = iter.key();
 	reinterpret_cast<uint64_t*>(key_str)[0]=__builtin_bswap64(keys[i]);
 	keyString = string(key_str, 8);
@@ -1,91 +1,461 @@
+#ifndef _FST_HPP_
+#define _FST_HPP_
+
 #include <stdint.h>
 #include <emmintrin.h>
 
 #include <vector>
 #include <algorithm>
+#include <functional>
 #include <iostream>
+#include <string>
 
 #include <common.h>
+#include <fst-config.h>
 
 #include <bitmap-rank.h>
 #include <bitmap-rankF.h>
 #include <bitmap-select.h>
+#include <elias-fano.h>
+#include <key-encoder.h>
+#include <label-search.h>
+#include <posting-list.h>
+#include <radix-sort.h>
 
 using namespace std;
 
 class FSTIter;
 class FST;
 
-class FST {
-public:
-    static const uint8_t TERM = 36; //$
-    static const int CUTOFF_RATIO = 64;
-
-    FST();
-    virtual ~FST();
+//******************************************************
+// Build statistics
+//******************************************************
+struct FSTLevelStats {
+    int level;
+    bool dense;
+    uint64_t firstNode;    // node number of the first node in the level
+    uint64_t firstPos;     // sparse: position of the first label in level order; dense: firstNode << 8
+    uint64_t nodeCount;
+    uint64_t labelCount;   // including TERM labels
+    double avgFanout;
+
+    uint64_t labelBits;    // D-Labels bitmaps and list labels, or S-Labels bytes
+    uint64_t hasChildBits; // D-HasChild and list has-child bits, or S-HasChild
+    uint64_t prefixBits;   // D-IsPrefixKey, dense only
+    uint64_t loudsBits;    // S-LOUDS, sparse only
+    uint64_t lutBytes;     // share of the rank/select lookup tables
+    uint64_t valueBytes;
+};
 
-    void load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen);
-    void load(vector<uint64_t> &keys, vector<uint64_t> &values);
+struct FSTBuildTimes {
+    double levels;  // splitting keys into per-level labels
+    double cutoff;  // choosing the dense/sparse cutoff
+    double dense;   // encoding LOUDS-Dense
+    double sparse;  // encoding LOUDS-Sparse
+    double sort;    // loadUnsorted: sorting the input, 0 for load
+    double total;
+};
 
-    bool lookup(const uint8_t* key, const int keylen, uint64_t &value);
-    bool lookup(const uint64_t key, uint64_t &value);
+struct FSTStats {
+    uint64_t numKeys;
+    int cutoffLevel;
+    uint32_t treeHeight;
+    int sparseLayout;
+    uint64_t sparseBlocks;  // SPARSE_BLOCKED only
+    vector<FSTLevelStats> levels;
+    FSTBuildTimes times; // seconds
+
+    uint64_t denseBytes;  // bitmaps, label lists and values of the dense levels
+    uint64_t sparseBytes; // bit/byte vectors and values of the sparse levels
+    uint64_t lutBytes;    // all rank/select lookup tables
+    uint64_t blockDirBytes; // SPARSE_BLOCKED directory
+    uint64_t keyDictBytes;  // key compression dictionary, 0 without
+    uint64_t postingBytes;  // multi-value posting lists and their directory, 0 without
+    uint64_t payloadBytes;  // payload blob and offsets, 0 without
+    uint64_t rankBytes;     // subtree key counts for rank access, 0 without
+    uint64_t nodeTypeBytes; // S-NodeType, D-NodeType with the list offsets, and their rank tables
+    uint64_t bitmapNodes;   // sparse nodes stored as a label bitmap
+    uint64_t listNodes;     // dense nodes stored as a label list
+};
 
-    bool lowerBound(const uint8_t* key, const int keylen, FSTIter &iter);
-    bool lowerBound(const uint64_t key, FSTIter &iter);
+// Heap bytes owned by a loaded trie, by component (FST::memory). Bit
+// vectors count the words allocated for them, lookup tables and
+// directories their entries, containers their capacity.
+struct FSTMemory {
+    uint64_t denseLabels;    // D-Labels and the labels of list nodes
+    uint64_t denseHasChild;  // D-HasChild and the has-child bits of list nodes
+    uint64_t densePrefix;    // D-IsPrefixKey
+    uint64_t denseValues;
+    uint64_t denseLUT;       // rank tables of the dense bitmaps and D-NodeType
+    uint64_t sparseLabels;   // S-Labels
+    uint64_t sparseHasChild; // S-HasChild
+    uint64_t sparseLouds;    // S-LOUDS
+    uint64_t sparseValues;
+    uint64_t sparseLUT;      // S-HasChild rank and S-LOUDS select tables
+    uint64_t blockDir;       // SPARSE_BLOCKED directory
+    uint64_t nodeTypes;      // S-NodeType and D-NodeType, and the list offsets
+    uint64_t keyDict;
+    uint64_t postings;
+    uint64_t payloads;
+    uint64_t rankCounts;
+    uint64_t objects;        // the bitmap objects
+    uint64_t total;
+};
 
-    uint32_t cMemU();
-    uint32_t tMemU();
-    uint32_t oMemU();
-    uint32_t keyMemU();
-    uint32_t valueMemU();
+//******************************************************
+// Directory entry of a LOUDS-Sparse block (SPARSE_BLOCKED)
+//******************************************************
+struct SparseBlock {
+    uint32_t nodeBase;      // S-LOUDS ones before the block
+    uint32_t tBase;         // S-HasChild ones before the block
+    uint32_t innerChildren; // S-HasChild ones above the bottom level of the block
+    uint32_t numRoots;
+    uint32_t rootBase;      // first root, counted among the roots of the band
+    uint32_t childBase;     // first child below the bottom level, counted among the roots of the next band
+};
 
-    uint64_t cMem();
-    uint32_t tMem();
-    uint32_t sMem();
-    uint64_t keyMem();
-    uint64_t valueMem();
+// A run of labels [start, end) of one sparse level and its values
+// [valStart, valEnd), copied as a unit into the sparse arrays.
+struct SparseSegment {
+    int level;
+    uint64_t start;
+    uint64_t end;
+    uint64_t valStart;
+    uint64_t valEnd;
+};
 
-    uint64_t mem();
+// A range for scanBatch: up to count keys, starting at the first key
+// >= key.
+struct FSTRange {
+    const uint8_t* key;
+    int keylen;
+    uint32_t count;
+};
 
-    uint32_t numT();
+// A key's payload, a view into the trie's payload blob.
+struct FSTPayload {
+    const uint8_t* data;
+    uint64_t len;
+};
 
-    void printU();
-    void print();
+// A run of keys handed out by exportAll, in key order. Key i is
+// keys[i == 0 ? 0 : keyEnd[i - 1] .. keyEnd[i]) with value values[i].
+// The buffers belong to exportAll and are reused after the sink returns.
+struct FSTExportBatch {
+    int part;           // rank range the batch belongs to
+    uint64_t firstRank; // rank of key 0
+    uint32_t count;
+    const uint8_t* keys;
+    const uint32_t* keyEnd;
+    const uint64_t* values;
+};
 
-private:
-    inline bool insertChar_cond(const uint8_t ch, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
-    inline bool insertChar(const uint8_t ch, bool isTerm, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
+// State of a lowerBound descent between two levels.
+struct FSTDescent {
+    int keypos;
+    uint64_t nodeNum; // dense levels
+    uint64_t pos;     // sparse levels
+    uint64_t block;
+    bool result;
+};
 
-    inline bool isCbitSetU(uint64_t nodeNum, uint8_t kc);
-    inline bool isTbitSetU(uint64_t nodeNum, uint8_t kc);
-    inline bool isObitSetU(uint64_t nodeNum);
-    inline bool isSbitSet(uint64_t pos);
-    inline bool isTbitSet(uint64_t pos);
-    inline uint64_t valuePosU(uint64_t nodeNum, uint64_t pos);
-    inline uint64_t valuePos(uint64_t pos);
+// DFS state of forEach. Nodes of a level are entered, and its leaves
+// reached, in storage order, so after the first visit of a level its
+// next node and next value are known without rank/select.
+struct FSTWalk {
+    vector<uint64_t> pos;      // per level: dense (nodeNum << 8) + label, sparse label position
+    vector<uint8_t> isO;       // per level: dense, at the node's prefix key
+    vector<int64_t> nextNode;  // per level: node to enter next, -1 if not known yet
+    vector<int64_t> nextValue; // per level: value of the next leaf, -1 if not known yet
+    vector<uint8_t> tight;     // per level: the labels above equal the prefix of hi
+    const uint8_t* hi;
+    int hilen;
+    string hiKey; // hi encoded, when the trie compresses keys
+    int level;    // level of the current leaf
+    bool pending; // current leaf not visited yet
+    uint8_t* keys;    // exportAll: the leaves' keys are appended here, NULL for forEach
+    uint32_t* keyEnd; // end of each key in keys
+    uint32_t keyBytes;
+    uint32_t keyCap;
+    bool done;
+};
 
-    inline uint64_t childNodeNumU(uint64_t pos);
-    inline uint64_t childNodeNum(uint64_t pos);
-    inline uint64_t childpos(uint64_t nodeNum);
+//******************************************************
+// Fixed-width key of N big-endian bytes (N = 4, 8, 16)
+//******************************************************
+template<int N>
+struct FixedKey {
+    uint8_t bytes[N];
+};
 
-    inline int nodeSize(uint64_t pos);
-    inline bool simdSearch(uint64_t &pos, uint64_t size, uint8_t target);
-    inline bool binarySearch(uint64_t &pos, uint64_t size, uint8_t target);
-    inline bool linearSearch(uint64_t &pos, uint64_t size, uint8_t target);
-    inline bool nodeSearch(uint64_t &pos, int size, uint8_t target);
-    inline bool nodeSearch_lowerBound(uint64_t &pos, int size, uint8_t target);
+// Thread safety: once load() returns, all const member functions only
+// read the trie and may be called concurrently from any number of
+// threads without locking. Each thread must use its own FSTIter.
+// load() must not run concurrently with anything else.
+class FST {
+public:
+    static const uint8_t TERM = 36; //$
+    static const int CUTOFF_RATIO = FST_CUTOFF_RATIO;
+    static const int NODE_BITMAP_MIN = FST_NODE_BITMAP_MIN;
+    static const int DENSE_LIST_BELOW = FST_DENSE_LIST_BELOW;
+    // a sparse node stored as a bitmap: its first label and 256 bits
+    static const int BITMAP_NODE_BYTES = 33;
+
+    // LOUDS-Sparse layouts. SPARSE_LEVEL_ORDER stores the sparse levels
+    // one after another. SPARSE_BLOCKED cuts the sparse levels into bands
+    // of SPARSE_BLOCK_LEVELS levels and stores each band as blocks of
+    // about SPARSE_BLOCK_LABELS labels, each block holding a run of
+    // consecutive subtrees (level by level inside the block). A
+    // root-to-leaf descent then touches one block per band instead of
+    // one spot per level.
+    static const int SPARSE_LEVEL_ORDER = 0;
+    static const int SPARSE_BLOCKED = 1;
+    static const int SPARSE_BLOCK_LEVELS = 8;
+    static const int SPARSE_BLOCK_LABELS = 512;
+
+    // forEach hands values to the visitor in chunks of this size
+    static const int FOREACH_CHUNK = 64;
+
+    // exportAll hands out batches of up to this many keys, or of about
+    // this many key bytes
+    static const int EXPORT_BATCH = 16384;
+    static const int EXPORT_BYTES = 1 << 20;
+
+    // scanBatch interleaves the lowerBound descents of this many ranges
+    static const int SCAN_GROUP = 8;
 
-    inline bool binarySearch_lowerBound(uint64_t &pos, uint64_t size, uint8_t target);
-    inline bool linearSearch_lowerBound(uint64_t &pos, uint64_t size, uint8_t target);
+    FST();
+    virtual ~FST();
 
-    inline bool nextItemU(uint64_t nodeNum, uint8_t kc, uint8_t &cc);
+    // overrides CUTOFF_RATIO for the next load()
+    void setCutoffRatio(int ratio);
+
+    // From the next load() on, stores keys compressed with an
+    // order-preserving dictionary of up to numSymbols common n-grams
+    // (see key-encoder.h); 0 turns it off. Query keys are encoded on
+    // the way in and FSTIter::key() decodes. Key order, and so ranges,
+    // are unchanged, but forEach's prefix rule for hi applies to the
+    // encoded hi.
+    void setKeyCompression(int numSymbols = KeyEncoder::DEFAULT_SYMBOLS);
+    const KeyEncoder* keyEncoder() const;
+
+    // From the next load() on, repeated keys keep all their values, as
+    // a posting list per key (see posting-list.h), instead of the last
+    // one. The trie then stores the list id as the key's value:
+    // lookup(key, list) and FSTIter::postings() hand out the list and
+    // forEach visits every value, while the calls that return a single
+    // value (lookup, lookupSorted, scanBatch, FSTIter::value) return
+    // the list id, which postings() turns into the list.
+    void setMultiValue(bool on);
+    bool multiValue() const;
+
+    // From the next load() on, keeps the number of keys below every
+    // child (a uint32 per has-child label) so that keys can be reached
+    // by their rank in key order: seekToRank and keyAt walk down one
+    // node per level, skipping the subtrees before the rank.
+    void setRankAccess(bool on);
+
+    // keys must be sorted; of equal neighbours the last one's value is kept.
+    // Every load replaces the trie of the previous one.
+    void load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout = SPARSE_LEVEL_ORDER);
+    void load(vector<uint64_t> &keys, vector<uint64_t> &values, int sparseLayout = SPARSE_LEVEL_ORDER);
+
+    // Like load, for keys in any order: radix sorts them first on
+    // threads threads (0: all, see radix-sort.h). Of repeated keys the
+    // one that comes last in the input keeps its value. The string sort
+    // hands its common prefix lengths on to the build.
+    void loadUnsorted(const vector<string> &keys, const vector<uint64_t> &values, int sparseLayout = SPARSE_LEVEL_ORDER, int threads = 0);
+    void loadUnsorted(const vector<uint64_t> &keys, const vector<uint64_t> &values, int sparseLayout = SPARSE_LEVEL_ORDER, int threads = 0);
+
+    // Like load, but each key carries a byte payload instead of a value
+    // (of equal neighbours, the last one's). The payloads are stored in
+    // key order in one blob, their offsets as an Elias-Fano sequence
+    // (elias-fano.h). The trie stores each key's rank as its value:
+    // lookup(key, payload) and FSTIter::payload() return a view into
+    // the blob, while the calls that return a value return the rank,
+    // which payload() turns into the view.
+    void load(vector<string> &keys, vector<string> &payloads, int longestKeyLen, int sparseLayout = SPARSE_LEVEL_ORDER);
+
+    bool lookup(const uint8_t* key, const int keylen, uint64_t &value) const;
+    bool lookup(const uint64_t key, uint64_t &value) const;
+    // multi-value tries only
+    bool lookup(const uint8_t* key, const int keylen, PostingList &list) const;
+    PostingList postings(uint64_t listId) const;
+    // payload tries only
+    bool lookup(const uint8_t* key, const int keylen, FSTPayload &payload) const;
+    FSTPayload payload(uint64_t rank) const;
+    // Unrolled lookup for tries whose keys are all N bytes long; falls
+    // back to the byte-string lookup otherwise. lookup(uint64_t) uses it.
+    template<int N>
+    bool lookup(const FixedKey<N> &key, uint64_t &value) const;
+
+    // Looks up keys[0 .. n-1], resuming each descent at the longest
+    // common prefix with the previous key. Any order is correct; sorted
+    // batches share the most work. Returns the number of keys found.
+    int lookupSorted(const string* keys, int n, uint64_t* values, bool* found) const;
+
+    bool lowerBound(const uint8_t* key, const int keylen, FSTIter &iter) const;
+    bool lowerBound(const uint64_t key, FSTIter &iter) const;
+
+    // Rank access (setRankAccess) only: positions iter on the key of
+    // rank 0 .. numKeys() - 1, or returns false. keyAt returns the
+    // stored prefix of that key, like FSTIter::key.
+    bool seekToRank(uint64_t rank, FSTIter &iter) const;
+    bool keyAt(uint64_t rank, string &key) const;
+    // distinct keys in the trie, with rank access
+    uint64_t numKeys() const;
+
+    // Calls visit(value) for the keys in [lo, hi] (to the end if hi is
+    // NULL), in key order, and for every value of a multi-value key.
+    // Like lowerBound, a stored key that shares its (truncated) prefix
+    // with hi counts as <= hi. Returns the number of values visited.
+    template<typename Visitor>
+    uint64_t forEach(const uint8_t* lo, int lolen, const uint8_t* hi, int hilen, Visitor&& visit) const;
+
+    // Writes every key (its stored prefix, like FSTIter::key) and value
+    // in key order into large buffers and hands them to sink. The walk
+    // is a DFS that keeps a cursor per level, so a key costs a few label
+    // reads rather than an iterator step. With rank access the keys are
+    // cut into threads rank ranges (0: one per hardware thread), each
+    // exported by its own thread: sink is then called concurrently,
+    // with the batches of a range in order and tagged with their part
+    // and first rank. Without rank access it runs on the calling
+    // thread. Multi-value and payload tries export the list id or rank
+    // as the value. Returns the number of keys.
+    uint64_t exportAll(const function<void(const FSTExportBatch&)> &sink, int threads = 1) const;
+
+    // Scans ranges[0 .. n-1]. The values of each range are written one
+    // after another to values, counts[i] gets the number written for
+    // ranges[i] (less than its count at the end of the trie). values
+    // must hold the sum of the counts. Returns the number written.
+    uint64_t scanBatch(const FSTRange* ranges, int n, uint64_t* values, uint32_t* counts) const;
+    // Like scanBatch, also writing the key (its stored prefix, like
+    // FSTIter::key) of every value, laid out like FSTExportBatch: keys
+    // one after another in keys, which is cleared first, and the end of
+    // the i-th one in keyEnd[i]. keyEnd must hold as many as values.
+    uint64_t scanBatch(const FSTRange* ranges, int n, uint64_t* values, uint32_t* counts, vector<uint8_t> &keys, uint32_t* keyEnd) const;
+
+    uint32_t cMemU() const;
+    uint32_t tMemU() const;
+    uint32_t oMemU() const;
+    uint32_t keyMemU() const;
+    uint32_t valueMemU() const;
+
+    uint64_t cMem() const;
+    uint32_t tMem() const;
+    uint32_t sMem() const;
+    uint64_t keyMem() const;
+    uint64_t valueMem() const;
+
+    // every heap byte the trie owns, memory().total
+    uint64_t mem() const;
+    FSTMemory memory() const;
+
+    int sparseLayout() const;
+
+    uint32_t numT() const;
+
+    // LOUDS-Sparse label positions, the label at pos and the size of
+    // the node starting at pos, for tools that sample the trie
+    uint64_t numSparseLabels() const;
+    uint8_t sparseLabel(uint64_t pos) const;
+    int sparseNodeSize(uint64_t pos) const;
+
+    //build stats
+    const FSTStats& stats() const;
+    string statsJSON() const;
+
+    void printU() const;
+    void print() const;
 
-    inline bool nextLeftU(int keypos, uint64_t pos, FSTIter* iter);
-    inline bool nextLeft(int keypos, uint64_t pos, FSTIter* iter);
+private:
+    // lcp: common prefix lengths of neighbouring keys, if already known
+    void loadSorted(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout, const vector<uint32_t>* lcp);
+    void loadEncoded(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout, const vector<uint32_t>* lcp);
+    void clear();
+    void loadKeys(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout, const vector<uint32_t>* lcp);
+    // scanBatch, keys == NULL if only values are wanted
+    uint64_t scanRanges(const FSTRange* ranges, int n, uint64_t* values, uint32_t* counts, vector<uint8_t>* keys, uint32_t* keyEnd) const;
+    inline bool lookupKey(const uint8_t* key, const int keylen, uint64_t &value) const;
 
-    inline bool nextNodeU(int keypos, uint64_t nodeNum, FSTIter* iter);
-    inline bool nextNode(int keypos, uint64_t pos, FSTIter* iter);
+    inline bool insertChar_cond(const uint8_t ch, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
+    inline bool insertChar(const uint8_t ch, bool isTerm, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc);
 
+    inline bool isCbitSetU(uint64_t nodeNum, uint8_t kc) const;
+    inline bool isTbitSetU(uint64_t nodeNum, uint8_t kc) const;
+    inline bool isObitSetU(uint64_t nodeNum) const;
+    inline bool isSbitSet(uint64_t pos) const;
+    inline bool isTbitSet(uint64_t pos) const;
+    inline uint64_t valuePosU(uint64_t nodeNum, uint64_t pos) const;
+    inline uint64_t valuePos(uint64_t pos) const;
+
+    inline uint64_t childNodeNumU(uint64_t pos) const;
+    uint64_t encodeListNodesU();
+    inline bool isListNodeU(uint64_t nodeNum) const;
+    inline uint64_t listEndU(uint64_t list, uint8_t kc) const;
+    inline uint64_t labelsThroughU(uint64_t nodeNum, uint8_t kc) const;
+    inline uint64_t childrenThroughU(uint64_t nodeNum, uint8_t kc) const;
+    inline void prefetchNodeU(uint64_t nodeNum, uint8_t kc) const;
+    inline bool mixedStepU(uint64_t nodeNum, uint8_t kc, bool &hasChild, uint64_t &next) const;
+    inline uint64_t childNodeNum(uint64_t pos) const;
+    inline uint64_t childpos(uint64_t nodeNum) const;
+
+    void buildSparseBlocks(vector<vector<uint64_t> > &t, vector<vector<uint64_t> > &s, vector<int> &pos_list, vector<SparseSegment> &segments);
+    inline uint64_t levelStart(uint64_t block, int i) const;
+    inline uint64_t blockOf(uint64_t pos) const;
+    inline uint64_t rootPos(int band, uint64_t root, uint64_t &block) const;
+    inline uint64_t childPosBlocked(int level, uint64_t pos, uint64_t &block) const;
+    inline uint64_t sparseRootPos(uint64_t nodeNum, uint64_t &block) const;
+    inline uint64_t sparseChildPos(int level, uint64_t pos, uint64_t &block) const;
+    inline uint64_t sparseChildPos(int level, uint64_t pos) const;
+    inline uint64_t nextInLevel(int level, uint64_t pos) const;
+
+    inline int nodeSize(uint64_t pos) const;
+    inline bool nodeSearch(uint64_t &pos, int size, uint8_t target) const;
+    inline bool nodeSearch_lowerBound(uint64_t &pos, int size, uint8_t target) const;
+
+    uint64_t encodeBitmapNodes();
+    uint64_t buildRankCounts(int level, uint64_t nodeNum, uint64_t pos, uint64_t block);
+    inline bool isBitmapNode(uint64_t pos) const;
+    inline const uint8_t* nodeLabels(uint64_t pos) const;
+    inline uint64_t nodeStart(uint64_t pos) const;
+    inline uint8_t firstLabel(uint64_t pos) const;
+    inline uint8_t label(uint64_t nodePos, uint64_t pos) const;
+    inline uint8_t label(uint64_t pos) const;
+    inline void prefetchNode(uint64_t pos) const;
+    inline bool bitmapSearch(const uint8_t* labels, uint64_t &pos, uint8_t target) const;
+    inline bool bitmapSearch_lowerBound(const uint8_t* labels, uint64_t &pos, int size, uint8_t target) const;
+
+    inline bool lookupFrom(const uint8_t* key, const int keylen, int keypos, uint64_t* nodes, uint64_t* blocks, int &depth, uint64_t &value) const;
+
+    bool walkStart(const uint8_t* lo, int lolen, const uint8_t* hi, int hilen, FSTWalk &w) const;
+    bool walkStart(const FSTIter &iter, const uint8_t* hi, int hilen, FSTWalk &w) const;
+    int walkValues(FSTWalk &w, uint64_t* values, int cap) const;
+    inline void walkLeaf(FSTWalk &w, int level, uint64_t* values, int &n) const;
+    uint64_t exportRange(uint64_t first, uint64_t count, int part, const function<void(const FSTExportBatch&)> &sink) const;
+
+    inline void lowerBoundInit(FSTDescent &d) const;
+    inline bool lowerBoundStep(const uint8_t* key, const int keylen, FSTDescent &d, FSTIter &iter) const;
+
+    inline bool nextItemU(uint64_t nodeNum, uint8_t kc, uint8_t &cc) const;
+
+    inline bool nextLeftU(int keypos, uint64_t pos, FSTIter* iter) const;
+    inline bool nextLeft(int keypos, uint64_t pos, FSTIter* iter) const;
+
+    inline bool nextNodeU(int keypos, uint64_t nodeNum, FSTIter* iter) const;
+    inline bool nextNode(int keypos, uint64_t pos, FSTIter* iter) const;
+
+    int cutoff_ratio_;
+    int keyCompression_;  // dictionary size for the next load(), 0: off
+    KeyEncoder* encoder_; // NULL if keys are stored as is
+    bool multiValue_;         // for the next load()
+    PostingLists* postings_;  // NULL unless the trie holds multi-value keys
+    vector<uint8_t> payloadBlob_;
+    EliasFano* payloadOffsets_; // n + 1 offsets into payloadBlob_, NULL without payloads
+    bool rankAccess_;             // for the next load()
+    vector<uint32_t> rankCountsU_; // keys below each dense child, by child node number - 1
+    vector<uint32_t> rankCounts_;  // keys below each sparse child, by S-HasChild rank - 1
+    uint64_t rankKeys_;            // keys in the trie, 0 without rank access
     int cutoff_level_;
     uint64_t nodeCountU_;
     uint64_t childCountU_;
@@ -95,11 +465,37 @@ private:
     BitmapRankFPoppy* obitsU_;
     uint64_t* valuesU_;
 
+    // Dense nodes of fewer than DENSE_LIST_BELOW labels may be stored
+    // as a list of their labels, each with a has-child bit, instead of
+    // 256 bits of D-Labels and D-HasChild. D-NodeType has a one per
+    // list node: node n is list node rank(n), or else its bitmaps are
+    // those of node n - rank(n) in cbitsU_ and tbitsU_. NULL if every
+    // dense node is a bitmap.
+    BitmapRankPoppy* nodeTypesU_;
+    BitmapRankPoppy* ltbitsU_;    // has-child bits of labelsU_
+    vector<uint8_t> labelsU_;     // labels of the list nodes, padded for the SIMD search
+    vector<uint32_t> listStartU_; // first label of each list node, then the end
+
     uint8_t* cbytes_;
     BitmapRankPoppy* tbits_;
     BitmapSelectPoppy* sbits_;
     uint64_t* values_;
 
+    int sparseLayout_;
+    int fixedKeyLen_; // length shared by all keys, 0 if they differ
+    vector<SparseBlock> blocks_;
+    vector<uint32_t> blockLevelStart_;  // SPARSE_BLOCK_LEVELS + 1 positions per block
+    vector<uint32_t> bandFirstBlock_;   // one per band, plus the block count
+    vector<vector<uint32_t> > rootSample_; // per band, the block holding every 64th root
+
+    // Sparse nodes of NODE_BITMAP_MIN labels or more may be stored in
+    // cbytes_ as their first label and a 256-bit bitmap of their labels
+    // except a leading TERM, instead of a byte per label. S-NodeType has
+    // ones on the first size - BITMAP_NODE_BYTES positions of each such
+    // node, so the bytes of the node at pos start at pos - rank(pos).
+    // NULL if no node is stored as a bitmap.
+    BitmapRankPoppy* nodeTypes_;
+
     //stats
     uint32_t tree_height_;
     int32_t last_value_pos_; // negative means in valuesU_
@@ -111,17 +507,56 @@ private:
     uint32_t t_memU_;
     uint32_t o_memU_;
     uint32_t val_memU_;
+    uint64_t list_memU_; // labelsU_ and ltbitsU_ bits
+    uint64_t type_memU_; // D-NodeType and listStartU_
 
-    uint64_t c_mem_;
+    uint64_t c_mem_;     // label positions
+    uint64_t label_mem_; // bytes of cbytes_
     uint32_t t_mem_;
     uint32_t s_mem_;
     uint64_t val_mem_;
+    uint64_t dir_mem_;
+    uint64_t type_mem_;
 
     uint32_t num_t_;
 
+    FSTStats stats_;
+
     friend class FSTIter;
 };
 
+//******************************************************
+// FOR EACH
+// The traversal runs in FST.cpp and fills a small buffer, the visitor
+// is inlined over it.
+//******************************************************
+template<typename Visitor>
+uint64_t FST::forEach(const uint8_t* lo, int lolen, const uint8_t* hi, int hilen, Visitor&& visit) const {
+    FSTWalk w;
+    if (!walkStart(lo, lolen, hi, hilen, w))
+	return 0;
+
+    uint64_t values[FOREACH_CHUNK];
+    uint64_t count = 0;
+    int n;
+    while ((n = walkValues(w, values, FOREACH_CHUNK)) > 0) {
+	if (postings_ == NULL) {
+	    for (int i = 0; i < n; i++)
+		visit(values[i]);
+	    count += n;
+	    continue;
+	}
+	for (int i = 0; i < n; i++) {
+	    PostingList list = postings_->list(values[i]);
+	    uint64_t value;
+	    while (list.next(value))
+		visit(value);
+	    count += list.size();
+	}
+    }
+    return count;
+}
+
 typedef struct {
     int32_t keyPos;
     int32_t valPos;
@@ -129,11 +564,20 @@ typedef struct {
 } Cursor;
 
 
+// The cursor stack lives inside the iterator for tries up to
+// INLINE_LEVELS high and is only heap allocated for deeper ones, so
+// iterators are cheap to create, copy and reuse.
 class FSTIter {
 public:
+    static const int INLINE_LEVELS = 128;
+
     FSTIter();
-    FSTIter(FST* idx);
+    FSTIter(const FST* idx);
+    FSTIter(const FSTIter &other);
+    FSTIter& operator = (const FSTIter &other);
+    ~FSTIter();
 
+    // resets only the levels touched since the last clear
     void clear ();
 
     inline void setVU (int keypos, uint64_t nodeNum, uint64_t pos);
@@ -142,12 +586,27 @@ public:
     inline void setKV (int keypos, uint64_t pos);
 
     uint64_t value ();
+    // the stored prefix of the current key, i.e. the shortest prefix
+    // that tells it apart from its neighbours (decoded if the trie
+    // compresses keys)
+    string key ();
+    // the current key's values, multi-value tries only
+    PostingList postings ();
+    // the current key's payload, payload tries only
+    FSTPayload payload ();
+    // bytes of the iterator, including cursors on the heap
+    uint64_t mem () const;
     bool operator ++ (int);
     bool operator -- (int);
 
 private:
-    FST* index;
-    vector<Cursor> positions;
+    void init (const FST* idx);
+    void copyFrom (const FSTIter &other);
+    inline void touch (int level);
+
+    const FST* index;
+    Cursor* positions;  // inlinePositions, or a heap array of tree_height
+    uint32_t depth;     // positions at and above depth are clear
 
     uint32_t len;
     bool isEnd;
@@ -156,8 +615,11 @@ private:
     uint64_t cBound;
     int cutoff_level;
     uint32_t tree_height;
-    uint32_t last_value_pos;
+    int32_t last_value_pos; // as FST::last_value_pos_, negative in valuesU_
+
+    Cursor inlinePositions[INLINE_LEVELS];
 
     friend class FST;
 };
 
+#endif /* _FST_HPP_ */
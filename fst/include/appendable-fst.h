@@ -0,0 +1,123 @@
+#ifndef _APPENDABLEFST_H_
+#define _APPENDABLEFST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "FST.hpp"
+
+using namespace std;
+
+//******************************************************
+// Append-only FST for keys that arrive in increasing order
+//
+// Keys are split into runs of consecutive keys, each run an FST built
+// by FST::load. Because every key is larger than the ones before it,
+// the runs partition the key space: a lookup picks its run by the
+// runs' first keys, checks the run's full last key and descends one
+// FST. Appending never touches the
+// existing tries or their rank/select directories.
+//
+// publish() turns the keys appended since the last publish into a new
+// run. Small runs keep their keys, and a new run absorbs the runs
+// before it that are no larger than itself (like a binary counter), so
+// a key is rebuilt O(log(segmentKeys / batch)) times. Once a run holds
+// segmentKeys keys it is sealed: its keys are dropped and it is never
+// rebuilt again.
+//
+// Thread safety: append and publish are called from one writer
+// thread. Each publish installs a new FSTSnapshot of all published
+// keys with an atomic pointer swap. Readers take a snapshot, or use
+// lookup and scan which take one per call, from any number of threads
+// without locking. A snapshot stays valid, and unchanged, for as long
+// as the reader holds it.
+//******************************************************
+class FSTSnapshot {
+public:
+    FSTSnapshot();
+
+    bool lookup(const uint8_t* key, const int keylen, uint64_t &value) const;
+    // Copies the values of up to count keys from the first >= key on,
+    // across runs, returns how many. Like FST::lowerBound, a stored key
+    // that shares its (truncated) prefix with key counts as >= key.
+    uint64_t scan(const uint8_t* key, const int keylen, uint64_t count, uint64_t* values) const;
+
+    uint64_t numKeys() const;
+    uint64_t numRuns() const;
+    uint64_t mem() const;
+
+private:
+    // the last run whose first key is <= key, -1 if key is before the
+    // first one
+    int64_t findRun(const uint8_t* key, const int keylen) const;
+
+    vector<shared_ptr<const FST> > runs_;
+    // Full first and last key of every run. Each run's FST truncates
+    // its last key without seeing the next run, so a key past lastKeys_
+    // of its run belongs to the gap before the next run.
+    vector<string> firstKeys_;
+    vector<string> lastKeys_;
+    uint64_t numKeys_;
+
+    friend class AppendableFST;
+};
+
+class AppendableFST {
+public:
+    static const uint64_t SEGMENT_KEYS = 1 << 20;
+
+    AppendableFST(uint64_t segmentKeys = SEGMENT_KEYS, int sparseLayout = FST::SPARSE_LEVEL_ORDER);
+
+    // key must not be smaller than the last appended key. A key equal
+    // to it replaces its value until the next publish(), after which
+    // it is rejected. Returns false if the key is rejected.
+    bool append(const string &key, uint64_t value);
+    // makes the appended keys visible to readers
+    void publish();
+    // keys appended but not published yet
+    uint64_t pending() const;
+
+    shared_ptr<const FSTSnapshot> snapshot() const;
+
+    bool lookup(const uint8_t* key, const int keylen, uint64_t &value) const;
+    uint64_t scan(const uint8_t* key, const int keylen, uint64_t count, uint64_t* values) const;
+    // published keys
+    uint64_t numKeys() const;
+    // The published tries, plus the keys the writer keeps to rebuild
+    // the unsealed runs. Writer thread only; readers use
+    // snapshot()->mem().
+    uint64_t mem() const;
+
+private:
+    AppendableFST(const AppendableFST &other);
+    AppendableFST& operator = (const AppendableFST &other);
+
+    struct Run {
+	shared_ptr<const FST> index;
+	vector<string> keys;     // empty once sealed
+	vector<uint64_t> values;
+	string firstKey;
+	string lastKey;
+	uint64_t numKeys;
+    };
+
+    void build(Run &run);
+
+    uint64_t segmentKeys_;
+    int sparseLayout_;
+
+    // writer side
+    vector<Run> runs_;          // in key order, sealed ones first
+    vector<string> pendingKeys_;
+    vector<uint64_t> pendingValues_;
+    string lastKey_;
+    bool empty_;
+
+    shared_ptr<const FSTSnapshot> snapshot_; // atomic_load / atomic_store only
+};
+
+#endif /* _APPENDABLEFST_H_ */
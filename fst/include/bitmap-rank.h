@@ -31,6 +31,7 @@ Modified by Huanchen Zhang
 #include <inttypes.h>
 
 #include "shared.h"
+#include "popcount.h"
 
 class BitmapRank {
 public:
@@ -41,8 +42,7 @@ public:
     const int kWordCountPerBasicBlock = kBasicBlockSize / kWordSize;
 
     BitmapRank() { pCount_ = 0; }    
-    virtual uint32 rank(uint32 pos) = 0;
-    uint64 pCount() { return pCount_; }
+    uint64 pCount() const { return pCount_; }
     
 protected:
     uint64 pCount_;
@@ -51,13 +51,16 @@ protected:
 class BitmapRankPoppy: public BitmapRank {
 public:
     BitmapRankPoppy(uint64* bits, uint32 nbits);
-    ~BitmapRankPoppy() {}
+    // frees the lookup table; bits stay with the caller
+    ~BitmapRankPoppy();
     
-    uint32 rank(uint32 pos);
+    // rank is not virtual so that it can be inlined into the lookup loop;
+    // it only reads the bitmap and is safe to call from many threads.
+    inline uint32 rank(uint32 pos) const;
 
-    uint64* getBits();
-    uint32 getNbits();
-    uint32 getMem();
+    uint64* getBits() const;
+    uint32 getNbits() const;
+    uint32 getMem() const;
 
     friend class FST;
     friend class FSTIter;
@@ -71,4 +74,11 @@ private:
     uint32  basicBlockCount_;
 };
 
+inline uint32 BitmapRankPoppy::rank(uint32 pos) const
+{
+    assert(pos <= nbits_);
+    uint32 blockId = pos >> kBasicBlockBits;
+    return rankLUT_[blockId] + popcountLinear(bits_, (blockId << 3), (pos & 511));
+}
+
 #endif /* _BITMAPRANK_H_ */
@@ -31,6 +31,7 @@ Modified by Huanchen Zhang
 #include <inttypes.h>
 
 #include "shared.h"
+#include "popcount.h"
 
 class BitmapRankF {
 public:
@@ -41,8 +42,7 @@ public:
     const int kWordCountPerBasicBlock = kBasicBlockSize / kWordSize;
 
     BitmapRankF() { pCount_ = 0; }
-    virtual uint32 rank(uint32 pos) = 0;
-    uint64 pCount() { return pCount_; }
+    uint64 pCount() const { return pCount_; }
     
 protected:
     uint64 pCount_;
@@ -51,13 +51,15 @@ protected:
 class BitmapRankFPoppy: public BitmapRankF {
 public:
     BitmapRankFPoppy(uint64* bits, uint32 nbits);
-    ~BitmapRankFPoppy() {}
+    // frees the lookup table; bits stay with the caller
+    ~BitmapRankFPoppy();
     
-    uint32 rank(uint32 pos);
+    // see BitmapRankPoppy::rank
+    inline uint32 rank(uint32 pos) const;
 
-    uint64* getBits();
-    uint32 getNbits();
-    uint32 getMem();
+    uint64* getBits() const;
+    uint32 getNbits() const;
+    uint32 getMem() const;
 
     friend class FST;
     friend class FSTIter;
@@ -71,4 +73,15 @@ private:
     uint32  basicBlockCount_;
 };
 
+inline uint32 BitmapRankFPoppy::rank(uint32 pos) const
+{
+    assert(pos <= nbits_);
+    uint32 blockId = pos >> kBasicBlockBits;
+    uint32 offset = pos & (uint32)63;
+    if (offset)
+	return rankLUT_[blockId] + popcount(bits_[blockId] >> (64 - offset));
+    else
+	return rankLUT_[blockId];
+}
+
 #endif /* _BITMAPRANKF_H_ */
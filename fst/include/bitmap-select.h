@@ -31,6 +31,7 @@ Modified by Huanchen Zhang
 #include <inttypes.h>
 
 #include "shared.h"
+#include "popcount.h"
 
 class BitmapSelect {
 public:
@@ -43,19 +44,20 @@ public:
     const uint32 kSkipMask = ((uint32)1 << kSkipBits) - 1;
 
     BitmapSelect() { }
-    virtual uint32 select(uint32 rank) = 0;
 };
 
 class BitmapSelectPoppy: public BitmapSelect {
 public:
     BitmapSelectPoppy(uint64* bits, uint32 nbits);
-    ~BitmapSelectPoppy() {}
+    // frees the lookup table; bits stay with the caller
+    ~BitmapSelectPoppy();
     
-    uint32 select(uint32 rank);
+    // see BitmapRankPoppy::rank
+    inline uint32 select(uint32 rank) const;
 
-    uint64* getBits();
-    uint32 getNbits();
-    uint32 getMem();
+    uint64* getBits() const;
+    uint32 getNbits() const;
+    uint32 getMem() const;
 
     friend class FST;
     friend class FSTIter;
@@ -71,4 +73,27 @@ private:
     uint32  selectLUTCount_;
 };
 
+inline uint32 BitmapSelectPoppy::select(uint32 rank) const {
+    assert(rank <= pCount_);
+
+    uint32 s = selectLUT_[rank >> kSkipBits];
+    uint32 rankR = rank & kSkipMask;
+
+    if (rankR == 0)
+	return s - 1;
+
+    int idx = s >> kWordBits;
+    int startWordBit = s & kWordMask;
+    uint64 word = bits_[idx] << startWordBit >> startWordBit;
+
+    int pop = 0;
+    while ((pop = popcount(word)) < rankR) {
+	idx++;
+	word = bits_[idx];
+	rankR -= pop;
+    }
+
+    return (idx << kWordBits) + select64_popcount_search(word, rankR);
+}
+
 #endif /* _BITMAPSELECT_H_ */
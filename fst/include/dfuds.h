@@ -0,0 +1,190 @@
+#ifndef _DFUDS_H_
+#define _DFUDS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "bitmap-rank.h"
+#include "common.h"
+
+using namespace std;
+
+class DFUDSIter;
+
+//******************************************************
+// DFUDS trie: an alternative to LOUDS-Sparse for scan-heavy workloads
+//
+// Stores the same trie as FST (shortest distinguishing prefixes, a
+// TERM label first in a node for a key that ends there, the last value
+// of equal keys) with every node in DFS order. A node of d children
+// is d open parens and a close, preceded by one open paren for the
+// root (Depth-First Unary Degree Sequence, MSB first like the FST's
+// bitmaps); its labels are stored in the same order. Leaves are nodes
+// of degree 0, so a subtree is one run of the sequence and the leaves,
+// and values, come in key order.
+//
+// Child i of the node at v starts after the close matching paren
+// v + d - 1 - i, found with a range min-max tree over the paren
+// excess (a minimum per word, per 64 words and per 4096 words). A
+// lowerBound is one such descent; the keys after it are a sequential
+// read of the parens, labels and values, with no rank or select.
+//******************************************************
+class DFUDSTrie {
+public:
+    static const uint8_t TERM = 36; //$, as in FST
+
+    DFUDSTrie();
+    ~DFUDSTrie();
+
+    // keys must be sorted; of equal neighbours the last one's value is kept
+    void load(const vector<string> &keys, const vector<uint64_t> &values);
+
+    bool lookup(const uint8_t* key, const int keylen, uint64_t &value) const;
+    // Like FST::lowerBound, a stored key that shares its (truncated)
+    // prefix with key counts as >= key.
+    bool lowerBound(const uint8_t* key, const int keylen, DFUDSIter &iter) const;
+    // Copies the values of up to count keys from the first >= key on,
+    // returns how many.
+    uint64_t scan(const uint8_t* key, const int keylen, uint64_t count, uint64_t* values) const;
+
+    uint64_t numKeys() const;
+    uint64_t numNodes() const;
+    uint64_t mem() const;
+
+private:
+    DFUDSTrie(const DFUDSTrie &other);
+    DFUDSTrie& operator = (const DFUDSTrie &other);
+
+    void clear();
+    void buildNode(const vector<string> &keys, const vector<uint64_t> &values, const vector<uint32_t> &lcp, uint64_t lo, uint64_t hi, uint32_t depth);
+    void appendBit(bool open);
+    void buildDirectories();
+
+    inline bool bit(uint64_t pos) const;
+    inline uint32_t degree(uint64_t v) const;
+    inline uint64_t labelBase(uint64_t v) const;
+    inline uint64_t leafRank(uint64_t v) const;
+    inline int64_t excess(uint64_t pos) const;
+    inline uint64_t child(uint64_t v, uint32_t d, uint32_t i) const;
+    inline bool hasTerm(uint64_t v, uint32_t d, uint64_t base) const;
+    uint64_t fwdSearch(uint64_t start, int64_t target) const;
+    bool scanWord(uint64_t word, int from, int64_t &cur, int64_t target, uint64_t &pos) const;
+
+    uint64_t numBits_;
+    vector<uint64_t> bits_;     // the parens, 1 = open, padded to whole rank blocks
+    BitmapRankPoppy* rank_;     // opens before a position
+    vector<uint8_t> labels_;    // one per open paren but the first, plus padding
+    vector<uint64_t> values_;   // one per leaf, in key order
+    vector<uint32_t> leafLUT_;  // leaves before every 512-bit block
+    vector<int8_t> wordMin_;    // per word, the minimum excess of its prefixes
+    vector<int32_t> blockMin_;  // per 64 words, the minimum absolute excess
+    vector<int32_t> superMin_;  // per 64 blocks
+    uint64_t numNodes_;
+
+    friend class DFUDSIter;
+};
+
+// Cursor over a DFUDSTrie in key order: the path of (node, child) from
+// the root to the current leaf.
+class DFUDSIter {
+public:
+    DFUDSIter();
+    DFUDSIter(const DFUDSTrie* idx);
+
+    uint64_t value() const;
+    // the stored prefix of the current key, like FSTIter::key
+    string key() const;
+    bool operator ++ (int);
+
+private:
+    struct Step {
+	uint64_t node;  // position of the node's first paren
+	uint64_t base;  // its first label
+	uint32_t d;     // degree
+	uint32_t i;     // child taken
+    };
+
+    void clear();
+    // walks down the first children from the node at v to a leaf
+    void descend(uint64_t v);
+    // moves to the node at v, the next one in DFS order after the
+    // subtree of the last step's current child
+    bool next(uint64_t v);
+
+    const DFUDSTrie* index;
+    vector<Step> path;
+    uint64_t leaf;   // position of the current leaf
+    uint64_t rank;   // its value
+    uint64_t edges;  // labels before the next node in DFS order
+    bool isEnd;
+
+    friend class DFUDSTrie;
+};
+
+//******************************************************
+// DFUDSTrie inline functions
+//******************************************************
+inline bool DFUDSTrie::bit(uint64_t pos) const {
+    return bits_[pos >> 6] & (MSB_MASK >> (pos & 63));
+}
+
+// the run of open parens at v
+inline uint32_t DFUDSTrie::degree(uint64_t v) const {
+    uint32_t d = 0;
+    while (true) {
+	int off = v & 63;
+	uint64_t w = ~(bits_[v >> 6] << off);
+	int ones = (w == 0) ? 64 - off : __builtin_clzll(w);
+	if (ones > 64 - off)
+	    ones = 64 - off;
+	d += ones;
+	if (ones < 64 - off)
+	    return d;
+	v += ones;
+    }
+}
+
+inline uint64_t DFUDSTrie::labelBase(uint64_t v) const {
+    return rank_->rank(v) - 1;
+}
+
+// A leaf is a close paren right after another one.
+inline uint64_t DFUDSTrie::leafRank(uint64_t v) const {
+    uint64_t block = v >> 9;
+    uint64_t n = leafLUT_[block];
+    uint64_t prev = (block == 0) ? 1 : (bits_[(block << 3) - 1] & 1);
+    for (uint64_t k = block << 3; k <= (v >> 6); k++) {
+	uint64_t w = bits_[k];
+	uint64_t leaves = ~w & ~((w >> 1) | (prev << 63));
+	if (k == (v >> 6)) {
+	    int off = v & 63;
+	    leaves = (off == 0) ? 0 : leaves & (~0ULL << (64 - off));
+	}
+	n += __builtin_popcountll(leaves);
+	prev = w & 1;
+    }
+    return n;
+}
+
+// opens minus closes before pos
+inline int64_t DFUDSTrie::excess(uint64_t pos) const {
+    return 2 * (int64_t)rank_->rank(pos) - (int64_t)pos;
+}
+
+inline uint64_t DFUDSTrie::child(uint64_t v, uint32_t d, uint32_t i) const {
+    if (i == 0)
+	return v + d + 1;
+    uint64_t open = v + d - 1 - i;
+    return fwdSearch(open + 1, excess(open)) + 1;
+}
+
+// a TERM label first whose child is a leaf ends a key at the node
+inline bool DFUDSTrie::hasTerm(uint64_t v, uint32_t d, uint64_t base) const {
+    return labels_[base] == TERM && !bit(v + d + 1);
+}
+
+#endif /* _DFUDS_H_ */
@@ -0,0 +1,81 @@
+#ifndef _ELIASFANO_H_
+#define _ELIASFANO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "bitmap-select.h"
+#include "common.h"
+
+using namespace std;
+
+//******************************************************
+// Elias-Fano coding of a non-decreasing sequence of n values up to U
+//
+// Value i is split into its low l = floor(log2(U / n)) bits, packed into
+// an array, and its high bits h, stored as a one at position h + i of a
+// bitmap (MSB first, like the trie's bitmaps). get(i) is a select on
+// the bitmap plus a read of the low bits; about 2 + l bits per value.
+//******************************************************
+class EliasFano {
+public:
+    EliasFano(const vector<uint64_t> &values);
+    ~EliasFano();
+
+    inline uint64_t get(uint64_t i) const;
+    // values i and i + 1 with one select
+    inline void getPair(uint64_t i, uint64_t &a, uint64_t &b) const;
+
+    uint64_t size() const;
+    uint64_t mem() const;
+
+private:
+    EliasFano(const EliasFano &other);
+    EliasFano& operator = (const EliasFano &other);
+
+    inline uint64_t lowBits(uint64_t i) const;
+
+    uint64_t n_;
+    int lowWidth_;
+    vector<uint64_t> low_;  // plus a word of padding
+    vector<uint64_t> high_;
+    BitmapSelectPoppy* select_;
+};
+
+inline uint64_t EliasFano::lowBits(uint64_t i) const {
+    if (lowWidth_ == 0)
+	return 0;
+    uint64_t bit = i * lowWidth_;
+    uint64_t word = bit >> 6;
+    int shift = bit & 63;
+    uint64_t v = low_[word] >> shift;
+    if (shift + lowWidth_ > 64)
+	v |= low_[word + 1] << (64 - shift);
+    return v & ((1ULL << lowWidth_) - 1);
+}
+
+inline uint64_t EliasFano::get(uint64_t i) const {
+    uint64_t pos = select_->select(i + 1);
+    return ((pos - i) << lowWidth_) | lowBits(i);
+}
+
+inline void EliasFano::getPair(uint64_t i, uint64_t &a, uint64_t &b) const {
+    uint64_t pos = select_->select(i + 1);
+    a = ((pos - i) << lowWidth_) | lowBits(i);
+
+    // the next one in the bitmap
+    uint64_t next = pos + 1;
+    uint64_t word = high_[next >> 6] << (next & 63);
+    while (word == 0) {
+	next = (next | 63) + 1;
+	word = high_[next >> 6];
+    }
+    next += __builtin_clzll(word);
+    b = ((next - i - 1) << lowWidth_) | lowBits(i + 1);
+}
+
+#endif /* _ELIASFANO_H_ */
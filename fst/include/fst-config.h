@@ -0,0 +1,55 @@
+#ifndef _FST_CONFIG_H_
+#define _FST_CONFIG_H_
+
+//******************************************************
+// Build-time tuning knobs. Each can be set with -D, or all at once
+// from the header written by benchmark/autotune:
+//   cmake -DFST_TUNED_CONFIG=/path/to/fst-tuned.h
+//******************************************************
+#ifdef FST_TUNED_CONFIG
+#include FST_TUNED_CONFIG
+#endif
+
+// nodeSearch: linear search for nodes with fewer than
+// FST_SEARCH_LINEAR_BELOW labels, binary search below
+// FST_SEARCH_BINARY_BELOW, SIMD search otherwise
+#ifndef FST_SEARCH_LINEAR_BELOW
+#define FST_SEARCH_LINEAR_BELOW 3
+#endif
+#ifndef FST_SEARCH_BINARY_BELOW
+#define FST_SEARCH_BINARY_BELOW 12
+#endif
+
+// nodeSearch_lowerBound, same meaning
+#ifndef FST_LOWERBOUND_LINEAR_BELOW
+#define FST_LOWERBOUND_LINEAR_BELOW 3
+#endif
+#ifndef FST_LOWERBOUND_BINARY_BELOW
+#define FST_LOWERBOUND_BINARY_BELOW 12
+#endif
+
+// LOUDS-Sparse nodes with at least FST_NODE_BITMAP_MIN labels are
+// stored as a 256-bit label bitmap instead of a byte per label, so that
+// searching them is a bit test and a popcount, if that saves space
+// overall (257 turns the bitmaps off). A bitmap node takes 33 bytes,
+// and every search then pays a rank on the node-type bitmap.
+#ifndef FST_NODE_BITMAP_MIN
+#define FST_NODE_BITMAP_MIN 48
+#endif
+
+// LOUDS-Dense nodes with fewer than FST_DENSE_LIST_BELOW labels are
+// stored as a list of their labels instead of two 256-bit bitmaps, if
+// that saves space overall (0 turns the lists off). A list node takes
+// 9 bits per label and a 32-bit offset, and every dense step then pays
+// a rank on the node-type bitmap.
+#ifndef FST_DENSE_LIST_BELOW
+#define FST_DENSE_LIST_BELOW 48
+#endif
+
+// levels stay LOUDS-Dense while they hold fewer than 1/FST_CUTOFF_RATIO
+// of all nodes
+#ifndef FST_CUTOFF_RATIO
+#define FST_CUTOFF_RATIO 64
+#endif
+
+#endif /* _FST_CONFIG_H_ */
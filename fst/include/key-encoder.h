@@ -0,0 +1,106 @@
+#ifndef _KEYENCODER_H_
+#define _KEYENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+//******************************************************
+// Order-preserving key compression (HOPE-style)
+//
+// The key space is cut into intervals, each one the set of strings
+// whose longest dictionary entry prefix is the same symbol (every
+// single byte is a symbol, plus common n-grams of the sample). A key
+// is encoded by repeatedly finding the interval of its remaining bytes,
+// emitting the interval's code and consuming its symbol. Codes are
+// assigned in interval order and are prefix-free, so encoded keys sort
+// like the keys themselves.
+//
+// Codes are byte-aligned so that the trie keeps byte labels: frequent
+// intervals get a one-byte code, the runs between them share lead
+// bytes and get two-byte codes. A key therefore never grows by more
+// than 2x.
+//******************************************************
+class KeyEncoder {
+public:
+    static const int MAX_GRAM = 8;
+    static const int MAX_SYMBOLS = 20000;
+    static const int SAMPLE_KEYS = 10000;
+    static const int DEFAULT_SYMBOLS = 4096;
+
+    KeyEncoder();
+
+    // Picks up to numSymbols n-grams (2 .. MAX_GRAM bytes) from an even
+    // sample of keys. Code bytes are >= minByte, so encoded keys can
+    // stay clear of bytes with a special meaning.
+    void build(const vector<string> &keys, int numSymbols, int minByte = 0);
+
+    // out must hold 2 * keylen bytes; returns the encoded length
+    int encode(const uint8_t* key, int keylen, uint8_t* out) const;
+    string encode(const string &key) const;
+    string decode(const uint8_t* code, int codelen) const;
+
+    int numSymbols() const;
+    uint64_t mem() const;
+
+private:
+    struct Code {
+	uint8_t bytes[2];
+	uint8_t len;
+    };
+
+    void buildIntervals(const vector<string> &grams);
+    void countUsage(const vector<const string*> &sample, vector<uint64_t> &usage) const;
+    void assignCodes(const vector<uint64_t> &usage);
+    inline uint32_t findInterval(const uint8_t* key, int keylen) const;
+    inline uint8_t codeByte(int i) const;
+    inline string symbol(uint32_t i) const;
+
+    int minByte_;
+    int numSymbols_;
+    // Left boundary of each interval, sorted. A boundary has at most
+    // MAX_GRAM bytes and is kept big-endian in a word (zero padded) plus
+    // its length; (word, length) pairs sort like the strings.
+    vector<uint64_t> boundWord_;
+    vector<uint8_t> boundLen_;
+    vector<uint8_t> symLen_;    // the interval's symbol is this prefix of its boundary
+    vector<Code> codes_;
+    uint32_t firstBound_[257];  // intervals whose boundary starts with byte c
+    int32_t leadInterval_[256]; // first interval of a lead byte, -1 if unused
+    bool leadSingle_[256];      // one-byte code
+};
+
+// A key encoded into a stack buffer (heap for long keys), or the key
+// itself when there is no encoder.
+class EncodedKey {
+public:
+    static const int STACK_BYTES = 256;
+
+    EncodedKey(const KeyEncoder* enc, const uint8_t* key, int keylen) {
+	if (enc == NULL) {
+	    data = key;
+	    len = keylen;
+	    return;
+	}
+	uint8_t* out = buf_;
+	if (2 * keylen > STACK_BYTES) {
+	    heap_.resize(2 * keylen);
+	    out = heap_.data();
+	}
+	len = enc->encode(key, keylen, out);
+	data = out;
+    }
+
+    const uint8_t* data;
+    int len;
+
+private:
+    uint8_t buf_[STACK_BYTES];
+    vector<uint8_t> heap_;
+};
+
+#endif /* _KEYENCODER_H_ */
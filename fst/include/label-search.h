@@ -0,0 +1,194 @@
+#ifndef _LABEL_SEARCH_H_
+#define _LABEL_SEARCH_H_
+
+#include <stdint.h>
+#include <emmintrin.h>
+
+#include "common.h"
+#include "fst-config.h"
+
+//******************************************************
+// Label search kernels for LOUDS-Sparse nodes.
+// Each searches the size sorted labels starting at labels[pos] for
+// target. On success pos is moved to the match (or, for the
+// lowerBound variants, to the first label >= target).
+//******************************************************
+
+//******************************************************
+// SIMD SEARCH
+//******************************************************
+inline bool simdSearch(const uint8_t* labels, uint64_t &pos, uint64_t size, uint8_t target) {
+    uint64_t s = 0;
+    while (size >> 4) {
+	__m128i cmp= _mm_cmpeq_epi8(_mm_set1_epi8(target), _mm_loadu_si128(reinterpret_cast<const __m128i*>(labels + pos + s)));
+	unsigned bitfield= _mm_movemask_epi8(cmp);
+	if (bitfield) {
+	    pos += (s + __builtin_ctz(bitfield));
+	    return true;
+	}
+	s += 16;
+	size -= 16;
+    }
+
+    if (size > 0) {
+	__m128i cmp= _mm_cmpeq_epi8(_mm_set1_epi8(target), _mm_loadu_si128(reinterpret_cast<const __m128i*>(labels + pos + s)));
+	unsigned bitfield= _mm_movemask_epi8(cmp) & ((1 << size) - 1);
+	if (bitfield) {
+	    pos += (s + __builtin_ctz(bitfield));
+	    return true;
+	}
+    }
+    return false;
+}
+
+inline bool simdSearch_lowerBound(const uint8_t* labels, uint64_t &pos, uint64_t size, uint8_t target) {
+    __m128i t = _mm_set1_epi8(target);
+    uint64_t s = 0;
+    while (size > 0) {
+	__m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(labels + pos + s));
+	// unsigned l >= target <=> max(l, target) == l
+	unsigned bitfield = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(l, t), l));
+	if (size < 16)
+	    bitfield &= (1 << size) - 1;
+	if (bitfield) {
+	    pos += (s + __builtin_ctz(bitfield));
+	    return true;
+	}
+	uint64_t n = (size < 16) ? size : 16;
+	s += n;
+	size -= n;
+    }
+    pos += s;
+    return false;
+}
+
+//******************************************************
+// BINARY SEARCH
+//******************************************************
+inline bool binarySearch(const uint8_t* labels, uint64_t &pos, uint64_t size, uint8_t target) {
+    uint64_t l = pos;
+    uint64_t r = pos + size;
+    while (l < r) {
+	uint64_t m = (l + r) >> 1;
+	if (labels[m] == target) {
+	    pos = m;
+	    return true;
+	}
+	else if (labels[m] < target)
+	    l = m + 1;
+	else
+	    r = m;
+    }
+    return false;
+}
+
+inline bool binarySearch_lowerBound(const uint8_t* labels, uint64_t &pos, uint64_t size, uint8_t target) {
+    uint64_t rightBound = pos + size;
+    uint64_t l = pos;
+    uint64_t r = rightBound;
+    while (l < r) {
+	uint64_t m = (l + r) >> 1;
+	if (labels[m] < target)
+	    l = m + 1;
+	else
+	    r = m;
+    }
+    pos = l;
+    return pos < rightBound;
+}
+
+//******************************************************
+// LINEAR SEARCH
+//******************************************************
+inline bool linearSearch(const uint8_t* labels, uint64_t &pos, uint64_t size, uint8_t target) {
+    for (int i = 0; i < size; i++) {
+	if (labels[pos] == target)
+	    return true;
+	pos++;
+    }
+    return false;
+}
+
+inline bool linearSearch_lowerBound(const uint8_t* labels, uint64_t &pos, uint64_t size, uint8_t target) {
+    for (int i = 0; i < size; i++) {
+	if (labels[pos] >= target)
+	    return true;
+	pos++;
+    }
+    return false;
+}
+
+//******************************************************
+// BITMAP SEARCH
+// For nodes stored as a 256-bit label bitmap (MSB first, see setBit):
+// a bit test, and a popcount of the labels below the match for its
+// offset.
+//******************************************************
+inline int labelsBelow(const uint64_t* bits, uint8_t c) {
+    int group = c >> 6;
+    int idx = c & 63;
+    int n = 0;
+    for (int i = 0; i < group; i++)
+	n += __builtin_popcountll(bits[i]);
+    if (idx > 0)
+	n += __builtin_popcountll(bits[group] >> (64 - idx));
+    return n;
+}
+
+// the label with k labels below it
+inline uint8_t selectLabel(const uint64_t* bits, int k) {
+    int group = 0;
+    int n;
+    while (k >= (n = __builtin_popcountll(bits[group]))) {
+	k -= n;
+	group++;
+    }
+    uint64_t b64 = bits[group];
+    for (; k > 0; k--)
+	b64 &= ~(MSB_MASK >> __builtin_clzll(b64));
+    return (group << 6) + __builtin_clzll(b64);
+}
+
+inline bool bitmapSearch(const uint64_t* bits, uint64_t &pos, uint8_t target) {
+    if (!isLabelExist((uint64_t*)bits, target))
+	return false;
+    pos += labelsBelow(bits, target);
+    return true;
+}
+
+inline bool bitmapSearch_lowerBound(const uint64_t* bits, uint64_t &pos, uint64_t size, uint8_t target) {
+    uint8_t c;
+    if (!isLabelExist_lowerBound((uint64_t*)bits, target, c)) {
+	pos += size;
+	return false;
+    }
+    pos += labelsBelow(bits, c);
+    return true;
+}
+
+//******************************************************
+// NODE SEARCH
+// Picks a kernel by node size. The thresholds default to
+// fst-config.h and can be given explicitly to compare settings.
+//******************************************************
+template<int LINEAR_BELOW = FST_SEARCH_LINEAR_BELOW, int BINARY_BELOW = FST_SEARCH_BINARY_BELOW>
+inline bool nodeSearch(const uint8_t* labels, uint64_t &pos, int size, uint8_t target) {
+    if (size < LINEAR_BELOW)
+	return linearSearch(labels, pos, size, target);
+    else if (size < BINARY_BELOW)
+	return binarySearch(labels, pos, size, target);
+    else
+	return simdSearch(labels, pos, size, target);
+}
+
+template<int LINEAR_BELOW = FST_LOWERBOUND_LINEAR_BELOW, int BINARY_BELOW = FST_LOWERBOUND_BINARY_BELOW>
+inline bool nodeSearch_lowerBound(const uint8_t* labels, uint64_t &pos, int size, uint8_t target) {
+    if (size < LINEAR_BELOW)
+	return linearSearch_lowerBound(labels, pos, size, target);
+    else if (size < BINARY_BELOW)
+	return binarySearch_lowerBound(labels, pos, size, target);
+    else
+	return simdSearch_lowerBound(labels, pos, size, target);
+}
+
+#endif /* _LABEL_SEARCH_H_ */
@@ -0,0 +1,132 @@
+#ifndef _POSTINGLIST_H_
+#define _POSTINGLIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+using namespace std;
+
+//******************************************************
+// Posting lists of multi-value keys (FST::setMultiValue)
+//
+// Each list holds the values of one key in ascending order, stored from
+// a byte boundary as
+//   count (varint), first value (varint),
+//   if count > 1: delta width w (1 byte), count - 1 deltas of w bits
+// with the deltas packed LSB first. List i starts at byte
+// base_[i / 64] + offset_[i].
+//******************************************************
+
+// Forward iterator over one posting list.
+class PostingList {
+public:
+    PostingList() : data_(NULL), count_(0), left_(0), width_(0), bit_(0), value_(0) { }
+
+    // number of values in the list
+    uint32_t size() const { return count_; }
+
+    inline bool next(uint64_t &value);
+    // decodes the values not read yet into out, returns how many
+    inline uint32_t decode(uint64_t* out);
+
+private:
+    static inline uint64_t readVarint(const uint8_t* &p) {
+	uint64_t v = 0;
+	int shift = 0;
+	while (*p & 0x80) {
+	    v |= (uint64_t)(*p++ & 0x7F) << shift;
+	    shift += 7;
+	}
+	v |= (uint64_t)(*p++) << shift;
+	return v;
+    }
+
+    inline void open(const uint8_t* p);
+    inline uint64_t readDelta();
+
+    const uint8_t* data_; // deltas
+    uint32_t count_;
+    uint32_t left_;       // values not read yet
+    int width_;
+    uint64_t bit_;        // next delta
+    uint64_t value_;      // last value read
+
+    friend class PostingLists;
+};
+
+class PostingLists {
+public:
+    PostingLists() { }
+
+    // Appends a list of values[0 .. n-1] (any order, n > 0); returns its id.
+    uint64_t add(const uint64_t* values, uint32_t n);
+    // pads the data so that reads past the last list stay in bounds
+    void finish();
+    void clear();
+
+    uint64_t numLists() const { return offset_.size(); }
+    uint64_t mem() const;
+
+    inline PostingList list(uint64_t id) const {
+	PostingList l;
+	l.open(data_.data() + base_[id >> 6] + offset_[id]);
+	return l;
+    }
+
+private:
+    void writeVarint(uint64_t v);
+
+    vector<uint8_t> data_;
+    vector<uint64_t> base_;   // byte offset of every 64th list
+    vector<uint32_t> offset_; // byte offset of a list from its base
+};
+
+//******************************************************
+// PostingList inline functions
+//******************************************************
+inline void PostingList::open(const uint8_t* p) {
+    count_ = readVarint(p);
+    left_ = count_;
+    value_ = readVarint(p);
+    width_ = 0;
+    if (count_ > 1)
+	width_ = *p++;
+    data_ = p;
+    bit_ = 0;
+}
+
+// Deltas never span more than 9 bytes; the data is padded for the
+// unaligned 8-byte reads.
+inline uint64_t PostingList::readDelta() {
+    const uint8_t* p = data_ + (bit_ >> 3);
+    int shift = bit_ & 7;
+    uint64_t w;
+    memcpy(&w, p, 8);
+    uint64_t v = w >> shift;
+    if (shift + width_ > 64)
+	v |= (uint64_t)p[8] << (64 - shift);
+    bit_ += width_;
+    return (width_ == 64) ? v : (v & ((1ULL << width_) - 1));
+}
+
+inline bool PostingList::next(uint64_t &value) {
+    if (left_ == 0)
+	return false;
+    if (left_ < count_)
+	value_ += readDelta();
+    left_--;
+    value = value_;
+    return true;
+}
+
+inline uint32_t PostingList::decode(uint64_t* out) {
+    uint32_t n = 0;
+    while (next(out[n]))
+	n++;
+    return n;
+}
+
+#endif /* _POSTINGLIST_H_ */
@@ -0,0 +1,31 @@
+#ifndef _RADIXSORT_H_
+#define _RADIXSORT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+#include <string>
+
+using namespace std;
+
+//******************************************************
+// Radix sorts feeding FST::loadUnsorted
+//
+// Both sorts are stable and hand back the sorted order as a permutation
+// of key indices, so equal keys stay in input order. Work is split over
+// threads (0: one per hardware thread).
+//******************************************************
+
+// MSD radix sort on bytes. lcp[i] gets the length of the common prefix
+// of the i-th and (i+1)-th sorted keys, which the sort knows anyway
+// (the depth at which it split them). Large buckets are shared out
+// between the threads, small ones are sorted by the thread that split
+// them.
+void radixSort(const vector<string> &keys, vector<uint32_t> &order, vector<uint32_t> &lcp, int threads = 0);
+
+// LSD radix sort on 64-bit keys, 11-bit digits, least significant
+// first; passes over a digit that all keys share are skipped.
+void radixSort(const vector<uint64_t> &keys, vector<uint32_t> &order, int threads = 0);
+
+#endif /* _RADIXSORT_H_ */
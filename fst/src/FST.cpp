@@ -1,40 +1,126 @@
 #include <FST.hpp>
 
-FST::FST() : cutoff_level_(0), nodeCountU_(0), childCountU_(0),
-	     cbitsU_(NULL), tbitsU_(NULL), obitsU_(NULL), valuesU_(NULL),
+#include <string.h>
+#include <sys/time.h>
+#include <sstream>
+#include <thread>
+
+const uint8_t FST::TERM;
+const int FST::NODE_BITMAP_MIN;
+const int FST::BITMAP_NODE_BYTES;
+static_assert(FST::NODE_BITMAP_MIN > FST::BITMAP_NODE_BYTES, "FST_NODE_BITMAP_MIN must exceed the size of a bitmap node");
+const int FST::SPARSE_LEVEL_ORDER;
+const int FST::SPARSE_BLOCKED;
+const int FST::SPARSE_BLOCK_LEVELS;
+const int FST::SPARSE_BLOCK_LABELS;
+const int FST::FOREACH_CHUNK;
+const int FST::EXPORT_BATCH;
+const int FST::EXPORT_BYTES;
+const int FST::SCAN_GROUP;
+const int FSTIter::INLINE_LEVELS;
+
+FST::FST() : cutoff_ratio_(CUTOFF_RATIO), keyCompression_(0), encoder_(NULL), multiValue_(false), postings_(NULL), payloadOffsets_(NULL), rankAccess_(false), rankKeys_(0), cutoff_level_(0), nodeCountU_(0), childCountU_(0),
+	     cbitsU_(NULL), tbitsU_(NULL), obitsU_(NULL), valuesU_(NULL), nodeTypesU_(NULL), ltbitsU_(NULL),
 	     cbytes_(NULL), tbits_(NULL), sbits_(NULL), values_(NULL),
-	     tree_height_(0), last_value_pos_(0),
-	     c_lenU_(0), o_lenU_(0), c_memU_(0), t_memU_(0), o_memU_(0), val_memU_(0),
-	     c_mem_(0), t_mem_(0), s_mem_(0), val_mem_(0), num_t_(0) { }
+	     sparseLayout_(SPARSE_LEVEL_ORDER), fixedKeyLen_(0), nodeTypes_(NULL), tree_height_(0), last_value_pos_(0),
+	     c_lenU_(0), o_lenU_(0), c_memU_(0), t_memU_(0), o_memU_(0), val_memU_(0), list_memU_(0), type_memU_(0),
+	     c_mem_(0), label_mem_(0), t_mem_(0), s_mem_(0), val_mem_(0), dir_mem_(0), type_mem_(0), num_t_(0), stats_() { }
 
 FST::~FST() {
-    if (cbitsU_) delete cbitsU_;
-    if (tbitsU_) delete tbitsU_;
-    if (obitsU_) delete obitsU_;
-    if (valuesU_) delete valuesU_;
+    clear();
+    if (encoder_) delete encoder_;
+    if (postings_) delete postings_;
+    if (payloadOffsets_) delete payloadOffsets_;
+}
 
-    if (cbytes_) delete cbytes_;
-    if (tbits_) delete tbits_;
-    if (sbits_) delete sbits_;
-    if (values_) delete values_;
+// Frees the trie and resets everything loadKeys builds; the settings
+// for the next load() stay. The bitmaps leave their bits to the FST.
+void FST::clear() {
+    if (cbitsU_) { delete[] cbitsU_->getBits(); delete cbitsU_; }
+    if (tbitsU_) { delete[] tbitsU_->getBits(); delete tbitsU_; }
+    if (obitsU_) { delete[] obitsU_->getBits(); delete obitsU_; }
+    if (valuesU_) delete[] valuesU_;
+    if (nodeTypesU_) { delete[] nodeTypesU_->getBits(); delete nodeTypesU_; }
+    if (ltbitsU_) { delete[] ltbitsU_->getBits(); delete ltbitsU_; }
+    cbitsU_ = tbitsU_ = obitsU_ = NULL;
+    valuesU_ = NULL;
+    nodeTypesU_ = ltbitsU_ = NULL;
+    labelsU_.clear();
+    listStartU_.clear();
+
+    if (cbytes_) delete[] cbytes_;
+    if (tbits_) { delete[] tbits_->getBits(); delete tbits_; }
+    if (sbits_) { delete[] sbits_->getBits(); delete sbits_; }
+    if (values_) delete[] values_;
+    if (nodeTypes_) { delete[] nodeTypes_->getBits(); delete nodeTypes_; }
+    cbytes_ = NULL;
+    tbits_ = NULL;
+    sbits_ = NULL;
+    values_ = NULL;
+    nodeTypes_ = NULL;
+
+    rankCountsU_.clear();
+    rankCounts_.clear();
+    rankKeys_ = 0;
+    cutoff_level_ = 0;
+    nodeCountU_ = childCountU_ = 0;
+    sparseLayout_ = SPARSE_LEVEL_ORDER;
+    fixedKeyLen_ = 0;
+    blocks_.clear();
+    blockLevelStart_.clear();
+    bandFirstBlock_.clear();
+    rootSample_.clear();
+    tree_height_ = 0;
+    last_value_pos_ = 0;
+    c_lenU_ = o_lenU_ = 0;
+    c_memU_ = t_memU_ = o_memU_ = val_memU_ = 0;
+    list_memU_ = type_memU_ = 0;
+    c_mem_ = label_mem_ = 0;
+    t_mem_ = s_mem_ = 0;
+    val_mem_ = dir_mem_ = type_mem_ = 0;
+    num_t_ = 0;
+    stats_ = FSTStats();
 }
 
 //stat
-uint32_t FST::cMemU() { return c_memU_; }
-uint32_t FST::tMemU() { return t_memU_; }
-uint32_t FST::oMemU() { return o_memU_;}
-uint32_t FST::keyMemU() { return (c_memU_ + t_memU_ + o_memU_); }
-uint32_t FST::valueMemU() { return val_memU_; }
+uint32_t FST::cMemU() const { return c_memU_; }
+uint32_t FST::tMemU() const { return t_memU_; }
+uint32_t FST::oMemU() const { return o_memU_;}
+uint32_t FST::keyMemU() const { return (c_memU_ + t_memU_ + o_memU_ + list_memU_ + type_memU_); }
+uint32_t FST::valueMemU() const { return val_memU_; }
+
+uint64_t FST::cMem() const { return label_mem_; }
+uint32_t FST::tMem() const { return t_mem_; }
+uint32_t FST::sMem() const { return s_mem_;}
+uint64_t FST::keyMem() const { return (label_mem_ + t_mem_ + s_mem_ + type_mem_); }
+uint64_t FST::valueMem() const { return val_mem_; }
+
+uint64_t FST::mem() const { return memory().total; }
+
+int FST::sparseLayout() const { return sparseLayout_; }
+
+uint32_t FST::numT() const { return num_t_; }
+
+void FST::setCutoffRatio(int ratio) { cutoff_ratio_ = ratio; }
+
+void FST::setKeyCompression(int numSymbols) { keyCompression_ = numSymbols; }
+const KeyEncoder* FST::keyEncoder() const { return encoder_; }
+
+void FST::setMultiValue(bool on) { multiValue_ = on; }
+bool FST::multiValue() const { return postings_ != NULL; }
 
-uint64_t FST::cMem() { return c_mem_; }
-uint32_t FST::tMem() { return t_mem_; }
-uint32_t FST::sMem() { return s_mem_;}
-uint64_t FST::keyMem() { return (c_mem_ + t_mem_ + s_mem_); }
-uint64_t FST::valueMem() { return val_mem_; }
+void FST::setRankAccess(bool on) { rankAccess_ = on; }
+uint64_t FST::numKeys() const { return rankKeys_; }
 
-uint64_t FST::mem() { return (c_memU_ + t_memU_ + o_memU_ + val_memU_ + c_mem_ + t_mem_ + s_mem_ + val_mem_); }
+uint64_t FST::numSparseLabels() const { return c_mem_; }
+uint8_t FST::sparseLabel(uint64_t pos) const { return label(pos); }
+int FST::sparseNodeSize(uint64_t pos) const { return nodeSize(pos); }
 
-uint32_t FST::numT() { return num_t_; }
+inline double getNow() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
 
 //*******************************************************************
 inline bool FST::insertChar_cond(const uint8_t ch, vector<uint8_t> &c, vector<uint64_t> &t, vector<uint64_t> &s, int &pos, int &nc) {
@@ -77,8 +163,117 @@ inline bool FST::insertChar(const uint8_t ch, bool isTerm, vector<uint8_t> &c, v
 //******************************************************
 // LOAD
 //******************************************************
-void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen) {
+void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout) {
+    loadSorted(keys, values, longestKeyLen, sparseLayout, NULL);
+    stats_.times.sort = 0;
+}
+
+void FST::loadSorted(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout, const vector<uint32_t>* lcp) {
+    if (postings_) delete postings_;
+    postings_ = NULL;
+    if (!multiValue_) {
+	loadEncoded(keys, values, longestKeyLen, sparseLayout, lcp);
+	stats_.postingBytes = 0;
+	return;
+    }
+
+    // one key per run of equal keys, its value the id of the run's list
+    PostingLists* postings = new PostingLists();
+    vector<string> distinct;
+    vector<uint64_t> ids;
+    vector<uint32_t> distinctLcp;
+    int k = 0;
+    while (k < (int)keys.size()) {
+	int end = k + 1;
+	while (end < (int)keys.size()
+	       && (lcp ? ((*lcp)[end - 1] == keys[k].length() && keys[end].length() == keys[k].length())
+		   : keys[end].compare(keys[k]) == 0))
+	    end++;
+	distinct.push_back(keys[k]);
+	ids.push_back(postings->add(&values[k], end - k));
+	if (lcp)
+	    distinctLcp.push_back((*lcp)[end - 1]);
+	k = end;
+    }
+    postings->finish();
+    loadEncoded(distinct, ids, longestKeyLen, sparseLayout, lcp ? &distinctLcp : NULL);
+
+    postings_ = postings;
+    stats_.postingBytes = postings_->mem();
+}
+
+void FST::load(vector<string> &keys, vector<string> &payloads, int longestKeyLen, int sparseLayout) {
+    if (postings_) delete postings_;
+    postings_ = NULL;
+    stats_.postingBytes = 0;
+
+    // a run of equal keys gets one rank, loadKeys keeps the last key's
+    // value and so the last payload goes into the blob
+    vector<uint64_t> ranks(keys.size());
+    vector<uint64_t> offsets(1, 0);
+    vector<uint8_t> blob;
+    uint64_t rank = 0;
+    for (int k = 0; k < (int)keys.size(); k++) {
+	ranks[k] = rank;
+	if (k + 1 < (int)keys.size() && keys[k].compare(keys[k+1]) == 0)
+	    continue;
+	blob.insert(blob.end(), payloads[k].begin(), payloads[k].end());
+	offsets.push_back(blob.size());
+	rank++;
+    }
+    loadEncoded(keys, ranks, longestKeyLen, sparseLayout, NULL);
+    stats_.times.sort = 0;
+
+    blob.shrink_to_fit();
+    payloadBlob_.swap(blob);
+    payloadOffsets_ = new EliasFano(offsets);
+    stats_.payloadBytes = payloadBlob_.size() + payloadOffsets_->mem();
+}
+
+void FST::loadEncoded(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout, const vector<uint32_t>* lcp) {
+    if (payloadOffsets_) delete payloadOffsets_;
+    payloadOffsets_ = NULL;
+    payloadBlob_.clear();
+    stats_.payloadBytes = 0;
+
+    if (encoder_) delete encoder_;
+    encoder_ = NULL;
+    if (keyCompression_ <= 0) {
+	loadKeys(keys, values, longestKeyLen, sparseLayout, lcp);
+	stats_.keyDictBytes = 0;
+	return;
+    }
+
+    // Encoding preserves order, the encoded keys are still sorted. Code
+    // bytes stay above TERM: sparse nodes keep a TERM label first, and
+    // dense label 0 shares its value slot with D-IsPrefixKey.
+    KeyEncoder* encoder = new KeyEncoder();
+    encoder->build(keys, keyCompression_, TERM + 1);
+    vector<string> encoded(keys.size());
+    int longestEncoded = 0;
+    for (int k = 0; k < (int)keys.size(); k++) {
+	encoded[k] = encoder->encode(keys[k]);
+	longestEncoded = max(longestEncoded, (int)encoded[k].length());
+    }
+    loadKeys(encoded, values, longestEncoded, sparseLayout, NULL);
+
+    encoder_ = encoder;
+    fixedKeyLen_ = 0; // FixedKey lookups must go through the encoder
+    stats_.keyDictBytes = encoder_->mem();
+}
+
+void FST::loadKeys(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen, int sparseLayout, const vector<uint32_t>* lcp) {
+    clear();
+    double startTime = getNow();
     tree_height_ = longestKeyLen;
+    sparseLayout_ = sparseLayout;
+
+    fixedKeyLen_ = keys.empty() ? 0 : keys[0].length();
+    for (int k = 1; k < (int)keys.size() && fixedKeyLen_ > 0; k++) {
+	if ((int)keys[k].length() != fixedKeyLen_)
+	    fixedKeyLen_ = 0;
+    }
+
     vector<vector<uint8_t> > c;
     vector<vector<uint64_t> > t;
     vector<vector<uint64_t> > s;
@@ -107,8 +302,10 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	uint64_t value = values[k];
 
 	// if same key
-	if (k < (int)(keys.size()-1) && key.compare(keys[k+1]) == 0)
-	    continue;
+	if (k < (int)(keys.size()-1)) {
+	    if (lcp ? ((*lcp)[k] == key.length() && (*lcp)[k] == keys[k+1].length()) : key.compare(keys[k+1]) == 0)
+		continue;
+	}
 
 	int i = 0;
 	while (i < key.length() && !insertChar_cond((uint8_t)key[i], c[i], t[i], s[i], pos_list[i], nc[i]))
@@ -116,7 +313,7 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 
 	if (i < key.length()) {
 	    if (k + 1 < (int)keys.size()) {
-		int cpl = commonPrefixLen(key, keys[k+1]);
+		int cpl = lcp ? (*lcp)[k] : commonPrefixLen(key, keys[k+1]);
 		if (i < cpl) {
 		    if (pos_list[i] % 64 == 0)
 			setBit(t[i].rbegin()[1], 63);
@@ -147,20 +344,20 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	    last_value_level = i;
     }
 
+    double levelsTime = getNow();
+
     // put together
     int nc_total = 0;
     for (int i = 0; i < (int)nc.size(); i++)
 	nc_total += nc[i];
 
     int nc_u = 0;
-    while (nc_u * CUTOFF_RATIO < nc_total) {
+    while (nc_u * cutoff_ratio_ < nc_total) {
 	nc_u += nc[cutoff_level_];
 	cutoff_level_++;
     }
     cutoff_level_--;
 
-    cout << "cutoff_level_ = " << cutoff_level_ << "\n";
-
     // determine the position of the last value for range query boundary check
     if (last_value_level < cutoff_level_) {
 	for (int i = 0; i <= last_value_level; i++)
@@ -173,6 +370,8 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	last_value_pos_--;
     }
 
+    double cutoffTime = getNow();
+
     //-------------------------------------------------
     vector<vector<uint64_t> > cU;
     vector<vector<uint64_t> > tU;
@@ -235,17 +434,22 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	vallenU += val[i].size();
     }
     
-    uint64_t* cbitsU = new uint64_t[c_lenU_];
-    uint64_t* tbitsU = new uint64_t[c_lenU_];
-    uint64_t* obitsU = new uint64_t[o_lenU_ / 64 + 1];
+    // the bitmaps cover whole rank blocks
+    int c_sizeU = (c_lenU_ / 32 + 1) * 32; // round-up to 1024-bit block size for Poppy
+    int t_sizeU = (c_lenU_ / 32 + 1) * 32; // round-up to 1024-bit block size for Poppy
+    int o_sizeU = (o_lenU_ / 64 / 32 + 1) * 32; // round-up to 1024-bit block size for Poppy
+
+    uint64_t* cbitsU = new uint64_t[c_sizeU];
+    uint64_t* tbitsU = new uint64_t[t_sizeU];
+    uint64_t* obitsU = new uint64_t[o_sizeU];
     valuesU_ = new uint64_t[vallenU];
 
     // init
-    for (int i = 0; i < c_lenU_; i++) {
+    for (int i = 0; i < c_sizeU; i++) {
 	cbitsU[i] = 0;
 	tbitsU[i] = 0;
     }
-    for (int i = 0; i < (o_lenU_ / 64 + 1); i++)
+    for (int i = 0; i < o_sizeU; i++)
 	obitsU[i] = 0;
 
     uint64_t c_bitPosU = 0;
@@ -259,7 +463,6 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	}
     }
 
-    int c_sizeU = (c_lenU_ / 32 + 1) * 32; // round-up to 1024-bit block size for Poppy
     cbitsU_ = new BitmapRankFPoppy(cbitsU, c_sizeU * 64);
     c_memU_ = cbitsU_->getNbits() / 8; //stat
 
@@ -274,7 +477,6 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	}
     }
 
-    int t_sizeU = (c_lenU_ / 32 + 1) * 32; // round-up to 1024-bit block size for Poppy
     tbitsU_ = new BitmapRankFPoppy(tbitsU, t_sizeU * 64);
     t_memU_ = tbitsU_->getNbits() / 8; //stat
 
@@ -287,7 +489,6 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	}
     }
 
-    int o_sizeU = (o_lenU_ / 64 / 32 + 1) * 32; // round-up to 1024-bit block size for Poppy
     obitsU_ = new BitmapRankFPoppy(obitsU, o_sizeU * 64);
     o_memU_ = obitsU_->getNbits() / 8; //stat
 
@@ -300,6 +501,10 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
     }
     val_memU_ = vallenU * 8;
 
+    uint64_t listNodes = encodeListNodesU();
+
+    double denseTime = getNow();
+
     //-------------------------------------------------
     for (int i = cutoff_level_; i < (int)c.size(); i++)
 	c_mem_ += c[i].size();
@@ -320,6 +525,7 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
     s_mem_ = (s_mem_ / 32 + 1) * 32; // round-up to 2048-bit block size for Poppy
 
     cbytes_ = new uint8_t[c_mem_];
+    label_mem_ = c_mem_;
     uint64_t* tbits = new uint64_t[t_mem_];
     uint64_t* sbits = new uint64_t[s_mem_];
     values_ = new uint64_t[val_mem_ / sizeof(uint64_t)];
@@ -330,137 +536,800 @@ void FST::load(vector<string> &keys, vector<uint64_t> &values, int longestKeyLen
 	sbits[i] = 0;
     }
 
+    // the order in which runs of each level are laid out
+    vector<SparseSegment> segments;
+    if (sparseLayout_ == SPARSE_BLOCKED)
+	buildSparseBlocks(t, s, pos_list, segments);
+    else {
+	for (int i = cutoff_level_; i < (int)c.size(); i++) {
+	    SparseSegment seg = {i, 0, (uint64_t)pos_list[i], 0, val[i].size()};
+	    segments.push_back(seg);
+	}
+    }
+
     uint64_t c_pos = 0;
-    for (int i = cutoff_level_; i < (int)c.size(); i++) {
-	for (int j = 0; j < (int)c[i].size(); j++) {
+    uint64_t val_pos = 0;
+    for (int k = 0; k < (int)segments.size(); k++) {
+	const SparseSegment &seg = segments[k];
+	int i = seg.level;
+	for (uint64_t j = seg.start; j < seg.end; j++) {
 	    cbytes_[c_pos] = c[i][j];
+	    if (readBit(t[i][j / 64], j % 64))
+		setBit(tbits[c_pos/64], c_pos % 64);
+	    if (readBit(s[i][j / 64], j % 64))
+		setBit(sbits[c_pos/64], c_pos % 64);
 	    c_pos++;
 	}
-    }
-
-    uint64_t t_bitPos = 0;
-    for (int i = cutoff_level_; i < (int)t.size(); i++) {
-	uint64_t bitPos_i = 0;
-	uint64_t maxPos_i = pos_list[i];
-	for (int j = 0; j < (int)t[i].size(); j++) {
-	    if (bitPos_i >= maxPos_i) break;
-	    for (int k = 0; k < 64; k++) {
-		if (bitPos_i >= maxPos_i) break;
-		if (readBit(t[i][j], k))
-		    setBit(tbits[t_bitPos/64], t_bitPos % 64);
-		t_bitPos++;
-		bitPos_i++;
-	    }
+	for (uint64_t j = seg.valStart; j < seg.valEnd; j++) {
+	    if (sparseLayout_ == SPARSE_BLOCKED && i == last_value_level && j + 1 == val[i].size())
+		last_value_pos_ = val_pos;
+	    values_[val_pos] = val[i][j];
+	    val_pos++;
 	}
     }
 
+    // mark the end of the last node so that nodeSize (and nextInLevel)
+    // find it like any other node end
+    setBit(sbits[c_mem_/64], c_mem_ % 64);
+
     tbits_ = new BitmapRankPoppy(tbits, t_mem_ * 64);
     t_mem_ = tbits_->getMem(); //stat
 
-    uint64_t s_bitPos = 0;
-    for (int i = cutoff_level_; i < (int)s.size(); i++) {
-	uint64_t bitPos_i = 0;
-	uint64_t maxPos_i = pos_list[i];
-	for (int j = 0; j < (int)s[i].size(); j++) {
-	    if (bitPos_i >= maxPos_i) break;
-	    for (int k = 0; k < 64; k++) {
-		if (bitPos_i >= maxPos_i) break;
-		if (readBit(s[i][j], k))
-		    setBit(sbits[s_bitPos/64], s_bitPos % 64);
-		s_bitPos++;
-		bitPos_i++;
-	    }
-	}
-    }
-
     sbits_ = new BitmapSelectPoppy(sbits, s_mem_ * 64);
     s_mem_ = sbits_->getMem(); //stat
 
-    uint64_t val_pos = 0;
-    for (int i = cutoff_level_; i < (int)val.size(); i++) {
-	for (int j = 0; j < (int)val[i].size(); j++) {
-	    values_[val_pos] = val[i][j];
-	    val_pos++;
-	}
+    uint64_t bitmapNodes = encodeBitmapNodes();
+
+    rankCountsU_.clear();
+    rankCounts_.clear();
+    rankKeys_ = 0;
+    if (rankAccess_) {
+	rankCountsU_.resize(childCountU_);
+	rankCounts_.resize(tbits_->pCount());
+	uint64_t block = 0;
+	uint64_t root = (cutoff_level_ > 0) ? 0 : sparseRootPos(0, block);
+	rankKeys_ = buildRankCounts(0, 0, root, block);
     }
+    stats_.rankBytes = (rankCountsU_.size() + rankCounts_.size()) * sizeof(uint32_t);
+
     //-------------------------------------------------
+    double endTime = getNow();
+
+    // stats
+    stats_.numKeys = keys.size();
+    stats_.cutoffLevel = cutoff_level_;
+    stats_.treeHeight = tree_height_;
+    stats_.sparseLayout = sparseLayout_;
+    stats_.sparseBlocks = blocks_.size();
+    stats_.levels.clear();
+
+    uint64_t firstNode = 0;
+    uint64_t firstPos = 0;
+    for (int i = 0; i < (int)c.size(); i++) {
+	FSTLevelStats ls = FSTLevelStats();
+	ls.level = i;
+	ls.dense = (i < cutoff_level_);
+	ls.firstNode = firstNode;
+	ls.nodeCount = nc[i];
+	ls.labelCount = pos_list[i];
+	ls.avgFanout = (nc[i] == 0) ? 0 : (double)pos_list[i] / nc[i];
+	ls.valueBytes = val[i].size() * sizeof(uint64_t);
+	if (ls.dense) {
+	    ls.firstPos = firstNode << 8;
+	    ls.labelBits = (uint64_t)nc[i] * 256;
+	    ls.hasChildBits = (uint64_t)nc[i] * 256;
+	    if (listNodes > 0) {
+		// 9 bits per label for each list node
+		for (uint64_t n = firstNode; n < firstNode + nc[i]; n++) {
+		    if (!isListNodeU(n))
+			continue;
+		    uint64_t list = nodeTypesU_->rank(n);
+		    uint64_t labels = listStartU_[list + 1] - listStartU_[list];
+		    ls.labelBits -= 256 - labels * 8;
+		    ls.hasChildBits -= 256 - labels;
+		}
+	    }
+	    ls.prefixBits = nc[i];
+	    // one 32-bit rank entry per 64 bits
+	    ls.lutBytes = (ls.labelBits + ls.hasChildBits + ls.prefixBits) / 64 * sizeof(uint32_t);
+	}
+	else {
+	    ls.firstPos = firstPos;
+	    ls.labelBits = (uint64_t)pos_list[i] * 8;
+	    if (bitmapNodes > 0) {
+		// BITMAP_NODE_BYTES for each bitmap node
+		uint64_t start = 0;
+		for (uint64_t j = 1; j <= (uint64_t)pos_list[i]; j++) {
+		    if (j < (uint64_t)pos_list[i] && !readBit(s[i][j / 64], j % 64))
+			continue;
+		    if (j - start >= (uint64_t)NODE_BITMAP_MIN)
+			ls.labelBits -= (j - start - BITMAP_NODE_BYTES) * 8;
+		    start = j;
+		}
+	    }
+	    ls.hasChildBits = pos_list[i];
+	    ls.loudsBits = pos_list[i];
+	    // one rank entry per 512 bits, one select entry per 64 nodes
+	    ls.lutBytes = (ls.hasChildBits / 512 + ls.nodeCount / 64) * sizeof(uint32_t);
+	    firstPos += pos_list[i];
+	}
+	firstNode += nc[i];
+	stats_.levels.push_back(ls);
+    }
+
+    stats_.times.levels = levelsTime - startTime;
+    stats_.times.cutoff = cutoffTime - levelsTime;
+    stats_.times.dense = denseTime - cutoffTime;
+    stats_.times.sparse = endTime - denseTime;
+    stats_.times.total = endTime - startTime;
+
+    stats_.denseBytes = c_memU_ + t_memU_ + o_memU_ + val_memU_ + list_memU_;
+    stats_.sparseBytes = label_mem_ + tbits_->getNbits() / 8 + sbits_->getNbits() / 8 + val_mem_ + dir_mem_ + type_mem_;
+    stats_.nodeTypeBytes = type_mem_ + type_memU_;
+    stats_.bitmapNodes = bitmapNodes;
+    stats_.listNodes = listNodes;
+    stats_.blockDirBytes = dir_mem_;
+    stats_.lutBytes = (cbitsU_->getMem() - cbitsU_->getNbits() / 8)
+	+ (tbitsU_->getMem() - tbitsU_->getNbits() / 8)
+	+ (obitsU_->getMem() - obitsU_->getNbits() / 8)
+	+ (nodeTypesU_ ? nodeTypesU_->getMem() - nodeTypesU_->getNbits() / 8 : 0)
+	+ (ltbitsU_ ? ltbitsU_->getMem() - ltbitsU_->getNbits() / 8 : 0)
+	+ (tbits_->getMem() - tbits_->getNbits() / 8)
+	+ (sbits_->getMem() - sbits_->getNbits() / 8)
+	+ (nodeTypes_ ? nodeTypes_->getMem() - nodeTypes_->getNbits() / 8 : 0);
 }
 
-void FST::load(vector<uint64_t> &keys, vector<uint64_t> &values) {
+void FST::load(vector<uint64_t> &keys, vector<uint64_t> &values, int sparseLayout) {
     vector<string> keys_str;
     for (int i = 0; i < (int)keys.size(); i++) {
 	char key[8];
 	reinterpret_cast<uint64_t*>(key)[0]=__builtin_bswap64(keys[i]);
 	keys_str.push_back(string(key, 8));
     }
-    load(keys_str, values, sizeof(uint64_t));
+    load(keys_str, values, sizeof(uint64_t), sparseLayout);
+}
+
+void FST::loadUnsorted(const vector<string> &keys, const vector<uint64_t> &values, int sparseLayout, int threads) {
+    double startTime = getNow();
+    vector<uint32_t> order;
+    vector<uint32_t> lcp;
+    radixSort(keys, order, lcp, threads);
+
+    vector<string> sorted(keys.size());
+    vector<uint64_t> sortedValues(keys.size());
+    int longestKeyLen = 0;
+    for (int k = 0; k < (int)keys.size(); k++) {
+	sorted[k] = keys[order[k]];
+	sortedValues[k] = values[order[k]];
+	longestKeyLen = max(longestKeyLen, (int)sorted[k].length());
+    }
+    double sortTime = getNow() - startTime;
+
+    loadSorted(sorted, sortedValues, longestKeyLen, sparseLayout, &lcp);
+    stats_.times.sort = sortTime;
+    stats_.times.total += sortTime;
+}
+
+void FST::loadUnsorted(const vector<uint64_t> &keys, const vector<uint64_t> &values, int sparseLayout, int threads) {
+    double startTime = getNow();
+    vector<uint32_t> order;
+    radixSort(keys, order, threads);
+
+    vector<string> sorted(keys.size());
+    vector<uint64_t> sortedValues(keys.size());
+    vector<uint32_t> lcp(keys.size(), 0);
+    for (int k = 0; k < (int)keys.size(); k++) {
+	uint64_t key = keys[order[k]];
+	char bytes[8];
+	reinterpret_cast<uint64_t*>(bytes)[0] = __builtin_bswap64(key);
+	sorted[k] = string(bytes, 8);
+	sortedValues[k] = values[order[k]];
+	if (k > 0) {
+	    uint64_t diff = keys[order[k - 1]] ^ key;
+	    lcp[k - 1] = (diff == 0) ? 8 : __builtin_clzll(diff) / 8;
+	}
+    }
+    double sortTime = getNow() - startTime;
+
+    loadSorted(sorted, sortedValues, sizeof(uint64_t), sparseLayout, &lcp);
+    stats_.times.sort = sortTime;
+    stats_.times.total += sortTime;
+}
+
+//******************************************************
+// SPARSE BLOCKS
+//******************************************************
+// Cuts the sparse levels into bands of SPARSE_BLOCK_LEVELS levels and
+// the roots of each band into runs whose subtrees (within the band)
+// hold about SPARSE_BLOCK_LABELS labels. The descendants of a run of
+// nodes form a run on every level below, so a block is one segment per
+// level. Blocks are laid out band by band, in key order within a band.
+void FST::buildSparseBlocks(vector<vector<uint64_t> > &t, vector<vector<uint64_t> > &s, vector<int> &pos_list, vector<SparseSegment> &segments) {
+    int height = (int)pos_list.size();
+    int H = SPARSE_BLOCK_LEVELS;
+
+    // node start positions (plus the level size) and S-HasChild
+    // prefix counts of every sparse level
+    vector<vector<uint32_t> > nodeStart(height);
+    vector<vector<uint32_t> > tPrefix(height);
+    for (int i = cutoff_level_; i < height; i++) {
+	uint32_t ones = 0;
+	tPrefix[i].push_back(0);
+	for (uint64_t j = 0; j < (uint64_t)pos_list[i]; j++) {
+	    if (readBit(s[i][j / 64], j % 64))
+		nodeStart[i].push_back(j);
+	    if (readBit(t[i][j / 64], j % 64))
+		ones++;
+	    tPrefix[i].push_back(ones);
+	}
+	nodeStart[i].push_back(pos_list[i]);
+    }
+
+    // labels in the band below roots [l, h) of level top
+    auto subtreeLabels = [&](int top, uint64_t l, uint64_t h) {
+	uint64_t labels = 0;
+	for (int i = top; i < top + H && i < height; i++) {
+	    uint64_t start = nodeStart[i][l];
+	    uint64_t end = nodeStart[i][h];
+	    labels += end - start;
+	    l = tPrefix[i][start];
+	    h = tPrefix[i][end];
+	}
+	return labels;
+    };
+
+    uint64_t physPos = 0;
+    uint64_t nodeBase = 0;
+    uint64_t tBase = 0;
+    for (int top = cutoff_level_; top < height; top += H) {
+	int band = (top - cutoff_level_) / H;
+	bandFirstBlock_.push_back(blocks_.size());
+	rootSample_.push_back(vector<uint32_t>());
+
+	uint64_t numRoots = nodeStart[top].size() - 1;
+	uint64_t lo = 0;
+	while (lo < numRoots) {
+	    uint64_t hi = lo + 1;
+	    while (hi < numRoots && subtreeLabels(top, lo, hi + 1) <= SPARSE_BLOCK_LABELS)
+		hi++;
+
+	    SparseBlock b;
+	    b.nodeBase = nodeBase;
+	    b.tBase = tBase;
+	    b.innerChildren = 0;
+	    b.numRoots = hi - lo;
+	    b.rootBase = lo;
+	    b.childBase = 0;
+
+	    uint64_t l = lo;
+	    uint64_t h = hi;
+	    for (int k = 0; k < H; k++) {
+		int i = top + k;
+		blockLevelStart_.push_back(physPos);
+		if (i >= height)
+		    continue;
+
+		uint64_t start = nodeStart[i][l];
+		uint64_t end = nodeStart[i][h];
+		uint64_t ones = tPrefix[i][end] - tPrefix[i][start];
+		if (end > start) {
+		    SparseSegment seg = {i, start, end, start - tPrefix[i][start], end - tPrefix[i][end]};
+		    segments.push_back(seg);
+		}
+
+		if (k < H - 1)
+		    b.innerChildren += ones;
+		else
+		    b.childBase = tPrefix[i][start];
+
+		nodeBase += h - l;
+		tBase += ones;
+		physPos += end - start;
+		l = tPrefix[i][start];
+		h = tPrefix[i][end];
+	    }
+	    blockLevelStart_.push_back(physPos);
+
+	    for (uint64_t r = (lo + 63) / 64 * 64; r < hi; r += 64)
+		rootSample_[band].push_back(blocks_.size());
+	    blocks_.push_back(b);
+	    lo = hi;
+	}
+    }
+    bandFirstBlock_.push_back(blocks_.size());
+
+    dir_mem_ = blocks_.size() * sizeof(SparseBlock)
+	+ (blockLevelStart_.size() + bandFirstBlock_.size()) * sizeof(uint32_t);
+    for (int i = 0; i < (int)rootSample_.size(); i++)
+	dir_mem_ += rootSample_[i].size() * sizeof(uint32_t);
+}
+
+//******************************************************
+// STATS
+//******************************************************
+const FSTStats& FST::stats() const {
+    return stats_;
+}
+
+template<typename T>
+static inline uint64_t capacityBytes(const vector<T> &v) {
+    return v.capacity() * sizeof(T);
+}
+
+template<typename Bitmap>
+static inline uint64_t lutBytes(const Bitmap* b) {
+    return b ? b->getMem() - b->getNbits() / 8 : 0;
+}
+
+template<typename Bitmap>
+static inline uint64_t bitBytes(const Bitmap* b) {
+    return b ? b->getNbits() / 8 : 0;
+}
+
+FSTMemory FST::memory() const {
+    FSTMemory m = FSTMemory();
+    m.denseLabels = bitBytes(cbitsU_) + capacityBytes(labelsU_);
+    m.denseHasChild = bitBytes(tbitsU_) + bitBytes(ltbitsU_);
+    m.densePrefix = bitBytes(obitsU_);
+    m.denseValues = val_memU_;
+    m.denseLUT = lutBytes(cbitsU_) + lutBytes(tbitsU_) + lutBytes(obitsU_) + lutBytes(nodeTypesU_) + lutBytes(ltbitsU_);
+
+    m.sparseLabels = label_mem_;
+    m.sparseHasChild = bitBytes(tbits_);
+    m.sparseLouds = bitBytes(sbits_);
+    m.sparseValues = val_mem_;
+    m.sparseLUT = lutBytes(tbits_) + lutBytes(sbits_) + lutBytes(nodeTypes_);
+
+    m.blockDir = capacityBytes(blocks_) + capacityBytes(blockLevelStart_)
+	+ capacityBytes(bandFirstBlock_) + capacityBytes(rootSample_);
+    for (int i = 0; i < (int)rootSample_.size(); i++)
+	m.blockDir += capacityBytes(rootSample_[i]);
+    m.nodeTypes = bitBytes(nodeTypes_) + bitBytes(nodeTypesU_) + capacityBytes(listStartU_);
+
+    if (encoder_)
+	m.keyDict = sizeof(KeyEncoder) + encoder_->mem();
+    if (postings_)
+	m.postings = sizeof(PostingLists) + postings_->mem();
+    m.payloads = capacityBytes(payloadBlob_);
+    if (payloadOffsets_)
+	m.payloads += sizeof(EliasFano) + payloadOffsets_->mem();
+    m.rankCounts = capacityBytes(rankCountsU_) + capacityBytes(rankCounts_);
+
+    if (cbitsU_)
+	m.objects += 3 * sizeof(BitmapRankFPoppy);
+    if (tbits_)
+	m.objects += sizeof(BitmapRankPoppy) + sizeof(BitmapSelectPoppy);
+    if (nodeTypes_)
+	m.objects += sizeof(BitmapRankPoppy);
+    if (nodeTypesU_)
+	m.objects += 2 * sizeof(BitmapRankPoppy);
+
+    m.total = m.denseLabels + m.denseHasChild + m.densePrefix + m.denseValues + m.denseLUT
+	+ m.sparseLabels + m.sparseHasChild + m.sparseLouds + m.sparseValues + m.sparseLUT
+	+ m.blockDir + m.nodeTypes + m.keyDict + m.postings + m.payloads + m.rankCounts + m.objects;
+    return m;
+}
+
+// Single-line JSON so that it can be grepped out of benchmark logs.
+string FST::statsJSON() const {
+    FSTMemory m = memory();
+    ostringstream os;
+    os << "{\"numKeys\":" << stats_.numKeys
+       << ",\"cutoffLevel\":" << stats_.cutoffLevel
+       << ",\"treeHeight\":" << stats_.treeHeight
+       << ",\"sparseLayout\":\"" << (stats_.sparseLayout == SPARSE_BLOCKED ? "blocked" : "level") << "\""
+       << ",\"sparseBlocks\":" << stats_.sparseBlocks
+       << ",\"mem\":{\"dense\":" << stats_.denseBytes
+       << ",\"sparse\":" << stats_.sparseBytes
+       << ",\"lut\":" << stats_.lutBytes
+       << ",\"blockDir\":" << stats_.blockDirBytes
+       << ",\"keyDict\":" << stats_.keyDictBytes
+       << ",\"postings\":" << stats_.postingBytes
+       << ",\"payloads\":" << stats_.payloadBytes
+       << ",\"rank\":" << stats_.rankBytes
+       << ",\"nodeTypes\":" << stats_.nodeTypeBytes << "}"
+       << ",\"heap\":{\"denseLabels\":" << m.denseLabels
+       << ",\"denseHasChild\":" << m.denseHasChild
+       << ",\"densePrefix\":" << m.densePrefix
+       << ",\"denseValues\":" << m.denseValues
+       << ",\"denseLUT\":" << m.denseLUT
+       << ",\"sparseLabels\":" << m.sparseLabels
+       << ",\"sparseHasChild\":" << m.sparseHasChild
+       << ",\"sparseLouds\":" << m.sparseLouds
+       << ",\"sparseValues\":" << m.sparseValues
+       << ",\"sparseLUT\":" << m.sparseLUT
+       << ",\"blockDir\":" << m.blockDir
+       << ",\"nodeTypes\":" << m.nodeTypes
+       << ",\"keyDict\":" << m.keyDict
+       << ",\"postings\":" << m.postings
+       << ",\"payloads\":" << m.payloads
+       << ",\"rankCounts\":" << m.rankCounts
+       << ",\"objects\":" << m.objects
+       << ",\"total\":" << m.total << "}"
+       << ",\"bitmapNodes\":" << stats_.bitmapNodes
+       << ",\"listNodes\":" << stats_.listNodes
+       << ",\"times\":{\"levels\":" << stats_.times.levels
+       << ",\"cutoff\":" << stats_.times.cutoff
+       << ",\"dense\":" << stats_.times.dense
+       << ",\"sparse\":" << stats_.times.sparse
+       << ",\"sort\":" << stats_.times.sort
+       << ",\"total\":" << stats_.times.total << "}"
+       << ",\"levels\":[";
+    for (int i = 0; i < (int)stats_.levels.size(); i++) {
+	const FSTLevelStats &ls = stats_.levels[i];
+	if (i > 0)
+	    os << ",";
+	os << "{\"level\":" << ls.level
+	   << ",\"encoding\":\"" << (ls.dense ? "dense" : "sparse") << "\""
+	   << ",\"nodes\":" << ls.nodeCount
+	   << ",\"labels\":" << ls.labelCount
+	   << ",\"avgFanout\":" << ls.avgFanout
+	   << ",\"labelBits\":" << ls.labelBits
+	   << ",\"hasChildBits\":" << ls.hasChildBits
+	   << ",\"prefixBits\":" << ls.prefixBits
+	   << ",\"loudsBits\":" << ls.loudsBits
+	   << ",\"lutBytes\":" << ls.lutBytes
+	   << ",\"valueBytes\":" << ls.valueBytes << "}";
+    }
+    os << "]}";
+    return os.str();
 }
 
 //******************************************************
 // IS O BIT SET U?
 //******************************************************
-inline bool FST::isCbitSetU(uint64_t nodeNum, uint8_t kc) {
-    return isLabelExist(cbitsU_->bits_ + (nodeNum << 2), kc);
+inline bool FST::isCbitSetU(uint64_t nodeNum, uint8_t kc) const {
+    if (likely(nodeTypesU_ == NULL))
+	return isLabelExist(cbitsU_->bits_ + (nodeNum << 2), kc);
+    uint64_t list = nodeTypesU_->rank(nodeNum);
+    if (!isListNodeU(nodeNum))
+	return isLabelExist(cbitsU_->bits_ + ((nodeNum - list) << 2), kc);
+    uint64_t pos = listStartU_[list];
+    return ::nodeSearch<>(labelsU_.data(), pos, listStartU_[list + 1] - pos, kc);
 }
 //******************************************************
 // IS O BIT SET U?
 //******************************************************
-inline bool FST::isTbitSetU(uint64_t nodeNum, uint8_t kc) {
-    return isLabelExist(tbitsU_->bits_ + (nodeNum << 2), kc);
+inline bool FST::isTbitSetU(uint64_t nodeNum, uint8_t kc) const {
+    if (likely(nodeTypesU_ == NULL))
+	return isLabelExist(tbitsU_->bits_ + (nodeNum << 2), kc);
+    uint64_t list = nodeTypesU_->rank(nodeNum);
+    if (!isListNodeU(nodeNum))
+	return isLabelExist(tbitsU_->bits_ + ((nodeNum - list) << 2), kc);
+    uint64_t pos = listStartU_[list];
+    if (!::nodeSearch<>(labelsU_.data(), pos, listStartU_[list + 1] - pos, kc))
+	return false;
+    return readBit(ltbitsU_->bits_[pos >> 6], pos & (uint64_t)63);
 }
 //******************************************************
 // IS O BIT SET U?
 //******************************************************
-inline bool FST::isObitSetU(uint64_t nodeNum) {
+inline bool FST::isObitSetU(uint64_t nodeNum) const {
     return readBit(obitsU_->bits_[nodeNum >> 6], nodeNum & (uint64_t)63);
 }
 //******************************************************
 // IS S BIT SET?
 //******************************************************
-inline bool FST::isSbitSet(uint64_t pos) {
+inline bool FST::isSbitSet(uint64_t pos) const {
     return readBit(sbits_->bits_[pos >> 6], pos & (uint64_t)63);
 }
 //******************************************************
 // IS T BIT SET?
 //******************************************************
-inline bool FST::isTbitSet(uint64_t pos) {
+inline bool FST::isTbitSet(uint64_t pos) const {
     return readBit(tbits_->bits_[pos >> 6], pos & (uint64_t)63);
 }
 //******************************************************
 // GET VALUE POS U
 //******************************************************
-inline uint64_t FST::valuePosU(uint64_t nodeNum, uint64_t pos) {
-    return cbitsU_->rank(pos + 1) - tbitsU_->rank(pos + 1) + obitsU_->rank(nodeNum + 1) - 1;
+inline uint64_t FST::valuePosU(uint64_t nodeNum, uint64_t pos) const {
+    return labelsThroughU(nodeNum, pos & 255) - childrenThroughU(nodeNum, pos & 255) + obitsU_->rank(nodeNum + 1) - 1;
 }
 //******************************************************
 // GET VALUE POS
 //******************************************************
-inline uint64_t FST::valuePos(uint64_t pos) {
+inline uint64_t FST::valuePos(uint64_t pos) const {
     return pos - tbits_->rank(pos+1);
 }
 
 //******************************************************
 // CHILD NODE NUM
 //******************************************************
-inline uint64_t FST::childNodeNumU(uint64_t pos) {
-    return tbitsU_->rank(pos + 1);
+inline uint64_t FST::childNodeNumU(uint64_t pos) const {
+    return childrenThroughU(pos >> 8, pos & 255);
 }
-inline uint64_t FST::childNodeNum(uint64_t pos) {
+inline uint64_t FST::childNodeNum(uint64_t pos) const {
     return tbits_->rank(pos + 1);
 }
 
+//******************************************************
+// LIST NODES
+//******************************************************
+static inline int denseLabelCount(const uint64_t* bits) {
+    return __builtin_popcountll(bits[0]) + __builtin_popcountll(bits[1])
+	+ __builtin_popcountll(bits[2]) + __builtin_popcountll(bits[3]);
+}
+
+// A dense node of n < DENSE_LIST_BELOW labels takes 9n bits and an
+// offset as a list instead of 512 bits of D-Labels and D-HasChild. The
+// nodes are only stored that way if that makes the dense levels
+// smaller, so a trie of wide dense nodes keeps the bitmaps and its
+// steps skip the rank. Returns the number of list nodes.
+uint64_t FST::encodeListNodesU() {
+    uint64_t lists = 0;
+    uint64_t listLabels = 0;
+    for (uint64_t n = 0; n < nodeCountU_; n++) {
+	int size = denseLabelCount(cbitsU_->bits_ + (n << 2));
+	if (size < DENSE_LIST_BELOW) {
+	    lists++;
+	    listLabels += size;
+	}
+    }
+    if (lists == 0)
+	return 0;
+
+    uint64_t bitsSize = ((nodeCountU_ - lists) * 4 / 32 + 1) * 32; // round-up to 1024-bit block size for Poppy
+    uint64_t typeSize = (nodeCountU_ / 64 / 32 + 1) * 32; // round-up to 2048-bit block size for Poppy
+    uint64_t ltSize = (listLabels / 64 / 32 + 1) * 32;
+    uint64_t* cbits = new uint64_t[bitsSize];
+    uint64_t* tbits = new uint64_t[bitsSize];
+    uint64_t* types = new uint64_t[typeSize];
+    uint64_t* ltbits = new uint64_t[ltSize];
+    for (uint64_t i = 0; i < bitsSize; i++)
+	cbits[i] = tbits[i] = 0;
+    for (uint64_t i = 0; i < typeSize; i++)
+	types[i] = 0;
+    for (uint64_t i = 0; i < ltSize; i++)
+	ltbits[i] = 0;
+    vector<uint8_t> labels(listLabels + 16, 0); // SIMD search reads past a list
+    vector<uint32_t> listStart;
+
+    uint64_t out = 0;
+    uint64_t bitmapNodes = 0;
+    for (uint64_t n = 0; n < nodeCountU_; n++) {
+	uint64_t* c = cbitsU_->bits_ + (n << 2);
+	uint64_t* t = tbitsU_->bits_ + (n << 2);
+	if (denseLabelCount(c) < DENSE_LIST_BELOW) {
+	    setBit(types[n / 64], n % 64);
+	    listStart.push_back(out);
+	    for (int ch = 0; ch < 256; ch++) {
+		if (!isLabelExist(c, (uint8_t)ch))
+		    continue;
+		labels[out] = (uint8_t)ch;
+		if (isLabelExist(t, (uint8_t)ch))
+		    setBit(ltbits[out / 64], out % 64);
+		out++;
+	    }
+	}
+	else {
+	    for (int i = 0; i < 4; i++) {
+		cbits[(bitmapNodes << 2) + i] = c[i];
+		tbits[(bitmapNodes << 2) + i] = t[i];
+	    }
+	    bitmapNodes++;
+	}
+    }
+    listStart.push_back(out);
+
+    BitmapRankFPoppy* cbitsU = new BitmapRankFPoppy(cbits, bitsSize * 64);
+    BitmapRankFPoppy* tbitsU = new BitmapRankFPoppy(tbits, bitsSize * 64);
+    BitmapRankPoppy* nodeTypes = new BitmapRankPoppy(types, typeSize * 64);
+    BitmapRankPoppy* ltbitsU = new BitmapRankPoppy(ltbits, ltSize * 64);
+    uint64_t before = cbitsU_->getMem() + tbitsU_->getMem();
+    uint64_t after = cbitsU->getMem() + tbitsU->getMem() + nodeTypes->getMem() + ltbitsU->getMem()
+	+ labels.size() + listStart.size() * sizeof(uint32_t);
+    if (after >= before) {
+	delete cbitsU;
+	delete tbitsU;
+	delete nodeTypes;
+	delete ltbitsU;
+	delete[] cbits;
+	delete[] tbits;
+	delete[] types;
+	delete[] ltbits;
+	return 0;
+    }
+
+    delete[] cbitsU_->getBits();
+    delete cbitsU_;
+    delete[] tbitsU_->getBits();
+    delete tbitsU_;
+    cbitsU_ = cbitsU;
+    tbitsU_ = tbitsU;
+    nodeTypesU_ = nodeTypes;
+    ltbitsU_ = ltbitsU;
+    labelsU_.swap(labels);
+    listStartU_.swap(listStart);
+
+    c_memU_ = cbitsU_->getNbits() / 8; //stat
+    t_memU_ = tbitsU_->getNbits() / 8; //stat
+    list_memU_ = labelsU_.size() + ltbitsU_->getNbits() / 8;
+    type_memU_ = nodeTypesU_->getMem() + listStartU_.size() * sizeof(uint32_t);
+    return lists;
+}
+
+inline bool FST::isListNodeU(uint64_t nodeNum) const {
+    return nodeTypesU_ != NULL && readBit(nodeTypesU_->bits_[nodeNum >> 6], nodeNum & 63);
+}
+
+// the end of the labels of the list-th list node up to kc
+inline uint64_t FST::listEndU(uint64_t list, uint8_t kc) const {
+    uint64_t pos = listStartU_[list];
+    uint64_t end = listStartU_[list + 1];
+    if (kc == 255)
+	return end;
+    ::nodeSearch_lowerBound<>(labelsU_.data(), pos, end - pos, kc + 1);
+    return pos;
+}
+
+// D-Labels ones up to label kc of the node, list labels included
+inline uint64_t FST::labelsThroughU(uint64_t nodeNum, uint8_t kc) const {
+    if (likely(nodeTypesU_ == NULL))
+	return cbitsU_->rank((nodeNum << 8) + kc + 1);
+    uint64_t list = nodeTypesU_->rank(nodeNum);
+    uint64_t bitmapPos = (nodeNum - list) << 8;
+    if (!isListNodeU(nodeNum))
+	return cbitsU_->rank(bitmapPos + kc + 1) + listStartU_[list];
+    return cbitsU_->rank(bitmapPos) + listEndU(list, kc);
+}
+
+// D-HasChild ones up to label kc of the node, list labels included
+inline uint64_t FST::childrenThroughU(uint64_t nodeNum, uint8_t kc) const {
+    if (likely(nodeTypesU_ == NULL))
+	return tbitsU_->rank((nodeNum << 8) + kc + 1);
+    uint64_t list = nodeTypesU_->rank(nodeNum);
+    uint64_t bitmapPos = (nodeNum - list) << 8;
+    if (!isListNodeU(nodeNum))
+	return tbitsU_->rank(bitmapPos + kc + 1) + ltbitsU_->rank(listStartU_[list]);
+    return tbitsU_->rank(bitmapPos) + ltbitsU_->rank(listEndU(list, kc));
+}
+
+// what a dense step at label kc of the node reads first
+inline void FST::prefetchNodeU(uint64_t nodeNum, uint8_t kc) const {
+    if (likely(nodeTypesU_ == NULL)) {
+	uint64_t pos = (nodeNum << 8) + kc;
+	__builtin_prefetch(tbitsU_->bits_ + (nodeNum << 2) + (kc >> 6), 0);
+	__builtin_prefetch(tbitsU_->rankLUT_ + ((pos + 1) >> 6), 0);
+	return;
+    }
+    __builtin_prefetch(nodeTypesU_->bits_ + (nodeNum >> 6), 0);
+    __builtin_prefetch(nodeTypesU_->rankLUT_ + (nodeNum >> 9), 0);
+}
+
+// A whole dense lookup step with one D-NodeType rank, for when there are
+// list nodes. False if kc is missing; otherwise next is the child node
+// number, or if the label has no child its D-Values rank through kc
+// without D-IsPrefixKey (valuePosU is next + obitsU_->rank(nodeNum+1) - 1).
+inline bool FST::mixedStepU(uint64_t nodeNum, uint8_t kc, bool &hasChild, uint64_t &next) const {
+    uint64_t list = nodeTypesU_->rank(nodeNum);
+    uint64_t bitmapPos = (nodeNum - list) << 8;
+    uint64_t labels, children;
+    if (!isListNodeU(nodeNum)) {
+	if (!isLabelExist(cbitsU_->bits_ + ((nodeNum - list) << 2), kc))
+	    return false;
+	hasChild = isLabelExist(tbitsU_->bits_ + ((nodeNum - list) << 2), kc);
+	children = tbitsU_->rank(bitmapPos + kc + 1) + ltbitsU_->rank(listStartU_[list]);
+	if (hasChild) {
+	    next = children;
+	    return true;
+	}
+	labels = cbitsU_->rank(bitmapPos + kc + 1) + listStartU_[list];
+    }
+    else {
+	uint64_t pos = listStartU_[list];
+	if (!::nodeSearch<>(labelsU_.data(), pos, listStartU_[list + 1] - pos, kc))
+	    return false;
+	hasChild = readBit(ltbitsU_->bits_[pos >> 6], pos & (uint64_t)63);
+	children = tbitsU_->rank(bitmapPos) + ltbitsU_->rank(pos + 1);
+	if (hasChild) {
+	    next = children;
+	    return true;
+	}
+	labels = cbitsU_->rank(bitmapPos) + pos + 1;
+    }
+    next = labels - children;
+    return true;
+}
+
 //******************************************************
 // CHILD POS
 //******************************************************
-inline uint64_t FST::childpos(uint64_t nodeNum) {
+inline uint64_t FST::childpos(uint64_t nodeNum) const {
     return sbits_->select(nodeNum - nodeCountU_ + 1);
 }
 
+//******************************************************
+// SPARSE BLOCKS NAVIGATION
+//******************************************************
+inline uint64_t FST::levelStart(uint64_t block, int i) const {
+    return blockLevelStart_[block * (SPARSE_BLOCK_LEVELS + 1) + i];
+}
+
+inline uint64_t FST::blockOf(uint64_t pos) const {
+    uint64_t lo = 0;
+    uint64_t hi = blocks_.size() - 1;
+    while (lo < hi) {
+	uint64_t mid = (lo + hi + 1) >> 1;
+	if (levelStart(mid, 0) <= pos)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+    return lo;
+}
+
+// position of the first label of a root of a band
+inline uint64_t FST::rootPos(int band, uint64_t root, uint64_t &block) const {
+    const vector<uint32_t> &sample = rootSample_[band];
+    uint64_t lo = sample[root >> 6];
+    uint64_t hi = ((root >> 6) + 1 < sample.size()) ? sample[(root >> 6) + 1] : (bandFirstBlock_[band + 1] - 1);
+    while (lo < hi) {
+	uint64_t mid = (lo + hi + 1) >> 1;
+	if (blocks_[mid].rootBase <= root)
+	    lo = mid;
+	else
+	    hi = mid - 1;
+    }
+    block = lo;
+    return sbits_->select(blocks_[lo].nodeBase + (root - blocks_[lo].rootBase) + 1);
+}
+
+// children above the bottom level of a block are nodes of the same
+// block, numbered after its roots; the others are roots of the next band
+inline uint64_t FST::childPosBlocked(int level, uint64_t pos, uint64_t &block) const {
+    const SparseBlock &b = blocks_[block];
+    uint64_t k = tbits_->rank(pos + 1) - b.tBase;
+    if (k <= b.innerChildren)
+	return sbits_->select(b.nodeBase + b.numRoots + k);
+
+    int band = (level - cutoff_level_) / SPARSE_BLOCK_LEVELS;
+    return rootPos(band + 1, b.childBase + k - b.innerChildren - 1, block);
+}
+
+inline uint64_t FST::sparseRootPos(uint64_t nodeNum, uint64_t &block) const {
+    if (sparseLayout_ == SPARSE_BLOCKED)
+	return rootPos(0, nodeNum - nodeCountU_, block);
+    return childpos(nodeNum);
+}
+
+inline uint64_t FST::sparseChildPos(int level, uint64_t pos, uint64_t &block) const {
+    if (sparseLayout_ == SPARSE_BLOCKED)
+	return childPosBlocked(level, pos, block);
+    return childpos(childNodeNum(pos) + childCountU_);
+}
+
+inline uint64_t FST::sparseChildPos(int level, uint64_t pos) const {
+    uint64_t block = (sparseLayout_ == SPARSE_BLOCKED) ? blockOf(pos) : 0;
+    return sparseChildPos(level, pos, block);
+}
+
+// The label after pos in key order on its level: pos + 1, except at
+// the end of a block's segment of the level, where it is the start of
+// the level in the next block of the band that has one. Returns c_mem_
+// (numSparseLabels()) past the last label of the level.
+inline uint64_t FST::nextInLevel(int level, uint64_t pos) const {
+    pos++;
+    if (sparseLayout_ != SPARSE_BLOCKED || !isSbitSet(pos))
+	return pos;
+
+    uint64_t block = blockOf(pos - 1);
+    int i = (level - cutoff_level_) % SPARSE_BLOCK_LEVELS;
+    int band = (level - cutoff_level_) / SPARSE_BLOCK_LEVELS;
+    if (pos < levelStart(block, i + 1))
+	return pos;
+
+    for (block++; block < bandFirstBlock_[band + 1]; block++) {
+	if (levelStart(block, i) < levelStart(block, i + 1))
+	    return levelStart(block, i);
+    }
+    return c_mem_;
+}
+
 
 //******************************************************
 // NODE SIZE
 //******************************************************
-inline int FST::nodeSize(uint64_t pos) {
+inline int FST::nodeSize(uint64_t pos) const {
     pos++;
     uint64_t startIdx = pos >> 6;
     uint64_t shift = pos & (uint64_t)0x3F;
@@ -478,125 +1347,203 @@ inline int FST::nodeSize(uint64_t pos) {
 }
 
 //******************************************************
-// SIMD SEARCH
+// NODE SEARCH
 //******************************************************
-inline bool FST::simdSearch(uint64_t &pos, uint64_t size, uint8_t target) {
-    uint64_t s = 0;
-    while (size >> 4) {
-	__m128i cmp= _mm_cmpeq_epi8(_mm_set1_epi8(target), _mm_loadu_si128(reinterpret_cast<__m128i*>(cbytes_ + pos + s)));
-	unsigned bitfield= _mm_movemask_epi8(cmp);
-	if (bitfield) {
-	    pos += (s + __builtin_ctz(bitfield));
-	    return true;
-	}
-	s += 16;
-	size -= 16;
-    }
+// pos is the first label of the node
+inline bool FST::nodeSearch(uint64_t &pos, int size, uint8_t target) const {
+    if (likely(nodeTypes_ == NULL))
+	return ::nodeSearch<>(cbytes_, pos, size, target);
+    const uint8_t* labels = nodeLabels(pos);
+    if (isBitmapNode(pos))
+	return bitmapSearch(labels, pos, target);
+    uint64_t i = 0;
+    bool found = ::nodeSearch<>(labels, i, size, target);
+    pos += i;
+    return found;
+}
 
-    if (size > 0) {
-	__m128i cmp= _mm_cmpeq_epi8(_mm_set1_epi8(target), _mm_loadu_si128(reinterpret_cast<__m128i*>(cbytes_ + pos + s)));
-	unsigned bitfield= _mm_movemask_epi8(cmp) & ((1 << size) - 1);
-	if (bitfield) {
-	    pos += (s + __builtin_ctz(bitfield));
+// The labels after a leading TERM are sorted, but may be below TERM.
+// A key that ends at the node takes a TERM target, and is smaller than
+// the key for any target below TERM: those search the labels after it.
+inline bool FST::nodeSearch_lowerBound(uint64_t &pos, int size, uint8_t target) const {
+    int skip = 0;
+    if (unlikely(target <= TERM) && firstLabel(pos) == TERM && !isTbitSet(pos)) {
+	if (target == TERM)
 	    return true;
-	}
+	skip = 1;
     }
-    return false;
+    if (likely(nodeTypes_ == NULL)) {
+	pos += skip;
+	return ::nodeSearch_lowerBound<>(cbytes_, pos, size - skip, target);
+    }
+    const uint8_t* labels = nodeLabels(pos);
+    if (isBitmapNode(pos))
+	return bitmapSearch_lowerBound(labels, pos, size, target);
+    uint64_t i = skip;
+    bool found = ::nodeSearch_lowerBound<>(labels, i, size - skip, target);
+    pos += i;
+    return found;
 }
 
 //******************************************************
-// BINARY SEARCH
+// BITMAP NODES
 //******************************************************
-inline bool FST::binarySearch(uint64_t &pos, uint64_t size, uint8_t target) {
-    uint64_t l = pos;
-    uint64_t r = pos + size - 1;
-    uint64_t m = (l + r) >> 1;
-
-    while (l <= r) {
-	if (cbytes_[m] == target) {
-	    pos = m;
-	    return true;
+// A node of n >= NODE_BITMAP_MIN labels takes BITMAP_NODE_BYTES
+// instead of n bytes as a bitmap. The nodes are only stored that way
+// if together they save more than S-NodeType costs, so a trie without
+// enough wide nodes keeps plain labels and its searches skip the rank.
+// Returns the number of bitmap nodes.
+uint64_t FST::encodeBitmapNodes() {
+    uint64_t saved = 0;
+    for (uint64_t pos = 0; pos < c_mem_; ) {
+	int size = nodeSize(pos);
+	if (size >= NODE_BITMAP_MIN)
+	    saved += size - BITMAP_NODE_BYTES;
+	pos += size;
+    }
+    if (saved == 0)
+	return 0;
+
+    uint64_t words = ((c_mem_ + 63) / 64 / 32 + 1) * 32; // round-up to 2048-bit block size for Poppy
+    uint64_t* types = new uint64_t[words];
+    for (uint64_t i = 0; i < words; i++)
+	types[i] = 0;
+    for (uint64_t pos = 0; pos < c_mem_; ) {
+	int size = nodeSize(pos);
+	if (size >= NODE_BITMAP_MIN) {
+	    for (uint64_t p = pos; p < pos + size - BITMAP_NODE_BYTES; p++)
+		setBit(types[p / 64], p % 64);
 	}
-	else if (cbytes_[m] < target)
-	    l = m + 1;
-	else
-	    r = m - 1;
-	m = (l + r) >> 1;
+	pos += size;
     }
-    return false;
+    BitmapRankPoppy* nodeTypes = new BitmapRankPoppy(types, words * 64);
+    if (nodeTypes->getMem() >= saved) {
+	delete nodeTypes;
+	delete[] types;
+	return 0;
+    }
+
+    uint8_t* labels = new uint8_t[c_mem_ - saved];
+    uint64_t out = 0;
+    uint64_t count = 0;
+    for (uint64_t pos = 0; pos < c_mem_; ) {
+	int size = nodeSize(pos);
+	if (size >= NODE_BITMAP_MIN) {
+	    uint64_t bits[4] = {0, 0, 0, 0};
+	    for (uint64_t p = pos + (cbytes_[pos] == TERM); p < pos + size; p++)
+		setBit(bits[cbytes_[p] >> 6], cbytes_[p] & 63);
+	    labels[out] = cbytes_[pos];
+	    memcpy(labels + out + 1, bits, sizeof(bits));
+	    out += BITMAP_NODE_BYTES;
+	    count++;
+	}
+	else {
+	    memcpy(labels + out, cbytes_ + pos, size);
+	    out += size;
+	}
+	pos += size;
+    }
+
+    delete[] cbytes_;
+    cbytes_ = labels;
+    label_mem_ = out;
+    nodeTypes_ = nodeTypes;
+    type_mem_ = nodeTypes_->getMem();
+    return count;
 }
 
-inline bool FST::binarySearch_lowerBound(uint64_t &pos, uint64_t size, uint8_t target) {
-    uint64_t rightBound = pos + size;
-    uint64_t l = pos;
-    uint64_t r = pos + size - 1;
-    uint64_t m = (l + r) >> 1;
+// pos is the first label of a node
+inline bool FST::isBitmapNode(uint64_t pos) const {
+    return nodeTypes_ != NULL && readBit(nodeTypes_->bits_[pos >> 6], pos & 63);
+}
 
-    while (l < r) {
-	if (cbytes_[m] == target) {
-	    pos = m;
-	    return true;
-	}
-	else if (cbytes_[m] < target)
-	    l = m + 1;
-	else
-	    r = m - 1;
-	m = (l + r) >> 1;
+// the bytes of the node starting at pos
+inline const uint8_t* FST::nodeLabels(uint64_t pos) const {
+    if (likely(nodeTypes_ == NULL))
+	return cbytes_ + pos;
+    return cbytes_ + pos - nodeTypes_->rank(pos);
+}
+
+// the last node start at or before pos
+inline uint64_t FST::nodeStart(uint64_t pos) const {
+    uint64_t word = pos >> 6;
+    uint64_t bits = sbits_->bits_[word] >> (63 - (pos & 63));
+    while (bits == 0) {
+	word--;
+	bits = sbits_->bits_[word];
+	pos = (word << 6) + 63;
     }
+    return pos - __builtin_ctzll(bits);
+}
 
-    if (cbytes_[m] < target)
-	pos = m + 1;
-    else
-	pos = m;
+// Both encodings keep the first label in front, so the TERM check at
+// the end of a key reads one byte.
+inline uint8_t FST::firstLabel(uint64_t pos) const {
+    return *nodeLabels(pos);
+}
 
-    return pos < rightBound;
+inline uint8_t FST::label(uint64_t nodePos, uint64_t pos) const {
+    const uint8_t* labels = nodeLabels(nodePos);
+    if (!isBitmapNode(nodePos) || pos == nodePos)
+	return labels[pos - nodePos];
+    uint64_t bits[4];
+    memcpy(bits, labels + 1, sizeof(bits));
+    return selectLabel(bits, pos - nodePos - (labels[0] == TERM));
 }
 
-//******************************************************
-// LINEAR SEARCH
-//******************************************************
-inline bool FST::linearSearch(uint64_t &pos, uint64_t size, uint8_t target) {
-    for (int i = 0; i < size; i++) {
-	if (cbytes_[pos] == target)
-	    return true;
-	pos++;
+inline uint8_t FST::label(uint64_t pos) const {
+    if (likely(nodeTypes_ == NULL))
+	return cbytes_[pos];
+    return label(nodeStart(pos), pos);
+}
+
+// what the search of the node at pos reads first
+inline void FST::prefetchNode(uint64_t pos) const {
+    if (likely(nodeTypes_ == NULL)) {
+	__builtin_prefetch(cbytes_ + pos, 0, 1);
+	return;
     }
-    return false;
+    __builtin_prefetch(nodeTypes_->bits_ + (pos >> 6), 0, 1);
+    __builtin_prefetch(nodeTypes_->rankLUT_ + (pos >> 9), 0);
 }
 
-inline bool FST::linearSearch_lowerBound(uint64_t &pos, uint64_t size, uint8_t target) {
-    for (int i = 0; i < size; i++) {
-	if (cbytes_[pos] >= target)
+inline bool FST::bitmapSearch(const uint8_t* labels, uint64_t &pos, uint8_t target) const {
+    uint64_t bits[4];
+    memcpy(bits, labels + 1, sizeof(bits));
+    if (labels[0] == TERM) {
+	if (target == TERM)
 	    return true;
 	pos++;
     }
-    return false;
-}
-
-//******************************************************
-// NODE SEARCH
-//******************************************************
-inline bool FST::nodeSearch(uint64_t &pos, int size, uint8_t target) {
-    if (size < 3)
-	return linearSearch(pos, size, target);
-    else if (size < 12)
-	return binarySearch(pos, size, target);
-    else
-	return simdSearch(pos, size, target);
+    return ::bitmapSearch(bits, pos, target);
 }
 
-inline bool FST::nodeSearch_lowerBound(uint64_t &pos, int size, uint8_t target) {
-    if (size < 3)
-	return linearSearch_lowerBound(pos, size, target);
-    else
-	return binarySearch_lowerBound(pos, size, target);
+inline bool FST::bitmapSearch_lowerBound(const uint8_t* labels, uint64_t &pos, int size, uint8_t target) const {
+    uint64_t bits[4];
+    memcpy(bits, labels + 1, sizeof(bits));
+    // a leading '$' label with children, unlike a key ending here, is
+    // >= a target up to TERM
+    if (labels[0] == TERM) {
+	if (target <= TERM && isTbitSet(pos))
+	    return true;
+	pos++;
+	size--;
+    }
+    return ::bitmapSearch_lowerBound(bits, pos, size, target);
 }
 
 
 //******************************************************
 // LOOKUP
 //******************************************************
-bool FST::lookup(const uint8_t* key, const int keylen, uint64_t &value) {
+bool FST::lookup(const uint8_t* key, const int keylen, uint64_t &value) const {
+    if (likely(encoder_ == NULL))
+	return lookupKey(key, keylen, value);
+    EncodedKey ek(encoder_, key, keylen);
+    return lookupKey(ek.data, ek.len, value);
+}
+
+inline bool FST::lookupKey(const uint8_t* key, const int keylen, uint64_t &value) const {
     int keypos = 0;
     uint64_t nodeNum = 0;
     uint8_t kc = (uint8_t)key[keypos];
@@ -606,8 +1553,20 @@ bool FST::lookup(const uint8_t* key, const int keylen, uint64_t &value) {
 	kc = (uint8_t)key[keypos];
 	pos = (nodeNum << 8) + kc;
 
-	__builtin_prefetch(tbitsU_->bits_ + (nodeNum << 2) + (kc >> 6), 0);
-	__builtin_prefetch(tbitsU_->rankLUT_ + ((pos + 1) >> 6), 0);
+	prefetchNodeU(nodeNum, kc);
+
+	if (unlikely(nodeTypesU_ != NULL)) {
+	    bool hasChild;
+	    if (!mixedStepU(nodeNum, kc, hasChild, pos))
+		return false;
+	    if (!hasChild) {
+		value = valuesU_[pos + obitsU_->rank(nodeNum + 1) - 1];
+		return true;
+	    }
+	    nodeNum = pos;
+	    keypos++;
+	    continue;
+	}
 
 	if (!isCbitSetU(nodeNum, kc))
 	    return false;
@@ -630,7 +1589,8 @@ bool FST::lookup(const uint8_t* key, const int keylen, uint64_t &value) {
     }
 
     //-----------------------------------------------------------------------
-    pos = (cutoff_level_ == 0) ? 0 : childpos(nodeNum);
+    uint64_t block = 0;
+    pos = (cutoff_level_ == 0) ? 0 : sparseRootPos(nodeNum, block);
 
     while (keypos < keylen) {
 	kc = (uint8_t)key[keypos];
@@ -644,40 +1604,273 @@ bool FST::lookup(const uint8_t* key, const int keylen, uint64_t &value) {
 	    return true;
 	}
 
-	pos = childpos(childNodeNum(pos) + childCountU_);
+	pos = sparseChildPos(keypos, pos, block);
 	keypos++;
 
-	__builtin_prefetch(cbytes_ + pos, 0, 1);
+	prefetchNode(pos);
 	__builtin_prefetch(tbits_->bits_ + (pos >> 6), 0, 1);
 	__builtin_prefetch(tbits_->rankLUT_ + ((pos + 1) >> 9), 0);
     }
 
-    if (cbytes_[pos] == TERM && !isTbitSet(pos)) {
+    if (firstLabel(pos) == TERM && !isTbitSet(pos)) {
 	value = values_[valuePos(pos)];
 	return true;
     }
     return false;
 }
 
-bool FST::lookup(const uint64_t key, uint64_t &value) {
-    uint8_t key_str[8];
-    reinterpret_cast<uint64_t*>(key_str)[0]=__builtin_bswap64(key);
+//******************************************************
+// LOOKUP FIXED-WIDTH KEY
+//******************************************************
+// No N-byte key is a prefix of another, so every key ends in a leaf at
+// depth <= N: no D-IsPrefixKey bits, no TERM labels and no keylen
+// checks. The level loop has a constant trip count and is unrolled.
+template<int N>
+bool FST::lookup(const FixedKey<N> &key, uint64_t &value) const {
+    if (fixedKeyLen_ != N)
+	return lookup(key.bytes, N, value);
 
-    return lookup(key_str, 8, value);
-}
+    uint64_t nodeNum = 0;
+    uint64_t pos = 0;
+    uint64_t block = 0;
+
+#pragma GCC unroll 16
+    for (int keypos = 0; keypos < N; keypos++) {
+	uint8_t kc = key.bytes[keypos];
+
+	if (keypos < cutoff_level_) {
+	    pos = (nodeNum << 8) + kc;
+
+	    prefetchNodeU(nodeNum, kc);
+
+	    if (unlikely(nodeTypesU_ != NULL)) {
+		bool hasChild;
+		if (!mixedStepU(nodeNum, kc, hasChild, pos))
+		    return false;
+		if (!hasChild) {
+		    value = valuesU_[pos - 1];
+		    return true;
+		}
+		nodeNum = pos;
+		continue;
+	    }
+
+	    if (!isCbitSetU(nodeNum, kc))
+		return false;
+
+	    if (!isTbitSetU(nodeNum, kc)) {
+		// valuePosU without the (all zero) D-IsPrefixKey rank
+		value = valuesU_[labelsThroughU(nodeNum, kc) - childrenThroughU(nodeNum, kc) - 1];
+		return true;
+	    }
+
+	    nodeNum = childNodeNumU(pos);
+	    continue;
+	}
+
+	if (keypos == cutoff_level_)
+	    pos = (cutoff_level_ == 0) ? 0 : sparseRootPos(nodeNum, block);
+
+	if (!nodeSearch(pos, nodeSize(pos), kc))
+	    return false;
+
+	if (!isTbitSet(pos)) {
+	    value = values_[valuePos(pos)];
+	    return true;
+	}
+
+	pos = sparseChildPos(keypos, pos, block);
+
+	prefetchNode(pos);
+	__builtin_prefetch(tbits_->bits_ + (pos >> 6), 0, 1);
+	__builtin_prefetch(tbits_->rankLUT_ + ((pos + 1) >> 9), 0);
+    }
+    return false;
+}
+
+template bool FST::lookup<4>(const FixedKey<4> &key, uint64_t &value) const;
+template bool FST::lookup<8>(const FixedKey<8> &key, uint64_t &value) const;
+template bool FST::lookup<16>(const FixedKey<16> &key, uint64_t &value) const;
+
+bool FST::lookup(const uint64_t key, uint64_t &value) const {
+    FixedKey<8> key_str;
+    reinterpret_cast<uint64_t*>(key_str.bytes)[0]=__builtin_bswap64(key);
+
+    return lookup(key_str, value);
+}
+
+bool FST::lookup(const uint8_t* key, const int keylen, PostingList &list) const {
+    uint64_t listId;
+    if (postings_ == NULL || !lookup(key, keylen, listId))
+	return false;
+    list = postings_->list(listId);
+    return true;
+}
+
+PostingList FST::postings(uint64_t listId) const {
+    return postings_->list(listId);
+}
+
+bool FST::lookup(const uint8_t* key, const int keylen, FSTPayload &payload) const {
+    uint64_t rank;
+    if (payloadOffsets_ == NULL || !lookup(key, keylen, rank))
+	return false;
+    payload = this->payload(rank);
+    return true;
+}
+
+FSTPayload FST::payload(uint64_t rank) const {
+    uint64_t start;
+    uint64_t end;
+    payloadOffsets_->getPair(rank, start, end);
+    FSTPayload p;
+    p.data = payloadBlob_.data() + start;
+    p.len = end - start;
+    return p;
+}
 
 
+//******************************************************
+// LOOKUP SORTED
+//******************************************************
+// nodes[k] is the node entered at key position k on the last descent
+// (dense: node number, sparse: position of its first label), blocks[k]
+// its SPARSE_BLOCKED block. Entries 0 .. depth are valid; the descent
+// starts at keypos, which must not exceed depth.
+inline bool FST::lookupFrom(const uint8_t* key, const int keylen, int keypos, uint64_t* nodes, uint64_t* blocks, int &depth, uint64_t &value) const {
+    uint64_t nodeNum = nodes[keypos];
+    uint64_t pos = nodeNum;
+    uint64_t block = blocks[keypos];
+    bool inDense = (keypos < cutoff_level_);
+    depth = keypos;
+
+    while (keypos < keylen && keypos < cutoff_level_) {
+	uint8_t kc = (uint8_t)key[keypos];
+	pos = (nodeNum << 8) + kc;
+
+	if (unlikely(nodeTypesU_ != NULL)) {
+	    bool hasChild;
+	    if (!mixedStepU(nodeNum, kc, hasChild, pos))
+		return false;
+	    if (!hasChild) {
+		value = valuesU_[pos + obitsU_->rank(nodeNum + 1) - 1];
+		return true;
+	    }
+	    nodeNum = pos;
+	}
+	else {
+	    if (!isCbitSetU(nodeNum, kc))
+		return false;
+
+	    if (!isTbitSetU(nodeNum, kc)) {
+		value = valuesU_[valuePosU(nodeNum, pos)];
+		return true;
+	    }
+
+	    nodeNum = childNodeNumU(pos);
+	}
+	keypos++;
+	nodes[keypos] = nodeNum;
+	depth = keypos;
+    }
+
+    if (keypos < cutoff_level_) {
+	if (isObitSetU(nodeNum)) {
+	    value = valuesU_[valuePosU(nodeNum, (nodeNum << 8))];
+	    return true;
+	}
+	return false;
+    }
+
+    //-----------------------------------------------------------------------
+    if (inDense) {
+	pos = sparseRootPos(nodeNum, block);
+	nodes[keypos] = pos;
+	blocks[keypos] = block;
+    }
+
+    while (keypos < keylen) {
+	uint8_t kc = (uint8_t)key[keypos];
+
+	int nsize = nodeSize(pos);
+	if (!nodeSearch(pos, nsize, kc))
+	    return false;
+
+	if (!isTbitSet(pos)) {
+	    value = values_[valuePos(pos)];
+	    return true;
+	}
+
+	pos = sparseChildPos(keypos, pos, block);
+	keypos++;
+	nodes[keypos] = pos;
+	blocks[keypos] = block;
+	depth = keypos;
+
+	prefetchNode(pos);
+	__builtin_prefetch(tbits_->bits_ + (pos >> 6), 0, 1);
+	__builtin_prefetch(tbits_->rankLUT_ + ((pos + 1) >> 9), 0);
+    }
+
+    if (firstLabel(pos) == TERM && !isTbitSet(pos)) {
+	value = values_[valuePos(pos)];
+	return true;
+    }
+    return false;
+}
+
+int FST::lookupSorted(const string* keys, int n, uint64_t* values, bool* found) const {
+    vector<string> encoded;
+    if (encoder_ != NULL) {
+	encoded.resize(n);
+	for (int i = 0; i < n; i++)
+	    encoded[i] = encoder_->encode(keys[i]);
+	keys = encoded.data();
+    }
+
+    // the root is node 0 in LOUDS-Dense and position 0 in LOUDS-Sparse
+    vector<uint64_t> nodes(tree_height_ + 1, 0);
+    vector<uint64_t> blocks(tree_height_ + 1, 0);
+    int depth = 0;
+    int numFound = 0;
+
+    for (int i = 0; i < n; i++) {
+	const string &key = keys[i];
+	int keypos = 0;
+	if (i > 0) {
+	    const string &prev = keys[i - 1];
+	    int maxlcp = min(depth, (int)min(key.length(), prev.length()));
+	    while (keypos < maxlcp && key[keypos] == prev[keypos])
+		keypos++;
+	}
+
+	found[i] = lookupFrom((const uint8_t*)key.data(), key.length(), keypos, nodes.data(), blocks.data(), depth, values[i]);
+	if (found[i])
+	    numFound++;
+    }
+    return numFound;
+}
+
 //******************************************************
 // NEXT ITEM U
 //******************************************************
-inline bool FST::nextItemU(uint64_t nodeNum, uint8_t kc, uint8_t &cc) {
-    return isLabelExist_lowerBound(cbitsU_->bits_ + (nodeNum << 2), kc, cc);
+inline bool FST::nextItemU(uint64_t nodeNum, uint8_t kc, uint8_t &cc) const {
+    if (likely(nodeTypesU_ == NULL))
+	return isLabelExist_lowerBound(cbitsU_->bits_ + (nodeNum << 2), kc, cc);
+    uint64_t list = nodeTypesU_->rank(nodeNum);
+    if (!isListNodeU(nodeNum))
+	return isLabelExist_lowerBound(cbitsU_->bits_ + ((nodeNum - list) << 2), kc, cc);
+    uint64_t pos = listStartU_[list];
+    if (!::nodeSearch_lowerBound<>(labelsU_.data(), pos, listStartU_[list + 1] - pos, kc))
+	return false;
+    cc = labelsU_[pos];
+    return true;
 }
 
 //******************************************************
 // NEXT LEFT ITEM
 //******************************************************
-inline bool FST::nextLeftU(int level, uint64_t pos, FSTIter* iter) {
+inline bool FST::nextLeftU(int level, uint64_t pos, FSTIter* iter) const {
     uint64_t nodeNum = pos >> 8;
     uint8_t cc = pos & 255;
 
@@ -707,15 +1900,16 @@ inline bool FST::nextLeftU(int level, uint64_t pos, FSTIter* iter) {
 	nodeNum = (iter->positions[level].keyPos < 0) ? childNodeNumU(pos) : (iter->positions[level].keyPos >> 8);
     }
 
-    pos = (iter->positions[level].keyPos < 0) ? childpos(nodeNum) : iter->positions[level].keyPos;
+    uint64_t block = 0;
+    pos = (iter->positions[level].keyPos < 0) ? sparseRootPos(nodeNum, block) : iter->positions[level].keyPos;
     return nextLeft(level, pos, iter);
 }
 
-inline bool FST::nextLeft(int level, uint64_t pos, FSTIter* iter) {
+inline bool FST::nextLeft(int level, uint64_t pos, FSTIter* iter) const {
     while (isTbitSet(pos)) {
 	iter->positions[level].keyPos = pos;
+	pos = (iter->positions[level + 1].keyPos < 0) ? sparseChildPos(level, pos) : iter->positions[level + 1].keyPos;
 	level++;
-	pos = (iter->positions[level].keyPos < 0) ? childpos(childNodeNum(pos) + childCountU_) : iter->positions[level].keyPos;
     }
     iter->setKV(level, pos);
     return true;
@@ -725,7 +1919,7 @@ inline bool FST::nextLeft(int level, uint64_t pos, FSTIter* iter) {
 //******************************************************
 // NEXT NODE
 //******************************************************
-inline bool FST::nextNodeU(int level, uint64_t nodeNum, FSTIter* iter) {
+inline bool FST::nextNodeU(int level, uint64_t nodeNum, FSTIter* iter) const {
     int cur_level = (level < cutoff_level_) ? level : (cutoff_level_ - 1);
     uint8_t cc = 0;
     uint8_t kc = 0;
@@ -742,8 +1936,10 @@ inline bool FST::nextNodeU(int level, uint64_t nodeNum, FSTIter* iter) {
 	    iter->positions[cur_level].keyPos = (nodeNum << 8) + cc;
 	}
 
-	if (cur_level == 0)
-	    break;
+	if (cur_level == 0) { // past the last node of the trie
+	    iter->isEnd = true;
+	    return false;
+	}
 
 	cur_level--;
 	nodeNum = iter->positions[cur_level].keyPos >> 8;
@@ -772,16 +1968,21 @@ inline bool FST::nextNodeU(int level, uint64_t nodeNum, FSTIter* iter) {
 	return false;
 }
 
-inline bool FST::nextNode(int level, uint64_t pos, FSTIter* iter) {
+inline bool FST::nextNode(int level, uint64_t pos, FSTIter* iter) const {
     bool inNode = false;
     int cur_level = level - 1;
     while (!inNode && cur_level >= cutoff_level_) {
-	iter->positions[cur_level].keyPos++;
+	iter->positions[cur_level].keyPos = nextInLevel(cur_level, iter->positions[cur_level].keyPos);
 	pos = iter->positions[cur_level].keyPos;
 	inNode = !isSbitSet(pos);
 	cur_level--;
     }
 
+    if (!inNode && cur_level < 0) { // past the last node of the trie
+	iter->isEnd = true;
+	return false;
+    }
+
     if (!inNode && cur_level < cutoff_level_) {
 	uint64_t nodeNum = iter->positions[cur_level].keyPos >> 8;
 	uint8_t kc = iter->positions[cur_level].keyPos & 255;
@@ -794,6 +1995,8 @@ inline bool FST::nextNode(int level, uint64_t pos, FSTIter* iter) {
 	if (!inNode) {
 	    if (nextNodeU(level, (iter->positions[cur_level].keyPos >> 8), iter))
 		return true;
+	    if (iter->isEnd)
+		return false;
 	}
 	else {
 	    iter->positions[cur_level].keyPos = (nodeNum << 8) + cc;
@@ -817,122 +2020,658 @@ inline bool FST::nextNode(int level, uint64_t pos, FSTIter* iter) {
 //******************************************************
 // LOWER BOUND
 //******************************************************
-bool FST::lowerBound(const uint8_t* key, const int keylen, FSTIter &iter) {
-    iter.clear();
-    int keypos = 0;
-    uint64_t nodeNum = 0;
-    uint8_t kc = (uint8_t)key[keypos];
+// One level of the lowerBound descent, so that scanBatch can interleave
+// several descents. Returns false once d.result holds the outcome.
+inline bool FST::lowerBoundStep(const uint8_t* key, const int keylen, FSTDescent &d, FSTIter &iter) const {
+    int keypos = d.keypos;
+    uint64_t nodeNum = d.nodeNum;
+    uint64_t pos;
+    uint8_t kc;
     uint8_t cc = 0;
-    uint64_t pos = kc;
 
-    while (keypos < keylen && keypos < cutoff_level_) {
-	kc = (uint8_t)key[keypos];
-	pos = (nodeNum << 8) + kc;
+    iter.touch(keypos);
+    if (keypos < cutoff_level_) {
+	if (keypos < keylen) {
+	    kc = (uint8_t)key[keypos];
+	    pos = (nodeNum << 8) + kc;
 
-	__builtin_prefetch(tbitsU_->bits_ + (nodeNum << 2) + (kc >> 6), 0);
-	__builtin_prefetch(tbitsU_->rankLUT_ + ((pos + 1) >> 6), 0);
+	    prefetchNodeU(nodeNum, kc);
 
-	if (!nextItemU(nodeNum, kc, cc)) { // next char is in next node
-	    nextNodeU(keypos, nodeNum, &iter);
-	    return nextLeftU(keypos, iter.positions[keypos].keyPos, &iter);
-	}
+	    if (!nextItemU(nodeNum, kc, cc)) { // next char is in next node
+		// nextNodeU descends to the leaf itself (or sets isEnd)
+		d.result = nextNodeU(keypos, nodeNum, &iter);
+		return false;
+	    }
 
-	if (cc != kc) {
-	    iter.positions[keypos].keyPos = (nodeNum << 8) + cc;
-	    return nextLeftU(keypos, iter.positions[keypos].keyPos, &iter);
-	}
+	    if (cc != kc) {
+		iter.positions[keypos].keyPos = (nodeNum << 8) + cc;
+		d.result = nextLeftU(keypos, iter.positions[keypos].keyPos, &iter);
+		return false;
+	    }
 
-	iter.positions[keypos].keyPos = pos;
+	    iter.positions[keypos].keyPos = pos;
 
-	if (!isTbitSetU(nodeNum, kc)) { // found key terminiation (value)
-	    iter.len = keypos + 1;
-	    iter.positions[keypos].valPos = valuePosU(nodeNum, pos);
+	    if (!isTbitSetU(nodeNum, kc)) { // found key terminiation (value)
+		iter.len = keypos + 1;
+		iter.positions[keypos].valPos = valuePosU(nodeNum, pos);
+		d.result = true;
+		return false;
+	    }
+
+	    d.nodeNum = childNodeNumU(pos);
+	    d.keypos = ++keypos;
+
+	    if (keypos < cutoff_level_) {
+		if (keypos < keylen && likely(nodeTypesU_ == NULL))
+		    __builtin_prefetch(cbitsU_->bits_ + (d.nodeNum << 2) + ((uint8_t)key[keypos] >> 6), 0);
+	    }
+	    else {
+		d.pos = sparseRootPos(d.nodeNum, d.block);
+		prefetchNode(d.pos);
+		__builtin_prefetch(sbits_->bits_ + (d.pos >> 6), 0, 1);
+	    }
 	    return true;
 	}
 
-	nodeNum = childNodeNumU(pos);
-	keypos++;
-    }
-
-    if (keypos < cutoff_level_) {
 	pos = nodeNum << 8;
 	if (isObitSetU(nodeNum)) {
 	    iter.setKVU(keypos, nodeNum, pos, true);
-	    return true;
+	    d.result = true;
+	    return false;
+	}
+	if (keypos == 0) { // empty key: the first key of the trie
+	    nextItemU(0, 0, cc);
+	    iter.positions[0].keyPos = cc;
+	    d.result = nextLeftU(0, cc, &iter);
+	    return false;
 	}
 	keypos--;
-	return nextLeftU(keypos, iter.positions[keypos].keyPos, &iter);
+	d.result = nextLeftU(keypos, iter.positions[keypos].keyPos, &iter);
+	return false;
     }
 
     //----------------------------------------------------------
-    pos = (cutoff_level_ == 0) ? 0 : childpos(nodeNum);
-
-    bool inNode = true;
-    while (keypos < keylen) {
+    pos = d.pos;
+    if (keypos < keylen) {
 	kc = (uint8_t)key[keypos];
 
 	int nsize = nodeSize(pos);
-	inNode = nodeSearch_lowerBound(pos, nsize, kc);
+	bool inNode = nodeSearch_lowerBound(pos, nsize, kc);
+	if (!inNode)
+	    pos = nextInLevel(keypos, pos - 1);
 
 	iter.positions[keypos].keyPos = pos;
 
 	if (!inNode) {
-	    nextNode(keypos, pos, &iter);
-	    return nextLeft(keypos, pos, &iter);
+	    // nextNode descends to the leaf itself (or sets isEnd)
+	    d.result = nextNode(keypos, pos, &iter);
+	    return false;
 	}
 
-	cc = cbytes_[pos];
-	if (cc != kc)
-	    return nextLeft(keypos, pos, &iter);
+	cc = label(d.pos, pos);
+	if (cc != kc) {
+	    d.result = nextLeft(keypos, pos, &iter);
+	    return false;
+	}
 
 	if (!isTbitSet(pos)) {
 	    iter.len = keypos + 1;
 	    iter.positions[keypos].valPos = valuePos(pos);
-	    return true;
+	    d.result = true;
+	    return false;
 	}
 
-	pos = childpos(childNodeNum(pos) + childCountU_);
-	keypos++;
+	d.pos = pos = sparseChildPos(keypos, pos, d.block);
+	d.keypos++;
 
-	__builtin_prefetch(cbytes_ + pos, 0, 1);
+	prefetchNode(pos);
+	__builtin_prefetch(sbits_->bits_ + (pos >> 6), 0, 1);
 	__builtin_prefetch(tbits_->bits_ + (pos >> 6), 0, 1);
 	__builtin_prefetch(tbits_->rankLUT_ + ((pos + 1) >> 9), 0);
+	return true;
     }
 
-    if (cbytes_[pos] == TERM && !isTbitSet(pos)) {
+    if (firstLabel(pos) == TERM && !isTbitSet(pos)) {
 	iter.positions[keypos].keyPos = pos;
 	iter.len = keypos + 1;
 	iter.positions[keypos].valPos = valuePos(pos);
-	return true;
+	d.result = true;
+	return false;
     }
-    keypos--;
-    return nextLeft(keypos, iter.positions[keypos].keyPos, &iter);
+    // the key ends above this node: its first key. Descending from
+    // here rather than from the parent's label also covers a parent on
+    // a dense level and the empty key.
+    iter.positions[keypos].keyPos = pos;
+    d.result = nextLeft(keypos, pos, &iter);
+    return false;
+}
+
+inline void FST::lowerBoundInit(FSTDescent &d) const {
+    // the root is node 0 in LOUDS-Dense and position 0 in LOUDS-Sparse
+    d.keypos = 0;
+    d.nodeNum = 0;
+    d.pos = 0;
+    d.block = 0;
+    d.result = false;
 }
 
-bool FST::lowerBound(const uint64_t key, FSTIter &iter) {
+bool FST::lowerBound(const uint8_t* key, const int keylen, FSTIter &iter) const {
+    EncodedKey ek(encoder_, key, keylen);
+    iter.clear();
+    FSTDescent d;
+    lowerBoundInit(d);
+    while (lowerBoundStep(ek.data, ek.len, d, iter));
+    return d.result;
+}
+
+bool FST::lowerBound(const uint64_t key, FSTIter &iter) const {
     uint8_t key_str[8];
     reinterpret_cast<uint64_t*>(key_str)[0]=__builtin_bswap64(key);
     return lowerBound(key_str, 8, iter);
 }
 
 
+//******************************************************
+// RANK ACCESS
+//******************************************************
+// Keys below a node (nodeNum in LOUDS-Dense, the position of its first
+// label in LOUDS-Sparse); records the count of each child on the way.
+uint64_t FST::buildRankCounts(int level, uint64_t nodeNum, uint64_t pos, uint64_t block) {
+    uint64_t keys = 0;
+    if (level < cutoff_level_) {
+	if (isObitSetU(nodeNum))
+	    keys++;
+	uint8_t cc = 0;
+	int next = 0;
+	while (next < 256 && nextItemU(nodeNum, next, cc)) {
+	    uint64_t p = (nodeNum << 8) + cc;
+	    if (!isTbitSetU(nodeNum, cc)) {
+		keys++;
+	    }
+	    else {
+		uint64_t child = childNodeNumU(p);
+		uint64_t childBlock = 0;
+		uint64_t childPos = (level + 1 < cutoff_level_) ? 0 : sparseRootPos(child, childBlock);
+		uint64_t k = buildRankCounts(level + 1, child, childPos, childBlock);
+		rankCountsU_[child - 1] = k;
+		keys += k;
+	    }
+	    next = cc + 1;
+	}
+	return keys;
+    }
+
+    int size = nodeSize(pos);
+    for (uint64_t p = pos; p < pos + size; p++) {
+	if (!isTbitSet(p)) {
+	    keys++;
+	    continue;
+	}
+	uint64_t childBlock = block;
+	uint64_t childPos = sparseChildPos(level, p, childBlock);
+	uint64_t k = buildRankCounts(level + 1, 0, childPos, childBlock);
+	rankCounts_[childNodeNum(p) - 1] = k;
+	keys += k;
+    }
+    return keys;
+}
+
+// Like an exact lowerBound match, but each level picks the label whose
+// subtree holds the rank.
+bool FST::seekToRank(uint64_t rank, FSTIter &iter) const {
+    iter.clear();
+    if (rank >= rankKeys_)
+	return false;
+
+    uint64_t r = rank;
+    int level = 0;
+    uint64_t nodeNum = 0;
+    while (level < cutoff_level_) {
+	iter.touch(level);
+	if (isObitSetU(nodeNum)) {
+	    if (r == 0) {
+		iter.setKVU(level, nodeNum, nodeNum << 8, true);
+		return true;
+	    }
+	    r--;
+	}
+	uint8_t cc = 0;
+	int next = 0;
+	while (true) {
+	    nextItemU(nodeNum, next, cc);
+	    uint64_t p = (nodeNum << 8) + cc;
+	    if (!isTbitSetU(nodeNum, cc)) {
+		if (r == 0) {
+		    iter.positions[level].keyPos = p;
+		    iter.len = level + 1;
+		    iter.positions[level].valPos = valuePosU(nodeNum, p);
+		    return true;
+		}
+		r--;
+	    }
+	    else {
+		uint64_t child = childNodeNumU(p);
+		if (r < rankCountsU_[child - 1]) {
+		    iter.positions[level].keyPos = p;
+		    nodeNum = child;
+		    break;
+		}
+		r -= rankCountsU_[child - 1];
+	    }
+	    next = cc + 1;
+	}
+	level++;
+    }
+
+    uint64_t block = 0;
+    uint64_t pos = sparseRootPos(nodeNum, block);
+    while (true) {
+	iter.touch(level);
+	// S-HasChild rank of the next child in the node
+	uint64_t child = childNodeNum(pos) - (isTbitSet(pos) ? 1 : 0);
+	uint64_t p = pos;
+	while (true) {
+	    if (!isTbitSet(p)) {
+		if (r == 0) {
+		    iter.positions[level].keyPos = p;
+		    iter.len = level + 1;
+		    iter.positions[level].valPos = valuePos(p);
+		    return true;
+		}
+		r--;
+	    }
+	    else {
+		if (r < rankCounts_[child])
+		    break;
+		r -= rankCounts_[child];
+		child++;
+	    }
+	    p++;
+	}
+	iter.positions[level].keyPos = p;
+	pos = sparseChildPos(level, p, block);
+	level++;
+    }
+}
+
+bool FST::keyAt(uint64_t rank, string &key) const {
+    FSTIter iter(this);
+    if (!seekToRank(rank, iter))
+	return false;
+    key = iter.key();
+    return true;
+}
+
+
+//******************************************************
+// SCAN BATCH
+//******************************************************
+// The descents of SCAN_GROUP ranges advance one level at a time in
+// turn, so the prefetches each step issues for its next node overlap
+// with the steps of the other ranges.
+uint64_t FST::scanBatch(const FSTRange* ranges, int n, uint64_t* values, uint32_t* counts) const {
+    return scanRanges(ranges, n, values, counts, NULL, NULL);
+}
+
+uint64_t FST::scanBatch(const FSTRange* ranges, int n, uint64_t* values, uint32_t* counts, vector<uint8_t> &keys, uint32_t* keyEnd) const {
+    keys.clear();
+    return scanRanges(ranges, n, values, counts, &keys, keyEnd);
+}
+
+uint64_t FST::scanRanges(const FSTRange* ranges, int n, uint64_t* values, uint32_t* counts, vector<uint8_t>* keys, uint32_t* keyEnd) const {
+    vector<string> encoded;
+    vector<FSTRange> encodedRanges;
+    if (encoder_ != NULL) {
+	encoded.resize(n);
+	encodedRanges.assign(ranges, ranges + n);
+	for (int i = 0; i < n; i++) {
+	    encoded[i] = encoder_->encode(string((const char*)ranges[i].key, ranges[i].keylen));
+	    encodedRanges[i].key = (const uint8_t*)encoded[i].data();
+	    encodedRanges[i].keylen = encoded[i].length();
+	}
+	ranges = encodedRanges.data();
+    }
+
+    vector<FSTIter> iters(SCAN_GROUP, FSTIter(this));
+    FSTDescent d[SCAN_GROUP];
+    bool active[SCAN_GROUP];
+    uint64_t total = 0;
+
+    for (int base = 0; base < n; base += SCAN_GROUP) {
+	int m = min(SCAN_GROUP, n - base);
+	for (int j = 0; j < m; j++) {
+	    iters[j].clear();
+	    lowerBoundInit(d[j]);
+	    active[j] = true;
+	}
+
+	int numActive = m;
+	while (numActive > 0) {
+	    for (int j = 0; j < m; j++) {
+		if (active[j] && !lowerBoundStep(ranges[base + j].key, ranges[base + j].keylen, d[j], iters[j])) {
+		    active[j] = false;
+		    numActive--;
+		}
+	    }
+	}
+
+	for (int j = 0; j < m; j++) {
+	    FSTIter &iter = iters[j];
+	    uint32_t count = ranges[base + j].count;
+	    uint32_t c = 0;
+	    if (count > 0 && d[j].result) {
+		do {
+		    values[total + c] = iter.value();
+		    if (keys != NULL) {
+			string k = iter.key();
+			keys->insert(keys->end(), k.begin(), k.end());
+			keyEnd[total + c] = keys->size();
+		    }
+		    c++;
+		} while (c < count && iter++);
+	    }
+	    counts[base + j] = c;
+	    total += c;
+	}
+    }
+    return total;
+}
+
+
+//******************************************************
+// FOR EACH
+//******************************************************
+bool FST::walkStart(const uint8_t* lo, int lolen, const uint8_t* hi, int hilen, FSTWalk &w) const {
+    FSTIter iter(this);
+    if (!lowerBound(lo, lolen, iter))
+	return false;
+    return walkStart(iter, hi, hilen, w);
+}
+
+// Starts the walk at the key iter points to.
+bool FST::walkStart(const FSTIter &iter, const uint8_t* hi, int hilen, FSTWalk &w) const {
+    int height = tree_height_ + 1;
+    w.pos.assign(height, 0);
+    w.isO.assign(height, 0);
+    w.nextNode.assign(height, -1);
+    w.nextValue.assign(height, -1);
+    w.tight.assign(height, 0);
+    if (encoder_ != NULL && hi != NULL) {
+	w.hiKey = encoder_->encode(string((const char*)hi, hilen));
+	hi = (const uint8_t*)w.hiKey.data();
+	hilen = w.hiKey.length();
+    }
+    w.hi = hi;
+    w.hilen = hilen;
+    w.level = 0;
+    w.pending = false;
+    w.done = true;
+    w.keys = NULL;
+    w.keyEnd = NULL;
+    w.keyBytes = 0;
+    w.keyCap = 0;
+
+    int len = iter.len;
+    w.tight[0] = (hi != NULL);
+    for (int level = 0; level < len; level++) {
+	w.pos[level] = iter.positions[level].keyPos;
+	w.isO[level] = (level < cutoff_level_) && iter.positions[level].isO;
+	if (!w.tight[level])
+	    continue;
+	if (w.isO[level]) // the key ends above this level
+	    continue;
+	uint8_t c = (level < cutoff_level_) ? (w.pos[level] & 255) : label(w.pos[level]);
+	if (level >= cutoff_level_ && c == TERM && !isTbitSet(w.pos[level]))
+	    continue;
+	if (level >= hilen || c > hi[level])
+	    return false;
+	w.tight[level + 1] = (c == hi[level]);
+    }
+
+    w.level = len - 1;
+    w.nextValue[len - 1] = iter.positions[len - 1].valPos;
+    w.pending = true;
+    w.done = false;
+    return true;
+}
+
+inline void FST::walkLeaf(FSTWalk &w, int level, uint64_t* values, int &n) const {
+    if (w.keys != NULL) {
+	// the labels above the leaf, and its own unless it ends the key
+	uint8_t* out = w.keys + w.keyBytes;
+	for (int l = 0; l < level; l++)
+	    *out++ = (l < cutoff_level_) ? (w.pos[l] & 255) : label(w.pos[l]);
+	if (level < cutoff_level_) {
+	    if (!w.isO[level])
+		*out++ = w.pos[level] & 255;
+	}
+	else {
+	    uint8_t c = label(w.pos[level]);
+	    if (c != TERM || isTbitSet(w.pos[level]))
+		*out++ = c;
+	}
+	w.keyBytes = out - w.keys;
+	w.keyEnd[n] = w.keyBytes;
+    }
+
+    int64_t v = w.nextValue[level];
+    if (level < cutoff_level_) {
+	if (v < 0)
+	    v = valuePosU(w.pos[level] >> 8, w.pos[level]);
+	values[n++] = valuesU_[v];
+    }
+    else {
+	if (v < 0 || sparseLayout_ == SPARSE_BLOCKED)
+	    v = valuePos(w.pos[level]);
+	values[n++] = values_[v];
+    }
+    w.nextValue[level] = v + 1;
+}
+
+// Visits up to cap leaves after the current one (fewer if their keys
+// may not fit into w.keys). Returns 0 at the end.
+int FST::walkValues(FSTWalk &w, uint64_t* values, int cap) const {
+    int n = 0;
+    if (w.keys != NULL) {
+	// a key is at most a label per level
+	int room = (w.keyCap - w.keyBytes) / w.pos.size();
+	cap = min(cap, max(room, 1));
+    }
+    if (w.done)
+	return 0;
+    if (w.pending) {
+	walkLeaf(w, w.level, values, n);
+	w.pending = false;
+    }
+
+    int level = w.level;
+    while (n < cap) {
+	// next label, climbing out of finished nodes
+	while (level >= 0) {
+	    if (level < cutoff_level_) {
+		uint64_t nodeNum = w.pos[level] >> 8;
+		uint8_t kc = w.pos[level] & 255;
+		uint8_t cc = 0;
+		bool hasNext;
+		if (w.isO[level]) {
+		    w.isO[level] = 0;
+		    hasNext = nextItemU(nodeNum, 0, cc);
+		}
+		else {
+		    hasNext = (kc < 255) && nextItemU(nodeNum, kc + 1, cc);
+		}
+		if (hasNext) {
+		    w.pos[level] = (nodeNum << 8) + cc;
+		    break;
+		}
+		w.nextNode[level] = nodeNum + 1;
+	    }
+	    else {
+		uint64_t p = nextInLevel(level, w.pos[level]);
+		if (!isSbitSet(p)) {
+		    w.pos[level] = p;
+		    break;
+		}
+		w.nextNode[level] = p;
+	    }
+	    level--;
+	}
+	if (level < 0) {
+	    w.done = true;
+	    return n;
+	}
+
+	// down to the leftmost leaf below it
+	while (true) {
+	    uint64_t pos = w.pos[level];
+	    bool dense = (level < cutoff_level_);
+	    uint8_t c = dense ? (pos & 255) : label(pos);
+
+	    // a TERM leaf ends the key above this level, it is <= hi
+	    w.tight[level + 1] = 0;
+	    if (w.tight[level] && !(!dense && c == TERM && !isTbitSet(pos))) {
+		if (level >= w.hilen || c > w.hi[level]) {
+		    w.done = true;
+		    return n;
+		}
+		w.tight[level + 1] = (c == w.hi[level]);
+	    }
+
+	    bool hasChild = dense ? isTbitSetU(pos >> 8, c) : isTbitSet(pos);
+	    if (!hasChild) {
+		walkLeaf(w, level, values, n);
+		break;
+	    }
+
+	    int64_t node = w.nextNode[level + 1];
+	    if (node < 0) {
+		if (!dense) {
+		    node = sparseChildPos(level, pos);
+		}
+		else {
+		    node = childNodeNumU(pos);
+		    if (level + 1 >= cutoff_level_) {
+			uint64_t block = 0;
+			node = sparseRootPos(node, block);
+		    }
+		}
+	    }
+	    level++;
+
+	    if (level >= cutoff_level_) {
+		w.pos[level] = node;
+		continue;
+	    }
+	    if (isObitSetU(node)) {
+		w.pos[level] = node << 8;
+		w.isO[level] = 1;
+		walkLeaf(w, level, values, n);
+		break;
+	    }
+	    uint8_t cc = 0;
+	    nextItemU(node, 0, cc);
+	    w.pos[level] = (node << 8) + cc;
+	    w.isO[level] = 0;
+	}
+    }
+    w.level = level;
+    return n;
+}
+
+
+//******************************************************
+// EXPORT
+//******************************************************
+uint64_t FST::exportAll(const function<void(const FSTExportBatch&)> &sink, int threads) const {
+    if (threads <= 0)
+	threads = max(1, (int)thread::hardware_concurrency());
+    if (rankKeys_ == 0 || threads == 1 || rankKeys_ < (uint64_t)threads * EXPORT_BATCH)
+	return exportRange(0, UINT64_MAX, 0, sink);
+
+    vector<uint64_t> counts(threads);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+	uint64_t first = rankKeys_ * t / threads;
+	uint64_t count = rankKeys_ * (t + 1) / threads - first;
+	workers.push_back(thread([&, t, first, count]() { counts[t] = exportRange(first, count, t, sink); }));
+    }
+    uint64_t total = 0;
+    for (int t = 0; t < threads; t++) {
+	workers[t].join();
+	total += counts[t];
+    }
+    return total;
+}
+
+// Exports count keys from rank first on (to the end for UINT64_MAX;
+// first is 0 without rank access).
+uint64_t FST::exportRange(uint64_t first, uint64_t count, int part, const function<void(const FSTExportBatch&)> &sink) const {
+    FSTIter iter(this);
+    bool found = (rankKeys_ > 0) ? seekToRank(first, iter) : lowerBound((const uint8_t*)"", 0, iter);
+    FSTWalk w;
+    if (count == 0 || !found || !walkStart(iter, NULL, 0, w))
+	return 0;
+
+    vector<uint8_t> keys(max<uint64_t>(EXPORT_BYTES, w.pos.size()));
+    vector<uint32_t> keyEnd(EXPORT_BATCH);
+    vector<uint64_t> values(EXPORT_BATCH);
+    w.keys = keys.data();
+    w.keyEnd = keyEnd.data();
+    w.keyCap = keys.size();
+
+    // stored keys are decoded into a second buffer
+    vector<uint8_t> decoded;
+    vector<uint32_t> decodedEnd;
+    if (encoder_ != NULL)
+	decodedEnd.resize(EXPORT_BATCH);
+
+    FSTExportBatch batch;
+    batch.part = part;
+    batch.firstRank = first;
+    uint64_t done = 0;
+    int n;
+    while (done < count && (n = walkValues(w, values.data(), min<uint64_t>(EXPORT_BATCH, count - done))) > 0) {
+	batch.count = n;
+	batch.keys = keys.data();
+	batch.keyEnd = keyEnd.data();
+	batch.values = values.data();
+	if (encoder_ != NULL) {
+	    decoded.clear();
+	    uint32_t start = 0;
+	    for (int i = 0; i < n; i++) {
+		string k = encoder_->decode(keys.data() + start, keyEnd[i] - start);
+		decoded.insert(decoded.end(), k.begin(), k.end());
+		decodedEnd[i] = decoded.size();
+		start = keyEnd[i];
+	    }
+	    batch.keys = decoded.data();
+	    batch.keyEnd = decodedEnd.data();
+	}
+	sink(batch);
+	batch.firstRank += n;
+	done += n;
+	w.keyBytes = 0;
+    }
+    return done;
+}
+
 //******************************************************
 // PRINT
 //******************************************************
-void FST::printU() {
+void FST::printU() const {
     cout << "\n======================================================\n\n";
-    for (int i = 0; i < c_lenU_; i += 4) {
+    for (uint64_t n = 0; n < nodeCountU_; n++) {
 	for (int j = 0; j < 256; j++) {
-	    if (isLabelExist(cbitsU_->bits_ + i, (uint8_t)j))
+	    if (isCbitSetU(n, (uint8_t)j))
 		cout << (char)j;
 	}
 	cout << " || ";
     }
 
     cout << "\n======================================================\n\n";
-    for (int i = 0; i < c_lenU_; i += 4) {
+    for (uint64_t n = 0; n < nodeCountU_; n++) {
 	for (int j = 0; j < 256; j++) {
-	    if (isLabelExist(tbitsU_->bits_ + i, (uint8_t)j))
+	    if (isCbitSetU(n, (uint8_t)j) && isTbitSetU(n, (uint8_t)j))
 		cout << (char)j;
 	    //cout << j << " ";
 	}
@@ -954,7 +2693,7 @@ void FST::printU() {
     cout << "\n";
 }
 
-void FST::print() {
+void FST::print() const {
     int c_pos = 0;
     int v_pos = 0;
     int s_pos = 0;
@@ -963,7 +2702,7 @@ void FST::print() {
     cout << "\n======================================================\n\n";
 
     for (int i = 0; i < c_mem_; i++)
-	cout << "(" << i << ")" << cbytes_[i] << " ";
+	cout << "(" << i << ")" << label(i) << " ";
 
     cout << "\n======================================================\n\n";
     for (int i = 0; i < c_mem_; i++) {
@@ -992,40 +2731,103 @@ void FST::print() {
 //******************************************************
 // ITERATOR
 //******************************************************
-FSTIter::FSTIter() : index(NULL), len(0), isEnd(false), cBoundU(0), cBound(0), cutoff_level(0), tree_height(0), last_value_pos(0) { }
+FSTIter::FSTIter() : index(NULL), positions(inlinePositions), depth(0), len(0), isEnd(false), cBoundU(0), cBound(0), cutoff_level(0), tree_height(0), last_value_pos(0) { }
 
-FSTIter::FSTIter(FST* idx) {
+FSTIter::FSTIter(const FST* idx) {
+    init(idx);
+    for (int i = 0; i < tree_height; i++) {
+	positions[i].keyPos = -1;
+	positions[i].valPos = -1;
+	positions[i].isO = false;
+    }
+}
+
+FSTIter::FSTIter(const FSTIter &other) : index(NULL), positions(inlinePositions) {
+    copyFrom(other);
+}
+
+FSTIter& FSTIter::operator = (const FSTIter &other) {
+    if (this != &other) {
+	if (positions != inlinePositions)
+	    delete[] positions;
+	positions = inlinePositions;
+	copyFrom(other);
+    }
+    return *this;
+}
+
+FSTIter::~FSTIter() {
+    if (positions != inlinePositions)
+	delete[] positions;
+}
+
+uint64_t FSTIter::mem() const {
+    uint64_t m = sizeof(FSTIter);
+    if (positions != inlinePositions)
+	m += tree_height * sizeof(Cursor);
+    return m;
+}
+
+// Sets everything but the cursors.
+void FSTIter::init(const FST* idx) {
     index = idx;
     tree_height = index->tree_height_;
     cutoff_level = index->cutoff_level_;
     cBoundU = (index->c_lenU_ << 6) - 1;
-    cBound = index->cMem() - 1;
+    cBound = index->c_mem_ - 1;
     last_value_pos = index->last_value_pos_;
 
+    if (tree_height <= INLINE_LEVELS)
+	positions = inlinePositions;
+    else
+	positions = new Cursor[tree_height];
+
+    depth = 0;
     len = 0;
     isEnd = false;
+}
 
-    for (int i = 0; i < tree_height; i++) {
-	Cursor c;
-	c.keyPos = -1;
-	c.valPos = -1;
-	c.isO = false;
-	positions.push_back(c);
+// Expects positions to point at inlinePositions.
+void FSTIter::copyFrom(const FSTIter &other) {
+    if (other.index == NULL) {
+	index = NULL;
+	depth = len = 0;
+	isEnd = false;
+	cBoundU = cBound = 0;
+	cutoff_level = 0;
+	tree_height = last_value_pos = 0;
+	return;
     }
+    init(other.index);
+    for (int i = 0; i < tree_height; i++)
+	positions[i] = other.positions[i];
+    depth = other.depth;
+    len = other.len;
+    isEnd = other.isEnd;
+}
+
+// Every write to a level goes either through the set* functions or
+// through a lowerBound step at that level (or below the current leaf),
+// so depth only has to be raised there.
+inline void FSTIter::touch(int level) {
+    if ((uint32_t)level >= depth)
+	depth = level + 1;
 }
 
 void FSTIter::clear() {
-    for (int i = 0; i < tree_height; i++) {
+    for (uint32_t i = 0; i < depth; i++) {
 	positions[i].keyPos = -1;
 	positions[i].valPos = -1;
 	positions[i].isO = false;
     }
 
+    depth = 0;
     len = 0;
     isEnd = false;
 }
 
 inline void FSTIter::setVU(int level, uint64_t nodeNum, uint64_t pos) {
+    touch(level);
     len = level + 1;
     if (positions[level].valPos < 0)
 	positions[level].valPos = index->valuePosU(nodeNum, pos);
@@ -1034,6 +2836,7 @@ inline void FSTIter::setVU(int level, uint64_t nodeNum, uint64_t pos) {
 }
 
 inline void FSTIter::setKVU(int level, uint64_t nodeNum, uint64_t pos, bool o) {
+    touch(level);
     positions[level].keyPos = pos;
     positions[level].isO = o;
     len = level + 1;
@@ -1043,18 +2846,22 @@ inline void FSTIter::setKVU(int level, uint64_t nodeNum, uint64_t pos, bool o) {
 	positions[level].valPos++;
 }
 
+// In the blocked layout the next value of a level is not always the
+// next one in values_, so it is recomputed.
 inline void FSTIter::setV(int level, uint64_t pos) {
+    touch(level);
     len = level + 1;
-    if (positions[level].valPos < 0)
+    if (positions[level].valPos < 0 || index->sparseLayout_ == FST::SPARSE_BLOCKED)
 	positions[level].valPos = index->valuePos(pos);
     else
 	positions[level].valPos++;
 }
 
 inline void FSTIter::setKV(int level, uint64_t pos) {
+    touch(level);
     positions[level].keyPos = pos;
     len = level + 1;
-    if (positions[level].valPos < 0)
+    if (positions[level].valPos < 0 || index->sparseLayout_ == FST::SPARSE_BLOCKED)
 	positions[level].valPos = index->valuePos(pos);
     else
 	positions[level].valPos++;
@@ -1072,6 +2879,40 @@ uint64_t FSTIter::value () {
     }
 }
 
+PostingList FSTIter::postings () {
+    return index->postings(value());
+}
+
+FSTPayload FSTIter::payload () {
+    return index->payload(value());
+}
+
+// One label per level down to the leaf, except that the leaf is the
+// node's prefix key (D-IsPrefixKey or a TERM label) when the key ends
+// above it.
+string FSTIter::key () {
+    string k;
+    if (len == 0)
+	return k;
+    for (uint32_t level = 0; level < len; level++) {
+	int32_t pos = positions[level].keyPos;
+	if ((int)level < cutoff_level) {
+	    if (level == len - 1 && positions[level].isO)
+		break;
+	    k.push_back((char)(pos & 255));
+	}
+	else {
+	    uint8_t c = index->label(pos);
+	    if (level == len - 1 && c == FST::TERM && !index->isTbitSet(pos))
+		break;
+	    k.push_back((char)c);
+	}
+    }
+    if (index->encoder_ != NULL)
+	return index->encoder_->decode((const uint8_t*)k.data(), k.length());
+    return k;
+}
+
 bool FSTIter::operator ++ (int) {
     if (unlikely(isEnd))
 	return false;
@@ -1113,7 +2954,7 @@ bool FSTIter::operator ++ (int) {
 		continue;
 	    }
 
-	    positions[level].keyPos++;
+	    positions[level].keyPos = index->nextInLevel(level, positions[level].keyPos);
 
 	    if (index->isSbitSet(positions[level].keyPos))
 		return index->nextNode(level, positions[level].keyPos, this);
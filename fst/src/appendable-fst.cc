@@ -0,0 +1,180 @@
+#include "appendable-fst.h"
+
+#include <string.h>
+
+#include <iterator>
+
+const uint64_t AppendableFST::SEGMENT_KEYS;
+
+static int compareKey(const string &a, const uint8_t* key, const int keylen) {
+    int len = ((int)a.length() < keylen) ? a.length() : keylen;
+    int cmp = memcmp(a.data(), key, len);
+    if (cmp != 0)
+	return cmp;
+    return (int)a.length() - keylen;
+}
+
+//******************************************************
+// SNAPSHOT
+//******************************************************
+FSTSnapshot::FSTSnapshot() : numKeys_(0) {}
+
+int64_t FSTSnapshot::findRun(const uint8_t* key, const int keylen) const {
+    // the last run whose first key is <= key
+    int64_t lo = 0;
+    int64_t hi = firstKeys_.size();
+    while (lo < hi) {
+	int64_t mid = (lo + hi) / 2;
+	if (compareKey(firstKeys_[mid], key, keylen) <= 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo - 1;
+}
+
+bool FSTSnapshot::lookup(const uint8_t* key, const int keylen, uint64_t &value) const {
+    int64_t r = findRun(key, keylen);
+    if (r < 0 || compareKey(lastKeys_[r], key, keylen) < 0)
+	return false;
+    return runs_[r]->lookup(key, keylen, value);
+}
+
+uint64_t FSTSnapshot::scan(const uint8_t* key, const int keylen, uint64_t count, uint64_t* values) const {
+    int64_t r = findRun(key, keylen);
+    if (r < 0)
+	r = 0;
+    else if (compareKey(lastKeys_[r], key, keylen) < 0)
+	r++;
+
+    // The keys of later runs are all > key, so key also finds their
+    // first key.
+    uint64_t n = 0;
+    for (; r < (int64_t)runs_.size() && n < count; r++) {
+	FSTIter iter(runs_[r].get());
+	if (!runs_[r]->lowerBound(key, keylen, iter))
+	    continue;
+	values[n++] = iter.value();
+	while (n < count && iter++)
+	    values[n++] = iter.value();
+    }
+    return n;
+}
+
+uint64_t FSTSnapshot::numKeys() const { return numKeys_; }
+
+uint64_t FSTSnapshot::numRuns() const { return runs_.size(); }
+
+uint64_t FSTSnapshot::mem() const {
+    uint64_t mem = sizeof(FSTSnapshot) + runs_.size() * (sizeof(shared_ptr<const FST>) + 2 * sizeof(string));
+    for (int r = 0; r < (int)runs_.size(); r++)
+	mem += runs_[r]->mem() + firstKeys_[r].capacity() + lastKeys_[r].capacity();
+    return mem;
+}
+
+//******************************************************
+// APPENDABLE FST
+//******************************************************
+AppendableFST::AppendableFST(uint64_t segmentKeys, int sparseLayout)
+    : segmentKeys_(segmentKeys), sparseLayout_(sparseLayout), empty_(true),
+      snapshot_(new FSTSnapshot()) {}
+
+bool AppendableFST::append(const string &key, uint64_t value) {
+    if (!empty_) {
+	int cmp = key.compare(lastKey_);
+	if (cmp < 0)
+	    return false;
+	if (cmp == 0) {
+	    if (pendingKeys_.empty())
+		return false;
+	    pendingValues_.back() = value;
+	    return true;
+	}
+    }
+    pendingKeys_.push_back(key);
+    pendingValues_.push_back(value);
+    lastKey_ = key;
+    empty_ = false;
+    return true;
+}
+
+void AppendableFST::build(Run &run) {
+    int longestKeyLen = 0;
+    for (uint64_t k = 0; k < run.keys.size(); k++)
+	if ((int)run.keys[k].length() > longestKeyLen)
+	    longestKeyLen = run.keys[k].length();
+
+    FST* index = new FST();
+    index->load(run.keys, run.values, longestKeyLen, sparseLayout_);
+    run.index.reset(index);
+    run.firstKey = run.keys[0];
+    run.lastKey = run.keys.back();
+    run.numKeys = run.keys.size();
+}
+
+void AppendableFST::publish() {
+    if (pendingKeys_.empty())
+	return;
+
+    Run run;
+    run.keys.swap(pendingKeys_);
+    run.values.swap(pendingValues_);
+
+    // absorb the unsealed runs before it that are no larger; they come
+    // first in key order
+    while (!runs_.empty() && !runs_.back().keys.empty()
+	   && runs_.back().keys.size() <= run.keys.size()) {
+	Run &prev = runs_.back();
+	prev.keys.insert(prev.keys.end(), make_move_iterator(run.keys.begin()), make_move_iterator(run.keys.end()));
+	prev.values.insert(prev.values.end(), run.values.begin(), run.values.end());
+	run.keys.swap(prev.keys);
+	run.values.swap(prev.values);
+	runs_.pop_back();
+    }
+
+    build(run);
+    if (run.numKeys >= segmentKeys_) {
+	vector<string>().swap(run.keys);
+	vector<uint64_t>().swap(run.values);
+    }
+    runs_.push_back(move(run));
+
+    FSTSnapshot* snapshot = new FSTSnapshot();
+    for (int r = 0; r < (int)runs_.size(); r++) {
+	snapshot->runs_.push_back(runs_[r].index);
+	snapshot->firstKeys_.push_back(runs_[r].firstKey);
+	snapshot->lastKeys_.push_back(runs_[r].lastKey);
+	snapshot->numKeys_ += runs_[r].numKeys;
+    }
+    atomic_store(&snapshot_, shared_ptr<const FSTSnapshot>(snapshot));
+}
+
+uint64_t AppendableFST::pending() const { return pendingKeys_.size(); }
+
+shared_ptr<const FSTSnapshot> AppendableFST::snapshot() const {
+    return atomic_load(&snapshot_);
+}
+
+bool AppendableFST::lookup(const uint8_t* key, const int keylen, uint64_t &value) const {
+    return snapshot()->lookup(key, keylen, value);
+}
+
+uint64_t AppendableFST::scan(const uint8_t* key, const int keylen, uint64_t count, uint64_t* values) const {
+    return snapshot()->scan(key, keylen, count, values);
+}
+
+uint64_t AppendableFST::numKeys() const { return snapshot()->numKeys(); }
+
+uint64_t AppendableFST::mem() const {
+    uint64_t mem = sizeof(AppendableFST) + snapshot()->mem() + runs_.capacity() * sizeof(Run);
+    for (int r = 0; r < (int)runs_.size(); r++) {
+	mem += runs_[r].firstKey.capacity() + runs_[r].lastKey.capacity() + runs_[r].values.capacity() * sizeof(uint64_t)
+	    + runs_[r].keys.capacity() * sizeof(string);
+	for (uint64_t k = 0; k < runs_[r].keys.size(); k++)
+	    mem += runs_[r].keys[k].capacity();
+    }
+    mem += pendingKeys_.capacity() * sizeof(string) + pendingValues_.capacity() * sizeof(uint64_t);
+    for (uint64_t k = 0; k < pendingKeys_.size(); k++)
+	mem += pendingKeys_[k].capacity();
+    return mem;
+}
@@ -34,7 +34,9 @@ BitmapRankPoppy::BitmapRankPoppy(uint64 *bits, uint32 nbits)
     nbits_ = nbits;    
     basicBlockCount_ = nbits_ / kBasicBlockSize;
 
-    assert(posix_memalign((void **) &rankLUT_, kCacheLineSize, basicBlockCount_ * sizeof(uint32)) >= 0);
+    // one extra entry holds the total so that rank(nbits) works and
+    // the last basic block keeps its own prefix count
+    assert(posix_memalign((void **) &rankLUT_, kCacheLineSize, (basicBlockCount_ + 1) * sizeof(uint32)) >= 0);
 
     uint32 rankCum = 0;
     for (uint32 i = 0; i < basicBlockCount_; i++) {
@@ -43,27 +45,25 @@ BitmapRankPoppy::BitmapRankPoppy(uint64 *bits, uint32 nbits)
 				  i * kWordCountPerBasicBlock, 
 				  kBasicBlockSize);
     }
-    rankLUT_[basicBlockCount_-1] = rankCum;
+    rankLUT_[basicBlockCount_] = rankCum;
 
     pCount_ = rankCum;
-    mem_ = nbits / 8 + basicBlockCount_ * sizeof(uint32);
+    mem_ = nbits / 8 + (basicBlockCount_ + 1) * sizeof(uint32);
 }
 
-uint32 BitmapRankPoppy::rank(uint32 pos)
+BitmapRankPoppy::~BitmapRankPoppy()
 {
-    assert(pos <= nbits_);
-    uint32 blockId = pos >> kBasicBlockBits;
-    return rankLUT_[blockId] + popcountLinear(bits_, (blockId << 3), (pos & 511));
+    free(rankLUT_);
 }
 
-uint64* BitmapRankPoppy::getBits() {
+uint64* BitmapRankPoppy::getBits() const {
     return bits_;
 }
 
-uint32 BitmapRankPoppy::getNbits() {
+uint32 BitmapRankPoppy::getNbits() const {
     return nbits_;
 }
 
-uint32 BitmapRankPoppy::getMem() {
+uint32 BitmapRankPoppy::getMem() const {
     return mem_;
 }
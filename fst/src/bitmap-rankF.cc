@@ -49,25 +49,19 @@ BitmapRankFPoppy::BitmapRankFPoppy(uint64 *bits, uint32 nbits)
     mem_ = nbits / 8 + basicBlockCount_ * sizeof(uint32);
 }
 
-uint32 BitmapRankFPoppy::rank(uint32 pos)
+BitmapRankFPoppy::~BitmapRankFPoppy()
 {
-    assert(pos <= nbits_);
-    uint32 blockId = pos >> kBasicBlockBits;
-    uint32 offset = pos & (uint32)63;
-    if (offset)
-	return rankLUT_[blockId] + popcount(bits_[blockId] >> (64 - offset));
-    else
-	return rankLUT_[blockId];
+    free(rankLUT_);
 }
 
-uint64* BitmapRankFPoppy::getBits() {
+uint64* BitmapRankFPoppy::getBits() const {
     return bits_;
 }
 
-uint32 BitmapRankFPoppy::getNbits() {
+uint32 BitmapRankFPoppy::getNbits() const {
     return nbits_;
 }
 
-uint32 BitmapRankFPoppy::getMem() {
+uint32 BitmapRankFPoppy::getMem() const {
     return mem_;
 }
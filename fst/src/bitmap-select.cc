@@ -64,37 +64,19 @@ BitmapSelectPoppy::BitmapSelectPoppy(uint64 *bits, uint32 nbits)
     mem_ = nbits_ / 8 + (selectLUTCount_ + 1) * sizeof(uint32);
 }
 
-uint32 BitmapSelectPoppy::select(uint32 rank) {
-    assert(rank <= pCount_);
-
-    uint32 s = selectLUT_[rank >> kSkipBits];
-    uint32 rankR = rank & kSkipMask;
-
-    if (rankR == 0)
-	return s - 1;
-
-    int idx = s >> kWordBits;
-    int startWordBit = s & kWordMask;
-    uint64 word = bits_[idx] << startWordBit >> startWordBit;
-
-    int pop = 0;
-    while ((pop = popcount(word)) < rankR) {
-	idx++;
-	word = bits_[idx];
-	rankR -= pop;
-    }
-
-    return (idx << kWordBits) + select64_popcount_search(word, rankR);
+BitmapSelectPoppy::~BitmapSelectPoppy()
+{
+    free(selectLUT_);
 }
 
-uint64* BitmapSelectPoppy::getBits() {
+uint64* BitmapSelectPoppy::getBits() const {
     return bits_;
 }
 
-uint32 BitmapSelectPoppy::getNbits() {
+uint32 BitmapSelectPoppy::getNbits() const {
     return nbits_;
 }
 
-uint32 BitmapSelectPoppy::getMem() {
+uint32 BitmapSelectPoppy::getMem() const {
     return mem_;
 }
@@ -0,0 +1,429 @@
+#include "dfuds.h"
+
+#include <algorithm>
+
+#include "label-search.h"
+
+const uint8_t DFUDSTrie::TERM;
+
+// enough bytes after the last label for the 16-byte label search loads
+static const int LABEL_PADDING = 16;
+
+//******************************************************
+// Excess of the 8 parens of a byte (MSB first): in total, and the
+// minimum over its prefixes of 1 .. 8 parens.
+//******************************************************
+struct ByteExcess {
+    int8_t total[256];
+    int8_t min[256];
+
+    ByteExcess() {
+	for (int b = 0; b < 256; b++) {
+	    int e = 0;
+	    int m = 8;
+	    for (int j = 7; j >= 0; j--) {
+		e += ((b >> j) & 1) ? 1 : -1;
+		m = std::min(m, e);
+	    }
+	    total[b] = e;
+	    min[b] = m;
+	}
+    }
+};
+
+static const ByteExcess byteExcess;
+
+DFUDSTrie::DFUDSTrie() : numBits_(0), rank_(NULL), numNodes_(0) { }
+
+DFUDSTrie::~DFUDSTrie() {
+    if (rank_) delete rank_;
+}
+
+void DFUDSTrie::clear() {
+    if (rank_) delete rank_;
+    rank_ = NULL;
+    numBits_ = 0;
+    numNodes_ = 0;
+    bits_.clear();
+    labels_.clear();
+    values_.clear();
+    leafLUT_.clear();
+    wordMin_.clear();
+    blockMin_.clear();
+    superMin_.clear();
+}
+
+uint64_t DFUDSTrie::numKeys() const { return values_.size(); }
+
+uint64_t DFUDSTrie::numNodes() const { return numNodes_; }
+
+uint64_t DFUDSTrie::mem() const {
+    uint64_t m = bits_.size() * sizeof(uint64_t) + labels_.size() + values_.size() * sizeof(uint64_t)
+	+ leafLUT_.size() * sizeof(uint32_t) + wordMin_.size()
+	+ (blockMin_.size() + superMin_.size()) * sizeof(int32_t);
+    if (rank_)
+	m += rank_->getMem() - rank_->getNbits() / 8;
+    return m;
+}
+
+//******************************************************
+// LOAD
+//******************************************************
+void DFUDSTrie::appendBit(bool open) {
+    if ((numBits_ & 63) == 0)
+	bits_.push_back(0);
+    if (open)
+	setBit(bits_.back(), numBits_ & 63);
+    numBits_++;
+}
+
+void DFUDSTrie::load(const vector<string> &keys, const vector<uint64_t> &values) {
+    clear();
+
+    // of equal neighbours the last one stays
+    vector<string> unique;
+    vector<uint64_t> uniqueValues;
+    for (uint64_t i = 0; i < keys.size(); i++) {
+	if (i + 1 < keys.size() && keys[i] == keys[i + 1])
+	    continue;
+	unique.push_back(keys[i]);
+	uniqueValues.push_back(values[i]);
+    }
+
+    vector<uint32_t> lcp(unique.size(), 0);
+    for (uint64_t i = 0; i + 1 < unique.size(); i++)
+	lcp[i] = commonPrefixLen(unique[i], unique[i + 1]);
+
+    if (!unique.empty()) {
+	appendBit(true);
+	buildNode(unique, uniqueValues, lcp, 0, unique.size(), 0);
+    }
+    labels_.resize(labels_.size() + LABEL_PADDING, 0);
+    buildDirectories();
+}
+
+// Writes the node of keys [lo, hi), which share their first depth
+// bytes, and then its subtrees.
+void DFUDSTrie::buildNode(const vector<string> &keys, const vector<uint64_t> &values, const vector<uint32_t> &lcp, uint64_t lo, uint64_t hi, uint32_t depth) {
+    // children as key ranges: a key ending here, then one per next byte
+    vector<uint64_t> starts;
+    uint64_t k = lo;
+    if (keys[k].length() == depth) {
+	labels_.push_back(TERM);
+	starts.push_back(k);
+	k++;
+    }
+    while (k < hi) {
+	labels_.push_back((uint8_t)keys[k][depth]);
+	starts.push_back(k);
+	while (k + 1 < hi && lcp[k] > depth)
+	    k++;
+	k++;
+    }
+    starts.push_back(hi);
+
+    for (uint64_t i = 0; i + 1 < starts.size(); i++)
+	appendBit(true);
+    appendBit(false);
+    numNodes_++;
+
+    for (uint64_t i = 0; i + 1 < starts.size(); i++) {
+	if (starts[i + 1] - starts[i] == 1) {
+	    appendBit(false);
+	    numNodes_++;
+	    values_.push_back(values[starts[i]]);
+	}
+	else {
+	    buildNode(keys, values, lcp, starts[i], starts[i + 1], depth + 1);
+	}
+    }
+}
+
+void DFUDSTrie::buildDirectories() {
+    // whole 2048-bit blocks, as the FST pads its Poppy bitmaps
+    bits_.resize((bits_.size() / 32 + 1) * 32, 0);
+    bits_.shrink_to_fit();
+    labels_.shrink_to_fit();
+    values_.shrink_to_fit();
+    rank_ = new BitmapRankPoppy(bits_.data(), bits_.size() * 64);
+
+    uint64_t numWords = bits_.size();
+    wordMin_.resize(numWords);
+    blockMin_.assign((numWords + 63) / 64, INT32_MAX);
+    superMin_.assign((blockMin_.size() + 63) / 64, INT32_MAX);
+    leafLUT_.resize(numWords / 8 + 1);
+
+    int64_t e = 0;
+    uint64_t leaves = 0;
+    uint64_t prev = 1;
+    for (uint64_t k = 0; k < numWords; k++) {
+	uint64_t w = bits_[k];
+	if ((k & 7) == 0)
+	    leafLUT_[k >> 3] = leaves;
+	leaves += __builtin_popcountll(~w & ~((w >> 1) | (prev << 63)));
+	prev = w & 1;
+
+	int m = 64;
+	int we = 0;
+	for (int j = 56; j >= 0; j -= 8) {
+	    uint8_t b = (w >> j) & 255;
+	    m = std::min(m, we + byteExcess.min[b]);
+	    we += byteExcess.total[b];
+	}
+	wordMin_[k] = m;
+	blockMin_[k >> 6] = std::min<int64_t>(blockMin_[k >> 6], e + m);
+	superMin_[k >> 12] = std::min<int64_t>(superMin_[k >> 12], e + m);
+	e += we;
+    }
+    leafLUT_[numWords / 8] = leaves;
+}
+
+//******************************************************
+// RANGE MIN-MAX SEARCH
+//******************************************************
+// Scans word from bit from on, cur being the excess before that bit.
+// Returns true with the first position whose excess after it is
+// target; otherwise cur is the excess at the end of the word.
+bool DFUDSTrie::scanWord(uint64_t word, int from, int64_t &cur, int64_t target, uint64_t &pos) const {
+    uint64_t w = bits_[word];
+    int j = from;
+    while (j < 64) {
+	if ((j & 7) == 0) {
+	    uint8_t b = (w >> (56 - j)) & 255;
+	    if (cur + byteExcess.min[b] > target) {
+		cur += byteExcess.total[b];
+		j += 8;
+		continue;
+	    }
+	}
+	cur += ((w << j) & MSB_MASK) ? 1 : -1;
+	if (cur == target) {
+	    pos = (word << 6) + j;
+	    return true;
+	}
+	j++;
+    }
+    return false;
+}
+
+// First position x >= start such that the excess after x is target,
+// for target < excess(start). Climbs the min tree from start's word
+// until a range reaches target, then walks down into it.
+uint64_t DFUDSTrie::fwdSearch(uint64_t start, int64_t target) const {
+    int64_t cur = excess(start);
+    uint64_t pos = 0;
+    uint64_t k = start >> 6;
+    if (scanWord(k, start & 63, cur, target, pos))
+	return pos;
+
+    uint64_t numWords = bits_.size();
+    uint64_t end = std::min(((k >> 6) + 1) << 6, numWords);
+    for (k++; k < end; k++) {
+	if (cur + wordMin_[k] <= target) {
+	    scanWord(k, 0, cur, target, pos);
+	    return pos;
+	}
+	cur += 2 * __builtin_popcountll(bits_[k]) - 64;
+    }
+
+    uint64_t b = k >> 6;
+    bool found = false;
+    uint64_t blockEnd = std::min(((b >> 6) + 1) << 6, (uint64_t)blockMin_.size());
+    for (; b < blockEnd; b++) {
+	if (blockMin_[b] <= target) {
+	    found = true;
+	    break;
+	}
+    }
+    if (!found) {
+	uint64_t s = b >> 6;
+	for (; s < superMin_.size(); s++) {
+	    if (superMin_[s] <= target)
+		break;
+	}
+	if (s >= superMin_.size())
+	    return numBits_;
+	for (b = s << 6; blockMin_[b] > target; b++) { }
+    }
+
+    cur = excess(b << 12);
+    for (k = b << 6; ; k++) {
+	if (cur + wordMin_[k] <= target) {
+	    scanWord(k, 0, cur, target, pos);
+	    return pos;
+	}
+	cur += 2 * __builtin_popcountll(bits_[k]) - 64;
+    }
+}
+
+//******************************************************
+// LOOKUP
+//******************************************************
+bool DFUDSTrie::lookup(const uint8_t* key, const int keylen, uint64_t &value) const {
+    if (numNodes_ == 0)
+	return false;
+
+    uint64_t v = 1;
+    int depth = 0;
+    while (true) {
+	uint32_t d = degree(v);
+	uint64_t base = labelBase(v);
+	bool term = hasTerm(v, d, base);
+	if (depth == keylen) {
+	    if (!term)
+		return false;
+	    value = values_[leafRank(v + d + 1)];
+	    return true;
+	}
+
+	uint8_t c = key[depth];
+	uint64_t pos = base;
+	if (!(term && c == TERM)) {
+	    if (term)
+		pos++;
+	    if (!simdSearch(labels_.data(), pos, base + d - pos, c))
+		return false;
+	}
+
+	uint64_t u = child(v, d, pos - base);
+	if (!bit(u)) {
+	    value = values_[leafRank(u)];
+	    return true;
+	}
+	v = u;
+	depth++;
+    }
+}
+
+bool DFUDSTrie::lowerBound(const uint8_t* key, const int keylen, DFUDSIter &iter) const {
+    iter.clear();
+    if (numNodes_ == 0) {
+	iter.isEnd = true;
+	return false;
+    }
+
+    uint64_t v = 1;
+    int depth = 0;
+    while (true) {
+	if (depth == keylen) {
+	    // the first key below the node
+	    iter.edges = labelBase(v);
+	    iter.descend(v);
+	    break;
+	}
+
+	uint32_t d = degree(v);
+	uint64_t base = labelBase(v);
+	uint8_t c = key[depth];
+	uint64_t pos = base;
+	bool found = true;
+	if (!(hasTerm(v, d, base) && c == TERM)) {
+	    if (hasTerm(v, d, base))
+		pos++;
+	    found = simdSearch_lowerBound(labels_.data(), pos, base + d - pos, c);
+	}
+
+	if (!found) {
+	    // every key below the node is smaller: the next node in DFS
+	    // order follows the node's subtree
+	    DFUDSIter::Step step = {v, base, d, d - 1};
+	    iter.path.push_back(step);
+	    uint64_t next = fwdSearch(v, excess(v) - 1) + 1;
+	    iter.edges = labelBase(next);
+	    if (!iter.next(next))
+		return false;
+	    break;
+	}
+
+	uint32_t i = pos - base;
+	DFUDSIter::Step step = {v, base, d, i};
+	iter.path.push_back(step);
+	uint64_t u = child(v, d, i);
+	if (labels_[pos] != c) {
+	    // the first key below a larger label
+	    iter.edges = labelBase(u);
+	    iter.descend(u);
+	    break;
+	}
+	if (!bit(u)) {
+	    iter.leaf = u;
+	    break;
+	}
+	v = u;
+	depth++;
+    }
+
+    iter.rank = leafRank(iter.leaf);
+    iter.edges = labelBase(iter.leaf);
+    return true;
+}
+
+uint64_t DFUDSTrie::scan(const uint8_t* key, const int keylen, uint64_t count, uint64_t* values) const {
+    DFUDSIter iter(this);
+    if (!lowerBound(key, keylen, iter))
+	return 0;
+    uint64_t n = std::min(count, (uint64_t)values_.size() - iter.rank);
+    memcpy(values, values_.data() + iter.rank, n * sizeof(uint64_t));
+    return n;
+}
+
+//******************************************************
+// ITERATOR
+//******************************************************
+DFUDSIter::DFUDSIter() : index(NULL), leaf(0), rank(0), edges(0), isEnd(true) { }
+
+DFUDSIter::DFUDSIter(const DFUDSTrie* idx) : index(idx), leaf(0), rank(0), edges(0), isEnd(true) { }
+
+void DFUDSIter::clear() {
+    path.clear();
+    leaf = rank = edges = 0;
+    isEnd = false;
+}
+
+void DFUDSIter::descend(uint64_t v) {
+    while (index->bit(v)) {
+	uint32_t d = index->degree(v);
+	Step step = {v, edges, d, 0};
+	path.push_back(step);
+	edges += d;
+	v += d + 1;
+    }
+    leaf = v;
+}
+
+bool DFUDSIter::next(uint64_t v) {
+    while (!path.empty() && path.back().i + 1 == path.back().d)
+	path.pop_back();
+    if (path.empty()) {
+	isEnd = true;
+	return false;
+    }
+    path.back().i++;
+    descend(v);
+    return true;
+}
+
+uint64_t DFUDSIter::value() const {
+    return index->values_[rank];
+}
+
+string DFUDSIter::key() const {
+    string k;
+    for (uint64_t l = 0; l < path.size(); l++) {
+	const Step &s = path[l];
+	uint8_t c = index->labels_[s.base + s.i];
+	if (l + 1 == path.size() && s.i == 0 && c == DFUDSTrie::TERM)
+	    break;
+	k.push_back((char)c);
+    }
+    return k;
+}
+
+bool DFUDSIter::operator ++ (int) {
+    if (isEnd)
+	return false;
+    if (!next(leaf + 1))
+	return false;
+    rank++;
+    return true;
+}
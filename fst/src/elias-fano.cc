@@ -0,0 +1,36 @@
+#include "elias-fano.h"
+
+EliasFano::EliasFano(const vector<uint64_t> &values) : n_(values.size()), lowWidth_(0), select_(NULL) {
+    uint64_t universe = n_ ? values.back() : 0;
+    if (n_ > 0 && universe / n_ > 0)
+	lowWidth_ = 63 - __builtin_clzll(universe / n_);
+
+    low_.assign((n_ * lowWidth_ + 63) / 64 + 1, 0);
+    uint64_t highBits = n_ + (universe >> lowWidth_) + 1;
+    high_.assign((highBits + 63) / 64 + 1, 0);
+
+    uint64_t mask = (lowWidth_ == 0) ? 0 : ((1ULL << lowWidth_) - 1);
+    for (uint64_t i = 0; i < n_; i++) {
+	uint64_t low = values[i] & mask;
+	uint64_t bit = i * lowWidth_;
+	if (lowWidth_ > 0) {
+	    low_[bit >> 6] |= low << (bit & 63);
+	    if ((bit & 63) + lowWidth_ > 64)
+		low_[(bit >> 6) + 1] |= low >> (64 - (bit & 63));
+	}
+	uint64_t pos = (values[i] >> lowWidth_) + i;
+	setBit(high_[pos >> 6], pos & 63);
+    }
+
+    select_ = new BitmapSelectPoppy(high_.data(), high_.size() * 64);
+}
+
+EliasFano::~EliasFano() {
+    if (select_) delete select_;
+}
+
+uint64_t EliasFano::size() const { return n_; }
+
+uint64_t EliasFano::mem() const {
+    return low_.size() * sizeof(uint64_t) + sizeof(BitmapSelectPoppy) + select_->getMem();
+}
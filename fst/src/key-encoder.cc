@@ -0,0 +1,286 @@
+#include "key-encoder.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <set>
+#include <unordered_map>
+#include <unordered_set>
+
+const int KeyEncoder::MAX_GRAM;
+const int KeyEncoder::MAX_SYMBOLS;
+const int KeyEncoder::SAMPLE_KEYS;
+const int KeyEncoder::DEFAULT_SYMBOLS;
+
+KeyEncoder::KeyEncoder() : minByte_(0), numSymbols_(0) {
+    memset(firstBound_, 0, sizeof(firstBound_));
+    for (int i = 0; i < 256; i++) {
+	leadInterval_[i] = -1;
+	leadSingle_[i] = false;
+    }
+}
+
+int KeyEncoder::numSymbols() const { return numSymbols_; }
+
+uint64_t KeyEncoder::mem() const {
+    uint64_t m = sizeof(firstBound_) + sizeof(leadInterval_) + sizeof(leadSingle_);
+    m += boundWord_.size() * sizeof(uint64_t) + boundLen_.size() + symLen_.size() + codes_.size() * sizeof(Code);
+    return m;
+}
+
+//******************************************************
+// BUILD
+//******************************************************
+// The first (up to) 8 bytes of key, big-endian and zero padded.
+static inline uint64_t keyWord(const uint8_t* key, int keylen) {
+    uint64_t w = 0;
+    if (keylen >= 8)
+	memcpy(&w, key, 8);
+    else
+	memcpy(&w, key, keylen);
+    return __builtin_bswap64(w);
+}
+
+// The smallest string above all strings that start with g, or empty if
+// there is none.
+static string successor(const string &g) {
+    string s = g;
+    while (!s.empty() && (uint8_t)s[s.size() - 1] == 0xFF)
+	s.erase(s.size() - 1);
+    if (!s.empty())
+	s[s.size() - 1] = (char)((uint8_t)s[s.size() - 1] + 1);
+    return s;
+}
+
+void KeyEncoder::build(const vector<string> &keys, int numSymbols, int minByte) {
+    minByte_ = minByte;
+    // every symbol adds at most two intervals, all of which need a code
+    int nb = 256 - minByte_;
+    numSymbols = min(numSymbols, min((int)MAX_SYMBOLS, nb * nb / 2 - 256));
+
+    vector<const string*> sample;
+    uint64_t step = max((uint64_t)1, (uint64_t)keys.size() / SAMPLE_KEYS);
+    for (uint64_t i = 0; i < keys.size(); i += step)
+	sample.push_back(&keys[i]);
+
+    // score each n-gram by the bytes it would save if it never overlapped
+    unordered_map<string, uint64_t> freq;
+    for (int k = 0; k < (int)sample.size(); k++) {
+	const string &key = *sample[k];
+	for (int i = 0; i < (int)key.size(); i++) {
+	    for (int n = 2; n <= MAX_GRAM && i + n <= (int)key.size(); n++)
+		freq[key.substr(i, n)]++;
+	}
+    }
+    vector<pair<uint64_t, string> > cand;
+    for (unordered_map<string, uint64_t>::iterator it = freq.begin(); it != freq.end(); ++it) {
+	if (it->second >= 2)
+	    cand.push_back(make_pair(it->second * (it->first.size() - 1), it->first));
+    }
+    int numCand = min(numSymbols, (int)cand.size());
+    partial_sort(cand.begin(), cand.begin() + numCand, cand.end(),
+		 [](const pair<uint64_t, string> &a, const pair<uint64_t, string> &b) {
+		     return (a.first != b.first) ? (a.first > b.first) : (a.second < b.second);
+		 });
+
+    vector<string> grams;
+    for (int c = 0; c < 256; c++)
+	grams.push_back(string(1, (char)c));
+    for (int i = 0; i < numCand; i++)
+	grams.push_back(cand[i].second);
+
+    // overlapping n-grams shadow each other, drop the ones the greedy
+    // parse of the sample never picks
+    vector<uint64_t> usage;
+    buildIntervals(grams);
+    countUsage(sample, usage);
+    unordered_set<string> used;
+    for (int i = 0; i < (int)boundWord_.size(); i++) {
+	if (usage[i] > 0)
+	    used.insert(symbol(i));
+    }
+    vector<string> kept(grams.begin(), grams.begin() + 256);
+    for (int i = 256; i < (int)grams.size(); i++) {
+	if (used.count(grams[i]) > 0)
+	    kept.push_back(grams[i]);
+    }
+    numSymbols_ = kept.size() - 256;
+
+    buildIntervals(kept);
+    countUsage(sample, usage);
+    assignCodes(usage);
+}
+
+// Interval boundaries are the symbols and their successors; the symbol
+// of an interval is the longest one that prefixes its boundary.
+void KeyEncoder::buildIntervals(const vector<string> &grams) {
+    unordered_set<string> gramSet(grams.begin(), grams.end());
+    vector<string> bounds = grams;
+    for (int i = 0; i < (int)grams.size(); i++) {
+	string s = successor(grams[i]);
+	if (!s.empty())
+	    bounds.push_back(s);
+    }
+    sort(bounds.begin(), bounds.end());
+    bounds.erase(unique(bounds.begin(), bounds.end()), bounds.end());
+
+    int n = bounds.size();
+    boundWord_.resize(n);
+    boundLen_.resize(n);
+    symLen_.resize(n);
+    for (int i = 0; i < n; i++) {
+	boundWord_[i] = keyWord((const uint8_t*)bounds[i].data(), bounds[i].size());
+	boundLen_[i] = bounds[i].size();
+	int len = bounds[i].size();
+	while (len > 1 && gramSet.count(bounds[i].substr(0, len)) == 0)
+	    len--;
+	symLen_[i] = len;
+    }
+
+    for (int c = 0; c <= 256; c++) {
+	if (c == 256)
+	    firstBound_[c] = n;
+	else
+	    firstBound_[c] = lower_bound(bounds.begin(), bounds.end(), string(1, (char)c)) - bounds.begin();
+    }
+}
+
+void KeyEncoder::countUsage(const vector<const string*> &sample, vector<uint64_t> &usage) const {
+    usage.assign(boundWord_.size(), 0);
+    for (int k = 0; k < (int)sample.size(); k++) {
+	const uint8_t* key = (const uint8_t*)sample[k]->data();
+	int keylen = sample[k]->size();
+	int i = 0;
+	while (i < keylen) {
+	    uint32_t iv = findInterval(key + i, keylen - i);
+	    usage[iv]++;
+	    i += symLen_[iv];
+	}
+    }
+}
+
+// Greedily gives one-byte codes to the most used intervals as long as
+// the lead bytes of the two-byte runs between them still fit.
+void KeyEncoder::assignCodes(const vector<uint64_t> &usage) {
+    int n = boundWord_.size();
+    int nb = 256 - minByte_;
+
+    vector<int> order;
+    for (int i = 0; i < n; i++) {
+	if (usage[i] > 0)
+	    order.push_back(i);
+    }
+    stable_sort(order.begin(), order.end(), [&](int a, int b) { return usage[a] > usage[b]; });
+
+    set<int> singles;
+    int leads = (n + nb - 1) / nb;
+    for (int k = 0; k < (int)order.size(); k++) {
+	int i = order[k];
+	set<int>::iterator next = singles.lower_bound(i);
+	int hi = (next == singles.end()) ? n - 1 : *next - 1;
+	int lo = (next == singles.begin()) ? 0 : *(--next) + 1;
+	int gap = hi - lo + 1;
+	int left = i - lo;
+	int right = hi - i;
+	int newLeads = leads - (gap + nb - 1) / nb + 1 + (left + nb - 1) / nb + (right + nb - 1) / nb;
+	if (newLeads <= nb) {
+	    singles.insert(i);
+	    leads = newLeads;
+	}
+    }
+
+    codes_.resize(n);
+    for (int c = 0; c < 256; c++) {
+	leadInterval_[c] = -1;
+	leadSingle_[c] = false;
+    }
+    int lead = 0;
+    int i = 0;
+    while (i < n) {
+	uint8_t b = codeByte(lead++);
+	leadInterval_[b] = i;
+	if (singles.count(i) > 0) {
+	    leadSingle_[b] = true;
+	    codes_[i].bytes[0] = b;
+	    codes_[i].len = 1;
+	    i++;
+	    continue;
+	}
+	for (int k = 0; k < nb && i < n && singles.count(i) == 0; k++, i++) {
+	    codes_[i].bytes[0] = b;
+	    codes_[i].bytes[1] = codeByte(k);
+	    codes_[i].len = 2;
+	}
+    }
+}
+
+//******************************************************
+// ENCODE / DECODE
+//******************************************************
+inline uint8_t KeyEncoder::codeByte(int i) const {
+    return minByte_ + i;
+}
+
+// The last boundary <= key. The one-byte boundary key[0] always
+// qualifies, so only the boundaries starting with key[0] are searched.
+inline uint32_t KeyEncoder::findInterval(const uint8_t* key, int keylen) const {
+    uint64_t w = keyWord(key, keylen);
+    int len = min(keylen, 8);
+    uint32_t lo = firstBound_[key[0]];
+    uint32_t hi = firstBound_[key[0] + 1];
+    while (hi - lo > 1) {
+	uint32_t mid = (lo + hi) >> 1;
+	if (boundWord_[mid] < w || (boundWord_[mid] == w && boundLen_[mid] <= len))
+	    lo = mid;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+inline string KeyEncoder::symbol(uint32_t i) const {
+    uint64_t w = __builtin_bswap64(boundWord_[i]);
+    return string((const char*)&w, symLen_[i]);
+}
+
+int KeyEncoder::encode(const uint8_t* key, int keylen, uint8_t* out) const {
+    int n = 0;
+    int i = 0;
+    while (i < keylen) {
+	const uint32_t iv = findInterval(key + i, keylen - i);
+	const Code &c = codes_[iv];
+	out[n++] = c.bytes[0];
+	if (c.len == 2)
+	    out[n++] = c.bytes[1];
+	i += symLen_[iv];
+    }
+    return n;
+}
+
+string KeyEncoder::encode(const string &key) const {
+    vector<uint8_t> out(2 * key.size());
+    int n = encode((const uint8_t*)key.data(), key.size(), out.data());
+    return string((const char*)out.data(), n);
+}
+
+string KeyEncoder::decode(const uint8_t* code, int codelen) const {
+    string key;
+    int i = 0;
+    while (i < codelen) {
+	uint8_t b = code[i++];
+	int32_t iv = leadInterval_[b];
+	if (iv < 0)
+	    break;
+	if (!leadSingle_[b]) {
+	    if (i >= codelen)
+		break;
+	    uint8_t c = code[i++];
+	    if (c < minByte_)
+		break;
+	    iv += c - minByte_;
+	}
+	uint64_t w = __builtin_bswap64(boundWord_[iv]);
+	key.append((const char*)&w, symLen_[iv]);
+    }
+    return key;
+}
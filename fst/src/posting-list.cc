@@ -0,0 +1,68 @@
+#include "posting-list.h"
+
+#include <algorithm>
+
+// enough zero bytes after the last list for PostingList::readDelta
+static const int PADDING = 16;
+
+void PostingLists::writeVarint(uint64_t v) {
+    while (v >= 0x80) {
+	data_.push_back((uint8_t)(v | 0x80));
+	v >>= 7;
+    }
+    data_.push_back((uint8_t)v);
+}
+
+uint64_t PostingLists::add(const uint64_t* values, uint32_t n) {
+    uint64_t id = offset_.size();
+    if ((id & 63) == 0)
+	base_.push_back(data_.size());
+    offset_.push_back(data_.size() - base_.back());
+
+    vector<uint64_t> sorted(values, values + n);
+    sort(sorted.begin(), sorted.end());
+
+    writeVarint(n);
+    writeVarint(sorted[0]);
+    if (n == 1)
+	return id;
+
+    uint64_t maxDelta = 0;
+    for (uint32_t i = 1; i < n; i++)
+	maxDelta = max(maxDelta, sorted[i] - sorted[i - 1]);
+    int width = (maxDelta == 0) ? 0 : 64 - __builtin_clzll(maxDelta);
+    data_.push_back((uint8_t)width);
+
+    uint64_t start = data_.size();
+    data_.resize(start + ((uint64_t)(n - 1) * width + 7) / 8, 0);
+    uint64_t bit = 0;
+    for (uint32_t i = 1; i < n; i++) {
+	uint64_t d = sorted[i] - sorted[i - 1];
+	int done = 0;
+	while (done < width) {
+	    int off = bit & 7;
+	    int take = min(8 - off, width - done);
+	    data_[start + (bit >> 3)] |= (uint8_t)(((d >> done) & ((1u << take) - 1)) << off);
+	    bit += take;
+	    done += take;
+	}
+    }
+    return id;
+}
+
+void PostingLists::finish() {
+    data_.resize(data_.size() + PADDING, 0);
+    data_.shrink_to_fit();
+    base_.shrink_to_fit();
+    offset_.shrink_to_fit();
+}
+
+void PostingLists::clear() {
+    data_.clear();
+    base_.clear();
+    offset_.clear();
+}
+
+uint64_t PostingLists::mem() const {
+    return data_.size() + base_.size() * sizeof(uint64_t) + offset_.size() * sizeof(uint32_t);
+}
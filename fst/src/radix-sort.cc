@@ -0,0 +1,273 @@
+#include "radix-sort.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// ranges up to this size are insertion sorted
+static const int INSERTION_MAX = 32;
+// buckets from this size on are handed to the thread pool
+static const uint64_t PARALLEL_MIN = 1 << 14;
+// LSD digit: 6 passes of 11 bits beat 8 of 8
+static const int DIGIT_BITS = 11;
+static const int DIGITS = 1 << DIGIT_BITS;
+
+static int numThreads(int threads, uint64_t n) {
+    if (threads <= 0)
+	threads = max(1, (int)thread::hardware_concurrency());
+    if (n < PARALLEL_MIN)
+	threads = 1;
+    return threads;
+}
+
+// Runs fn(0 .. threads-1), fn(0) on the calling thread.
+template<typename Fn>
+static void parallelFor(int threads, Fn fn) {
+    vector<thread> workers;
+    for (int t = 1; t < threads; t++)
+	workers.push_back(thread(fn, t));
+    fn(0);
+    for (int t = 0; t < (int)workers.size(); t++)
+	workers[t].join();
+}
+
+//******************************************************
+// MSD (byte strings)
+//******************************************************
+struct SortItem {
+    const uint8_t* data;
+    uint32_t len;
+    uint32_t idx;
+};
+
+struct SortRange {
+    uint64_t begin;
+    uint64_t end;
+    uint32_t depth; // all keys in the range share this many bytes
+};
+
+// bucket of the key at depth d: 0 if the key ends there, else byte + 1
+static inline int bucketOf(const SortItem &item, uint32_t d) {
+    return (d < item.len) ? item.data[d] + 1 : 0;
+}
+
+static inline uint32_t prefixFrom(const SortItem &a, const SortItem &b, uint32_t d) {
+    uint32_t len = min(a.len, b.len);
+    while (d < len && a.data[d] == b.data[d])
+	d++;
+    return d;
+}
+
+class MSDSorter {
+public:
+    MSDSorter(vector<SortItem> &items, vector<uint32_t> &lcp, int threads)
+	: items_(items), tmp_(items.size()), lcp_(lcp), threads_(threads), busy_(0) { }
+
+    void run() {
+	SortRange all = {0, items_.size(), 0};
+	if (threads_ <= 1) {
+	    sortRange(all, false);
+	    return;
+	}
+	queue_.push_back(all);
+	parallelFor(threads_, [this](int) { work(); });
+    }
+
+private:
+    void work() {
+	unique_lock<mutex> lock(mutex_);
+	while (true) {
+	    cond_.wait(lock, [this] { return !queue_.empty() || busy_ == 0; });
+	    if (queue_.empty())
+		return;
+	    SortRange r = queue_.back();
+	    queue_.pop_back();
+	    busy_++;
+	    lock.unlock();
+	    sortRange(r, true);
+	    lock.lock();
+	    busy_--;
+	    if (busy_ == 0 && queue_.empty())
+		cond_.notify_all();
+	}
+    }
+
+    void push(const SortRange &r) {
+	lock_guard<mutex> lock(mutex_);
+	queue_.push_back(r);
+	cond_.notify_one();
+    }
+
+    // Stable: an item only moves past items that are strictly greater.
+    void insertionSort(const SortRange &r) {
+	SortItem* a = items_.data();
+	for (uint64_t i = r.begin + 1; i < r.end; i++) {
+	    SortItem x = a[i];
+	    uint64_t j = i;
+	    while (j > r.begin) {
+		const SortItem &y = a[j - 1];
+		uint32_t p = prefixFrom(y, x, r.depth);
+		if (p == y.len || (p < x.len && y.data[p] < x.data[p]))
+		    break; // y <= x
+		a[j] = y;
+		j--;
+	    }
+	    a[j] = x;
+	}
+	for (uint64_t i = r.begin; i + 1 < r.end; i++)
+	    lcp_[i] = prefixFrom(a[i], a[i + 1], r.depth);
+    }
+
+    // Sorts r and fills lcp_ inside it; the lcp at r.end - 1 belongs to
+    // whoever split off r.
+    void sortRange(SortRange r, bool parallel) {
+	uint64_t count[257];
+	while (true) {
+	    uint64_t n = r.end - r.begin;
+	    if (n < 2)
+		return;
+	    if (n <= (uint64_t)INSERTION_MAX) {
+		insertionSort(r);
+		return;
+	    }
+
+	    memset(count, 0, sizeof(count));
+	    for (uint64_t i = r.begin; i < r.end; i++)
+		count[bucketOf(items_[i], r.depth)]++;
+
+	    // a shared byte: go one deeper without moving anything
+	    int first = 1;
+	    while (first < 257 && count[first] == 0)
+		first++;
+	    if (first < 257 && count[first] == n) {
+		r.depth++;
+		continue;
+	    }
+	    break;
+	}
+
+	uint64_t start[257];
+	uint64_t next[257];
+	uint64_t p = r.begin;
+	for (int b = 0; b < 257; b++) {
+	    start[b] = p;
+	    next[b] = p;
+	    p += count[b];
+	}
+	for (uint64_t i = r.begin; i < r.end; i++)
+	    tmp_[next[bucketOf(items_[i], r.depth)]++] = items_[i];
+	memcpy(&items_[r.begin], &tmp_[r.begin], (r.end - r.begin) * sizeof(SortItem));
+
+	// keys ending here are all equal, neighbouring buckets differ at depth
+	for (uint64_t i = start[0]; i < next[0] && i + 1 < r.end; i++)
+	    lcp_[i] = r.depth;
+	for (int b = 1; b < 257; b++) {
+	    if (count[b] > 0 && next[b] < r.end)
+		lcp_[next[b] - 1] = r.depth;
+	}
+
+	for (int b = 1; b < 257; b++) {
+	    if (count[b] < 2)
+		continue;
+	    SortRange sub = {start[b], next[b], r.depth + 1};
+	    if (parallel && count[b] >= PARALLEL_MIN)
+		push(sub);
+	    else
+		sortRange(sub, parallel);
+	}
+    }
+
+    vector<SortItem> &items_;
+    vector<SortItem> tmp_;
+    vector<uint32_t> &lcp_;
+    int threads_;
+
+    mutex mutex_;
+    condition_variable cond_;
+    vector<SortRange> queue_;
+    int busy_;
+};
+
+void radixSort(const vector<string> &keys, vector<uint32_t> &order, vector<uint32_t> &lcp, int threads) {
+    uint64_t n = keys.size();
+    vector<SortItem> items(n);
+    for (uint64_t i = 0; i < n; i++) {
+	items[i].data = (const uint8_t*)keys[i].data();
+	items[i].len = keys[i].length();
+	items[i].idx = i;
+    }
+    lcp.assign(n, 0);
+
+    MSDSorter sorter(items, lcp, numThreads(threads, n));
+    sorter.run();
+
+    order.resize(n);
+    for (uint64_t i = 0; i < n; i++)
+	order[i] = items[i].idx;
+}
+
+//******************************************************
+// LSD (64-bit keys)
+//******************************************************
+struct SortPair {
+    uint64_t key;
+    uint64_t idx;
+};
+
+void radixSort(const vector<uint64_t> &keys, vector<uint32_t> &order, int threads) {
+    uint64_t n = keys.size();
+    int T = numThreads(threads, n);
+    vector<SortPair> a(n);
+    vector<SortPair> b(n);
+    for (uint64_t i = 0; i < n; i++) {
+	a[i].key = keys[i];
+	a[i].idx = i;
+    }
+
+    // thread t owns items [chunk * t, chunk * (t + 1)) in every pass,
+    // and scatters them after the same items of threads < t
+    uint64_t chunk = (n + T - 1) / T;
+    vector<uint64_t> count(T * DIGITS);
+    for (int shift = 0; shift < 64; shift += DIGIT_BITS) {
+	const SortPair* src = a.data();
+	SortPair* dst = b.data();
+	fill(count.begin(), count.end(), 0);
+	parallelFor(T, [&](int t) {
+		uint64_t* c = &count[t * DIGITS];
+		uint64_t end = min(n, chunk * (t + 1));
+		for (uint64_t i = chunk * t; i < end; i++)
+		    c[(src[i].key >> shift) & (DIGITS - 1)]++;
+	    });
+
+	bool shared = false;
+	uint64_t p = 0;
+	for (int v = 0; v < DIGITS; v++) {
+	    uint64_t total = 0;
+	    for (int t = 0; t < T; t++) {
+		uint64_t c = count[t * DIGITS + v];
+		count[t * DIGITS + v] = p;
+		p += c;
+		total += c;
+	    }
+	    if (total == n)
+		shared = true;
+	}
+	if (shared)
+	    continue;
+
+	parallelFor(T, [&](int t) {
+		uint64_t* next = &count[t * DIGITS];
+		uint64_t end = min(n, chunk * (t + 1));
+		for (uint64_t i = chunk * t; i < end; i++)
+		    dst[next[(src[i].key >> shift) & (DIGITS - 1)]++] = src[i];
+	    });
+	a.swap(b);
+    }
+
+    order.resize(n);
+    for (uint64_t i = 0; i < n; i++)
+	order[i] = a[i].idx;
+}
@@ -3,13 +3,19 @@
 //************************************************
 #include "gtest/gtest.h"
 #include <stdlib.h>
+#include <string.h>
 #include <fstream>
 #include <algorithm>
+#include <thread>
+#include <atomic>
 
 #include "FST.hpp"
+#include "appendable-fst.h"
+#include "dfuds.h"
 
 #define TEST_SIZE 234369
 #define RANGE_SIZE 10
+#define NUM_THREADS 8
 
 using namespace std;
 
@@ -214,6 +220,1384 @@ TEST_F(UnitTest, ScanMonoIntTest) {
     }
 }
 
+TEST_F(UnitTest, BlockedLayoutTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = new FST();
+    index->load(keys, values, longestKeyLen, FST::SPARSE_BLOCKED);
+    FST *levelIndex = new FST();
+    levelIndex->load(keys, values, longestKeyLen);
+
+    ASSERT_EQ(FST::SPARSE_BLOCKED, index->sparseLayout());
+    ASSERT_TRUE(index->stats().sparseBlocks > 1);
+    ASSERT_EQ(levelIndex->cMem(), index->cMem());
+
+    uint64_t fetchedValue;
+    uint64_t levelValue;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	if (i > 0 && keys[i].compare(keys[i-1]) == 0)
+	    continue;
+	ASSERT_TRUE(index->lookup((uint8_t*)keys[i].c_str(), keys[i].length(), fetchedValue));
+	ASSERT_EQ(values[i], fetchedValue);
+
+	string missing = keys[i] + "~";
+	ASSERT_EQ(levelIndex->lookup((uint8_t*)missing.c_str(), missing.length(), levelValue),
+		  index->lookup((uint8_t*)missing.c_str(), missing.length(), fetchedValue));
+    }
+
+    FSTIter iter(index);
+    for (int i = 0; i < TEST_SIZE - 1; i++) {
+	if (i > 0 && keys[i].compare(keys[i-1]) == 0)
+	    continue;
+	ASSERT_TRUE(index->lowerBound((uint8_t*)keys[i].c_str(), keys[i].length(), iter));
+	ASSERT_EQ(values[i], iter.value());
+
+	for (int j = 0; j < RANGE_SIZE; j++) {
+	    if (i+j+1 < TEST_SIZE) {
+		ASSERT_TRUE(iter++);
+		ASSERT_EQ(values[i+j+1], iter.value());
+	    }
+	    else {
+		ASSERT_FALSE(iter++);
+		ASSERT_EQ(values[TEST_SIZE-1], iter.value());
+	    }
+	}
+    }
+
+    delete index;
+    delete levelIndex;
+}
+
+TEST_F(UnitTest, BlockedLayoutRandIntTest) {
+    vector<uint64_t> keys;
+    loadRandInt(keys);
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+    FST *index = new FST();
+    index->load(keys, keys, FST::SPARSE_BLOCKED);
+
+    FSTIter iter(index);
+    uint64_t fetchedValue;
+    for (int i = 0; i < (int)keys.size(); i++) {
+	ASSERT_TRUE(index->lookup(keys[i], fetchedValue));
+	ASSERT_EQ(keys[i], fetchedValue);
+
+	ASSERT_TRUE(index->lowerBound(keys[i], iter));
+	ASSERT_EQ(keys[i], iter.value());
+	for (int j = 1; j <= RANGE_SIZE && i + j < (int)keys.size(); j++) {
+	    ASSERT_TRUE(iter++);
+	    ASSERT_EQ(keys[i+j], iter.value());
+	}
+    }
+
+    delete index;
+}
+
+template<int N>
+void checkFixedKeys(vector<string> &keys) {
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    vector<uint64_t> values;
+    for (int i = 0; i < (int)keys.size(); i++)
+	values.push_back(i);
+
+    FST *index = new FST();
+    index->load(keys, values, N);
+
+    FixedKey<N> key;
+    uint64_t fetchedValue;
+    uint64_t expectedValue;
+    for (int i = 0; i < (int)keys.size(); i++) {
+	memcpy(key.bytes, keys[i].data(), N);
+	ASSERT_TRUE(index->lookup(key, fetchedValue));
+	ASSERT_EQ(values[i], fetchedValue);
+
+	// a missing key must get the same answer as the byte-string lookup
+	key.bytes[N - 1] ^= 0x5A;
+	bool expected = index->lookup(key.bytes, N, expectedValue);
+	ASSERT_EQ(expected, index->lookup(key, fetchedValue));
+	if (expected)
+	    ASSERT_EQ(expectedValue, fetchedValue);
+    }
+
+    delete index;
+}
+
+TEST_F(UnitTest, FixedKeyTest) {
+    vector<uint64_t> ints;
+    loadRandInt(ints);
+
+    vector<string> keys4;
+    vector<string> keys8;
+    vector<string> keys16;
+    for (int i = 0; i < (int)ints.size(); i++) {
+	uint32_t k4 = __builtin_bswap32((uint32_t)ints[i]);
+	uint64_t k8 = __builtin_bswap64(ints[i] * 0x9E3779B97F4A7C15ULL);
+	keys4.push_back(string((const char*)&k4, 4));
+	keys8.push_back(string((const char*)&k8, 8));
+	keys16.push_back(keys8.back() + keys4.back() + keys4.back());
+    }
+    checkFixedKeys<4>(keys4);
+    checkFixedKeys<8>(keys8);
+    checkFixedKeys<16>(keys16);
+
+    // variable-length keys take the byte-string path
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+    FST *index = new FST();
+    index->load(words, values, longestKeyLen);
+
+    FixedKey<4> key;
+    uint64_t fetchedValue;
+    uint64_t expectedValue;
+    for (int i = 0; i < TEST_SIZE; i += 97) {
+	string w = words[i] + "    ";
+	memcpy(key.bytes, w.data(), 4);
+	bool expected = index->lookup(key.bytes, 4, expectedValue);
+	ASSERT_EQ(expected, index->lookup(key, fetchedValue));
+	if (expected)
+	    ASSERT_EQ(expectedValue, fetchedValue);
+    }
+    delete index;
+}
+
+TEST_F(UnitTest, LookupSortedTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // present keys interleaved with missing keys that share their prefixes
+    vector<string> batch;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	batch.push_back(words[i]);
+	if (i % 3 == 0)
+	    batch.push_back(words[i] + "~");
+	if (i % 5 == 0)
+	    batch.push_back(words[i].substr(0, words[i].length() / 2));
+    }
+    sort(batch.begin(), batch.end());
+
+    int layouts[] = {FST::SPARSE_LEVEL_ORDER, FST::SPARSE_BLOCKED};
+    for (int l = 0; l < 2; l++) {
+	FST *index = new FST();
+	index->load(words, values, longestKeyLen, layouts[l]);
+
+	vector<uint64_t> fetchedValues(batch.size());
+	bool* found = new bool[batch.size()];
+	int numFound = index->lookupSorted(batch.data(), batch.size(), fetchedValues.data(), found);
+
+	int expectedFound = 0;
+	uint64_t expectedValue;
+	for (int i = 0; i < (int)batch.size(); i++) {
+	    bool expected = index->lookup((const uint8_t*)batch[i].data(), batch[i].length(), expectedValue);
+	    ASSERT_EQ(expected, found[i]);
+	    if (expected) {
+		ASSERT_EQ(expectedValue, fetchedValues[i]);
+		expectedFound++;
+	    }
+	}
+	ASSERT_EQ(expectedFound, numFound);
+
+	// unsorted input is still answered correctly
+	vector<string> shuffled(batch.begin(), batch.begin() + 10000);
+	random_shuffle(shuffled.begin(), shuffled.end());
+	index->lookupSorted(shuffled.data(), shuffled.size(), fetchedValues.data(), found);
+	for (int i = 0; i < (int)shuffled.size(); i++) {
+	    bool expected = index->lookup((const uint8_t*)shuffled[i].data(), shuffled[i].length(), expectedValue);
+	    ASSERT_EQ(expected, found[i]);
+	    if (expected)
+		ASSERT_EQ(expectedValue, fetchedValues[i]);
+	}
+
+	delete[] found;
+	delete index;
+    }
+}
+
+TEST_F(UnitTest, ScanBatchTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // ranges over existing keys, then past the last key
+    vector<FSTRange> ranges;
+    vector<int> starts;
+    srand(0);
+    for (int i = 0; i < TEST_SIZE; i += 37) {
+	FSTRange r = {(const uint8_t*)words[i].data(), (int)words[i].length(), (uint32_t)(rand() % 30)};
+	ranges.push_back(r);
+	starts.push_back(i);
+    }
+    string pastEnd = "~~~~";
+    FSTRange last = {(const uint8_t*)pastEnd.data(), (int)pastEnd.length(), 10};
+    ranges.push_back(last);
+
+    uint64_t maxValues = 0;
+    for (int i = 0; i < (int)ranges.size(); i++)
+	maxValues += ranges[i].count;
+
+    int layouts[] = {FST::SPARSE_LEVEL_ORDER, FST::SPARSE_BLOCKED};
+    for (int l = 0; l < 2; l++) {
+	FST *index = new FST();
+	index->load(words, values, longestKeyLen, layouts[l]);
+
+	vector<uint64_t> scanned(maxValues);
+	vector<uint32_t> counts(ranges.size());
+	uint64_t total = index->scanBatch(ranges.data(), ranges.size(), scanned.data(), counts.data());
+
+	uint64_t offset = 0;
+	for (int i = 0; i < (int)starts.size(); i++) {
+	    uint32_t expected = min((int)ranges[i].count, TEST_SIZE - starts[i]);
+	    ASSERT_EQ(expected, counts[i]);
+	    for (uint32_t j = 0; j < counts[i]; j++)
+		ASSERT_EQ(values[starts[i] + j], scanned[offset + j]);
+	    offset += counts[i];
+	}
+	ASSERT_EQ(0, counts[ranges.size() - 1]);
+	ASSERT_EQ(offset, total);
+
+	// with keys: the same values, each with the stored prefix of its key
+	vector<uint64_t> scannedWithKeys(maxValues);
+	vector<uint8_t> keys;
+	vector<uint32_t> keyEnd(maxValues);
+	ASSERT_EQ(total, index->scanBatch(ranges.data(), ranges.size(), scannedWithKeys.data(), counts.data(), keys, keyEnd.data()));
+	offset = 0;
+	for (int i = 0; i < (int)starts.size(); i++) {
+	    for (uint32_t j = 0; j < counts[i]; j++) {
+		uint64_t k = offset + j;
+		ASSERT_EQ(scanned[k], scannedWithKeys[k]);
+		uint32_t start = (k == 0) ? 0 : keyEnd[k - 1];
+		string key((const char*)keys.data() + start, keyEnd[k] - start);
+		ASSERT_LE(key.length(), words[starts[i] + j].length());
+		ASSERT_EQ(0, words[starts[i] + j].compare(0, key.length(), key));
+	    }
+	    offset += counts[i];
+	}
+	ASSERT_EQ(keys.size(), keyEnd[total - 1]);
+
+	delete index;
+    }
+}
+
+TEST_F(UnitTest, ForEachTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    int layouts[] = {FST::SPARSE_LEVEL_ORDER, FST::SPARSE_BLOCKED};
+    for (int l = 0; l < 2; l++) {
+	FST *index = new FST();
+	index->load(words, values, longestKeyLen, layouts[l]);
+
+	// [words[i], words[j]] visits values i .. j
+	srand(0);
+	for (int k = 0; k < 200; k++) {
+	    int i = rand() % TEST_SIZE;
+	    int j = min(TEST_SIZE - 1, i + rand() % 5000);
+	    uint64_t next = i;
+	    bool inOrder = true;
+	    uint64_t count = index->forEach((const uint8_t*)words[i].data(), words[i].length(),
+					    (const uint8_t*)words[j].data(), words[j].length(),
+					    [&](uint64_t value) { inOrder = inOrder && (value == next++); });
+	    ASSERT_TRUE(inOrder);
+	    ASSERT_EQ((uint64_t)(j - i + 1), count);
+	}
+
+	// whole trie, then past the end
+	uint64_t sum = 0;
+	uint64_t count = index->forEach((const uint8_t*)"", 0, NULL, 0, [&](uint64_t value) { sum += value; });
+	ASSERT_EQ((uint64_t)TEST_SIZE, count);
+	ASSERT_EQ((uint64_t)TEST_SIZE * (TEST_SIZE - 1) / 2, sum);
+	ASSERT_EQ(0, index->forEach((const uint8_t*)"~~~~", 4, NULL, 0, [&](uint64_t value) { sum += value; }));
+
+	delete index;
+    }
+
+    vector<uint64_t> keys;
+    loadRandInt(keys);
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    FST *index = new FST();
+    index->load(keys, keys);
+    uint64_t prev = 0;
+    bool sorted = true;
+    uint64_t count = index->forEach((const uint8_t*)"", 0, NULL, 0, [&](uint64_t value) { sorted = sorted && (value >= prev); prev = value; });
+    ASSERT_TRUE(sorted);
+    ASSERT_EQ(keys.size(), count);
+    delete index;
+}
+
+TEST_F(UnitTest, IterReuseTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    FST *index = new FST();
+    index->load(words, values, longestKeyLen);
+
+    // one iterator reused across lowerBound calls in random order; a
+    // copy taken mid-scan continues on its own
+    FSTIter iter(index);
+    srand(0);
+    for (int k = 0; k < 20000; k++) {
+	int i = rand() % (TEST_SIZE - RANGE_SIZE);
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)words[i].data(), words[i].length(), iter));
+	ASSERT_EQ(values[i], iter.value());
+	ASSERT_TRUE(iter++);
+	FSTIter copy(iter);
+	for (int j = 2; j < RANGE_SIZE; j++) {
+	    ASSERT_TRUE(iter++);
+	    ASSERT_EQ(values[i + j], iter.value());
+	}
+	ASSERT_EQ(values[i + 1], copy.value());
+	ASSERT_TRUE(copy++);
+	ASSERT_EQ(values[i + 2], copy.value());
+    }
+    delete index;
+
+    // a trie deeper than the inline cursor stack
+    vector<string> deep;
+    vector<uint64_t> deepValues;
+    string prefix(FSTIter::INLINE_LEVELS + 40, 'a');
+    for (int i = 0; i < 1000; i++) {
+	char suffix[8];
+	snprintf(suffix, sizeof(suffix), "%04d", i);
+	deep.push_back(prefix.substr(0, FSTIter::INLINE_LEVELS - 20 + (i % 60)) + suffix);
+    }
+    sort(deep.begin(), deep.end());
+    int deepLen = 0;
+    for (int i = 0; i < (int)deep.size(); i++) {
+	deepValues.push_back(i);
+	deepLen = max(deepLen, (int)deep[i].length());
+    }
+    index = new FST();
+    index->load(deep, deepValues, deepLen);
+    ASSERT_GT(index->stats().treeHeight, (uint32_t)FSTIter::INLINE_LEVELS);
+
+    FSTIter deepIter(index);
+    for (int i = 0; i < (int)deep.size(); i += 7) {
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)deep[i].data(), deep[i].length(), deepIter));
+	FSTIter copy;
+	copy = deepIter;
+	for (int j = i; j < (int)deep.size() && j < i + RANGE_SIZE; j++) {
+	    ASSERT_EQ(deepValues[j], copy.value());
+	    ASSERT_EQ(j + 1 < (int)deep.size(), copy++);
+	}
+    }
+    delete index;
+}
+
+TEST_F(UnitTest, ReloadTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+    vector<string> half(words.begin(), words.begin() + TEST_SIZE / 2);
+    vector<uint64_t> halfValues(values.begin(), values.begin() + TEST_SIZE / 2);
+
+    FST *fresh = new FST();
+    fresh->setCutoffRatio(16);
+    fresh->setRankAccess(true);
+    fresh->load(words, values, longestKeyLen, FST::SPARSE_BLOCKED);
+
+    // a second load replaces the first trie, with the new settings
+    FST *index = new FST();
+    index->setKeyCompression();
+    index->load(half, halfValues, longestKeyLen);
+    index->setKeyCompression(0);
+    index->setCutoffRatio(16);
+    index->setRankAccess(true);
+    index->load(words, values, longestKeyLen, FST::SPARSE_BLOCKED);
+
+    ASSERT_TRUE(index->keyEncoder() == NULL);
+    ASSERT_EQ(fresh->mem(), index->mem());
+    ASSERT_EQ(fresh->numKeys(), index->numKeys());
+
+    uint64_t fetchedValue;
+    for (int i = 0; i < TEST_SIZE - 1; i++) {
+	if (i > 0 && words[i].compare(words[i-1]) == 0)
+	    continue;
+	ASSERT_TRUE(index->lookup((uint8_t*)words[i].c_str(), words[i].length(), fetchedValue));
+	ASSERT_EQ(values[i], fetchedValue);
+    }
+
+    FSTIter iter(index);
+    FSTIter freshIter(fresh);
+    ASSERT_TRUE(index->lowerBound((const uint8_t*)"", 0, iter));
+    ASSERT_TRUE(fresh->lowerBound((const uint8_t*)"", 0, freshIter));
+    do {
+	ASSERT_EQ(freshIter.value(), iter.value());
+	ASSERT_EQ(freshIter.key(), iter.key());
+    } while (freshIter++ && iter++);
+    ASSERT_FALSE(iter++);
+
+    delete index;
+    delete fresh;
+}
+
+TEST_F(UnitTest, NodeBitmapTest) {
+    // below a few sparse levels, 32 nodes with a TERM label and 100
+    // children, and 32 without TERM and 128 children
+    vector<string> keys;
+    for (int i = 0; i < 2000; i++) {
+	char prefix[8];
+	snprintf(prefix, sizeof(prefix), "k%04d", i);
+	keys.push_back(prefix);
+    }
+    for (int n = 0; n < 64; n++) {
+	char prefix[8];
+	snprintf(prefix, sizeof(prefix), "w%02d", n);
+	if (n % 2 == 0) {
+	    keys.push_back(prefix);
+	    for (int c = FST::TERM + 1; c <= FST::TERM + 100; c++)
+		keys.push_back(string(prefix) + (char)c + "x");
+	}
+	else {
+	    for (int c = 1; c <= 255; c += 2)
+		keys.push_back(string(prefix) + (char)c);
+	}
+    }
+    sort(keys.begin(), keys.end());
+    vector<uint64_t> values;
+    int longestKeyLen = 0;
+    for (int i = 0; i < (int)keys.size(); i++) {
+	values.push_back(i);
+	longestKeyLen = max(longestKeyLen, (int)keys[i].length());
+    }
+
+    int layouts[] = {FST::SPARSE_LEVEL_ORDER, FST::SPARSE_BLOCKED};
+    for (int l = 0; l < 2; l++) {
+	FST *index = new FST();
+	index->setRankAccess(true);
+	index->load(keys, values, longestKeyLen, layouts[l]);
+	const FSTStats &stats = index->stats();
+	if (FST::NODE_BITMAP_MIN <= 101) {
+	    ASSERT_EQ((uint64_t)64, stats.bitmapNodes);
+	    ASSERT_EQ(index->numSparseLabels() - 32 * (101 + 128) + 64 * FST::BITMAP_NODE_BYTES, index->cMem());
+	}
+	uint64_t labelBits = 0;
+	for (int i = stats.cutoffLevel; i < (int)stats.levels.size(); i++)
+	    labelBits += stats.levels[i].labelBits;
+	ASSERT_EQ(index->cMem() * 8, labelBits);
+	ASSERT_EQ(index->cMem(), index->memory().sparseLabels);
+
+	uint64_t value;
+	for (int i = 0; i < (int)keys.size(); i++) {
+	    ASSERT_TRUE(index->lookup((const uint8_t*)keys[i].data(), keys[i].length(), value));
+	    ASSERT_EQ(values[i], value);
+	}
+	string missing = string("w00") + (char)(FST::TERM + 101) + "x";
+	ASSERT_FALSE(index->lookup((const uint8_t*)missing.data(), missing.length(), value));
+	missing = string("w00") + (char)(FST::TERM - 1);
+	ASSERT_FALSE(index->lookup((const uint8_t*)missing.data(), missing.length(), value));
+	missing = string("w01") + (char)2;
+	ASSERT_FALSE(index->lookup((const uint8_t*)missing.data(), missing.length(), value));
+	missing = "w01";
+	ASSERT_FALSE(index->lookup((const uint8_t*)missing.data(), missing.length(), value));
+
+	bool* found = new bool[keys.size()];
+	vector<uint64_t> sortedValues(keys.size());
+	ASSERT_EQ((int)keys.size(), index->lookupSorted(keys.data(), keys.size(), sortedValues.data(), found));
+	ASSERT_EQ(values, sortedValues);
+	delete[] found;
+
+	// lowerBound on a child finds it, between two children it lands
+	// on the second
+	FSTIter iter(index);
+	for (int i = 0; i + 1 < (int)keys.size(); i++) {
+	    if (keys[i][0] != 'w')
+		continue;
+	    ASSERT_TRUE(index->lowerBound((const uint8_t*)keys[i].data(), keys[i].length(), iter));
+	    ASSERT_EQ(values[i], iter.value());
+	    if (keys[i].length() != 4 || (uint8_t)keys[i][3] == 255)
+		continue;
+	    string probe = keys[i].substr(0, 3) + (char)(keys[i][3] + 1);
+	    ASSERT_TRUE(index->lowerBound((const uint8_t*)probe.data(), probe.length(), iter));
+	    ASSERT_EQ(values[i + 1], iter.value());
+	}
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)"kz", 2, iter));
+	ASSERT_EQ((uint64_t)2000, iter.value());
+	// past a key that ends at a node on a byte below TERM, on it with
+	// TERM
+	int w00 = find(keys.begin(), keys.end(), "w00") - keys.begin();
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)"w00 ", 4, iter));
+	ASSERT_EQ(values[w00 + 1], iter.value());
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)"w00$", 4, iter));
+	ASSERT_EQ(values[w00], iter.value());
+	ASSERT_FALSE(index->lowerBound((const uint8_t*)"x", 1, iter));
+
+	// the keys read back through the bitmaps, by iterator, rank and
+	// export
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)"", 0, iter));
+	vector<string> stored;
+	for (int i = 0; i < (int)keys.size(); i++) {
+	    ASSERT_EQ(values[i], iter.value());
+	    string key = iter.key();
+	    ASSERT_EQ(0, keys[i].compare(0, key.length(), key));
+	    if (keys[i][0] == 'w')
+		ASSERT_EQ(keys[i].substr(0, 4), key);
+	    stored.push_back(key);
+	    string atRank;
+	    ASSERT_TRUE(index->keyAt(i, atRank));
+	    ASSERT_EQ(key, atRank);
+	    ASSERT_EQ(i + 1 < (int)keys.size(), iter++);
+	}
+	vector<string> exported;
+	index->exportAll([&](const FSTExportBatch &batch) {
+		for (uint32_t k = 0; k < batch.count; k++) {
+		    uint32_t start = (k == 0) ? 0 : batch.keyEnd[k - 1];
+		    exported.push_back(string((const char*)batch.keys + start, batch.keyEnd[k] - start));
+		}
+	    });
+	ASSERT_EQ(stored, exported);
+	delete index;
+    }
+}
+
+TEST_F(UnitTest, DenseListTest) {
+    // two dense levels: a root of 200 labels, 4 nodes of 120 labels and
+    // 196 of 3; with prefix keys, D-IsPrefixKey bits on the second
+    for (int prefixKeys = 0; prefixKeys < 2; prefixKeys++) {
+	vector<string> keys;
+	for (int a = 1; a <= 200; a++) {
+	    if (prefixKeys && a % 3 == 0)
+		keys.push_back(string(1, (char)a));
+	    int first = (a % 50 == 0) ? 1 : a % 7 + 1;
+	    int last = (a % 50 == 0) ? 120 : first + 2;
+	    for (int b = first; b <= last; b++)
+		for (char c = 'x'; c <= 'y'; c++)
+		    for (char d = 'p'; d <= 'q'; d++)
+			keys.push_back(string(1, (char)a) + (char)b + c + d);
+	}
+	sort(keys.begin(), keys.end());
+	vector<uint64_t> values;
+	for (int i = 0; i < (int)keys.size(); i++)
+	    values.push_back(i);
+
+	FST *index = new FST();
+	index->setCutoffRatio(4);
+	index->setRankAccess(true);
+	index->load(keys, values, 4);
+	const FSTStats &stats = index->stats();
+	ASSERT_EQ(2, stats.cutoffLevel);
+	if (FST::DENSE_LIST_BELOW > 3 && FST::DENSE_LIST_BELOW <= 120) {
+	    ASSERT_EQ((uint64_t)196, stats.listNodes);
+	    ASSERT_EQ((uint64_t)(4 * 256 + 196 * 3 * 8), stats.levels[1].labelBits);
+	    ASSERT_EQ((uint64_t)(4 * 256 + 196 * 3), stats.levels[1].hasChildBits);
+	}
+	FSTMemory m = index->memory();
+	ASSERT_EQ(index->stats().lutBytes, m.denseLUT + m.sparseLUT);
+
+	uint64_t value;
+	for (int i = 0; i < (int)keys.size(); i++) {
+	    ASSERT_TRUE(index->lookup((const uint8_t*)keys[i].data(), keys[i].length(), value));
+	    ASSERT_EQ(values[i], value);
+	}
+	if (!prefixKeys) {
+	    FixedKey<4> key;
+	    for (int i = 0; i < (int)keys.size(); i++) {
+		memcpy(key.bytes, keys[i].data(), 4);
+		ASSERT_TRUE(index->lookup(key, value));
+		ASSERT_EQ(values[i], value);
+	    }
+	}
+	string missing[4] = {string(1, (char)201) + "\x01xp", string("\x01\x05xp"), string("\x32\x79xp"), string("\x04")};
+	for (int k = 0; k < 4; k++)
+	    ASSERT_FALSE(index->lookup((const uint8_t*)missing[k].data(), missing[k].length(), value));
+
+	bool* found = new bool[keys.size()];
+	vector<uint64_t> sortedValues(keys.size());
+	ASSERT_EQ((int)keys.size(), index->lookupSorted(keys.data(), keys.size(), sortedValues.data(), found));
+	ASSERT_EQ(values, sortedValues);
+	delete[] found;
+
+	// lowerBound on a key finds it, past the labels of a node it
+	// lands on the next node's first key
+	FSTIter iter(index);
+	for (int i = 0; i < (int)keys.size(); i++) {
+	    ASSERT_TRUE(index->lowerBound((const uint8_t*)keys[i].data(), keys[i].length(), iter));
+	    ASSERT_EQ(values[i], iter.value());
+	}
+	for (int a = 1; a < 200; a++) {
+	    string probe = string(1, (char)a) + "\x7f";
+	    string next = string(1, (char)(a + 1));
+	    uint64_t expected = lower_bound(keys.begin(), keys.end(), next) - keys.begin();
+	    ASSERT_TRUE(index->lowerBound((const uint8_t*)probe.data(), probe.length(), iter));
+	    ASSERT_EQ(values[expected], iter.value());
+	}
+
+	// the keys read back through the lists, by iterator and rank
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)"", 0, iter));
+	for (int i = 0; i < (int)keys.size(); i++) {
+	    ASSERT_EQ(values[i], iter.value());
+	    string key = iter.key();
+	    ASSERT_EQ(0, keys[i].compare(0, key.length(), key));
+	    string atRank;
+	    ASSERT_TRUE(index->keyAt(i, atRank));
+	    ASSERT_EQ(key, atRank);
+	    ASSERT_EQ(i + 1 < (int)keys.size(), iter++);
+	}
+	delete index;
+    }
+}
+
+TEST_F(UnitTest, KeyCompressionTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // the encoding round-trips, preserves order and keeps code bytes
+    // above TERM
+    KeyEncoder encoder;
+    encoder.build(words, 1024, FST::TERM + 1);
+    ASSERT_GT(encoder.numSymbols(), 0);
+    vector<string> encoded(TEST_SIZE);
+    uint64_t rawLen = 0;
+    uint64_t encodedLen = 0;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	encoded[i] = encoder.encode(words[i]);
+	ASSERT_EQ(words[i], encoder.decode((const uint8_t*)encoded[i].data(), encoded[i].length()));
+	for (int j = 0; j < (int)encoded[i].length(); j++)
+	    ASSERT_GT((uint8_t)encoded[i][j], FST::TERM);
+	if (i > 0)
+	    ASSERT_LT(encoded[i - 1], encoded[i]);
+	rawLen += words[i].length();
+	encodedLen += encoded[i].length();
+    }
+    ASSERT_LT(encodedLen, rawLen);
+    string odd("\x00\xff\xff$ab\x00", 7);
+    string enc = encoder.encode(odd);
+    ASSERT_EQ(odd, encoder.decode((const uint8_t*)enc.data(), enc.length()));
+
+    int layouts[] = {FST::SPARSE_LEVEL_ORDER, FST::SPARSE_BLOCKED};
+    for (int l = 0; l < 2; l++) {
+	FST *index = new FST();
+	index->setKeyCompression();
+	index->load(words, values, longestKeyLen, layouts[l]);
+	ASSERT_TRUE(index->keyEncoder() != NULL);
+	ASSERT_GT(index->stats().keyDictBytes, (uint64_t)0);
+
+	uint64_t value;
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_TRUE(index->lookup((const uint8_t*)words[i].data(), words[i].length(), value));
+	    ASSERT_EQ(values[i], value);
+	}
+
+	// the iterator decodes the stored key prefixes on the way out
+	FSTIter iter(index);
+	for (int i = 0; i < TEST_SIZE - RANGE_SIZE; i += 101) {
+	    ASSERT_TRUE(index->lowerBound((const uint8_t*)words[i].data(), words[i].length(), iter));
+	    for (int j = 0; j < RANGE_SIZE; j++) {
+		string k = iter.key();
+		ASSERT_FALSE(k.empty());
+		ASSERT_EQ(0, words[i + j].compare(0, k.length(), k));
+		ASSERT_EQ(values[i + j], iter.value());
+		ASSERT_TRUE(iter++);
+	    }
+	}
+
+	vector<uint64_t> sorted(1000);
+	bool* foundPtr = new bool[1000];
+	ASSERT_EQ(1000, index->lookupSorted(&words[5000], 1000, sorted.data(), foundPtr));
+	for (int i = 0; i < 1000; i++)
+	    ASSERT_EQ(values[5000 + i], sorted[i]);
+	delete[] foundPtr;
+
+	uint64_t count = index->forEach((const uint8_t*)words[100].data(), words[100].length(),
+					(const uint8_t*)words[200].data(), words[200].length(),
+					[&](uint64_t) { });
+	ASSERT_EQ((uint64_t)101, count);
+
+	FSTRange r = {(const uint8_t*)words[300].data(), (int)words[300].length(), 5};
+	uint64_t scanned[5];
+	uint32_t scannedCount;
+	ASSERT_EQ((uint64_t)5, index->scanBatch(&r, 1, scanned, &scannedCount));
+	ASSERT_EQ(values[304], scanned[4]);
+
+	delete index;
+    }
+
+    // key() without compression: the shortest prefix that tells the
+    // key apart from its neighbours
+    FST *index = new FST();
+    index->load(words, values, longestKeyLen);
+    FSTIter iter(index);
+    ASSERT_TRUE(index->lowerBound((const uint8_t*)words[0].data(), words[0].length(), iter));
+    for (int i = 0; i < TEST_SIZE; i++) {
+	string k = iter.key();
+	ASSERT_EQ(0, words[i].compare(0, k.length(), k));
+	if (i > 0)
+	    ASSERT_NE(0, words[i - 1].compare(0, k.length(), k));
+	ASSERT_EQ(i < TEST_SIZE - 1, iter++);
+    }
+    delete index;
+}
+
+TEST_F(UnitTest, LoadUnsortedTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // shuffled, then every 7th word again with a new value
+    vector<string> keys;
+    vector<uint64_t> vals;
+    vector<int> perm(TEST_SIZE);
+    for (int i = 0; i < TEST_SIZE; i++)
+	perm[i] = i;
+    srand(0);
+    random_shuffle(perm.begin(), perm.end());
+    for (int i = 0; i < TEST_SIZE; i++) {
+	keys.push_back(words[perm[i]]);
+	vals.push_back(values[perm[i]]);
+    }
+    for (int i = 0; i < TEST_SIZE; i += 7) {
+	keys.push_back(words[perm[i]]);
+	vals.push_back(values[perm[i]] + TEST_SIZE);
+    }
+
+    // stable order and exact common prefix lengths, serial and threaded
+    int threads[] = {1, 4};
+    for (int t = 0; t < 2; t++) {
+	vector<uint32_t> order;
+	vector<uint32_t> lcp;
+	radixSort(keys, order, lcp, threads[t]);
+	ASSERT_EQ(keys.size(), order.size());
+	for (int i = 0; i + 1 < (int)order.size(); i++) {
+	    string &a = keys[order[i]];
+	    string &b = keys[order[i + 1]];
+	    ASSERT_TRUE(a < b || (a == b && order[i] < order[i + 1]));
+	    ASSERT_EQ(commonPrefixLen(a, b), (int)lcp[i]);
+	}
+    }
+
+    FST *sorted = new FST();
+    sorted->load(words, values, longestKeyLen);
+    for (int t = 0; t < 2; t++) {
+	FST *index = new FST();
+	index->loadUnsorted(keys, vals, FST::SPARSE_LEVEL_ORDER, threads[t]);
+	ASSERT_EQ(sorted->mem(), index->mem());
+	ASSERT_GT(index->stats().times.sort, 0);
+
+	uint64_t value;
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_TRUE(index->lookup((const uint8_t*)keys[i].data(), keys[i].length(), value));
+	    ASSERT_EQ(vals[i] + ((i % 7 == 0) ? TEST_SIZE : 0), value);
+	}
+
+	FSTIter iter(index);
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)words[0].data(), words[0].length(), iter));
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_EQ(values[i] % TEST_SIZE, iter.value() % TEST_SIZE);
+	    if (i + 1 < TEST_SIZE)
+		ASSERT_TRUE(iter++);
+	}
+	delete index;
+    }
+    delete sorted;
+
+    // 64-bit keys: random, some repeated
+    vector<uint64_t> ints;
+    vector<uint64_t> intVals;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	ints.push_back(((uint64_t)rand() << 31) ^ rand());
+	intVals.push_back(i);
+    }
+    for (int i = 0; i < TEST_SIZE; i += 5) {
+	ints.push_back(ints[i]);
+	intVals.push_back(i + TEST_SIZE);
+    }
+    for (int t = 0; t < 2; t++) {
+	vector<uint32_t> order;
+	radixSort(ints, order, threads[t]);
+	for (int i = 0; i + 1 < (int)order.size(); i++) {
+	    uint64_t a = ints[order[i]];
+	    uint64_t b = ints[order[i + 1]];
+	    ASSERT_TRUE(a < b || (a == b && order[i] < order[i + 1]));
+	}
+
+	FST *index = new FST();
+	index->loadUnsorted(ints, intVals, FST::SPARSE_LEVEL_ORDER, threads[t]);
+	uint64_t value;
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_TRUE(index->lookup(ints[i], value));
+	    ASSERT_EQ((uint64_t)(i + ((i % 5 == 0) ? TEST_SIZE : 0)), value);
+	}
+	delete index;
+    }
+}
+
+TEST_F(UnitTest, MultiValueTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // word i repeated i % 4 + 1 times, values out of order; word 0 needs
+    // 64-bit deltas, word 1 has equal values
+    vector<vector<uint64_t> > lists(TEST_SIZE);
+    for (int i = 0; i < TEST_SIZE; i++) {
+	for (int j = i % 4; j >= 0; j--)
+	    lists[i].push_back((uint64_t)i * 1000 + j * 77);
+    }
+    lists[0].clear();
+    lists[0].push_back(UINT64_MAX);
+    lists[0].push_back(0);
+    lists[1].assign(3, 5);
+
+    vector<string> keys;
+    vector<uint64_t> vals;
+    uint64_t total = 0;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	for (int j = 0; j < (int)lists[i].size(); j++) {
+	    keys.push_back(words[i]);
+	    vals.push_back(lists[i][j]);
+	}
+	total += lists[i].size();
+	sort(lists[i].begin(), lists[i].end());
+    }
+
+    FST *plain = new FST();
+    plain->load(words, values, longestKeyLen);
+    ASSERT_FALSE(plain->multiValue());
+
+    for (int m = 0; m < 2; m++) {
+	FST *index = new FST();
+	index->setMultiValue(true);
+	if (m == 0) {
+	    index->load(keys, vals, longestKeyLen);
+	}
+	else {
+	    vector<int> perm(keys.size());
+	    for (int i = 0; i < (int)perm.size(); i++)
+		perm[i] = i;
+	    srand(0);
+	    random_shuffle(perm.begin(), perm.end());
+	    vector<string> shuffledKeys;
+	    vector<uint64_t> shuffledVals;
+	    for (int i = 0; i < (int)perm.size(); i++) {
+		shuffledKeys.push_back(keys[perm[i]]);
+		shuffledVals.push_back(vals[perm[i]]);
+	    }
+	    index->loadUnsorted(shuffledKeys, shuffledVals);
+	}
+	ASSERT_TRUE(index->multiValue());
+	ASSERT_GT(index->stats().postingBytes, (uint64_t)0);
+	ASSERT_EQ(plain->mem() + index->memory().postings, index->mem());
+
+	uint64_t out[4];
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    PostingList list;
+	    ASSERT_TRUE(index->lookup((const uint8_t*)words[i].data(), words[i].length(), list));
+	    ASSERT_EQ(lists[i].size(), list.size());
+	    ASSERT_EQ(lists[i].size(), list.decode(out));
+	    for (int j = 0; j < (int)lists[i].size(); j++)
+		ASSERT_EQ(lists[i][j], out[j]);
+	}
+	PostingList none;
+	string missing("zzzzzzzz{");
+	ASSERT_FALSE(index->lookup((const uint8_t*)missing.data(), missing.length(), none));
+
+	// forEach yields every value, in key order
+	int i = 0;
+	int j = 0;
+	bool ordered = true;
+	uint64_t count = index->forEach((const uint8_t*)words[0].data(), words[0].length(), NULL, 0,
+					[&](uint64_t v) {
+					    if (i >= TEST_SIZE || lists[i][j] != v)
+						ordered = false;
+					    if (++j == (int)lists[i].size()) {
+						i++;
+						j = 0;
+					    }
+					});
+	ASSERT_TRUE(ordered);
+	ASSERT_EQ(total, count);
+
+	FSTIter iter(index);
+	for (int k = 0; k < TEST_SIZE - RANGE_SIZE; k += 97) {
+	    ASSERT_TRUE(index->lowerBound((const uint8_t*)words[k].data(), words[k].length(), iter));
+	    for (int r = 0; r < RANGE_SIZE; r++) {
+		PostingList list = iter.postings();
+		uint64_t v;
+		for (int j = 0; j < (int)lists[k + r].size(); j++) {
+		    ASSERT_TRUE(list.next(v));
+		    ASSERT_EQ(lists[k + r][j], v);
+		}
+		ASSERT_FALSE(list.next(v));
+		ASSERT_TRUE(iter++);
+	    }
+	}
+	delete index;
+    }
+    delete plain;
+}
+
+TEST_F(UnitTest, PayloadTest) {
+    // Elias-Fano: dense, sparse and repeated values
+    vector<uint64_t> seq;
+    uint64_t x = 0;
+    srand(0);
+    for (int i = 0; i < 10000; i++) {
+	x += (i % 100 == 0) ? ((uint64_t)rand() << 20) : rand() % 8;
+	seq.push_back(x);
+    }
+    EliasFano ef(seq);
+    ASSERT_EQ(seq.size(), ef.size());
+    for (int i = 0; i < (int)seq.size(); i++) {
+	ASSERT_EQ(seq[i], ef.get(i));
+	if (i + 1 < (int)seq.size()) {
+	    uint64_t a, b;
+	    ef.getPair(i, a, b);
+	    ASSERT_EQ(seq[i], a);
+	    ASSERT_EQ(seq[i + 1], b);
+	}
+    }
+
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // payloads of 0 .. 40 bytes; word 3 comes twice and keeps the second
+    vector<string> payloads;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	string p;
+	for (int j = 0; j < i % 41; j++)
+	    p.push_back((char)(i + j));
+	payloads.push_back(p);
+    }
+    vector<string> keys(words);
+    vector<string> keyPayloads(payloads);
+    keys.insert(keys.begin() + 3, words[3]);
+    keyPayloads.insert(keyPayloads.begin() + 3, string("first"));
+
+    int layouts[] = {FST::SPARSE_LEVEL_ORDER, FST::SPARSE_BLOCKED};
+    for (int l = 0; l < 2; l++) {
+	FST *index = new FST();
+	index->load(keys, keyPayloads, longestKeyLen, layouts[l]);
+	ASSERT_GT(index->stats().payloadBytes, (uint64_t)0);
+
+	FSTPayload p;
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_TRUE(index->lookup((const uint8_t*)words[i].data(), words[i].length(), p));
+	    ASSERT_EQ(payloads[i], string((const char*)p.data, p.len));
+	}
+
+	// ranks follow key order
+	FSTIter iter(index);
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)words[0].data(), words[0].length(), iter));
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_EQ((uint64_t)i, iter.value());
+	    p = iter.payload();
+	    ASSERT_EQ(payloads[i], string((const char*)p.data, p.len));
+	    if (i + 1 < TEST_SIZE)
+		ASSERT_TRUE(iter++);
+	}
+
+	delete index;
+    }
+
+    FST *plain = new FST();
+    plain->load(words, values, longestKeyLen);
+    FSTPayload p;
+    ASSERT_EQ((uint64_t)0, plain->stats().payloadBytes);
+    ASSERT_FALSE(plain->lookup((const uint8_t*)words[0].data(), words[0].length(), p));
+    delete plain;
+}
+
+TEST_F(UnitTest, RankAccessTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // both layouts, and a trie without dense levels
+    for (int l = 0; l < 3; l++) {
+	FST *index = new FST();
+	index->setRankAccess(true);
+	if (l == 2)
+	    index->setCutoffRatio(1 << 30);
+	index->load(words, values, longestKeyLen, (l == 1) ? FST::SPARSE_BLOCKED : FST::SPARSE_LEVEL_ORDER);
+	ASSERT_EQ((uint64_t)TEST_SIZE, index->numKeys());
+	ASSERT_GT(index->stats().rankBytes, (uint64_t)0);
+
+	FSTIter iter(index);
+	string key;
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_TRUE(index->seekToRank(i, iter));
+	    ASSERT_EQ(values[i], iter.value());
+	    ASSERT_TRUE(index->keyAt(i, key));
+	    ASSERT_EQ(0, words[i].compare(0, key.length(), key));
+	}
+	ASSERT_FALSE(index->seekToRank(TEST_SIZE, iter));
+
+	// the iterator carries on from the rank
+	for (int i = 0; i < TEST_SIZE - RANGE_SIZE; i += 1013) {
+	    ASSERT_TRUE(index->seekToRank(i, iter));
+	    for (int j = 0; j < RANGE_SIZE; j++) {
+		ASSERT_EQ(values[i + j], iter.value());
+		ASSERT_TRUE(iter++);
+	    }
+	}
+	delete index;
+    }
+
+    FST *plain = new FST();
+    plain->load(words, values, longestKeyLen);
+    FSTIter iter(plain);
+    ASSERT_EQ((uint64_t)0, plain->numKeys());
+    ASSERT_FALSE(plain->seekToRank(0, iter));
+    delete plain;
+}
+
+TEST_F(UnitTest, ExportTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // serial, parallel by rank ranges (blocked layout), compressed keys
+    for (int l = 0; l < 3; l++) {
+	FST *index = new FST();
+	if (l == 1)
+	    index->setRankAccess(true);
+	if (l == 2)
+	    index->setKeyCompression();
+	index->load(words, values, longestKeyLen, (l == 1) ? FST::SPARSE_BLOCKED : FST::SPARSE_LEVEL_ORDER);
+
+	vector<string> keys(TEST_SIZE);
+	vector<uint64_t> exported(TEST_SIZE);
+	vector<int> parts(TEST_SIZE, -1);
+	uint64_t count = index->exportAll([&](const FSTExportBatch &batch) {
+		uint32_t start = 0;
+		for (uint32_t i = 0; i < batch.count; i++) {
+		    keys[batch.firstRank + i].assign((const char*)batch.keys + start, batch.keyEnd[i] - start);
+		    exported[batch.firstRank + i] = batch.values[i];
+		    parts[batch.firstRank + i] = batch.part;
+		    start = batch.keyEnd[i];
+		}
+	    }, (l == 1) ? 4 : 1);
+	ASSERT_EQ((uint64_t)TEST_SIZE, count);
+
+	FSTIter iter(index);
+	ASSERT_TRUE(index->lowerBound((const uint8_t*)"", 0, iter));
+	for (int i = 0; i < TEST_SIZE; i++) {
+	    ASSERT_EQ(values[i], exported[i]);
+	    ASSERT_EQ(iter.key(), keys[i]);
+	    ASSERT_EQ(0, words[i].compare(0, keys[i].length(), keys[i]));
+	    ASSERT_TRUE(i == 0 || parts[i] >= parts[i - 1]);
+	    iter++;
+	}
+	ASSERT_EQ((l == 1) ? 3 : 0, parts[TEST_SIZE - 1]);
+	delete index;
+    }
+}
+
+TEST_F(UnitTest, DFUDSTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    // the FST stores the same trie, so it is the reference
+    FST *index = new FST();
+    index->load(words, values, longestKeyLen);
+    DFUDSTrie *dfuds = new DFUDSTrie();
+    dfuds->load(words, values);
+    ASSERT_EQ((uint64_t)TEST_SIZE, dfuds->numKeys());
+
+    uint64_t value;
+    for (int i = 0; i < TEST_SIZE; i++) {
+	ASSERT_TRUE(dfuds->lookup((const uint8_t*)words[i].data(), words[i].length(), value));
+	ASSERT_EQ(values[i], value);
+    }
+
+    // a full walk gives the FST's keys and values
+    FSTIter fiter(index);
+    DFUDSIter diter(dfuds);
+    ASSERT_TRUE(index->lowerBound((const uint8_t*)"", 0, fiter));
+    ASSERT_TRUE(dfuds->lowerBound((const uint8_t*)"", 0, diter));
+    for (int i = 0; i < TEST_SIZE; i++) {
+	ASSERT_EQ(values[i], diter.value());
+	ASSERT_EQ(fiter.key(), diter.key());
+	ASSERT_EQ(i + 1 < TEST_SIZE, diter++);
+	fiter++;
+    }
+
+    // lowerBound of keys and of keys in between; a byte below TERM
+    // after a key must not take the TERM child
+    uint64_t scanned[RANGE_SIZE];
+    for (int i = 0; i < TEST_SIZE; i += 7) {
+	string half = words[i].substr(0, words[i].length() / 2);
+	string probes[6] = {words[i], half, words[i] + "~", words[i] + " ", words[i] + "#", half + "#"};
+	for (int p = 0; p < 6; p++) {
+	    const uint8_t* key = (const uint8_t*)probes[p].data();
+	    bool ffound = index->lowerBound(key, probes[p].length(), fiter);
+	    ASSERT_EQ(ffound, dfuds->lowerBound(key, probes[p].length(), diter));
+	    if (!ffound)
+		continue;
+	    ASSERT_EQ(fiter.value(), diter.value());
+	    uint64_t n = dfuds->scan(key, probes[p].length(), RANGE_SIZE, scanned);
+	    for (uint64_t j = 0; j < n; j++) {
+		ASSERT_EQ(fiter.value(), scanned[j]);
+		fiter++;
+	    }
+	}
+    }
+    ASSERT_FALSE(dfuds->lowerBound((const uint8_t*)"~~~~", 4, diter));
+    ASSERT_GT(dfuds->mem(), (uint64_t)0);
+
+    delete index;
+    delete dfuds;
+
+    // keys ending at inner nodes, probed with bytes below TERM
+    string small[5] = {"%", "%\x01" "000", "%#\x01", "a", "a b"};
+    vector<string> smallKeys(small, small + 5);
+    vector<uint64_t> smallValues;
+    for (uint64_t i = 0; i < smallKeys.size(); i++)
+	smallValues.push_back(i);
+    index = new FST();
+    index->load(smallKeys, smallValues, 4);
+    dfuds = new DFUDSTrie();
+    dfuds->load(smallKeys, smallValues);
+    FSTIter smallIter(index);
+    DFUDSIter smallDiter(dfuds);
+    string smallProbes[8] = {"%#0", "%#", "% ", "%\x01", "%\"", "a!", "a ", "a a"};
+    for (int p = 0; p < 8; p++) {
+	const uint8_t* key = (const uint8_t*)smallProbes[p].data();
+	int keylen = smallProbes[p].length();
+	bool ffound = index->lowerBound(key, keylen, smallIter);
+	ASSERT_EQ(ffound, dfuds->lowerBound(key, keylen, smallDiter));
+	if (!ffound)
+	    continue;
+	ASSERT_EQ(smallIter.value(), smallDiter.value());
+	ASSERT_EQ(smallIter.key(), smallDiter.key());
+	uint64_t n = dfuds->scan(key, keylen, RANGE_SIZE, scanned);
+	ASSERT_EQ(smallKeys.size() - smallIter.value(), n);
+	ASSERT_EQ(smallIter.value(), scanned[0]);
+    }
+    ASSERT_TRUE(dfuds->lowerBound((const uint8_t*)"%#0", 3, smallDiter));
+    ASSERT_EQ((uint64_t)2, smallDiter.value());
+
+    delete index;
+    delete dfuds;
+}
+
+TEST_F(UnitTest, StatsTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = new FST();
+    index->load(keys, values, longestKeyLen);
+
+    const FSTStats &stats = index->stats();
+    ASSERT_EQ((uint32_t)longestKeyLen, stats.treeHeight);
+    ASSERT_EQ(stats.treeHeight, stats.levels.size());
+
+    uint64_t sparseLabels = 0;
+    uint64_t valueBytes = 0;
+    for (int i = 0; i < (int)stats.levels.size(); i++) {
+	const FSTLevelStats &ls = stats.levels[i];
+	ASSERT_EQ(i < stats.cutoffLevel, ls.dense);
+	ASSERT_TRUE(ls.labelCount >= ls.nodeCount);
+	if (!ls.dense) {
+	    ASSERT_EQ(sparseLabels, ls.firstPos);
+	    sparseLabels += ls.labelCount;
+	}
+	valueBytes += ls.valueBytes;
+    }
+    ASSERT_EQ(index->numSparseLabels(), sparseLabels);
+    ASSERT_EQ(index->valueMemU() + index->valueMem(), valueBytes);
+    ASSERT_TRUE(stats.lutBytes > 0);
+    ASSERT_TRUE(stats.times.total >= stats.times.sparse);
+
+    string json = index->statsJSON();
+    cout << json << "\n";
+    ASSERT_EQ('{', json[0]);
+    ASSERT_EQ('}', json[json.length() - 1]);
+    ASSERT_TRUE(json.find("\"levels\":[") != string::npos);
+
+    delete index;
+}
+
+TEST_F(UnitTest, MemoryTest) {
+    vector<string> words;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, words, values);
+
+    FST *index = new FST();
+    index->setRankAccess(true);
+    index->load(words, values, longestKeyLen, FST::SPARSE_BLOCKED);
+
+    FSTMemory m = index->memory();
+    ASSERT_EQ(m.total, index->mem());
+    ASSERT_EQ(m.total, m.denseLabels + m.denseHasChild + m.densePrefix + m.denseValues + m.denseLUT
+	      + m.sparseLabels + m.sparseHasChild + m.sparseLouds + m.sparseValues + m.sparseLUT
+	      + m.blockDir + m.nodeTypes + m.keyDict + m.postings + m.payloads + m.rankCounts + m.objects);
+    // the lookup tables of all five bitmaps are counted
+    ASSERT_EQ(index->stats().lutBytes, m.denseLUT + m.sparseLUT);
+    ASSERT_EQ(index->cMem(), m.sparseLabels);
+    ASSERT_EQ(index->valueMemU(), m.denseValues);
+    ASSERT_EQ(index->valueMem(), m.sparseValues);
+    ASSERT_GE(m.blockDir, index->stats().blockDirBytes);
+    ASSERT_EQ(index->stats().rankBytes, m.rankCounts);
+    ASSERT_EQ((uint64_t)0, m.keyDict + m.postings + m.payloads);
+
+    FSTIter iter(index);
+    ASSERT_EQ((uint64_t)sizeof(FSTIter), iter.mem());
+    delete index;
+}
+
+TEST_F(UnitTest, ConcurrentReadTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    int longestKeyLen = loadFile(testFilePath, keys, values);
+
+    FST *index = new FST();
+    index->load(keys, values, longestKeyLen);
+    const FST *shared = index;
+
+    atomic<uint64_t> errors(0);
+    vector<thread> threads;
+    for (int t = 0; t < NUM_THREADS; t++) {
+	threads.push_back(thread([&, t]() {
+		    FSTIter iter(shared);
+		    uint64_t fetchedValue;
+		    for (int i = t; i < TEST_SIZE - 1; i += NUM_THREADS) {
+			if (i > 0 && keys[i].compare(keys[i-1]) == 0)
+			    continue;
+			if (!shared->lookup((uint8_t*)keys[i].c_str(), keys[i].length(), fetchedValue)
+			    || fetchedValue != values[i])
+			    errors++;
+			if (!shared->lowerBound((uint8_t*)keys[i].c_str(), keys[i].length(), iter)
+			    || iter.value() != values[i])
+			    errors++;
+			for (int j = 0; j < RANGE_SIZE && i+j+1 < TEST_SIZE; j++) {
+			    if (!iter++ || iter.value() != values[i+j+1])
+				errors++;
+			}
+		    }
+		}));
+    }
+    for (int t = 0; t < NUM_THREADS; t++)
+	threads[t].join();
+
+    ASSERT_EQ(0, errors.load());
+    delete index;
+}
+
+TEST_F(UnitTest, AppendTest) {
+    vector<string> keys;
+    vector<uint64_t> values;
+    loadFile(testFilePath, keys, values);
+
+    // the distinct keys, each with the value of its last copy
+    vector<string> distinct;
+    vector<uint64_t> last;
+    for (int i = 0; i < TEST_SIZE - 1; i++) {
+	if (i > 0 && keys[i].compare(keys[i-1]) == 0) {
+	    last.back() = values[i];
+	    continue;
+	}
+	distinct.push_back(keys[i]);
+	last.push_back(values[i]);
+    }
+
+    AppendableFST empty;
+    uint64_t fetchedValue;
+    uint64_t scanned[RANGE_SIZE];
+    ASSERT_FALSE(empty.lookup((uint8_t*)distinct[0].c_str(), distinct[0].length(), fetchedValue));
+    ASSERT_EQ(0, empty.scan((uint8_t*)distinct[0].c_str(), distinct[0].length(), RANGE_SIZE, scanned));
+
+    // a reader checks the published keys while the writer appends
+    AppendableFST index(20000);
+    atomic<bool> done(false);
+    atomic<uint64_t> errors(0);
+    thread reader([&]() {
+	    uint64_t readerValues[RANGE_SIZE];
+	    uint64_t value;
+	    uint64_t j = 0;
+	    do {
+		shared_ptr<const FSTSnapshot> snapshot = index.snapshot();
+		uint64_t n = snapshot->numKeys();
+		for (int k = 0; k < 64 && n > 0; k++) {
+		    j = (j + 7919) % n;
+		    const string &key = distinct[j];
+		    if (!snapshot->lookup((uint8_t*)key.c_str(), key.length(), value) || value != last[j])
+			errors++;
+		    uint64_t count = snapshot->scan((uint8_t*)key.c_str(), key.length(), RANGE_SIZE, readerValues);
+		    if (count != min((uint64_t)RANGE_SIZE, n - j))
+			errors++;
+		    for (uint64_t c = 0; c < count; c++)
+			if (readerValues[c] != last[j + c])
+			    errors++;
+		}
+	    } while (!done.load());
+	});
+
+    for (int i = 0; i < TEST_SIZE - 1; i++) {
+	if (i % 1000 == 0 && (i == 0 || keys[i].compare(keys[i-1]) != 0))
+	    index.publish();
+	if (!index.append(keys[i], values[i]))
+	    errors++;
+    }
+    index.publish();
+    done = true;
+    reader.join();
+    ASSERT_EQ(0, errors.load());
+
+    ASSERT_EQ(distinct.size(), index.numKeys());
+    ASSERT_EQ(0, index.pending());
+    ASSERT_LT(index.snapshot()->numRuns(), 20);
+    ASSERT_GT(index.mem(), index.snapshot()->mem());
+
+    for (uint64_t j = 0; j < distinct.size(); j++) {
+	ASSERT_TRUE(index.lookup((uint8_t*)distinct[j].c_str(), distinct[j].length(), fetchedValue));
+	ASSERT_EQ(last[j], fetchedValue);
+    }
+    for (uint64_t j = 0; j < distinct.size(); j += 97) {
+	uint64_t count = index.scan((uint8_t*)distinct[j].c_str(), distinct[j].length(), RANGE_SIZE, scanned);
+	ASSERT_EQ(min((uint64_t)RANGE_SIZE, distinct.size() - j), count);
+	for (uint64_t c = 0; c < count; c++)
+	    ASSERT_EQ(last[j + c], scanned[c]);
+    }
+
+    // smaller keys, and the last key once published, are rejected
+    ASSERT_FALSE(index.append(distinct[0], 0));
+    ASSERT_FALSE(index.append(distinct.back(), 0));
+
+    // a new key is only visible after publish
+    string larger = distinct.back() + "~";
+    ASSERT_TRUE(index.append(larger, 1));
+    ASSERT_TRUE(index.append(larger, 2));
+    ASSERT_EQ(1, index.pending());
+    ASSERT_EQ(distinct.size(), index.numKeys());
+    shared_ptr<const FSTSnapshot> before = index.snapshot();
+    index.publish();
+    ASSERT_EQ(distinct.size() + 1, index.numKeys());
+    ASSERT_EQ(distinct.size(), before->numKeys());
+    ASSERT_TRUE(index.lookup((uint8_t*)larger.c_str(), larger.length(), fetchedValue));
+    ASSERT_EQ(2, fetchedValue);
+
+    // A key between two runs belongs to neither, although the first
+    // run's trie truncates its last key "dbddad" to a prefix of it.
+    AppendableFST gap;
+    gap.append("dbdd", 1);
+    gap.append("dbddad", 2);
+    gap.publish();
+    gap.append("dbddadabbb", 3);
+    gap.publish();
+    ASSERT_EQ(2, gap.snapshot()->numRuns());
+    string between = "dbddada";
+    ASSERT_FALSE(gap.lookup((uint8_t*)between.c_str(), between.length(), fetchedValue));
+    ASSERT_EQ(1, gap.scan((uint8_t*)between.c_str(), between.length(), RANGE_SIZE, scanned));
+    ASSERT_EQ(3, scanned[0]);
+    string after = "dbddadb";
+    ASSERT_FALSE(gap.lookup((uint8_t*)after.c_str(), after.length(), fetchedValue));
+    ASSERT_EQ(0, gap.scan((uint8_t*)after.c_str(), after.length(), RANGE_SIZE, scanned));
+    string inside = "dbddac";
+    ASSERT_EQ(2, gap.scan((uint8_t*)inside.c_str(), inside.length(), RANGE_SIZE, scanned));
+    ASSERT_EQ(2, scanned[0]);
+    ASSERT_EQ(3, scanned[1]);
+}
+
 int main (int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();